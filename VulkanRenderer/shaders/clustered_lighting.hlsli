@@ -0,0 +1,41 @@
+#pragma once
+
+#include "frame.hlsli"
+
+/* Clustered forward lighting: the view frustum is split in a grid of tiles of the screen and of depth slices that grow
+ * exponentially with the distance. The light culling pass writes for every cluster the range of its lights in a compact
+ * list of light indices, the pixel shaders only go through the lights of their cluster. */
+
+/* Must match VulkanRenderer::CLUSTER_GRID_X, _Y and _Z */
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+/* Matches VulkanRenderer::GpuPointLight, in view space */
+struct PointLight
+{
+    float3 position;
+    float radius;
+    float3 color;
+    float padding;
+};
+
+/* The slice of a view depth: log(z) * sliceScale + sliceBias is 0 on the near plane and CLUSTER_GRID_Z on the far plane */
+uint GetClusterSlice(float viewDepth)
+{
+    float slice = log(max(viewDepth, 1e-6)) * frameConstants.sliceScale + frameConstants.sliceBias;
+    return uint(clamp(slice, 0.0, CLUSTER_GRID_Z - 1.0));
+}
+
+/* View depth of the near side of a slice, the inverse of GetClusterSlice */
+float GetSliceDepth(uint slice)
+{
+    return exp((slice - frameConstants.sliceBias) / frameConstants.sliceScale);
+}
+
+uint GetClusterIndex(float2 pixelPosition, float viewDepth)
+{
+    uint2 tile = min(uint2(pixelPosition * float2(CLUSTER_GRID_X, CLUSTER_GRID_Y) / frameConstants.screenSize), uint2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    return (GetClusterSlice(viewDepth) * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
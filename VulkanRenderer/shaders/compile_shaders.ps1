@@ -7,6 +7,15 @@ $Compiler="${Env:VULKAN_SDK}\Bin\dxc.exe"
 $OutputDir="${PSScriptRoot}\..\bin\${Config}\shaders"
 $ShaderModel="6_7"
 
+# Every entry point found in a shader is compiled to <file>_<Suffix>.spv
+$Stages = @(
+	@{ Entry = "vs_main"; Profile = "vs"; Suffix = "VS" },
+	@{ Entry = "ps_main"; Profile = "ps"; Suffix = "PS" },
+	@{ Entry = "cs_main"; Profile = "cs"; Suffix = "CS" },
+	@{ Entry = "as_main"; Profile = "as"; Suffix = "AS" },
+	@{ Entry = "ms_main"; Profile = "ms"; Suffix = "MS" }
+)
+
 if (!(Test-Path -Path $OutputDir))
 {
 	New-Item -Path $OutputDir -ItemType Directory
@@ -16,17 +25,23 @@ $OutputDir=Resolve-Path $OutputDir
 #compile shaders
 foreach($file in Get-ChildItem -Path $PSScriptRoot -Filter *.hlsl) {
 	$Entry=[System.IO.Path]::GetFileNameWithoutExtension($file)
-	$AdditionalParamsVS = "-fspv-target-env=vulkan1.3", "-spirv"
-	$AdditionalParamsPS = "-fspv-target-env=vulkan1.3", "-spirv"
+	$Source=Get-Content -Raw $file
+	$AdditionalParams = "-fspv-target-env=vulkan1.3", "-spirv"
 
 	if($IsFinal) {
-		$FinalParams = "-Qstrip_debug"
-		$AdditionalParamsPS += , $FinalParams		
+		$AdditionalParams += "-Qstrip_debug"
 	} else {
-		$DebugParams = "-Od", "-Zi"
-		$AdditionalParamsPS += , $DebugParams
-		$AdditionalParamsVS += , $DebugParams
+		$AdditionalParams += "-Od", "-Zi"
+	}
+	foreach($Stage in $Stages) {
+		if ($Source -notmatch "\b$($Stage.Entry)\s*\(") {
+			continue
+		}
+		$StageParams = $AdditionalParams
+		if ($Stage.Profile -eq "as" -or $Stage.Profile -eq "ms") {
+			# DXC emits the NV mesh shader extension unless told otherwise
+			$StageParams += "-fspv-extension=SPV_EXT_mesh_shader"
+		}
+		& $Compiler -T "$($Stage.Profile)_${ShaderModel}" -E $Stage.Entry @StageParams $file -Fo "${OutputDir}\${Entry}_$($Stage.Suffix).spv"
 	}
-	& $Compiler -T vs_${ShaderModel} -E vs_main @AdditionalParamsVS $file -Fo ${OutputDir}\${Entry}_VS.spv
-	& $Compiler -T ps_${ShaderModel} -E ps_main @AdditionalParamsPS $file -Fo ${OutputDir}\${Entry}_PS.spv
 }
@@ -0,0 +1,59 @@
+#pragma once
+
+/* Bounding volume tests shared by the culling shaders */
+
+/* A (model-)view-projection matrix yields the frustum planes in the space it transforms from (Gribb & Hartmann), depth in [0, 1] */
+bool IsSphereInFrustum(float4x4 mvp, float3 center, float radius)
+{
+    float4 planes[6] =
+    {
+        mvp[3] + mvp[0],
+        mvp[3] - mvp[0],
+        mvp[3] + mvp[1],
+        mvp[3] - mvp[1],
+        mvp[2],
+        mvp[3] - mvp[2]
+    };
+    [unroll]
+    for (uint i = 0; i < 6; ++i)
+    {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+            return false;
+    }
+    return true;
+}
+
+/* Against a depth pyramid whose texels hold the farthest depth of the 2x2 texels below, level 0 at half the depth size.
+ * The box around the sphere projects to a rectangle that spans at most 2x2 texels of the level its size selects,
+ * the sphere is hidden when its nearest depth is behind all four. A sphere that crosses the near plane is not. */
+bool IsSphereOccluded(Texture2D<float> depthPyramid, uint levelCount, uint2 depthSize, float4x4 viewProjection, float3 center, float radius)
+{
+    float2 ndcMin = 1.0;
+    float2 ndcMax = -1.0;
+    float nearestDepth = 1.0;
+    [unroll]
+    for (uint i = 0; i < 8; ++i)
+    {
+        float3 corner = center + radius * float3(i & 1 ? 1.0 : -1.0, i & 2 ? 1.0 : -1.0, i & 4 ? 1.0 : -1.0);
+        float4 clip = mul(viewProjection, float4(corner, 1.0));
+        if (clip.z < 0.0)
+            return false;
+        float3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc.xy);
+        ndcMax = max(ndcMax, ndc.xy);
+        nearestDepth = min(nearestDepth, ndc.z);
+    }
+
+    /* Vulkan NDC y points down, like the rows of the depth buffer */
+    uint2 pixelMin = uint2(saturate(ndcMin * 0.5 + 0.5) * depthSize);
+    uint2 pixelMax = min(uint2(saturate(ndcMax * 0.5 + 0.5) * depthSize), depthSize - 1);
+    uint2 extent = pixelMax - pixelMin;
+    /* A texel of level L covers 2^(L+1) pixels. The last level is a single texel, nothing maps past it. */
+    uint level = min(firstbithigh(max(max(extent.x, extent.y), 1)), levelCount - 1);
+    uint2 texelMin = pixelMin >> (level + 1);
+    uint2 texelMax = pixelMax >> (level + 1);
+    float depth = max(
+        max(depthPyramid.Load(int3(texelMin, level)), depthPyramid.Load(int3(texelMax.x, texelMin.y, level))),
+        max(depthPyramid.Load(int3(texelMin.x, texelMax.y, level)), depthPyramid.Load(int3(texelMax, level))));
+    return nearestDepth > depth;
+}
@@ -0,0 +1,21 @@
+#include "surface.hlsli"
+
+/* Depth prepass: positions only, no pixel shader. The opaque pass then shades each pixel once, where its depth is equal. */
+
+struct VSInput
+{
+    float4 position : POSITION;
+    uint instanceIndex : SV_InstanceID;
+};
+
+struct VSOutput
+{
+    float4 position : SV_Position;
+};
+
+VSOutput vs_main(VSInput input)
+{
+    VSOutput output;
+    output.position = TransformPosition(input.position.xyz, input.instanceIndex);
+    return output;
+}
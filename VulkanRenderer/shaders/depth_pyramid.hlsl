@@ -0,0 +1,25 @@
+/* One level of the depth pyramid: every texel keeps the farthest depth of the 2x2 texels below it, so that
+ * a bounding volume in front of that depth may be visible and one behind it is hidden by what the texel covers.
+ * The level below is the depth buffer for level 0. Levels round their size up, the texels past the edge
+ * of the level below are clamped to it. */
+
+Texture2D<float> source : register(t0);
+[[vk::image_format("r32f")]] RWTexture2D<float> destination : register(u1);
+
+[numthreads(8, 8, 1)]
+void cs_main(uint3 dispatchThreadId : SV_DispatchThreadID)
+{
+    uint2 size;
+    destination.GetDimensions(size.x, size.y);
+    if (any(dispatchThreadId.xy >= size))
+        return;
+
+    uint2 sourceSize;
+    source.GetDimensions(sourceSize.x, sourceSize.y);
+    uint2 lastTexel = sourceSize - 1;
+    uint2 texel = dispatchThreadId.xy * 2;
+    float depth = max(
+        max(source.Load(int3(min(texel, lastTexel), 0)), source.Load(int3(min(texel + uint2(1, 0), lastTexel), 0))),
+        max(source.Load(int3(min(texel + uint2(0, 1), lastTexel), 0)), source.Load(int3(min(texel + uint2(1, 1), lastTexel), 0))));
+    destination[dispatchThreadId.xy] = depth;
+}
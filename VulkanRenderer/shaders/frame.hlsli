@@ -0,0 +1,19 @@
+#pragma once
+
+/* Uniform buffer of set 0, written once per frame. Matches VulkanRenderer::FrameConstants,
+ * the shaders that only transform may declare MVP alone. */
+struct FrameConstants
+{
+    matrix MVP;
+    /* Root transform of the scene times the view, to the space the lights are clustered in */
+    matrix ModelView;
+    /* Clustered lighting, see clustered_lighting.hlsli */
+    float2 projectionScale;
+    float2 screenSize;
+    float sliceScale;
+    float sliceBias;
+    uint lightCount;
+    float ambientIntensity;
+};
+
+ConstantBuffer<FrameConstants> frameConstants : register(b0);
@@ -0,0 +1,74 @@
+#include "gpu_driven.hlsli"
+
+/* Culls every object, selects its LOD by projected error and appends a draw for it to the range of
+ * the phase. The draws are consumed by vkCmdDrawIndexedIndirectCount.
+ * Early phase: the objects in the frustum that the previous frame found visible, without an occlusion test.
+ * Late phase: every object in the frustum is tested against the depth pyramid of the early draws, the
+ * visible ones that the early phase skipped are drawn, and the result is kept for the next frame.
+ * An object appears in the frame it becomes visible, and occluders drawn late still occlude next frame. */
+
+struct DrawIndexedIndirectCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+StructuredBuffer<GpuObject> objects : register(t0, space1);
+StructuredBuffer<GpuMesh> meshes : register(t1, space1);
+RWStructuredBuffer<DrawIndexedIndirectCommand> drawCommands : register(u2, space1);
+/* One count per phase */
+RWByteAddressBuffer drawCounts : register(u3, space1);
+RWStructuredBuffer<uint> visibility : register(u4, space1);
+Texture2D<float> depthPyramid : register(t5, space1);
+[[vk::push_constant]] GpuDrivenConstants constants;
+
+[numthreads(64, 1, 1)]
+void cs_main(uint3 dispatchThreadId : SV_DispatchThreadID)
+{
+    uint objectIndex = dispatchThreadId.x;
+    if (objectIndex >= constants.objectCount)
+        return;
+
+    bool wasVisible = visibility[objectIndex] != 0;
+    if (OCCLUSION_PHASE_EARLY == constants.phase && !wasVisible)
+        return;
+
+    GpuObject object = objects[objectIndex];
+    GpuMesh mesh = meshes[object.meshIndex];
+    InstanceData instance = instances[object.instanceIndex];
+    float maxScale = GetMaxScale(instance.objectMatrix);
+    float3 center = mul(instance.objectMatrix, float4(mesh.boundsCenter, 1.0)).xyz;
+    float radius = mesh.boundsRadius * maxScale;
+    bool isVisible = IsSphereInFrustum(constants.viewProjection, center, radius);
+    if (OCCLUSION_PHASE_LATE == constants.phase)
+    {
+        isVisible = isVisible && !IsSphereOccluded(depthPyramid, constants.depthPyramidLevelCount, constants.depthSize, constants.viewProjection, center, radius);
+        visibility[objectIndex] = isVisible ? 1 : 0;
+        /* Drawn by the early phase already */
+        isVisible = isVisible && !wasVisible;
+    }
+    if (!isVisible)
+        return;
+
+    /* Clip-space w is the view depth: distance to the front of the bounding sphere */
+    float distance = max(mul(constants.viewProjection, float4(center, 1.0)).w - radius, 0.01);
+    uint lod = 0;
+    for (uint l = 1; l < mesh.lodCount; ++l)
+    {
+        if (mesh.lods[l].error * maxScale * constants.pixelsPerUnit / distance <= constants.maxLodErrorPixels)
+            lod = l;
+    }
+
+    uint slot;
+    drawCounts.InterlockedAdd(constants.phase * 4, 1, slot);
+    DrawIndexedIndirectCommand command;
+    command.indexCount = mesh.lods[lod].indexCount;
+    command.instanceCount = 1;
+    command.firstIndex = mesh.lods[lod].firstIndex;
+    command.vertexOffset = mesh.vertexOffset;
+    command.firstInstance = objectIndex; /* read back as SV_InstanceID by the vertex shader */
+    drawCommands[constants.phase * constants.objectCount + slot] = command;
+}
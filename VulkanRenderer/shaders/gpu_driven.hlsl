@@ -0,0 +1,42 @@
+#include "frame.hlsli"
+#include "gpu_driven.hlsli"
+
+/* Vertex shader of the GPU-driven draws, pairs with ps_main of textured_surface.hlsl.
+ * The culling pass stores the object index as the first instance of every draw, and
+ * SV_InstanceID includes the first instance in Vulkan. */
+
+StructuredBuffer<GpuObject> objects : register(t0, space1);
+StructuredBuffer<GpuMesh> meshes : register(t1, space1);
+[[vk::push_constant]] GpuDrivenConstants constants;
+
+struct VSInput
+{
+    float4 position : POSITION;
+    float2 texCoord : TEXCOORD;
+    uint objectIndex : SV_InstanceID;
+};
+
+struct VSOutput
+{
+    float2 texCoord : TEXCOORD;
+    float4 color : COLOR;
+    float3 viewPosition : VIEW_POSITION;
+    float4 position : SV_Position;
+};
+
+VSOutput vs_main(VSInput input)
+{
+    GpuObject object = objects[input.objectIndex];
+    GpuMesh mesh = meshes[object.meshIndex];
+    InstanceData instance = instances[object.instanceIndex];
+
+    float3 position = input.position.xyz * mesh.positionScale.xyz + mesh.positionBias.xyz;
+    float4 worldPosition = mul(instance.objectMatrix, float4(position, 1.0));
+
+    VSOutput output;
+    output.position = mul(constants.viewProjection, worldPosition);
+    output.viewPosition = mul(frameConstants.ModelView, worldPosition).xyz;
+    output.texCoord = input.texCoord;
+    output.color = instance.color;
+    return output;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+/* Shared by the GPU-driven culling and vertex shaders */
+
+#include "culling.hlsli"
+#include "instance.hlsli"
+
+#define MAX_LOD_COUNT 6
+
+/* Matches VulkanRenderer::GpuLod */
+struct GpuLod
+{
+    uint firstIndex;
+    uint indexCount;
+    float error;
+    uint padding;
+};
+
+/* Matches VulkanRenderer::GpuMesh */
+struct GpuMesh
+{
+    float4 positionScale;
+    float4 positionBias;
+    float3 boundsCenter;
+    float boundsRadius;
+    int vertexOffset;
+    uint lodCount;
+    uint2 padding;
+    GpuLod lods[MAX_LOD_COUNT];
+};
+
+/* Matches VulkanRenderer::GpuObject, one mesh of one instance */
+struct GpuObject
+{
+    uint instanceIndex;
+    uint meshIndex;
+};
+
+/* Matches VulkanRenderer::GpuDrivenConstants */
+struct GpuDrivenConstants
+{
+    float4x4 viewProjection;
+    float pixelsPerUnit;
+    float maxLodErrorPixels;
+    uint objectCount;
+    uint phase;
+    uint2 depthSize;
+    uint depthPyramidLevelCount;
+    uint padding;
+};
+
+/* VulkanRenderer::OcclusionPhase */
+#define OCCLUSION_PHASE_EARLY 0
+#define OCCLUSION_PHASE_LATE 1
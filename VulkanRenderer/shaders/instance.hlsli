@@ -0,0 +1,19 @@
+#pragma once
+
+/* Per-instance data, indexed by SV_InstanceID */
+
+/* Matches gg::InstanceData */
+struct InstanceData
+{
+    float4x4 objectMatrix;
+    float4 color;
+};
+
+StructuredBuffer<InstanceData> instances : register(t2);
+
+/* Largest scale of the basis vectors, the columns of the matrix as read by HLSL */
+float GetMaxScale(float4x4 m)
+{
+    float3 scales = float3(dot(m._m00_m10_m20, m._m00_m10_m20), dot(m._m01_m11_m21, m._m01_m11_m21), dot(m._m02_m12_m22, m._m02_m12_m22));
+    return sqrt(max(scales.x, max(scales.y, scales.z)));
+}
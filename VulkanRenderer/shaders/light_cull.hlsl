@@ -0,0 +1,91 @@
+#include "clustered_lighting.hlsli"
+
+/* One thread per cluster: the lights whose sphere touches the view-space box of the cluster are counted, a range of
+ * the light index list is reserved for them, then they are written. The lights go through group shared memory in
+ * batches, every thread of the group tests the same batch. */
+
+#define LIGHT_CULL_GROUP_SIZE 64
+
+StructuredBuffer<PointLight> lights : register(t3);
+/* Offset and count in lightIndices of the lights of each cluster */
+RWStructuredBuffer<uint2> clusterLights : register(u4);
+RWStructuredBuffer<uint> lightIndices : register(u5);
+/* Cleared before the dispatch */
+RWStructuredBuffer<uint> lightIndexCount : register(u6);
+
+groupshared PointLight batch[LIGHT_CULL_GROUP_SIZE];
+
+/* Bounds of the part of the frustum in the cluster, x_view = ndc_x * z / P00 and y_view = ndc_y * z / P11 */
+void GetClusterBounds(uint clusterIndex, out float3 boundsMin, out float3 boundsMax)
+{
+    uint3 cluster = uint3(clusterIndex % CLUSTER_GRID_X, (clusterIndex / CLUSTER_GRID_X) % CLUSTER_GRID_Y, clusterIndex / (CLUSTER_GRID_X * CLUSTER_GRID_Y));
+    float2 ndcMin = float2(cluster.xy) / float2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0;
+    float2 ndcMax = float2(cluster.xy + 1) / float2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0;
+    float nearDepth = GetSliceDepth(cluster.z);
+    float farDepth = GetSliceDepth(cluster.z + 1);
+
+    float2 nearMin = ndcMin * nearDepth / frameConstants.projectionScale;
+    float2 nearMax = ndcMax * nearDepth / frameConstants.projectionScale;
+    float2 farMin = ndcMin * farDepth / frameConstants.projectionScale;
+    float2 farMax = ndcMax * farDepth / frameConstants.projectionScale;
+    boundsMin = float3(min(nearMin, farMin), nearDepth);
+    boundsMax = float3(max(nearMax, farMax), farDepth);
+}
+
+bool IntersectsSphere(PointLight light, float3 boundsMin, float3 boundsMax)
+{
+    float3 offset = light.position - clamp(light.position, boundsMin, boundsMax);
+    return dot(offset, offset) <= light.radius * light.radius;
+}
+
+[numthreads(LIGHT_CULL_GROUP_SIZE, 1, 1)]
+void cs_main(uint3 dispatchThreadId : SV_DispatchThreadID, uint threadIndex : SV_GroupIndex)
+{
+    uint clusterIndex = dispatchThreadId.x;
+    bool isCluster = clusterIndex < CLUSTER_COUNT;
+    float3 boundsMin;
+    float3 boundsMax;
+    GetClusterBounds(min(clusterIndex, CLUSTER_COUNT - 1), boundsMin, boundsMax);
+    uint lightCount = frameConstants.lightCount;
+
+    /* Counts the lights on the first pass and writes them on the second one */
+    uint count = 0;
+    uint offset = 0;
+    uint capacity = 0;
+    for (uint pass = 0; pass < 2; ++pass)
+    {
+        uint written = 0;
+        for (uint firstLight = 0; firstLight < lightCount; firstLight += LIGHT_CULL_GROUP_SIZE)
+        {
+            /* The previous batch is no longer read */
+            GroupMemoryBarrierWithGroupSync();
+            if (firstLight + threadIndex < lightCount)
+                batch[threadIndex] = lights[firstLight + threadIndex];
+            GroupMemoryBarrierWithGroupSync();
+
+            uint batchCount = min(LIGHT_CULL_GROUP_SIZE, lightCount - firstLight);
+            for (uint i = 0; isCluster && i < batchCount; ++i)
+            {
+                if (!IntersectsSphere(batch[i], boundsMin, boundsMax))
+                    continue;
+                if (0 == pass)
+                    ++count;
+                else if (written < capacity)
+                    lightIndices[offset + written++] = firstLight + i;
+            }
+        }
+
+        if (0 == pass && isCluster && count > 0)
+        {
+            /* A cluster past the end of the list keeps the lights that fit */
+            uint indexCapacity;
+            uint stride;
+            lightIndices.GetDimensions(indexCapacity, stride);
+            InterlockedAdd(lightIndexCount[0], count, offset);
+            capacity = offset < indexCapacity ? min(count, indexCapacity - offset) : 0;
+        }
+    }
+
+    if (isCluster)
+        clusterLights[clusterIndex] = uint2(offset, capacity);
+}
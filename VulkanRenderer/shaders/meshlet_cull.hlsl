@@ -0,0 +1,44 @@
+#include "meshlet_culling.hlsli"
+
+/* Culls the meshlets of one mesh instance and appends the triangles of the visible ones to an index
+ * buffer that is drawn with vkCmdDrawIndexedIndirect. One workgroup per meshlet, one thread per triangle. */
+
+struct ModelViewProjection
+{
+    matrix MVP;
+};
+
+ConstantBuffer<ModelViewProjection> ModelViewProjectionCB : register(b0);
+StructuredBuffer<Meshlet> meshlets : register(t0, space1);
+StructuredBuffer<uint> meshletVertices : register(t1, space1);
+StructuredBuffer<uint> meshletTriangles : register(t2, space1);
+RWStructuredBuffer<uint> culledIndices : register(u3, space1);
+/* VkDrawIndexedIndirectCommand, indexCount is at offset 0 */
+RWByteAddressBuffer drawCommand : register(u4, space1);
+[[vk::push_constant]] MeshletConstants meshletConstants;
+
+groupshared bool isVisible;
+groupshared uint firstIndex;
+
+[numthreads(128, 1, 1)]
+void cs_main(uint3 groupId : SV_GroupID, uint threadIndex : SV_GroupIndex)
+{
+    Meshlet meshlet = meshlets[groupId.x];
+    if (0 == threadIndex)
+    {
+        float4x4 mvp = mul(ModelViewProjectionCB.MVP, instances[meshletConstants.instanceIndex].objectMatrix);
+        isVisible = IsMeshletVisible(meshlet, mvp, meshletConstants.cameraPosition);
+        if (isVisible)
+            drawCommand.InterlockedAdd(0, meshlet.triangleCount * 3, firstIndex);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (!isVisible || threadIndex >= meshlet.triangleCount)
+        return;
+
+    uint3 triangle = UnpackTriangle(meshletTriangles[meshlet.triangleOffset + threadIndex]);
+    uint index = firstIndex + threadIndex * 3;
+    culledIndices[index + 0] = meshletVertices[meshlet.vertexOffset + triangle.x];
+    culledIndices[index + 1] = meshletVertices[meshlet.vertexOffset + triangle.y];
+    culledIndices[index + 2] = meshletVertices[meshlet.vertexOffset + triangle.z];
+}
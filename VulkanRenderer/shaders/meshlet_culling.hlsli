@@ -0,0 +1,48 @@
+#pragma once
+
+/* Shared by the compute and the task shader meshlet culling */
+
+#include "culling.hlsli"
+#include "instance.hlsli"
+
+/* Matches gg::Meshlet */
+struct Meshlet
+{
+    float3 center;
+    float radius;
+    float3 coneAxis;
+    float coneCutoff;
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+/* Matches VulkanRenderer::MeshletConstants */
+struct MeshletConstants
+{
+    float4 positionScale;
+    float4 positionBias;
+    float3 cameraPosition; /* object space */
+    uint meshletCount;
+    uint isQuantized;
+    uint instanceIndex; /* the meshlets are culled and drawn for this instance */
+};
+
+/* Three 8-bit meshlet-local vertex indices */
+uint3 UnpackTriangle(uint packed)
+{
+    return uint3(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF);
+}
+
+/* All triangles face away from the camera */
+bool IsConeBackfacing(Meshlet meshlet, float3 cameraPosition)
+{
+    float3 toCenter = meshlet.center - cameraPosition;
+    return dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * length(toCenter) + meshlet.radius;
+}
+
+bool IsMeshletVisible(Meshlet meshlet, float4x4 mvp, float3 cameraPosition)
+{
+    return IsSphereInFrustum(mvp, meshlet.center, meshlet.radius) && !IsConeBackfacing(meshlet, cameraPosition);
+}
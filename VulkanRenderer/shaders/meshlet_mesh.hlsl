@@ -0,0 +1,100 @@
+#include "frame.hlsli"
+#include "meshlet_culling.hlsli"
+
+/* VK_EXT_mesh_shader path: the task shader culls 32 meshlets per workgroup and launches
+ * one mesh shader workgroup per visible meshlet. Pairs with ps_main of textured_surface.hlsl. */
+
+#define TASK_GROUP_SIZE 32
+#define MAX_MESHLET_VERTICES 64
+#define MAX_MESHLET_TRIANGLES 124
+
+StructuredBuffer<Meshlet> meshlets : register(t0, space1);
+StructuredBuffer<uint> meshletVertices : register(t1, space1);
+StructuredBuffer<uint> meshletTriangles : register(t2, space1);
+/* The vertex streams, see gg::VertexFormat */
+ByteAddressBuffer positionStream : register(t3, space1);
+ByteAddressBuffer attributeStream : register(t4, space1);
+[[vk::push_constant]] MeshletConstants meshletConstants;
+
+struct Payload
+{
+    uint meshletIndices[TASK_GROUP_SIZE];
+};
+
+groupshared Payload taskPayload;
+groupshared uint visibleCount;
+
+[numthreads(TASK_GROUP_SIZE, 1, 1)]
+void as_main(uint3 dispatchThreadId : SV_DispatchThreadID, uint threadIndex : SV_GroupIndex)
+{
+    if (0 == threadIndex)
+        visibleCount = 0;
+    GroupMemoryBarrierWithGroupSync();
+
+    uint meshletIndex = dispatchThreadId.x;
+    float4x4 mvp = mul(frameConstants.MVP, instances[meshletConstants.instanceIndex].objectMatrix);
+    if (meshletIndex < meshletConstants.meshletCount
+        && IsMeshletVisible(meshlets[meshletIndex], mvp, meshletConstants.cameraPosition))
+    {
+        uint slot;
+        InterlockedAdd(visibleCount, 1, slot);
+        taskPayload.meshletIndices[slot] = meshletIndex;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    DispatchMesh(visibleCount, 1, 1, taskPayload);
+}
+
+struct VSOutput
+{
+    float2 texCoord : TEXCOORD;
+    float4 color : COLOR;
+    float3 viewPosition : VIEW_POSITION;
+    float4 position : SV_Position;
+};
+
+VSOutput LoadVertex(uint vertexIndex)
+{
+    float3 position;
+    float2 texCoord;
+    if (meshletConstants.isQuantized)
+    {
+        uint2 p = positionStream.Load2(vertexIndex * 8);
+        position = float3(p.x & 0xFFFF, p.x >> 16, p.y & 0xFFFF) / 65535.0;
+        uint uv = attributeStream.Load(vertexIndex * 4);
+        texCoord = float2(f16tof32(uv), f16tof32(uv >> 16));
+    }
+    else
+    {
+        position = asfloat(positionStream.Load3(vertexIndex * 12));
+        texCoord = asfloat(attributeStream.Load2(vertexIndex * 8));
+    }
+    position = position * meshletConstants.positionScale.xyz + meshletConstants.positionBias.xyz;
+
+    InstanceData instance = instances[meshletConstants.instanceIndex];
+    VSOutput output;
+    float4 worldPosition = mul(instance.objectMatrix, float4(position, 1.0));
+    output.position = mul(frameConstants.MVP, worldPosition);
+    output.viewPosition = mul(frameConstants.ModelView, worldPosition).xyz;
+    output.texCoord = texCoord;
+    output.color = instance.color;
+    return output;
+}
+
+[outputtopology("triangle")]
+[numthreads(128, 1, 1)]
+void ms_main(
+    uint3 groupId : SV_GroupID,
+    uint threadIndex : SV_GroupIndex,
+    in payload Payload payload,
+    out vertices VSOutput outVertices[MAX_MESHLET_VERTICES],
+    out indices uint3 outTriangles[MAX_MESHLET_TRIANGLES])
+{
+    Meshlet meshlet = meshlets[payload.meshletIndices[groupId.x]];
+    SetMeshOutputCounts(meshlet.vertexCount, meshlet.triangleCount);
+
+    if (threadIndex < meshlet.vertexCount)
+        outVertices[threadIndex] = LoadVertex(meshletVertices[meshlet.vertexOffset + threadIndex]);
+    if (threadIndex < meshlet.triangleCount)
+        outTriangles[threadIndex] = UnpackTriangle(meshletTriangles[meshlet.triangleOffset + threadIndex]);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "frame.hlsli"
+#include "instance.hlsli"
+
+/* Vertex transform of the textured surfaces, shared with the depth prepass so that both write the same depth */
+
+/* Dequantization of the mesh positions: position = input * scale + bias */
+struct MeshConstants
+{
+    float4 positionScale;
+    float4 positionBias;
+};
+
+[[vk::push_constant]] MeshConstants meshConstants;
+
+/* Precise, so that no shader fuses the operations differently and the depths match bit for bit */
+float4 TransformPosition(float3 quantizedPosition, uint instanceIndex)
+{
+    precise float3 position = quantizedPosition * meshConstants.positionScale.xyz + meshConstants.positionBias.xyz;
+    precise float4 clipPosition = mul(frameConstants.MVP, mul(instances[instanceIndex].objectMatrix, float4(position, 1.0)));
+    return clipPosition;
+}
+
+/* For the lighting, in the space of the clusters */
+float3 TransformViewPosition(float3 quantizedPosition, uint instanceIndex)
+{
+    float3 position = quantizedPosition * meshConstants.positionScale.xyz + meshConstants.positionBias.xyz;
+    return mul(frameConstants.ModelView, mul(instances[instanceIndex].objectMatrix, float4(position, 1.0))).xyz;
+}
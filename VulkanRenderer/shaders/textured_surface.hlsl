@@ -1,38 +1,71 @@
-struct ModelViewProjection
-{
-    matrix MVP;
-};
+#include "surface.hlsli"
+#include "clustered_lighting.hlsli"
 
-ConstantBuffer<ModelViewProjection> ModelViewProjectionCB : register(b0);
 Texture2D    texture1 : register(t1);
 SamplerState sampler1 : register(s1);
+/* Written by light_cull.hlsl */
+StructuredBuffer<PointLight> lights : register(t3);
+StructuredBuffer<uint2> clusterLights : register(t4);
+StructuredBuffer<uint> lightIndices : register(t5);
 
 struct VSInput
 {
     float4 position : POSITION;
     float2 texCoord : TEXCOORD;
+    uint instanceIndex : SV_InstanceID;
 };
 
 struct VSOutput
 {
     float2 texCoord : TEXCOORD;
+    float4 color : COLOR;
+    float3 viewPosition : VIEW_POSITION;
 	float4 position : SV_Position;
 };
 
 VSOutput vs_main(VSInput input)
 {
     VSOutput output;
-    output.position = mul(ModelViewProjectionCB.MVP, input.position);
+    output.position = TransformPosition(input.position.xyz, input.instanceIndex);
+    output.viewPosition = TransformViewPosition(input.position.xyz, input.instanceIndex);
     output.texCoord = input.texCoord;
+    output.color = instances[input.instanceIndex].color;
     return output;
 }
 
+/* Also the pixel shader of the meshlet and GPU-driven paths, their outputs match VSOutput */
 struct PSInput
 {
     float2 texCoord : TEXCOORD;
+    float4 color : COLOR;
+    float3 viewPosition : VIEW_POSITION;
+    float4 position : SV_Position;
 };
 
+/* Diffuse light of the lights of the pixel's cluster, falling off smoothly to 0 at their radius */
+float3 ShadeClusteredLights(float3 viewPosition, float3 normal, float2 pixelPosition)
+{
+    uint2 range = clusterLights[GetClusterIndex(pixelPosition, viewPosition.z)];
+    float3 light = 0.0;
+    for (uint i = 0; i < range.y; ++i)
+    {
+        PointLight pointLight = lights[lightIndices[range.x + i]];
+        float3 toLight = pointLight.position - viewPosition;
+        float distanceSquared = dot(toLight, toLight);
+        float falloff = saturate(1.0 - distanceSquared / (pointLight.radius * pointLight.radius));
+        float attenuation = falloff * falloff / (1.0 + distanceSquared);
+        light += pointLight.color * attenuation * saturate(dot(normal, toLight * rsqrt(max(distanceSquared, 1e-8))));
+    }
+    return light;
+}
+
 float4 ps_main(PSInput input) : SV_Target
 {
-    return texture1.Sample(sampler1, input.texCoord);
+    float4 albedo = texture1.Sample(sampler1, input.texCoord) * input.color;
+    /* The vertices have no normals, the faces are flat: the normal of the triangle, turned towards the camera */
+    float3 normal = normalize(cross(ddx(input.viewPosition), ddy(input.viewPosition)));
+    if (dot(normal, input.viewPosition) > 0.0)
+        normal = -normal;
+    float3 light = frameConstants.ambientIntensity + ShadeClusteredLights(input.viewPosition, normal, input.position.xy);
+    return float4(albedo.rgb * light, albedo.a);
 }
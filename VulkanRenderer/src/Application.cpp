@@ -1,7 +1,9 @@
 module;
 #include <cstdint>
 #include <DirectXMath.h>
+#include <format>
 #include <memory>
+#include <optional>
 #include <SDL2/SDL_keycode.h>
 #include <SDL2/SDL_video.h>
 module Application;
@@ -9,6 +11,7 @@ module Application;
 import VulkanRenderer;
 import Input;
 import Logging;
+import Scene;
 import TimeManager;
 import ErrorHandling;
 
@@ -44,16 +47,22 @@ namespace gg
 		: mTimeManager{ std::make_unique<TimeManager>() }
 		, mInputManager{ std::make_unique<InputManager>() }
 		, mRenderer{ std::make_unique<VulkanRenderer>(width, height, windowHandle)}
-		, mModelLoader{ std::make_unique<ModelLoader>() }
+		, mJobSystem{ std::make_shared<JobSystem>() }
+		, mModelLoader{ std::make_unique<ModelLoader>(mJobSystem) }
 	{
 		/* Check for DirectX Math library support. */
 		if (!DirectX::XMVerifyCPUSupport())
 			throw std::exception("Failed to verify DirectX Math library support");
+
+		mRenderer->GetScene().SetJobSystem(mJobSystem);
 	}
 
 	Application::~Application() 
 	{
 		DebugLog(DebugLevel::Info, "Shutting down the application");
+		/* Finishes the loads still running while the device exists: their models end up in the scene's futures,
+		 which the renderer releases, along with their shader modules, before it destroys the device */
+		mModelLoader.reset();
 	}
 
 	std::shared_ptr<TimeManager> Application::GetTimeManager() 
@@ -61,6 +70,11 @@ namespace gg
 		return mTimeManager;
 	}
 
+	std::shared_ptr<JobSystem> Application::GetJobSystem()
+	{
+		return mJobSystem;
+	}
+
 	std::shared_ptr<InputManager> Application::GetInputManager()
 	{
 		return mInputManager;
@@ -100,7 +114,17 @@ namespace gg
 
 	void Application::OnKeyPressed(SDL_Keycode key, bool isDown)
 	{
+		bool const wasToggleDown{ mInputManager->IsKeyDown(ToggleDepthPrepass) };
 		mInputManager->OnKeyPressed(key, isDown);
+		/* P: compare the fragment shader invocations with and without the depth prepass, once per press and not on key repeats */
+		if (!wasToggleDown && mInputManager->IsKeyDown(ToggleDepthPrepass))
+			mRenderer->SetDepthPrepass(!mRenderer->IsDepthPrepassEnabled());
+	}
+
+	void Application::OnMouseButtonPressed(uint32_t x, uint32_t y)
+	{
+		if (std::optional<InstanceId> const id{ mRenderer->PickInstance(x, y) })
+			DebugLog(DebugLevel::Info, std::format("Picked instance {}", *id));
 	}
 
 } // namespace gg 
@@ -0,0 +1,370 @@
+module;
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+module AssetPack;
+
+import Hashing;
+import MappedFile;
+
+namespace
+{
+	using namespace gg;
+
+	constexpr uint32_t ASSET_PACK_MAGIC{ 0x4B504747 }; /* "GGPK" */
+	/* Bump on any change of the layout below or of HashBytes, the entries are sorted by path hash */
+	constexpr uint32_t ASSET_PACK_VERSION{ 2 };
+	/* Every file starts aligned, so that it can be read in place whatever its content (SPIR-V words, KTX2 levels) */
+	constexpr size_t FILE_ALIGNMENT{ 64 };
+
+	enum class Compression : uint32_t
+	{
+		None,
+		Lz4, /* LZ4 block format, without the frame */
+	};
+
+	struct PackHeader
+	{
+		uint32_t Magic{ ASSET_PACK_MAGIC };
+		uint32_t Version{ ASSET_PACK_VERSION };
+		uint32_t EntryCount{ 0 };
+		uint32_t PathsSize{ 0 };
+	};
+	/* The entries follow the header, then the paths, then the files */
+
+	/* LZ4 constants: the shortest match, and how far from the end the matches have to stay */
+	constexpr size_t MIN_MATCH{ 4 };
+	constexpr size_t LAST_LITERALS{ 5 };
+	constexpr size_t MATCH_START_LIMIT{ 12 };
+	constexpr size_t MAX_OFFSET{ 65535 };
+	constexpr uint32_t HASH_BITS{ 16 };
+
+	std::shared_ptr<AssetPack const> mountedPack{};
+
+	std::string getKey(std::filesystem::path const& rootDirectory, std::string const& absolutePath)
+	{
+		return std::filesystem::path{ absolutePath }.lexically_normal().lexically_relative(rootDirectory).generic_string();
+	}
+
+	std::filesystem::path getRootDirectory(std::string const& packAbsolutePath)
+	{
+		return std::filesystem::path{ packAbsolutePath }.lexically_normal().parent_path();
+	}
+
+	uint64_t hashKey(std::string const& key)
+	{
+		return HashBytes(std::as_bytes(std::span{ key }));
+	}
+
+	uint32_t load32(std::span<std::byte const> data, size_t offset)
+	{
+		uint32_t value;
+		memcpy(&value, data.data() + offset, sizeof(value));
+		return value;
+	}
+
+	void writeLength(std::vector<std::byte>& output, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+			output.push_back(std::byte{ 255 });
+		output.push_back(static_cast<std::byte>(length));
+	}
+
+	void writeSequence(std::vector<std::byte>& output, std::span<std::byte const> literals, size_t offset, size_t matchLength)
+	{
+		size_t const matchCode{ matchLength - MIN_MATCH };
+		output.push_back(static_cast<std::byte>(std::min<size_t>(literals.size(), 15) << 4 | std::min<size_t>(matchCode, 15)));
+		if (literals.size() >= 15)
+			writeLength(output, literals.size() - 15);
+		output.insert(output.end(), literals.begin(), literals.end());
+		if (0 == matchLength)
+			return;
+		output.push_back(static_cast<std::byte>(offset & 0xFF));
+		output.push_back(static_cast<std::byte>(offset >> 8));
+		if (matchCode >= 15)
+			writeLength(output, matchCode - 15);
+	}
+
+	/* Greedy, one candidate per hash. Build-time only, the ratio matters more than the speed but not enough for a search. */
+	std::vector<std::byte> compressLz4(std::span<std::byte const> input)
+	{
+		std::vector<std::byte> output{};
+		output.reserve(input.size() + input.size() / 255 + 16);
+		std::vector<size_t> table(size_t{ 1 } << HASH_BITS, SIZE_MAX);
+		size_t anchor{ 0 };
+		size_t position{ 0 };
+		size_t const matchStartLimit{ input.size() > MATCH_START_LIMIT ? input.size() - MATCH_START_LIMIT : 0 };
+		while (position < matchStartLimit)
+		{
+			uint32_t const sequence{ load32(input, position) };
+			uint32_t const hash{ (sequence * 2654435761u) >> (32 - HASH_BITS) };
+			size_t const candidate{ std::exchange(table[hash], position) };
+			if (SIZE_MAX == candidate || position - candidate > MAX_OFFSET || load32(input, candidate) != sequence)
+			{
+				++position;
+				continue;
+			}
+			size_t length{ MIN_MATCH };
+			size_t const maxLength{ input.size() - LAST_LITERALS - position };
+			while (length < maxLength && input[candidate + length] == input[position + length])
+				++length;
+			writeSequence(output, input.subspan(anchor, position - anchor), position - candidate, length);
+			position += length;
+			anchor = position;
+		}
+		writeSequence(output, input.subspan(anchor), 0, 0);
+		return output;
+	}
+
+	bool readLength(std::span<std::byte const> input, size_t& position, size_t& length)
+	{
+		uint8_t byte{ 255 };
+		while (255 == byte)
+		{
+			if (position >= input.size())
+				return false;
+			byte = static_cast<uint8_t>(input[position++]);
+			length += byte;
+		}
+		return true;
+	}
+
+	/* Every read and write is checked, a corrupted pack fails instead of overrunning */
+	bool decompressLz4(std::span<std::byte const> input, std::span<std::byte> output)
+	{
+		size_t in{ 0 };
+		size_t out{ 0 };
+		while (in < input.size())
+		{
+			uint8_t const token{ static_cast<uint8_t>(input[in++]) };
+			size_t literalLength{ static_cast<size_t>(token >> 4) };
+			if (15 == literalLength && !readLength(input, in, literalLength))
+				return false;
+			if (literalLength > input.size() - in || literalLength > output.size() - out)
+				return false;
+			memcpy(output.data() + out, input.data() + in, literalLength);
+			in += literalLength;
+			out += literalLength;
+			/* The last sequence has no match */
+			if (in == input.size())
+				break;
+
+			if (input.size() - in < 2)
+				return false;
+			size_t const offset{ static_cast<size_t>(input[in]) | static_cast<size_t>(input[in + 1]) << 8 };
+			in += 2;
+			size_t matchLength{ static_cast<size_t>(token & 15) };
+			if (15 == matchLength && !readLength(input, in, matchLength))
+				return false;
+			matchLength += MIN_MATCH;
+			if (0 == offset || offset > out || matchLength > output.size() - out)
+				return false;
+			/* Byte by byte, the match may overlap what it writes */
+			for (size_t i{ 0 }; i < matchLength; ++i, ++out)
+				output[out] = output[out - offset];
+		}
+		return out == output.size();
+	}
+}
+
+namespace gg
+{
+	AssetPack::AssetPack(std::string const& absolutePath)
+		: mFile{ absolutePath }
+		, mRootDirectory{ getRootDirectory(absolutePath).generic_string() }
+	{
+		std::span<std::byte const> const data{ mFile.GetData() };
+		PackHeader header{};
+		if (data.size() < sizeof(header))
+			return;
+		memcpy(&header, data.data(), sizeof(header));
+		if (ASSET_PACK_MAGIC != header.Magic || ASSET_PACK_VERSION != header.Version)
+			return;
+		size_t const pathsOffset{ sizeof(header) + size_t{ header.EntryCount } * sizeof(Entry) };
+		if (pathsOffset + header.PathsSize > data.size())
+			return;
+
+		/* The mapping is page aligned and the entries follow the 16-byte header, they are read in place */
+		std::span<Entry const> const entries{ reinterpret_cast<Entry const*>(data.data() + sizeof(header)), header.EntryCount };
+		for (Entry const& entry : entries)
+		{
+			if (entry.PathOffset + uint64_t{ entry.PathSize } > header.PathsSize
+				|| entry.Offset > data.size() || entry.StoredSize > data.size() - entry.Offset
+				|| entry.Compression > static_cast<uint32_t>(Compression::Lz4)
+				|| (static_cast<uint32_t>(Compression::None) == entry.Compression && entry.Size != entry.StoredSize)
+				|| entry.Size / 255 > entry.StoredSize)
+				return;
+		}
+		if (!std::ranges::is_sorted(entries, {}, &Entry::PathHash))
+			return;
+		mPaths = data.subspan(pathsOffset, header.PathsSize);
+		mEntries = entries;
+	}
+
+	bool AssetPack::Contains(std::string const& absolutePath) const
+	{
+		return nullptr != FindEntry(absolutePath);
+	}
+
+	std::span<std::byte const> AssetPack::Read(std::string const& absolutePath, std::vector<std::byte>& storage) const
+	{
+		Entry const* const entry{ FindEntry(absolutePath) };
+		if (!entry)
+			return {};
+		std::span<std::byte const> const stored{ mFile.GetData().subspan(entry->Offset, entry->StoredSize) };
+		if (static_cast<uint32_t>(Compression::None) == entry->Compression)
+			return stored;
+
+		storage.resize(entry->Size);
+		if (!decompressLz4(stored, storage))
+		{
+			storage.clear();
+			return {};
+		}
+		return storage;
+	}
+
+	AssetPack::Entry const* AssetPack::FindEntry(std::string const& absolutePath) const
+	{
+		if (mEntries.empty())
+			return nullptr;
+		std::string const key{ getKey(mRootDirectory, absolutePath) };
+		uint64_t const hash{ hashKey(key) };
+		/* Sorted by hash, the paths only settle collisions */
+		auto it{ std::ranges::lower_bound(mEntries, hash, {}, &Entry::PathHash) };
+		for (; it != mEntries.end() && hash == it->PathHash; ++it)
+		{
+			std::span<std::byte const> const path{ mPaths.subspan(it->PathOffset, it->PathSize) };
+			if (key.size() == path.size() && 0 == memcmp(key.data(), path.data(), path.size()))
+				return &*it;
+		}
+		return nullptr;
+	}
+
+	bool WriteAssetPack(std::string const& packAbsolutePath, std::span<std::string const> fileAbsolutePaths)
+	{
+		std::filesystem::path const rootDirectory{ getRootDirectory(packAbsolutePath) };
+		std::vector<std::pair<AssetPack::Entry, std::string>> entries{};
+		std::vector<std::vector<std::byte>> contents{};
+		for (std::string const& path : fileAbsolutePaths)
+		{
+			std::string key{ getKey(rootDirectory, path) };
+			if (key.empty())
+				return false;
+			std::error_code error{};
+			bool const isEmpty{ std::filesystem::is_empty(path, error) };
+			MappedFile const file{ path };
+			if (!file.IsOpen() && (error || !isEmpty))
+				return false;
+
+			/* Only kept when it saves an eighth, small gains are not worth the decompression */
+			std::span<std::byte const> const data{ file.GetData() };
+			std::vector<std::byte> stored{ compressLz4(data) };
+			AssetPack::Entry entry{};
+			entry.PathHash = hashKey(key);
+			entry.Size = data.size();
+			entry.Compression = static_cast<uint32_t>(Compression::Lz4);
+			if (stored.size() > data.size() - data.size() / 8)
+			{
+				stored.assign(data.begin(), data.end());
+				entry.Compression = static_cast<uint32_t>(Compression::None);
+			}
+			entry.StoredSize = stored.size();
+			entries.emplace_back(entry, std::move(key));
+			contents.push_back(std::move(stored));
+		}
+
+		std::vector<uint32_t> order(entries.size());
+		for (uint32_t i{ 0 }; i < order.size(); ++i)
+			order[i] = i;
+		std::ranges::sort(order, {}, [&entries](uint32_t i) { return std::tie(entries[i].first.PathHash, entries[i].second); });
+		/* The same file listed twice */
+		if (std::ranges::adjacent_find(order, {}, [&entries](uint32_t i) { return entries[i].second; }) != order.end())
+			return false;
+
+		std::string paths{};
+		for (uint32_t i : order)
+		{
+			entries[i].first.PathOffset = static_cast<uint32_t>(paths.size());
+			entries[i].first.PathSize = static_cast<uint32_t>(entries[i].second.size());
+			paths += entries[i].second;
+		}
+		uint64_t offset{ sizeof(PackHeader) + entries.size() * sizeof(AssetPack::Entry) + paths.size() };
+		for (uint32_t i : order)
+		{
+			offset = (offset + FILE_ALIGNMENT - 1) & ~uint64_t{ FILE_ALIGNMENT - 1 };
+			entries[i].first.Offset = offset;
+			offset += entries[i].first.StoredSize;
+		}
+
+		/* Write to a temporary file first, a reader must never map a half-written pack */
+		std::string const temporaryPath{ packAbsolutePath + ".tmp" };
+		{
+			std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+			PackHeader const header{ ASSET_PACK_MAGIC, ASSET_PACK_VERSION, static_cast<uint32_t>(entries.size()), static_cast<uint32_t>(paths.size()) };
+			file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+			for (uint32_t i : order)
+				file.write(reinterpret_cast<char const*>(&entries[i].first), sizeof(AssetPack::Entry));
+			file.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+			uint64_t written{ sizeof(header) + entries.size() * sizeof(AssetPack::Entry) + paths.size() };
+			for (uint32_t i : order)
+			{
+				std::vector<char> const padding(static_cast<size_t>(entries[i].first.Offset - written), 0);
+				file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+				file.write(reinterpret_cast<char const*>(contents[i].data()), static_cast<std::streamsize>(contents[i].size()));
+				written = entries[i].first.Offset + contents[i].size();
+			}
+			if (!file)
+				return false;
+		}
+		std::error_code error{};
+		std::filesystem::rename(temporaryPath, packAbsolutePath, error);
+		return !error;
+	}
+
+	bool MountAssetPack(std::string const& packAbsolutePath)
+	{
+		auto pack{ std::make_shared<AssetPack const>(packAbsolutePath) };
+		if (!pack->IsOpen())
+			return false;
+		mountedPack = std::move(pack);
+		return true;
+	}
+
+	bool AssetExists(std::string const& absolutePath)
+	{
+		std::error_code error{};
+		return IsInAssetPack(absolutePath) || std::filesystem::exists(absolutePath, error);
+	}
+
+	bool IsInAssetPack(std::string const& absolutePath)
+	{
+		return mountedPack && mountedPack->Contains(absolutePath);
+	}
+
+	AssetFile::AssetFile(std::string const& absolutePath)
+	{
+		if (mountedPack)
+		{
+			mData = mountedPack->Read(absolutePath, mStorage);
+			if (!mData.empty())
+			{
+				mPack = mountedPack;
+				return;
+			}
+		}
+		mFile = MappedFile{ absolutePath };
+		mData = mFile.GetData();
+	}
+
+} // namespace gg
@@ -0,0 +1,425 @@
+module;
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+module AsyncIo;
+
+namespace
+{
+	using namespace gg;
+
+	/* Without io_uring every thread has one read in flight */
+	constexpr uint32_t MAX_BLOCKING_THREADS{ 8 };
+
+	IoStatus readFile(IoRead const& read, size_t& bytesRead)
+	{
+		std::ifstream file{ read.AbsolutePath, std::ios::binary };
+		if (!file.is_open())
+			return IoStatus::Failed;
+		file.seekg(static_cast<std::streamoff>(read.Offset));
+		file.read(reinterpret_cast<char*>(read.Destination.data()), static_cast<std::streamsize>(read.Destination.size()));
+		if (file.bad())
+			return IoStatus::Failed;
+		bytesRead = static_cast<size_t>(file.gcount());
+		return IoStatus::Success;
+	}
+}
+
+namespace gg
+{
+#ifdef __linux__
+	/* The rings are shared with the kernel: the submissions are written at the tail of one, the completions read at the head of the other */
+	struct AsyncIo::Ring
+	{
+		static constexpr uint64_t WAKE_USER_DATA{ UINT64_MAX };
+		/* Larger reads are split, the kernel returns at most this much at once */
+		static constexpr size_t MAX_READ_SIZE{ 0x7FFFF000 };
+
+		struct Slot
+		{
+			Request Pending;
+			int File{ -1 };
+			size_t BytesRead{ 0 };
+		};
+
+		explicit Ring(uint32_t queueDepth)
+		{
+			/* One more entry for the wake-up read */
+			io_uring_params params{};
+			Fd = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth + 1, &params));
+			if (Fd < 0)
+				return;
+			/* Reads at an offset came with the current position feature, older kernels only have the vectored ones */
+			Features = params.features;
+
+			SqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+			CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool const singleMap{ 0 != (params.features & IORING_FEAT_SINGLE_MMAP) };
+			if (singleMap)
+				SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize);
+			SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+			CqRing = singleMap ? SqRing : mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+			SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			void* const sqes{ mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES) };
+			WakeEvent = eventfd(0, EFD_CLOEXEC);
+			if (MAP_FAILED == SqRing || MAP_FAILED == CqRing || MAP_FAILED == sqes)
+			{
+				if (MAP_FAILED != sqes)
+					munmap(sqes, SqesSize);
+				return;
+			}
+
+			std::byte* const sq{ static_cast<std::byte*>(SqRing) };
+			SqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+			SqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+			SqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+			Sqes = static_cast<io_uring_sqe*>(sqes);
+			std::byte* const cq{ static_cast<std::byte*>(CqRing) };
+			CqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+			CqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+			CqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+			Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			Slots.resize(queueDepth);
+			for (uint32_t i{ queueDepth }; i > 0; --i)
+				FreeSlots.push_back(i - 1);
+		}
+
+		~Ring()
+		{
+			if (Sqes)
+				munmap(Sqes, SqesSize);
+			if (MAP_FAILED != CqRing && CqRing != SqRing)
+				munmap(CqRing, CqRingSize);
+			if (MAP_FAILED != SqRing)
+				munmap(SqRing, SqRingSize);
+			if (WakeEvent >= 0)
+				close(WakeEvent);
+			if (Fd >= 0)
+				close(Fd);
+		}
+
+		bool IsValid() const
+		{
+			return nullptr != Sqes && WakeEvent >= 0 && 0 != (Features & IORING_FEAT_RW_CUR_POS);
+		}
+
+		/* Only the ring thread submits, the tail is published once the entry is written */
+		void PushRead(int file, std::span<std::byte> destination, uint64_t offset, uint64_t userData)
+		{
+			uint32_t const tail{ *SqTail };
+			uint32_t const index{ tail & SqMask };
+			io_uring_sqe& sqe{ Sqes[index] };
+			sqe = {};
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = file;
+			sqe.addr = reinterpret_cast<uint64_t>(destination.data());
+			sqe.len = static_cast<uint32_t>(std::min(destination.size(), MAX_READ_SIZE));
+			sqe.off = offset;
+			sqe.user_data = userData;
+			SqArray[index] = index;
+			std::atomic_ref{ *SqTail }.store(tail + 1, std::memory_order_release);
+			++PendingSubmitCount;
+		}
+
+		void ArmWake()
+		{
+			PushRead(WakeEvent, std::as_writable_bytes(std::span{ &WakeValue, 1 }), 0, WAKE_USER_DATA);
+		}
+
+		void PushSlot(uint32_t slot)
+		{
+			IoRead const& read{ Slots[slot].Pending.Read };
+			size_t const bytesRead{ Slots[slot].BytesRead };
+			PushRead(Slots[slot].File, read.Destination.subspan(bytesRead), read.Offset + bytesRead, slot);
+		}
+
+		/* Submits the new entries and waits for at least one completion */
+		void SubmitAndWait()
+		{
+			while (true)
+			{
+				long const submitted{ syscall(__NR_io_uring_enter, Fd, PendingSubmitCount, 1, IORING_ENTER_GETEVENTS, nullptr, 0) };
+				if (submitted >= 0)
+				{
+					PendingSubmitCount -= static_cast<uint32_t>(submitted);
+					return;
+				}
+				if (EINTR != errno)
+					return;
+			}
+		}
+
+		int Fd{ -1 };
+		uint32_t Features{ 0 };
+		int WakeEvent{ -1 };
+		uint64_t WakeValue{ 0 };
+		void* SqRing{ MAP_FAILED };
+		size_t SqRingSize{ 0 };
+		void* CqRing{ MAP_FAILED };
+		size_t CqRingSize{ 0 };
+		io_uring_sqe* Sqes{ nullptr };
+		size_t SqesSize{ 0 };
+		uint32_t* SqTail{ nullptr };
+		uint32_t SqMask{ 0 };
+		uint32_t* SqArray{ nullptr };
+		uint32_t* CqHead{ nullptr };
+		uint32_t* CqTail{ nullptr };
+		uint32_t CqMask{ 0 };
+		io_uring_cqe* Cqes{ nullptr };
+		uint32_t PendingSubmitCount{ 0 };
+
+		/* The reads in flight, a completion's user data is its slot */
+		std::vector<Slot> Slots;
+		std::vector<uint32_t> FreeSlots;
+	};
+#else
+	struct AsyncIo::Ring
+	{
+	};
+#endif
+
+	AsyncIo::AsyncIo(uint32_t queueDepth)
+		: mQueueDepth{ std::max(queueDepth, 1u) }
+	{
+#ifdef __linux__
+		/* Not available in some containers and sandboxes */
+		auto ring{ std::make_unique<Ring>(mQueueDepth) };
+		if (ring->IsValid())
+		{
+			mRing = std::move(ring);
+			mThreads.emplace_back([this] { RunRing(); });
+			return;
+		}
+#endif
+		uint32_t const threadCount{ std::min(mQueueDepth, MAX_BLOCKING_THREADS) };
+		for (uint32_t i{ 0 }; i < threadCount; ++i)
+			mThreads.emplace_back([this] { RunWorker(); });
+	}
+
+	AsyncIo::~AsyncIo()
+	{
+		Stop();
+	}
+
+	std::vector<IoRequestId> AsyncIo::Submit(std::span<IoRead> reads)
+	{
+		std::vector<IoRequestId> ids(reads.size());
+		bool stopping;
+		{
+			std::lock_guard lock{ mMutex };
+			stopping = mStopping;
+			for (size_t i{ 0 }; i < reads.size(); ++i)
+			{
+				ids[i] = mNextId++;
+				if (!stopping)
+					mQueues[static_cast<uint32_t>(reads[i].Priority)].push_back({ ids[i], std::move(reads[i]) });
+			}
+		}
+		if (stopping)
+		{
+			for (IoRead& read : reads)
+				read.OnComplete(IoStatus::Cancelled, 0);
+		}
+		else if (mRing)
+			WakeRing();
+		else
+			mRequestAvailable.notify_all();
+		return ids;
+	}
+
+	IoRequestId AsyncIo::Submit(IoRead read)
+	{
+		return Submit(std::span{ &read, 1 }).front();
+	}
+
+	bool AsyncIo::Cancel(IoRequestId id)
+	{
+		Request request{};
+		{
+			std::lock_guard lock{ mMutex };
+			for (std::deque<Request>& queue : mQueues)
+			{
+				auto const it{ std::ranges::find(queue, id, &Request::Id) };
+				if (it != queue.end())
+				{
+					request = std::move(*it);
+					queue.erase(it);
+					break;
+				}
+			}
+		}
+		if (0 == request.Id)
+			return false;
+		request.Read.OnComplete(IoStatus::Cancelled, 0);
+		return true;
+	}
+
+	void AsyncIo::Stop()
+	{
+		std::vector<Request> cancelled{};
+		{
+			std::lock_guard lock{ mMutex };
+			if (mStopping)
+				return;
+			mStopping = true;
+			for (std::deque<Request>& queue : mQueues)
+			{
+				std::ranges::move(queue, std::back_inserter(cancelled));
+				queue.clear();
+			}
+		}
+		for (Request& request : cancelled)
+			request.Read.OnComplete(IoStatus::Cancelled, 0);
+
+		if (mRing)
+			WakeRing();
+		else
+			mRequestAvailable.notify_all();
+		for (std::thread& thread : mThreads)
+			thread.join();
+		mThreads.clear();
+	}
+
+	bool AsyncIo::PopRequest(Request& request)
+	{
+		for (std::deque<Request>& queue : mQueues)
+		{
+			if (!queue.empty())
+			{
+				request = std::move(queue.front());
+				queue.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void AsyncIo::RunWorker()
+	{
+		while (true)
+		{
+			Request request{};
+			{
+				std::unique_lock lock{ mMutex };
+				mRequestAvailable.wait(lock, [this, &request] { return PopRequest(request) || mStopping; });
+				/* Stopping cancels the queued reads, nothing is left */
+				if (0 == request.Id)
+					return;
+			}
+			size_t bytesRead{ 0 };
+			IoStatus const status{ readFile(request.Read, bytesRead) };
+			request.Read.OnComplete(status, bytesRead);
+		}
+	}
+
+#ifdef __linux__
+	void AsyncIo::RunRing()
+	{
+		Ring& ring{ *mRing };
+		/* A read of the event that the submitting threads signal, it completes when there is more to read */
+		ring.ArmWake();
+		uint32_t inFlightCount{ 0 };
+		while (true)
+		{
+			/* Keeps the queue as deep as allowed, the highest priorities go first */
+			while (inFlightCount < mQueueDepth)
+			{
+				Request request{};
+				{
+					std::lock_guard lock{ mMutex };
+					if (!PopRequest(request))
+						break;
+				}
+				int const file{ open(request.Read.AbsolutePath.c_str(), O_RDONLY | O_CLOEXEC) };
+				if (file < 0 || request.Read.Destination.empty())
+				{
+					if (file >= 0)
+						close(file);
+					request.Read.OnComplete(file < 0 ? IoStatus::Failed : IoStatus::Success, 0);
+					continue;
+				}
+				uint32_t const slot{ ring.FreeSlots.back() };
+				ring.FreeSlots.pop_back();
+				ring.Slots[slot] = { std::move(request), file, 0 };
+				ring.PushSlot(slot);
+				++inFlightCount;
+			}
+
+			{
+				std::lock_guard lock{ mMutex };
+				if (mStopping && 0 == inFlightCount)
+					return;
+			}
+			ring.SubmitAndWait();
+
+			uint32_t head{ *ring.CqHead };
+			uint32_t const tail{ std::atomic_ref{ *ring.CqTail }.load(std::memory_order_acquire) };
+			for (; head != tail; ++head)
+			{
+				io_uring_cqe const& completion{ ring.Cqes[head & ring.CqMask] };
+				int32_t const result{ completion.res };
+				if (Ring::WAKE_USER_DATA == completion.user_data)
+				{
+					ring.ArmWake();
+					continue;
+				}
+
+				uint32_t const slot{ static_cast<uint32_t>(completion.user_data) };
+				Ring::Slot& inFlight{ ring.Slots[slot] };
+				if (result > 0)
+					inFlight.BytesRead += static_cast<size_t>(result);
+				/* A short read is resumed, the end of the file reads nothing */
+				if (result > 0 && inFlight.BytesRead < inFlight.Pending.Read.Destination.size())
+				{
+					ring.PushSlot(slot);
+					continue;
+				}
+
+				close(inFlight.File);
+				Request request{ std::move(inFlight.Pending) };
+				size_t const bytesRead{ inFlight.BytesRead };
+				ring.FreeSlots.push_back(slot);
+				--inFlightCount;
+				request.Read.OnComplete(result < 0 ? IoStatus::Failed : IoStatus::Success, bytesRead);
+			}
+			std::atomic_ref{ *ring.CqHead }.store(head, std::memory_order_release);
+		}
+	}
+
+	void AsyncIo::WakeRing()
+	{
+		uint64_t const value{ 1 };
+		[[maybe_unused]] ssize_t const written{ write(mRing->WakeEvent, &value, sizeof(value)) };
+	}
+#else
+	void AsyncIo::RunRing()
+	{
+	}
+
+	void AsyncIo::WakeRing()
+	{
+	}
+#endif
+
+} // namespace gg
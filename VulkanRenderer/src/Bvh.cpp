@@ -0,0 +1,404 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+module Bvh;
+
+import Culling;
+
+using namespace DirectX;
+
+namespace
+{
+	using namespace gg;
+
+	constexpr uint32_t BIN_COUNT{ 16 };
+	constexpr uint32_t MAX_LEAF_SIZE{ 4 };
+	/* Relative to testing one primitive box */
+	constexpr float TRAVERSAL_COST{ 1.f };
+	constexpr float INTERSECTION_COST{ 1.f };
+	constexpr uint32_t ALL_PLANES{ 0x3F };
+	constexpr uint32_t INVALID_NODE{ std::numeric_limits<uint32_t>::max() };
+
+	struct BuildPrimitive
+	{
+		Aabb Box;
+		std::array<float, 3> Centroid;
+		uint32_t Primitive;
+	};
+
+	/* Half of it, only the ratios matter. 0 for an empty box. */
+	float surfaceArea(XMVECTOR boundsMin, XMVECTOR boundsMax)
+	{
+		XMFLOAT3 size{};
+		XMStoreFloat3(&size, XMVectorMax(XMVectorSubtract(boundsMax, boundsMin), XMVectorZero()));
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	/* Clears the planes that the box is fully inside of, false when it is fully outside one of them */
+	bool testBox(Frustum const& frustum, XMFLOAT3 const& boundsMin, XMFLOAT3 const& boundsMax, uint32_t& planeMask)
+	{
+		for (uint32_t p{ 0 }; p < frustum.Planes.size(); ++p)
+		{
+			if (0 == (planeMask & 1u << p))
+				continue;
+			XMFLOAT4 const& plane{ frustum.Planes[p] };
+			bool const isPositiveX{ plane.x >= 0.f };
+			bool const isPositiveY{ plane.y >= 0.f };
+			bool const isPositiveZ{ plane.z >= 0.f };
+			/* The corner furthest along the normal, then the nearest one */
+			if (plane.x * (isPositiveX ? boundsMax.x : boundsMin.x) + plane.y * (isPositiveY ? boundsMax.y : boundsMin.y)
+				+ plane.z * (isPositiveZ ? boundsMax.z : boundsMin.z) + plane.w < 0.f)
+				return false;
+			if (plane.x * (isPositiveX ? boundsMin.x : boundsMax.x) + plane.y * (isPositiveY ? boundsMin.y : boundsMax.y)
+				+ plane.z * (isPositiveZ ? boundsMin.z : boundsMax.z) + plane.w >= 0.f)
+				planeMask &= ~(1u << p);
+		}
+		return true;
+	}
+
+	bool isEmpty(Aabb const& box)
+	{
+		return box.Min.x > box.Max.x;
+	}
+
+	/* Area times the cost of visiting the node */
+	float getNodeCost(BvhNode const& node)
+	{
+		return surfaceArea(XMLoadFloat3(&node.Min), XMLoadFloat3(&node.Max)) * (node.Count > 0 ? INTERSECTION_COST * node.Count : TRAVERSAL_COST);
+	}
+
+	bool isSameBounds(BvhNode const& a, BvhNode const& b)
+	{
+		return a.Min.x == b.Min.x && a.Min.y == b.Min.y && a.Min.z == b.Min.z && a.Max.x == b.Max.x && a.Max.y == b.Max.y && a.Max.z == b.Max.z;
+	}
+}
+
+namespace gg
+{
+	void Bvh::Build(std::span<Aabb const> boxes, std::span<uint32_t const> primitives)
+	{
+		mNodes.clear();
+		mParents.clear();
+		mPrimitives.clear();
+		mLeaves.assign(boxes.size(), INVALID_NODE);
+		mCostSum = 0.0;
+		mCost = 0.f;
+		mBuildCost = 0.f;
+		if (primitives.empty())
+			return;
+
+		/* Partitioned in place, reading the boxes through the indices would miss the cache at every level */
+		std::vector<BuildPrimitive> items(primitives.size());
+		for (size_t i{ 0 }; i < primitives.size(); ++i)
+		{
+			Aabb const& box{ boxes[primitives[i]] };
+			items[i] = { box, { 0.5f * (box.Min.x + box.Max.x), 0.5f * (box.Min.y + box.Max.y), 0.5f * (box.Min.z + box.Max.z) }, primitives[i] };
+		}
+
+		/* A node waiting on the stack holds its range of primitives, it only becomes interior once split */
+		mNodes.reserve(2 * items.size());
+		mParents.reserve(2 * items.size());
+		mNodes.push_back({ {}, 0, {}, static_cast<uint32_t>(items.size()) });
+		mParents.push_back(INVALID_NODE);
+		std::vector<uint32_t> stack{ 0 };
+		while (!stack.empty())
+		{
+			uint32_t const nodeIndex{ stack.back() };
+			stack.pop_back();
+			uint32_t const begin{ mNodes[nodeIndex].Offset };
+			uint32_t const count{ mNodes[nodeIndex].Count };
+
+			XMVECTOR boundsMin{ XMVectorReplicate(FLT_MAX) };
+			XMVECTOR boundsMax{ XMVectorReplicate(-FLT_MAX) };
+			std::array<float, 3> centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+			std::array<float, 3> centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (uint32_t i{ begin }; i < begin + count; ++i)
+			{
+				boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&items[i].Box.Min));
+				boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&items[i].Box.Max));
+				for (uint32_t axis{ 0 }; axis < 3; ++axis)
+				{
+					centroidMin[axis] = std::min(centroidMin[axis], items[i].Centroid[axis]);
+					centroidMax[axis] = std::max(centroidMax[axis], items[i].Centroid[axis]);
+				}
+			}
+			XMStoreFloat3(&mNodes[nodeIndex].Min, boundsMin);
+			XMStoreFloat3(&mNodes[nodeIndex].Max, boundsMax);
+			if (count <= 1)
+				continue;
+
+			uint32_t axis{ 0 };
+			for (uint32_t a{ 1 }; a < 3; ++a)
+				if (centroidMax[a] - centroidMin[a] > centroidMax[axis] - centroidMin[axis])
+					axis = a;
+			float const extent{ centroidMax[axis] - centroidMin[axis] };
+
+			uint32_t split{ begin + count / 2 };
+			if (extent > 0.f)
+			{
+				struct Bin
+				{
+					XMVECTOR Min{ XMVectorReplicate(FLT_MAX) };
+					XMVECTOR Max{ XMVectorReplicate(-FLT_MAX) };
+					uint32_t Count{ 0 };
+				};
+				float const scale{ BIN_COUNT / extent };
+				auto const getBin{ [&](BuildPrimitive const& item) { return std::min(BIN_COUNT - 1, static_cast<uint32_t>((item.Centroid[axis] - centroidMin[axis]) * scale)); } };
+				std::array<Bin, BIN_COUNT> bins{};
+				for (uint32_t i{ begin }; i < begin + count; ++i)
+				{
+					Bin& bin{ bins[getBin(items[i])] };
+					bin.Min = XMVectorMin(bin.Min, XMLoadFloat3(&items[i].Box.Min));
+					bin.Max = XMVectorMax(bin.Max, XMLoadFloat3(&items[i].Box.Max));
+					++bin.Count;
+				}
+
+				/* Cost of splitting after each bin: the area of each side times its primitive count */
+				std::array<float, BIN_COUNT - 1> splitCosts{};
+				Bin side{};
+				for (uint32_t b{ 0 }; b + 1 < BIN_COUNT; ++b)
+				{
+					side = { XMVectorMin(side.Min, bins[b].Min), XMVectorMax(side.Max, bins[b].Max), side.Count + bins[b].Count };
+					splitCosts[b] = 0 == side.Count ? FLT_MAX : surfaceArea(side.Min, side.Max) * side.Count;
+				}
+				side = {};
+				for (uint32_t b{ BIN_COUNT - 1 }; b > 0; --b)
+				{
+					side = { XMVectorMin(side.Min, bins[b].Min), XMVectorMax(side.Max, bins[b].Max), side.Count + bins[b].Count };
+					splitCosts[b - 1] = 0 == side.Count ? FLT_MAX : splitCosts[b - 1] + surfaceArea(side.Min, side.Max) * side.Count;
+				}
+				uint32_t const bestBin{ static_cast<uint32_t>(std::min_element(splitCosts.begin(), splitCosts.end()) - splitCosts.begin()) };
+
+				float const nodeArea{ surfaceArea(boundsMin, boundsMax) };
+				float const leafCost{ INTERSECTION_COST * count };
+				float const splitCost{ nodeArea > 0.f ? TRAVERSAL_COST + INTERSECTION_COST * splitCosts[bestBin] / nodeArea : leafCost };
+				if (count <= MAX_LEAF_SIZE && splitCost >= leafCost)
+					continue;
+				auto const middle{ std::partition(items.begin() + begin, items.begin() + begin + count, [&](BuildPrimitive const& item) { return getBin(item) <= bestBin; }) };
+				split = static_cast<uint32_t>(middle - items.begin());
+			}
+			else if (count <= MAX_LEAF_SIZE)
+				continue;
+			/* The boxes are all in one bin, or on top of each other: halve the range so that the leaves stay small */
+			if (split == begin || split == begin + count)
+			{
+				split = begin + count / 2;
+				std::nth_element(items.begin() + begin, items.begin() + split, items.begin() + begin + count,
+					[axis](BuildPrimitive const& a, BuildPrimitive const& b) { return a.Centroid[axis] < b.Centroid[axis]; });
+			}
+
+			uint32_t const firstChild{ static_cast<uint32_t>(mNodes.size()) };
+			mNodes.push_back({ {}, begin, {}, split - begin });
+			mNodes.push_back({ {}, split, {}, begin + count - split });
+			mParents.insert(mParents.end(), 2, nodeIndex);
+			mNodes[nodeIndex].Offset = firstChild;
+			mNodes[nodeIndex].Count = 0;
+			stack.push_back(firstChild + 1);
+			stack.push_back(firstChild);
+		}
+
+		mPrimitives.resize(items.size());
+		for (size_t i{ 0 }; i < items.size(); ++i)
+			mPrimitives[i] = items[i].Primitive;
+		for (uint32_t n{ 0 }; n < mNodes.size(); ++n)
+		{
+			mCostSum += getNodeCost(mNodes[n]);
+			for (uint32_t i{ mNodes[n].Offset }; i < mNodes[n].Offset + mNodes[n].Count; ++i)
+				mLeaves[mPrimitives[i]] = n;
+		}
+		UpdateCost();
+		mBuildCost = mCost;
+	}
+
+	void Bvh::Refit(std::span<Aabb const> boxes)
+	{
+		/* The children come after their parent */
+		mCostSum = 0.0;
+		for (size_t i{ mNodes.size() }; i-- > 0;)
+		{
+			ComputeNodeBounds(static_cast<uint32_t>(i), boxes);
+			mCostSum += getNodeCost(mNodes[i]);
+		}
+		UpdateCost();
+	}
+
+	void Bvh::Refit(std::span<Aabb const> boxes, std::span<uint32_t const> movedPrimitives)
+	{
+		for (uint32_t p : movedPrimitives)
+		{
+			if (p >= mLeaves.size())
+				continue;
+			for (uint32_t nodeIndex{ mLeaves[p] }; INVALID_NODE != nodeIndex; nodeIndex = mParents[nodeIndex])
+			{
+				BvhNode const previous{ mNodes[nodeIndex] };
+				ComputeNodeBounds(nodeIndex, boxes);
+				BvhNode const& node{ mNodes[nodeIndex] };
+				mCostSum += getNodeCost(node) - getNodeCost(previous);
+				if (isSameBounds(node, previous))
+					break;
+			}
+		}
+		UpdateCost();
+	}
+
+	void Bvh::ComputeNodeBounds(uint32_t nodeIndex, std::span<Aabb const> boxes)
+	{
+		BvhNode& node{ mNodes[nodeIndex] };
+		XMVECTOR boundsMin{ XMVectorReplicate(FLT_MAX) };
+		XMVECTOR boundsMax{ XMVectorReplicate(-FLT_MAX) };
+		if (node.Count > 0)
+		{
+			for (uint32_t i{ node.Offset }; i < node.Offset + node.Count; ++i)
+			{
+				boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&boxes[mPrimitives[i]].Min));
+				boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&boxes[mPrimitives[i]].Max));
+			}
+		}
+		else
+		{
+			for (uint32_t child{ node.Offset }; child < node.Offset + 2; ++child)
+			{
+				boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&mNodes[child].Min));
+				boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&mNodes[child].Max));
+			}
+		}
+		XMStoreFloat3(&node.Min, boundsMin);
+		XMStoreFloat3(&node.Max, boundsMax);
+	}
+
+	void Bvh::UpdateCost()
+	{
+		if (mNodes.empty())
+			return;
+		/* In box tests per query that reaches the root */
+		float const rootArea{ surfaceArea(XMLoadFloat3(&mNodes[0].Min), XMLoadFloat3(&mNodes[0].Max)) };
+		mCost = rootArea > 0.f ? static_cast<float>(mCostSum / rootArea) : 0.f;
+	}
+
+	void Bvh::CullFrustum(Frustum const& frustum, std::span<Aabb const> boxes, std::vector<uint32_t>& outPrimitives) const
+	{
+		if (mNodes.empty())
+			return;
+
+		/* The planes that a node is fully inside of are not tested again for its subtree */
+		struct Entry
+		{
+			uint32_t Node{ 0 };
+			uint32_t PlaneMask{ 0 };
+		};
+		std::vector<Entry> stack{ { 0, ALL_PLANES } };
+		while (!stack.empty())
+		{
+			Entry entry{ stack.back() };
+			stack.pop_back();
+			BvhNode const& node{ mNodes[entry.Node] };
+			if (0 != entry.PlaneMask && !testBox(frustum, node.Min, node.Max, entry.PlaneMask))
+				continue;
+			if (0 == entry.PlaneMask)
+			{
+				/* Fully inside: all the primitives of the subtree, from its leftmost to its rightmost leaf */
+				uint32_t first{ entry.Node };
+				while (0 == mNodes[first].Count)
+					first = mNodes[first].Offset;
+				uint32_t last{ entry.Node };
+				while (0 == mNodes[last].Count)
+					last = mNodes[last].Offset + 1;
+				for (uint32_t i{ mNodes[first].Offset }; i < mNodes[last].Offset + mNodes[last].Count; ++i)
+				{
+					if (!isEmpty(boxes[mPrimitives[i]]))
+						outPrimitives.push_back(mPrimitives[i]);
+				}
+				continue;
+			}
+			if (0 == node.Count)
+			{
+				stack.push_back({ node.Offset + 1, entry.PlaneMask });
+				stack.push_back({ node.Offset, entry.PlaneMask });
+				continue;
+			}
+			for (uint32_t i{ node.Offset }; i < node.Offset + node.Count; ++i)
+			{
+				uint32_t const p{ mPrimitives[i] };
+				uint32_t planeMask{ entry.PlaneMask };
+				if (testBox(frustum, boxes[p].Min, boxes[p].Max, planeMask))
+					outPrimitives.push_back(p);
+			}
+		}
+	}
+
+	std::optional<BvhHit> Bvh::IntersectRay(XMFLOAT3 const& origin, XMFLOAT3 const& direction, float maxDistance, std::span<Aabb const> boxes) const
+	{
+		if (mNodes.empty())
+			return std::nullopt;
+
+		XMFLOAT3 const inverse{ 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+		auto const enter{ [&](XMFLOAT3 const& boundsMin, XMFLOAT3 const& boundsMax) { return IntersectRayBox(origin, inverse, { boundsMin, boundsMax }); } };
+
+		std::optional<BvhHit> nearest{};
+		float nearestDistance{ maxDistance };
+		struct Entry
+		{
+			uint32_t Node{ 0 };
+			float Distance{ 0.f };
+		};
+		std::vector<Entry> stack{};
+		if (float const distance{ enter(mNodes[0].Min, mNodes[0].Max) }; distance <= nearestDistance)
+			stack.push_back({ 0, distance });
+		while (!stack.empty())
+		{
+			Entry const entry{ stack.back() };
+			stack.pop_back();
+			if (entry.Distance > nearestDistance)
+				continue;
+			BvhNode const& node{ mNodes[entry.Node] };
+			if (node.Count > 0)
+			{
+				for (uint32_t i{ node.Offset }; i < node.Offset + node.Count; ++i)
+				{
+					uint32_t const p{ mPrimitives[i] };
+					float const distance{ enter(boxes[p].Min, boxes[p].Max) };
+					if (distance <= nearestDistance)
+					{
+						nearestDistance = distance;
+						nearest = BvhHit{ p, distance };
+					}
+				}
+				continue;
+			}
+			/* The nearer child last, so that it is visited first */
+			Entry first{ node.Offset, enter(mNodes[node.Offset].Min, mNodes[node.Offset].Max) };
+			Entry second{ node.Offset + 1, enter(mNodes[node.Offset + 1].Min, mNodes[node.Offset + 1].Max) };
+			if (first.Distance < second.Distance)
+				std::swap(first, second);
+			if (first.Distance <= nearestDistance)
+				stack.push_back(first);
+			if (second.Distance <= nearestDistance)
+				stack.push_back(second);
+		}
+		return nearest;
+	}
+
+	float IntersectRayBox(XMFLOAT3 const& origin, XMFLOAT3 const& inverseDirection, Aabb const& box)
+	{
+		/* Infinite slabs on the axes that the ray is parallel to. An empty box would pass with its slabs swapped. */
+		if (box.Min.x > box.Max.x)
+			return std::numeric_limits<float>::infinity();
+		float const x0{ (box.Min.x - origin.x) * inverseDirection.x };
+		float const x1{ (box.Max.x - origin.x) * inverseDirection.x };
+		float const y0{ (box.Min.y - origin.y) * inverseDirection.y };
+		float const y1{ (box.Max.y - origin.y) * inverseDirection.y };
+		float const z0{ (box.Min.z - origin.z) * inverseDirection.z };
+		float const z1{ (box.Max.z - origin.z) * inverseDirection.z };
+		float const entryDistance{ std::max({ std::min(x0, x1), std::min(y0, y1), std::min(z0, z1), 0.f }) };
+		float const exitDistance{ std::min({ std::max(x0, x1), std::max(y0, y1), std::max(z0, z1) }) };
+		return entryDistance <= exitDistance ? entryDistance : std::numeric_limits<float>::infinity();
+	}
+
+} // namespace gg
@@ -71,5 +71,17 @@ namespace gg {
 
     XMMATRIX const & Camera::GetViewMatrix() const { return mViewMatrix; }
     XMMATRIX const & Camera::GetProjectionMatrix() const { return mProjectionMatrix; }
+    float Camera::GetNearPlane() const { return NEAR; }
+    float Camera::GetFarPlane() const { return FAR; }
+
+    void Camera::GetRay(float ndcX, float ndcY, XMMATRIX const& modelViewMatrix, XMFLOAT3& outOrigin, XMFLOAT3& outDirection) const
+    {
+        /* Back through the projection from depth 0 and 1 */
+        XMMATRIX const inverse{ XMMatrixInverse(nullptr, XMMatrixMultiply(modelViewMatrix, mProjectionMatrix)) };
+        XMVECTOR const nearPoint{ XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 0.f, 1.f), inverse) };
+        XMVECTOR const farPoint{ XMVector3TransformCoord(XMVectorSet(ndcX, ndcY, 1.f, 1.f), inverse) };
+        XMStoreFloat3(&outOrigin, nearPoint);
+        XMStoreFloat3(&outDirection, XMVectorSubtract(farPoint, nearPoint));
+    }
 
 } // namespace gg
\ No newline at end of file
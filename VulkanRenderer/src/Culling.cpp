@@ -0,0 +1,176 @@
+module;
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define GG_SSE
+#endif
+module Culling;
+
+import ErrorHandling;
+
+using namespace DirectX;
+
+namespace gg
+{
+	Frustum Frustum::FromMatrix(XMMATRIX const& matrix)
+	{
+		/* The columns of a row-vector matrix are the rows of its transpose */
+		XMMATRIX const m{ XMMatrixTranspose(matrix) };
+		std::array<XMVECTOR, 6> const planes
+		{
+			XMVectorAdd(m.r[3], m.r[0]),
+			XMVectorSubtract(m.r[3], m.r[0]),
+			XMVectorAdd(m.r[3], m.r[1]),
+			XMVectorSubtract(m.r[3], m.r[1]),
+			m.r[2],
+			XMVectorSubtract(m.r[3], m.r[2])
+		};
+
+		Frustum frustum{};
+		for (size_t i{ 0 }; i < planes.size(); ++i)
+			XMStoreFloat4(&frustum.Planes[i], XMPlaneNormalize(planes[i]));
+		return frustum;
+	}
+
+	bool Frustum::IntersectsSphere(XMFLOAT4 const& sphere) const
+	{
+		XMVECTOR const center{ XMVectorSetW(XMLoadFloat4(&sphere), 1.f) };
+		for (XMFLOAT4 const& plane : Planes)
+		{
+			if (XMVectorGetX(XMVector4Dot(XMLoadFloat4(&plane), center)) < -sphere.w)
+				return false;
+		}
+		return true;
+	}
+
+	bool Frustum::IntersectsBox(Aabb const& box) const
+	{
+		for (XMFLOAT4 const& plane : Planes)
+		{
+			/* The corner furthest along the normal */
+			float const x{ plane.x >= 0.f ? box.Max.x : box.Min.x };
+			float const y{ plane.y >= 0.f ? box.Max.y : box.Min.y };
+			float const z{ plane.z >= 0.f ? box.Max.z : box.Min.z };
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.f)
+				return false;
+		}
+		return true;
+	}
+
+	void BoundingBoxes::Resize(uint32_t size)
+	{
+		mSize = size;
+		/* The padding has a negative extent, which puts it behind every plane */
+		uint32_t const paddedSize{ (size + 3) & ~3u };
+		for (uint32_t c{ 0 }; c < COMPONENT_COUNT; ++c)
+		{
+			mComponents[c].resize(paddedSize);
+			std::fill(mComponents[c].begin() + size, mComponents[c].end(), c < ExtentX ? 0.f : -FLT_MAX);
+		}
+	}
+
+	void BoundingBoxes::Set(uint32_t index, XMFLOAT3 const& center, XMFLOAT3 const& extent)
+	{
+		BreakIfFalse(index < mSize);
+		mComponents[CenterX][index] = center.x;
+		mComponents[CenterY][index] = center.y;
+		mComponents[CenterZ][index] = center.z;
+		mComponents[ExtentX][index] = extent.x;
+		mComponents[ExtentY][index] = extent.y;
+		mComponents[ExtentZ][index] = extent.z;
+	}
+
+	void BoundingBoxes::Copy(uint32_t from, uint32_t to)
+	{
+		BreakIfFalse(from < mSize && to < mSize);
+		for (std::vector<float>& component : mComponents)
+			component[to] = component[from];
+	}
+
+	void CullBoxes(Frustum const& frustum, BoundingBoxes const& boxes, std::vector<uint32_t>& outVisibleIndices)
+	{
+		outVisibleIndices.clear();
+		outVisibleIndices.reserve(boxes.GetSize());
+		float const* const centerX{ boxes.GetComponent(BoundingBoxes::CenterX) };
+		float const* const centerY{ boxes.GetComponent(BoundingBoxes::CenterY) };
+		float const* const centerZ{ boxes.GetComponent(BoundingBoxes::CenterZ) };
+		float const* const extentX{ boxes.GetComponent(BoundingBoxes::ExtentX) };
+		float const* const extentY{ boxes.GetComponent(BoundingBoxes::ExtentY) };
+		float const* const extentZ{ boxes.GetComponent(BoundingBoxes::ExtentZ) };
+
+		/* Outside a plane when the center is further behind it than the extent reaches: dot(n, c) + d + dot(|n|, e) < 0 */
+#if defined(GG_SSE)
+		struct Plane { __m128 X, Y, Z, W, AbsX, AbsY, AbsZ; };
+		auto const splat{ [](float value) { return _mm_set1_ps(value); } };
+		std::array<Plane, 6> planes{};
+		for (size_t p{ 0 }; p < planes.size(); ++p)
+		{
+			XMFLOAT4 const& plane{ frustum.Planes[p] };
+			planes[p] = { splat(plane.x), splat(plane.y), splat(plane.z), splat(plane.w),
+				splat(std::abs(plane.x)), splat(std::abs(plane.y)), splat(std::abs(plane.z)) };
+		}
+#endif
+
+		uint32_t const paddedSize{ (boxes.GetSize() + 3) & ~3u };
+#if defined(GG_SSE)
+		for (uint32_t i{ 0 }; i < paddedSize; i += 4)
+		{
+			__m128 const cx{ _mm_loadu_ps(centerX + i) };
+			__m128 const cy{ _mm_loadu_ps(centerY + i) };
+			__m128 const cz{ _mm_loadu_ps(centerZ + i) };
+			__m128 const ex{ _mm_loadu_ps(extentX + i) };
+			__m128 const ey{ _mm_loadu_ps(extentY + i) };
+			__m128 const ez{ _mm_loadu_ps(extentZ + i) };
+			__m128 outside{ _mm_setzero_ps() };
+			for (Plane const& plane : planes)
+			{
+				__m128 const distance{ _mm_add_ps(
+					_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane.X, cx), _mm_mul_ps(plane.Y, cy)), _mm_add_ps(_mm_mul_ps(plane.Z, cz), plane.W)),
+					_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane.AbsX, ex), _mm_mul_ps(plane.AbsY, ey)), _mm_mul_ps(plane.AbsZ, ez))) };
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+			}
+			for (uint32_t visible{ ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xFu }; 0 != visible; visible &= visible - 1)
+				outVisibleIndices.push_back(i + std::countr_zero(visible));
+		}
+#else
+		for (uint32_t i{ 0 }; i < paddedSize; ++i)
+		{
+			bool isOutside{ false };
+			for (XMFLOAT4 const& plane : frustum.Planes)
+			{
+				float const distance{ plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w
+					+ std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i] };
+				isOutside |= distance < 0.f;
+			}
+			if (!isOutside)
+				outVisibleIndices.push_back(i);
+		}
+#endif
+	}
+
+	void TransformBox(XMFLOAT3 const& center, XMFLOAT3 const& extent, XMMATRIX const& objectMatrix, XMFLOAT3& outCenter, XMFLOAT3& outExtent)
+	{
+		XMVECTOR const worldExtent{ XMVectorAdd(XMVectorAdd(
+			XMVectorScale(XMVectorAbs(objectMatrix.r[0]), extent.x),
+			XMVectorScale(XMVectorAbs(objectMatrix.r[1]), extent.y)),
+			XMVectorScale(XMVectorAbs(objectMatrix.r[2]), extent.z)) };
+		XMStoreFloat3(&outCenter, XMVector3Transform(XMLoadFloat3(&center), objectMatrix));
+		XMStoreFloat3(&outExtent, worldExtent);
+	}
+
+	float GetMaxScale(XMMATRIX const& objectMatrix)
+	{
+		return std::sqrt(std::max({
+			XMVectorGetX(XMVector3LengthSq(objectMatrix.r[0])),
+			XMVectorGetX(XMVector3LengthSq(objectMatrix.r[1])),
+			XMVectorGetX(XMVector3LengthSq(objectMatrix.r[2])) }));
+	}
+
+} // namespace gg
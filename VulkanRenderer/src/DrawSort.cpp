@@ -0,0 +1,77 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <utility>
+module DrawSort;
+
+import ErrorHandling;
+
+namespace
+{
+	/* Depth is quantized logarithmically up to this distance, precision matters most up close */
+	constexpr float MAX_SORT_DEPTH{ 10000.f };
+	constexpr uint32_t RADIX_BITS{ 8 };
+	constexpr uint32_t RADIX_SIZE{ 1 << RADIX_BITS };
+	constexpr uint32_t RADIX_PASSES{ 64 / RADIX_BITS };
+
+	uint64_t field(uint32_t value, uint32_t bits, uint32_t shift)
+	{
+		return (static_cast<uint64_t>(value) & ((1ull << bits) - 1)) << shift;
+	}
+}
+
+namespace gg
+{
+	uint64_t MakeDrawKey(DrawKeyFields const& fields)
+	{
+		float const depth{ std::log2(1.f + std::max(fields.Depth, 0.f)) / std::log2(1.f + MAX_SORT_DEPTH) };
+		uint32_t const quantizedDepth{ static_cast<uint32_t>(std::min(depth, 1.f) * 65535.f) };
+		return field(static_cast<uint32_t>(fields.Pass), 4, 60)
+			| field(fields.Pipeline, 8, 52)
+			| field(fields.Material, 12, 40)
+			| field(fields.Model, 14, 26)
+			| field(fields.Mesh, 10, 16)
+			| field(quantizedDepth, 16, 0);
+	}
+
+	DrawPass GetDrawPass(uint64_t key)
+	{
+		return static_cast<DrawPass>(key >> 60);
+	}
+
+	void RadixSort(std::span<DrawPacket> packets, std::span<DrawPacket> scratch)
+	{
+		BreakIfFalse(scratch.size() >= packets.size());
+
+		/* All histograms in one read of the keys */
+		std::array<std::array<uint32_t, RADIX_SIZE>, RADIX_PASSES> histograms{};
+		for (DrawPacket const& packet : packets)
+			for (uint32_t pass{ 0 }; pass < RADIX_PASSES; ++pass)
+				++histograms[pass][(packet.Key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1)];
+
+		std::span<DrawPacket> source{ packets };
+		std::span<DrawPacket> destination{ scratch.first(packets.size()) };
+		for (uint32_t pass{ 0 }; pass < RADIX_PASSES; ++pass)
+		{
+			std::array<uint32_t, RADIX_SIZE>& histogram{ histograms[pass] };
+			uint32_t const shift{ pass * RADIX_BITS };
+			/* Every key has the same byte here, the pass would not move anything */
+			if (!packets.empty() && packets.size() == histogram[(source[0].Key >> shift) & (RADIX_SIZE - 1)])
+				continue;
+
+			uint32_t offset{ 0 };
+			for (uint32_t& count : histogram)
+				offset += std::exchange(count, offset);
+			for (DrawPacket const& packet : source)
+				destination[histogram[(packet.Key >> shift) & (RADIX_SIZE - 1)]++] = packet;
+			std::swap(source, destination);
+		}
+
+		if (source.data() != packets.data())
+			std::ranges::copy(source, packets.begin());
+	}
+
+} // namespace gg
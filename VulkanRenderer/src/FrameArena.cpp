@@ -0,0 +1,45 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+module FrameArena;
+
+namespace gg
+{
+	FrameArena::FrameArena(size_t capacityBytes)
+		: mBlock{ std::make_unique<std::byte[]>(capacityBytes) }
+		, mCapacity{ capacityBytes }
+	{
+	}
+
+	void* FrameArena::AllocateBytes(size_t sizeBytes, size_t alignment)
+	{
+		uintptr_t const base{ reinterpret_cast<uintptr_t>(mBlock.get()) };
+		size_t const alignedOffset{ ((base + mOffset + alignment - 1) & ~(alignment - 1)) - base };
+		mPeak += sizeBytes + alignment;
+		if (alignedOffset + sizeBytes <= mCapacity)
+		{
+			mOffset = alignedOffset + sizeBytes;
+			return mBlock.get() + alignedOffset;
+		}
+
+		/* Spill, the block grows on the next Reset */
+		std::unique_ptr<std::byte[]>& overflow{ mOverflow.emplace_back(std::make_unique<std::byte[]>(sizeBytes + alignment)) };
+		uintptr_t const overflowBase{ reinterpret_cast<uintptr_t>(overflow.get()) };
+		return reinterpret_cast<void*>((overflowBase + alignment - 1) & ~(alignment - 1));
+	}
+
+	void FrameArena::Reset()
+	{
+		if (!mOverflow.empty())
+		{
+			/* Headroom for scenes that keep growing */
+			mOverflow.clear();
+			mCapacity = mPeak + mPeak / 2;
+			mBlock = std::make_unique<std::byte[]>(mCapacity);
+		}
+		mOffset = 0;
+		mPeak = 0;
+	}
+
+} // namespace gg
@@ -0,0 +1,51 @@
+module;
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+module Hashing;
+
+namespace
+{
+	/* The primes of xxHash64 */
+	constexpr uint64_t PRIME_1{ 0x9E3779B185EBCA87ull };
+	constexpr uint64_t PRIME_2{ 0xC2B2AE3D27D4EB4Full };
+	constexpr uint64_t PRIME_3{ 0x165667B19E3779F9ull };
+	constexpr uint64_t PRIME_4{ 0x85EBCA77C2B2AE63ull };
+	constexpr uint64_t PRIME_5{ 0x27D4EB2F165667C5ull };
+
+	/* The rotation brings the high bits of the product back down, so that every input bit reaches every bit of the hash */
+	uint64_t mixWord(uint64_t hash, uint64_t word)
+	{
+		hash ^= std::rotl(word * PRIME_2, 31) * PRIME_1;
+		return std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+	}
+}
+
+namespace gg
+{
+	uint64_t HashBytes(std::span<std::byte const> bytes)
+	{
+		uint64_t hash{ PRIME_5 + bytes.size() };
+		size_t const wordCount{ bytes.size() / sizeof(uint64_t) };
+		for (size_t i{ 0 }; i < wordCount; ++i)
+		{
+			uint64_t word;
+			memcpy(&word, bytes.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+			hash = mixWord(hash, word);
+		}
+		for (size_t i{ wordCount * sizeof(uint64_t) }; i < bytes.size(); ++i)
+		{
+			hash ^= static_cast<uint64_t>(bytes[i]) * PRIME_5;
+			hash = std::rotl(hash, 11) * PRIME_1;
+		}
+		/* Final avalanche, each bit of the state flips about half of the bits of the result */
+		hash ^= hash >> 33;
+		hash *= PRIME_2;
+		hash ^= hash >> 29;
+		hash *= PRIME_3;
+		return hash ^ (hash >> 32);
+	}
+
+} // namespace gg
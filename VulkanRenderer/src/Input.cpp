@@ -28,6 +28,8 @@ namespace gg
 			Keys[TurnCameraLeft] = isDown;
 		else if (key == SDLK_RIGHT)
 			Keys[TurnCameraRight] = isDown;
+		else if (key == SDLK_p)
+			Keys[ToggleDepthPrepass] = isDown;
 	}
 
 	void InputManager::SetKeyDown(InputAction a, bool value) 
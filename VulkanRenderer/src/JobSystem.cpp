@@ -0,0 +1,219 @@
+module;
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+module JobSystem;
+
+namespace
+{
+	using namespace gg;
+
+	/* Set on the workers, the other threads share the last queue */
+	thread_local JobSystem const* tlsJobSystem{ nullptr };
+	thread_local uint32_t tlsQueueIndex{ 0 };
+}
+
+namespace gg
+{
+	JobSystem::JobSystem(uint32_t threadCount)
+	{
+		if (0 == threadCount)
+			threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		mQueues = std::vector<Queue>(threadCount + 1);
+		mThreads.reserve(threadCount);
+		for (uint32_t i{ 0 }; i < threadCount; ++i)
+			mThreads.emplace_back([this, i] { RunWorker(i); });
+	}
+
+	JobSystem::~JobSystem()
+	{
+		/* A running job may still submit more, stop only once nothing is left to run */
+		while (mPendingCount.load() > 0)
+		{
+			if (!RunPendingJob())
+				std::this_thread::yield();
+		}
+		{
+			std::lock_guard lock{ mSleepMutex };
+			mStopping = true;
+		}
+		mJobAvailable.notify_all();
+		for (std::thread& thread : mThreads)
+			thread.join();
+	}
+
+	JobHandle JobSystem::Run(std::function<void()> function, std::span<JobHandle const> dependencies)
+	{
+		std::shared_ptr<Job> job{ std::make_shared<Job>() };
+		job->Function = std::move(function);
+		for (JobHandle const& dependency : dependencies)
+		{
+			if (!dependency.mJob)
+				continue;
+			/* The dependency cannot finish in between, it marks itself done under the same lock */
+			std::lock_guard lock{ dependency.mJob->DependentsMutex };
+			if (!dependency.mJob->IsDone.load(std::memory_order_relaxed))
+			{
+				job->DependencyCount.fetch_add(1, std::memory_order_relaxed);
+				dependency.mJob->Dependents.push_back(job);
+			}
+		}
+		JobHandle handle{ job };
+		if (1 == job->DependencyCount.fetch_sub(1, std::memory_order_acq_rel))
+			Push(std::move(job));
+		return handle;
+	}
+
+	void JobSystem::Wait(JobHandle const& handle)
+	{
+		while (!handle.IsDone())
+		{
+			if (!RunPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+	void JobSystem::ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t begin, uint32_t end)> const& function)
+	{
+		if (0 == count)
+			return;
+		batchSize = std::max(batchSize, 1u);
+
+		/* Everything below lives on this stack, the jobs are done with it once the count reaches 0 */
+		std::atomic<uint32_t> remainingCount{ count };
+		std::function<void(uint32_t, uint32_t)> split{};
+		split = [&](uint32_t begin, uint32_t end)
+		{
+			while (end - begin > batchSize)
+			{
+				uint32_t const middle{ begin + (end - begin) / 2 };
+				Run([&split, middle, end] { split(middle, end); });
+				end = middle;
+			}
+			function(begin, end);
+			remainingCount.fetch_sub(end - begin, std::memory_order_acq_rel);
+		};
+		split(0, count);
+
+		while (remainingCount.load(std::memory_order_acquire) > 0)
+		{
+			if (!RunPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+	bool JobSystem::RunPendingJob()
+	{
+		std::shared_ptr<Job> job{ Pop() };
+		if (!job)
+			return false;
+		Execute(std::move(job));
+		return true;
+	}
+
+	void JobSystem::Push(std::shared_ptr<Job> job)
+	{
+		mPendingCount.fetch_add(1);
+		Queue& queue{ mQueues[GetQueueIndex()] };
+		{
+			std::lock_guard lock{ queue.Mutex };
+			queue.Jobs.push_back(std::move(job));
+		}
+		/* Either the sleeping worker sees the count, or this sees the worker and wakes it */
+		mQueuedCount.fetch_add(1);
+		if (mSleepingCount.load() > 0)
+		{
+			{
+				std::lock_guard lock{ mSleepMutex };
+			}
+			mJobAvailable.notify_one();
+		}
+	}
+
+	std::shared_ptr<Job> JobSystem::Pop()
+	{
+		if (0 == mQueuedCount.load(std::memory_order_relaxed))
+			return nullptr;
+
+		std::shared_ptr<Job> job{};
+		uint32_t const queueIndex{ GetQueueIndex() };
+		{
+			/* Newest first from the own queue, its data is likely still in the cache */
+			Queue& queue{ mQueues[queueIndex] };
+			std::lock_guard lock{ queue.Mutex };
+			if (!queue.Jobs.empty())
+			{
+				job = std::move(queue.Jobs.back());
+				queue.Jobs.pop_back();
+			}
+		}
+		/* Oldest first from the others, with ParallelFor the largest ranges */
+		uint32_t const queueCount{ static_cast<uint32_t>(mQueues.size()) };
+		for (uint32_t i{ 1 }; !job && i < queueCount; ++i)
+		{
+			Queue& queue{ mQueues[(queueIndex + i) % queueCount] };
+			std::lock_guard lock{ queue.Mutex };
+			if (!queue.Jobs.empty())
+			{
+				job = std::move(queue.Jobs.front());
+				queue.Jobs.pop_front();
+			}
+		}
+		if (job)
+			mQueuedCount.fetch_sub(1);
+		return job;
+	}
+
+	void JobSystem::Execute(std::shared_ptr<Job> job)
+	{
+		job->Function();
+		/* Releases the captures now, the handles may keep the job for a long time */
+		job->Function = nullptr;
+
+		std::vector<std::shared_ptr<Job>> dependents{};
+		{
+			std::lock_guard lock{ job->DependentsMutex };
+			job->IsDone.store(true, std::memory_order_release);
+			dependents.swap(job->Dependents);
+		}
+		for (std::shared_ptr<Job>& dependent : dependents)
+		{
+			if (1 == dependent->DependencyCount.fetch_sub(1, std::memory_order_acq_rel))
+				Push(std::move(dependent));
+		}
+		mPendingCount.fetch_sub(1);
+	}
+
+	void JobSystem::RunWorker(uint32_t queueIndex)
+	{
+		tlsJobSystem = this;
+		tlsQueueIndex = queueIndex;
+		while (true)
+		{
+			if (RunPendingJob())
+				continue;
+
+			std::unique_lock lock{ mSleepMutex };
+			mSleepingCount.fetch_add(1);
+			mJobAvailable.wait(lock, [this] { return mQueuedCount.load() > 0 || mStopping; });
+			mSleepingCount.fetch_sub(1);
+			if (mStopping && 0 == mQueuedCount.load())
+				break;
+		}
+		tlsJobSystem = nullptr;
+	}
+
+	uint32_t JobSystem::GetQueueIndex() const
+	{
+		return this == tlsJobSystem ? tlsQueueIndex : static_cast<uint32_t>(mQueues.size()) - 1;
+	}
+
+} // namespace gg
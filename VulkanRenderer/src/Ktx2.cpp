@@ -0,0 +1,250 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+module Ktx2;
+
+import MipChain;
+import Model;
+import TextureCompression;
+
+namespace
+{
+	using namespace gg;
+
+	constexpr std::array<uint8_t, 12> KTX2_IDENTIFIER{ 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+	constexpr uint32_t MAX_TEXTURE_SIZE{ 16384 };
+
+	struct Ktx2Header
+	{
+		std::array<uint8_t, 12> Identifier{ KTX2_IDENTIFIER };
+		uint32_t VulkanFormat{ 0 };
+		uint32_t TypeSize{ 1 };
+		uint32_t PixelWidth{ 0 };
+		uint32_t PixelHeight{ 0 };
+		uint32_t PixelDepth{ 0 };
+		uint32_t LayerCount{ 0 };
+		uint32_t FaceCount{ 1 };
+		uint32_t LevelCount{ 0 };
+		uint32_t SupercompressionScheme{ 0 };
+		uint32_t DfdByteOffset{ 0 };
+		uint32_t DfdByteLength{ 0 };
+		uint32_t KvdByteOffset{ 0 };
+		uint32_t KvdByteLength{ 0 };
+		uint64_t SgdByteOffset{ 0 };
+		uint64_t SgdByteLength{ 0 };
+	};
+	static_assert(sizeof(Ktx2Header) == 80);
+
+	struct Ktx2Level
+	{
+		uint64_t ByteOffset{ 0 };
+		uint64_t ByteLength{ 0 };
+		uint64_t UncompressedByteLength{ 0 };
+	};
+
+	/* Data format descriptor values of the Khronos Data Format specification */
+	constexpr uint8_t DF_MODEL_RGBSDA{ 1 };
+	constexpr uint8_t DF_MODEL_BC1A{ 128 };
+	constexpr uint8_t DF_MODEL_BC3{ 130 };
+	constexpr uint8_t DF_MODEL_BC5{ 132 };
+	constexpr uint8_t DF_MODEL_BC7{ 134 };
+	constexpr uint8_t DF_PRIMARIES_BT709{ 1 };
+	constexpr uint8_t DF_TRANSFER_LINEAR{ 1 };
+	constexpr uint8_t DF_TRANSFER_SRGB{ 2 };
+	constexpr uint8_t DF_CHANNEL_ALPHA{ 15 };
+	constexpr uint8_t DF_SAMPLE_LINEAR{ 0x10 };
+
+	struct DfdSample
+	{
+		uint16_t BitOffset{ 0 };
+		uint8_t BitLength{ 0 };
+		uint8_t Channel{ 0 };
+		uint32_t Upper{ 0 };
+	};
+
+	/* BC1 with alpha reads as BC1, the renderer ignores the base color alpha */
+	bool fromVulkanFormat(uint32_t vulkanFormat, TextureFormat& outFormat)
+	{
+		switch (vulkanFormat)
+		{
+		case VK_FORMAT_R8G8B8A8_SRGB: outFormat = TextureFormat::Rgba8Srgb; return true;
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: outFormat = TextureFormat::Bc1Unorm; return true;
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: outFormat = TextureFormat::Bc1Srgb; return true;
+		case VK_FORMAT_BC3_UNORM_BLOCK: outFormat = TextureFormat::Bc3Unorm; return true;
+		case VK_FORMAT_BC3_SRGB_BLOCK: outFormat = TextureFormat::Bc3Srgb; return true;
+		case VK_FORMAT_BC5_UNORM_BLOCK: outFormat = TextureFormat::Bc5Unorm; return true;
+		case VK_FORMAT_BC7_UNORM_BLOCK: outFormat = TextureFormat::Bc7Unorm; return true;
+		case VK_FORMAT_BC7_SRGB_BLOCK: outFormat = TextureFormat::Bc7Srgb; return true;
+		default: return false;
+		}
+	}
+
+	bool isSrgb(TextureFormat format)
+	{
+		return TextureFormat::Rgba8Srgb == format || TextureFormat::Bc1Srgb == format || TextureFormat::Bc3Srgb == format || TextureFormat::Bc7Srgb == format;
+	}
+
+	/* The basic descriptor block, readers that only look at vkFormat ignore it but it is mandatory */
+	std::vector<uint32_t> buildDataFormatDescriptor(TextureFormat format)
+	{
+		uint8_t model{ DF_MODEL_RGBSDA };
+		std::vector<DfdSample> samples{};
+		switch (format)
+		{
+		case TextureFormat::Rgba8Srgb:
+			samples = { { 0, 8, 0, 255 }, { 8, 8, 1, 255 }, { 16, 8, 2, 255 }, { 24, 8, DF_CHANNEL_ALPHA, 255 } };
+			break;
+		case TextureFormat::Bc1Unorm:
+		case TextureFormat::Bc1Srgb:
+			model = DF_MODEL_BC1A;
+			samples = { { 0, 64, 0, UINT32_MAX } };
+			break;
+		case TextureFormat::Bc3Unorm:
+		case TextureFormat::Bc3Srgb:
+			model = DF_MODEL_BC3;
+			samples = { { 0, 64, DF_CHANNEL_ALPHA, UINT32_MAX }, { 64, 64, 0, UINT32_MAX } };
+			break;
+		case TextureFormat::Bc5Unorm:
+			model = DF_MODEL_BC5;
+			samples = { { 0, 64, 0, UINT32_MAX }, { 64, 64, 1, UINT32_MAX } };
+			break;
+		case TextureFormat::Bc7Unorm:
+		case TextureFormat::Bc7Srgb:
+			model = DF_MODEL_BC7;
+			samples = { { 0, 128, 0, UINT32_MAX } };
+			break;
+		}
+
+		bool const srgb{ isSrgb(format) };
+		uint32_t const blockDimension{ IsBlockCompressed(format) ? 3u | 3u << 8 : 0u };
+		uint32_t const bytesPerBlock{ static_cast<uint32_t>(GetTextureLevelSize(format, 1, 1)) };
+		uint32_t const blockSize{ 24 + 16 * static_cast<uint32_t>(samples.size()) };
+		std::vector<uint32_t> words{ 4 + blockSize, 0, 2u | blockSize << 16
+			, uint32_t{ model } | uint32_t{ DF_PRIMARIES_BT709 } << 8 | uint32_t{ srgb ? DF_TRANSFER_SRGB : DF_TRANSFER_LINEAR } << 16
+			, blockDimension, bytesPerBlock, 0 };
+		for (DfdSample const& sample : samples)
+		{
+			/* Alpha is never sRGB encoded */
+			uint8_t const channelType{ static_cast<uint8_t>(sample.Channel | (srgb && DF_CHANNEL_ALPHA == sample.Channel ? DF_SAMPLE_LINEAR : 0)) };
+			words.insert(words.end(), { uint32_t{ sample.BitOffset } | uint32_t{ sample.BitLength - 1u } << 16 | uint32_t{ channelType } << 24, 0, 0, sample.Upper });
+		}
+		return words;
+	}
+
+	size_t alignUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+}
+
+namespace gg
+{
+	VkFormat GetVulkanFormat(TextureFormat format)
+	{
+		switch (format)
+		{
+		case TextureFormat::Bc1Unorm: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case TextureFormat::Bc1Srgb: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		case TextureFormat::Bc3Unorm: return VK_FORMAT_BC3_UNORM_BLOCK;
+		case TextureFormat::Bc3Srgb: return VK_FORMAT_BC3_SRGB_BLOCK;
+		case TextureFormat::Bc5Unorm: return VK_FORMAT_BC5_UNORM_BLOCK;
+		case TextureFormat::Bc7Unorm: return VK_FORMAT_BC7_UNORM_BLOCK;
+		case TextureFormat::Bc7Srgb: return VK_FORMAT_BC7_SRGB_BLOCK;
+		default: return VK_FORMAT_R8G8B8A8_SRGB;
+		}
+	}
+
+	bool IsKtx2(std::span<std::byte const> data)
+	{
+		return data.size() >= KTX2_IDENTIFIER.size() && 0 == memcmp(data.data(), KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size());
+	}
+
+	bool ReadKtx2(std::span<std::byte const> data, Texture& outTexture)
+	{
+		Ktx2Header header{};
+		if (!IsKtx2(data) || data.size() < sizeof(header))
+			return false;
+		memcpy(&header, data.data(), sizeof(header));
+
+		Texture texture{};
+		/* 2D, not an array or a cube map */
+		if (!fromVulkanFormat(header.VulkanFormat, texture.Format)
+			|| 0 != header.SupercompressionScheme
+			|| 0 == header.PixelWidth || header.PixelWidth > MAX_TEXTURE_SIZE
+			|| 0 == header.PixelHeight || header.PixelHeight > MAX_TEXTURE_SIZE
+			|| 0 != header.PixelDepth
+			|| header.LayerCount > 1
+			|| 1 != header.FaceCount)
+			return false;
+		texture.Width = header.PixelWidth;
+		texture.Height = header.PixelHeight;
+
+		/* 0 asks the reader to generate the mips, which only the uncompressed format can do */
+		uint32_t const levelCount{ std::max(header.LevelCount, 1u) };
+		if (levelCount > GetMipLevelCount(texture.Width, texture.Height) || data.size() < sizeof(header) + levelCount * sizeof(Ktx2Level))
+			return false;
+
+		std::vector<Ktx2Level> levels(levelCount);
+		memcpy(levels.data(), data.data() + sizeof(header), levelCount * sizeof(Ktx2Level));
+		size_t sizeBytes{ 0 };
+		for (uint32_t l{ 0 }; l < levelCount; ++l)
+		{
+			MipLevel const level{ sizeBytes, std::max(texture.Width >> l, 1u), std::max(texture.Height >> l, 1u) };
+			size_t const levelSize{ GetTextureLevelSize(texture.Format, level.Width, level.Height) };
+			if (levels[l].ByteLength != levelSize || levels[l].ByteOffset > data.size() || levelSize > data.size() - levels[l].ByteOffset)
+				return false;
+			texture.Levels.push_back(level);
+			sizeBytes += levelSize;
+		}
+
+		/* Level 0 first, unlike the file which stores the smallest level first */
+		texture.Pixels.resize(sizeBytes);
+		for (uint32_t l{ 0 }; l < levelCount; ++l)
+			memcpy(texture.Pixels.data() + texture.Levels[l].Offset, data.data() + levels[l].ByteOffset, levels[l].ByteLength);
+		if (!IsBlockCompressed(texture.Format) && 1 == levelCount)
+			texture.Levels.clear();
+
+		outTexture = std::move(texture);
+		return true;
+	}
+
+	std::vector<std::byte> WriteKtx2(Texture const& texture)
+	{
+		std::vector<MipLevel> const levels{ texture.Levels.empty() ? std::vector<MipLevel>{ { 0, texture.Width, texture.Height } } : texture.Levels };
+		std::vector<uint32_t> const dfd{ buildDataFormatDescriptor(texture.Format) };
+
+		Ktx2Header header{};
+		header.VulkanFormat = GetVulkanFormat(texture.Format);
+		header.PixelWidth = texture.Width;
+		header.PixelHeight = texture.Height;
+		header.LevelCount = static_cast<uint32_t>(levels.size());
+		header.DfdByteOffset = static_cast<uint32_t>(sizeof(header) + levels.size() * sizeof(Ktx2Level));
+		header.DfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+		/* Smallest level first, each aligned to its texel block */
+		size_t const alignment{ std::max<size_t>(GetTextureLevelSize(texture.Format, 1, 1), 4) };
+		std::vector<Ktx2Level> levelIndex(levels.size());
+		size_t offset{ header.DfdByteOffset + header.DfdByteLength };
+		for (size_t l{ levels.size() }; l-- > 0;)
+		{
+			offset = alignUp(offset, alignment);
+			size_t const levelSize{ GetTextureLevelSize(texture.Format, levels[l].Width, levels[l].Height) };
+			levelIndex[l] = { offset, levelSize, levelSize };
+			offset += levelSize;
+		}
+
+		std::vector<std::byte> data(offset);
+		memcpy(data.data(), &header, sizeof(header));
+		memcpy(data.data() + sizeof(header), levelIndex.data(), levelIndex.size() * sizeof(Ktx2Level));
+		memcpy(data.data() + header.DfdByteOffset, dfd.data(), header.DfdByteLength);
+		for (size_t l{ 0 }; l < levels.size(); ++l)
+			memcpy(data.data() + levelIndex[l].ByteOffset, texture.Pixels.data() + levels[l].Offset, levelIndex[l].ByteLength);
+		return data;
+	}
+
+} // namespace gg
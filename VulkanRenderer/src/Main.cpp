@@ -5,11 +5,28 @@
 #include <chrono>
 #include <thread>
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
 
 import Application;
+import AssetPack;
+import Bvh;
+import Culling;
 import ErrorHandling;
+import JobSystem;
 import Logging;
 import ModelLoader;
+import OcclusionCulling;
+import Scene;
+import Vertex;
 
 using namespace gg;
 
@@ -63,6 +80,10 @@ void MainLoop(std::shared_ptr<Application> app)
                         app->OnKeyPressed(key, event.type == SDL_KEYDOWN);
                     break;
                 }
+                case SDL_MOUSEBUTTONDOWN:
+                    if (event.button.button == SDL_BUTTON_LEFT)
+                        app->OnMouseButtonPressed(event.button.x, event.button.y);
+                    break;
                 default:
                     // Do nothing.
                     break;
@@ -75,8 +96,241 @@ void MainLoop(std::shared_ptr<Application> app)
     }
 }
 
-int main()
+/* --build-pack <file> <directory>...: pack every file under the directories, their paths relative to the pack */
+int BuildAssetPack(int argc, char* argv[])
+{
+    std::filesystem::path const packPath{ std::filesystem::absolute(argv[2]) };
+    std::vector<std::string> filePaths{};
+    for (int i{ 3 }; i < argc; ++i)
+    {
+        for (auto const& entry : std::filesystem::recursive_directory_iterator(std::filesystem::absolute(argv[i])))
+            if (entry.is_regular_file() && entry.path() != packPath)
+                filePaths.push_back(entry.path().generic_string());
+    }
+    if (!WriteAssetPack(packPath.generic_string(), filePaths))
+    {
+        DebugLog(DebugLevel::Error, std::format("Failed to write the asset pack {}", packPath.generic_string()));
+        return EXIT_FAILURE;
+    }
+    DebugLog(DebugLevel::Info, std::format("Packed {} files into {}", filePaths.size(), packPath.generic_string()));
+    return EXIT_SUCCESS;
+}
+
+/* Best of repeatCount runs of the function, in milliseconds */
+template <typename Function>
+double MeasureBestMs(Function const& function, uint32_t repeatCount)
+{
+    double bestMs{ std::numeric_limits<double>::max() };
+    for (uint32_t r{ 0 }; r < repeatCount; ++r)
+    {
+        auto const start{ std::chrono::steady_clock::now() };
+        function();
+        bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return bestMs;
+}
+
+/* --benchmark-jobs: time a ParallelFor and a graph of small jobs on 1 thread, then with every worker count up to the core count */
+int BenchmarkJobSystem()
+{
+    constexpr uint32_t ITEM_COUNT{ 1u << 24 };
+    constexpr uint32_t BATCH_SIZE{ 1u << 12 };
+    constexpr uint32_t GROUP_COUNT{ 2000 };
+    constexpr uint32_t GROUP_SIZE{ 64 };
+    constexpr uint32_t REPEAT_COUNT{ 5 };
+
+    std::vector<float> values(ITEM_COUNT);
+    auto const transform{ [&values](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i{ begin }; i < end; ++i)
+            values[i] = std::sqrt(static_cast<float>(i)) * std::sin(static_cast<float>(i));
+    } };
+
+    /* The baseline runs the plain loop, without the job overhead */
+    double const serialMs{ MeasureBestMs([&] { transform(0, ITEM_COUNT); }, REPEAT_COUNT) };
+    DebugLog(DebugLevel::Info, std::format("1 thread: ParallelFor {:.2f} ms", serialMs));
+
+    /* The calling thread takes part, so N threads are N - 1 workers */
+    uint32_t const maxThreadCount{ std::max(std::thread::hardware_concurrency(), 2u) };
+    for (uint32_t threadCount{ 2 }; threadCount <= maxThreadCount; ++threadCount)
+    {
+        JobSystem jobs{ threadCount - 1 };
+        double const parallelForMs{ MeasureBestMs([&] { jobs.ParallelFor(ITEM_COUNT, BATCH_SIZE, transform); }, REPEAT_COUNT) };
+        /* Fan out and in: every group joins on a job that depends on all of its jobs */
+        double const graphMs{ MeasureBestMs([&]
+        {
+            std::vector<JobHandle> joins(GROUP_COUNT);
+            std::vector<JobHandle> group(GROUP_SIZE);
+            for (uint32_t g{ 0 }; g < GROUP_COUNT; ++g)
+            {
+                for (uint32_t j{ 0 }; j < GROUP_SIZE; ++j)
+                {
+                    uint32_t const begin{ (g * GROUP_SIZE + j) * 64 };
+                    group[j] = jobs.Run([&transform, begin] { transform(begin, begin + 64); });
+                }
+                joins[g] = jobs.Run([] {}, group);
+            }
+            for (JobHandle const& join : joins)
+                jobs.Wait(join);
+        }, REPEAT_COUNT) };
+        DebugLog(DebugLevel::Info, std::format("{} threads: ParallelFor {:.2f} ms ({:.2f}x), {} small jobs {:.2f} ms",
+            threadCount, parallelForMs, serialMs / parallelForMs, GROUP_COUNT * (GROUP_SIZE + 1), graphMs));
+    }
+    return EXIT_SUCCESS;
+}
+
+/* --benchmark-culling: frustum cull 1M random boxes, against the per-sphere test the renderer used before.
+ * Then growing scenes at the same density under the same frustum, flat against through a BVH. */
+int BenchmarkCulling()
 {
+    using namespace DirectX;
+    constexpr uint32_t BOX_COUNT{ 1u << 20 };
+    constexpr uint32_t REPEAT_COUNT{ 20 };
+
+    std::mt19937 random{ 42 };
+    std::uniform_real_distribution<float> position{ -500.f, 500.f };
+    std::uniform_real_distribution<float> size{ 0.5f, 5.f };
+    BoundingBoxes boxes{};
+    boxes.Resize(BOX_COUNT);
+    std::vector<XMFLOAT4> spheres(BOX_COUNT);
+    for (uint32_t i{ 0 }; i < BOX_COUNT; ++i)
+    {
+        XMFLOAT3 const center{ position(random), position(random), position(random) };
+        XMFLOAT3 const extent{ size(random), size(random), size(random) };
+        boxes.Set(i, center, extent);
+        spheres[i] = { center.x, center.y, center.z, std::sqrt(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z) };
+    }
+    XMMATRIX const view{ XMMatrixLookAtLH(XMVectorSet(0.f, 0.f, -600.f, 1.f), XMVectorZero(), XMVectorSet(0.f, 1.f, 0.f, 0.f)) };
+    XMMATRIX const projection{ XMMatrixPerspectiveFovLH(XMConvertToRadians(60.f), 16.f / 9.f, 0.1f, 1000.f) };
+    Frustum const frustum{ Frustum::FromMatrix(XMMatrixMultiply(view, projection)) };
+
+    std::vector<uint32_t> visible{};
+    double const sphereMs{ MeasureBestMs([&]
+    {
+        visible.clear();
+        for (uint32_t i{ 0 }; i < BOX_COUNT; ++i)
+            if (frustum.IntersectsSphere(spheres[i]))
+                visible.push_back(i);
+    }, REPEAT_COUNT) };
+    size_t const sphereVisibleCount{ visible.size() };
+    double const boxMs{ MeasureBestMs([&] { CullBoxes(frustum, boxes, visible); }, REPEAT_COUNT) };
+    DebugLog(DebugLevel::Info, std::format("{} boxes: spheres {:.2f} ms ({} visible), SoA boxes {:.2f} ms ({} visible), {:.2f}x",
+        BOX_COUNT, sphereMs, sphereVisibleCount, boxMs, visible.size(), sphereMs / boxMs));
+
+    /* The visible count stays about the same, only the part of the scene outside the frustum grows */
+    Frustum const nearFrustum{ Frustum::FromMatrix(XMMatrixMultiply(view, XMMatrixPerspectiveFovLH(XMConvertToRadians(60.f), 16.f / 9.f, 0.1f, 200.f))) };
+    for (uint32_t count{ 1u << 10 }; count <= BOX_COUNT; count <<= 2)
+    {
+        float const halfSize{ 50.f * std::cbrt(static_cast<float>(count) / 1024.f) };
+        std::uniform_real_distribution<float> scenePosition{ -halfSize, halfSize };
+        BoundingBoxes sceneBoxes{};
+        sceneBoxes.Resize(count);
+        std::vector<Aabb> aabbs(count);
+        std::vector<uint32_t> primitives(count);
+        for (uint32_t i{ 0 }; i < count; ++i)
+        {
+            /* In front of the camera, which looks along +z from z = -600 */
+            XMFLOAT3 const center{ scenePosition(random), scenePosition(random), scenePosition(random) + halfSize - 600.f };
+            XMFLOAT3 const extent{ size(random), size(random), size(random) };
+            sceneBoxes.Set(i, center, extent);
+            aabbs[i] = { { center.x - extent.x, center.y - extent.y, center.z - extent.z }, { center.x + extent.x, center.y + extent.y, center.z + extent.z } };
+            primitives[i] = i;
+        }
+        Bvh bvh{};
+        auto const buildStart{ std::chrono::steady_clock::now() };
+        bvh.Build(aabbs, primitives);
+        double const buildMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count() };
+
+        double const flatMs{ MeasureBestMs([&] { CullBoxes(nearFrustum, sceneBoxes, visible); }, REPEAT_COUNT) };
+        size_t const flatVisibleCount{ visible.size() };
+        double const bvhMs{ MeasureBestMs([&] { visible.clear(); bvh.CullFrustum(nearFrustum, aabbs, visible); }, REPEAT_COUNT) };
+        DebugLog(DebugLevel::Info, std::format("{} boxes, {} visible: flat {:.3f} ms, BVH {:.3f} ms ({} visible), built in {:.1f} ms",
+            count, flatVisibleCount, flatMs, bvhMs, visible.size(), buildMs));
+    }
+    return EXIT_SUCCESS;
+}
+
+/* --benchmark-occlusion: rasterize a street of buildings into the CPU occlusion buffer, then test small boxes scattered around
+ * them, once they pass the frustum culling. The rasterization on 1 thread, then on the job system. */
+int BenchmarkOcclusion()
+{
+    using namespace DirectX;
+    constexpr uint32_t BOX_COUNT{ 100000 };
+    constexpr uint32_t REPEAT_COUNT{ 20 };
+
+    std::vector<XMFLOAT3> const cube{
+        { -1.f, -1.f, -1.f }, { 1.f, -1.f, -1.f }, { 1.f, 1.f, -1.f }, { -1.f, 1.f, -1.f },
+        { -1.f, -1.f, 1.f }, { 1.f, -1.f, 1.f }, { 1.f, 1.f, 1.f }, { -1.f, 1.f, 1.f } };
+    std::vector<uint32_t> const cubeIndices{
+        0, 1, 2, 0, 2, 3, 5, 4, 7, 5, 7, 6, 4, 0, 3, 4, 3, 7,
+        1, 5, 6, 1, 6, 2, 3, 2, 6, 3, 6, 7, 4, 5, 1, 4, 1, 0 };
+    /* Two rows of buildings along the street that the camera looks down, and one across its end */
+    std::vector<XMMATRIX> buildings{};
+    for (uint32_t i{ 0 }; i < 8; ++i)
+    {
+        float const height{ 10.f + 4.f * static_cast<float>(i % 3) };
+        for (float const side : { -1.f, 1.f })
+            buildings.push_back(XMMatrixMultiply(XMMatrixScaling(4.f, height, 5.f), XMMatrixTranslation(side * 9.f, height, 10.f + 12.f * static_cast<float>(i))));
+    }
+    buildings.push_back(XMMatrixMultiply(XMMatrixScaling(20.f, 15.f, 2.f), XMMatrixTranslation(0.f, 15.f, 110.f)));
+
+    std::mt19937 random{ 42 };
+    std::uniform_real_distribution<float> x{ -80.f, 80.f };
+    std::uniform_real_distribution<float> y{ 0.5f, 3.f };
+    std::uniform_real_distribution<float> z{ 5.f, 300.f };
+    std::uniform_real_distribution<float> size{ 0.5f, 1.5f };
+    BoundingBoxes boxes{};
+    boxes.Resize(BOX_COUNT);
+    for (uint32_t i{ 0 }; i < BOX_COUNT; ++i)
+        boxes.Set(i, { x(random), y(random), z(random) }, { size(random), size(random), size(random) });
+
+    XMMATRIX const view{ XMMatrixLookAtLH(XMVectorSet(0.f, 2.f, 0.f, 1.f), XMVectorSet(0.f, 2.f, 1.f, 1.f), XMVectorSet(0.f, 1.f, 0.f, 0.f)) };
+    XMMATRIX const viewProjection{ XMMatrixMultiply(view, XMMatrixPerspectiveFovLH(XMConvertToRadians(60.f), 16.f / 9.f, 0.1f, 1000.f)) };
+    std::vector<uint32_t> frustumVisible{};
+    CullBoxes(Frustum::FromMatrix(viewProjection), boxes, frustumVisible);
+
+    OcclusionBuffer buffer{};
+    buffer.Resize(320, 180);
+    auto const rasterize{ [&]
+    {
+        buffer.Clear();
+        for (XMMATRIX const& building : buildings)
+            buffer.AddOccluder(cube, cubeIndices, XMMatrixMultiply(building, viewProjection));
+        buffer.Rasterize();
+    } };
+
+    double const serialMs{ MeasureBestMs(rasterize, REPEAT_COUNT) };
+    buffer.SetJobSystem(std::make_shared<JobSystem>(std::max(std::thread::hardware_concurrency(), 2u) - 1));
+    double const parallelMs{ MeasureBestMs(rasterize, REPEAT_COUNT) };
+    std::vector<uint32_t> visible{};
+    double const testMs{ MeasureBestMs([&] { visible = frustumVisible; buffer.CullBoxes(boxes, viewProjection, visible); }, REPEAT_COUNT) };
+
+    size_t const occludedCount{ frustumVisible.size() - visible.size() };
+    DebugLog(DebugLevel::Info, std::format("{}x{} occlusion buffer, {} occluder triangles: rasterized in {:.3f} ms on 1 thread, {:.3f} ms on the job system",
+        buffer.GetWidth(), buffer.GetHeight(), buffer.GetTriangleCount(), serialMs, parallelMs));
+    DebugLog(DebugLevel::Info, std::format("{} boxes, {} in the frustum: {} occluded ({:.1f}%), tested in {:.3f} ms",
+        BOX_COUNT, frustumVisible.size(), occludedCount, 100.0 * static_cast<double>(occludedCount) / std::max<double>(static_cast<double>(frustumVisible.size()), 1.0), testMs));
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2 && std::string_view{ argv[1] } == "--build-pack")
+        return BuildAssetPack(argc, argv);
+    if (argc > 1 && std::string_view{ argv[1] } == "--benchmark-jobs")
+        return BenchmarkJobSystem();
+    if (argc > 1 && std::string_view{ argv[1] } == "--benchmark-culling")
+        return BenchmarkCulling();
+    if (argc > 1 && std::string_view{ argv[1] } == "--benchmark-occlusion")
+        return BenchmarkOcclusion();
+
+    /* --pack <file>: read the assets from a pack built with --build-pack, the renderer loads its shaders on creation */
+    for (int i{ 1 }; i + 1 < argc; ++i)
+    {
+        if (std::string_view{ argv[i] } == "--pack" && !MountAssetPack(std::filesystem::absolute(argv[i + 1]).generic_string()))
+            DebugLog(DebugLevel::Error, std::format("Failed to open the asset pack {}, reading the files from disk", argv[i + 1]));
+    }
+
     if(SDL_Init(SDL_INIT_VIDEO) != 0) 
     {
         DebugLog(DebugLevel::Error, "Could not initialize SDL");
@@ -97,9 +351,65 @@ int main()
     try
     {
         auto app = Application::Init(width, height, window);
+        /* --gpu-driven: cull and draw all objects from the GPU
+           --cpu-occlusion: hide the instances behind the largest visible ones, rasterized on the CPU
+           --depth-prepass: draw the depth first, P toggles it
+           --instances <count>: draw copies of each model on a grid
+           --lights <count>: scatter point lights of random colors over the grids
+           --models <directory>: load every .glb in the directory instead of the textured cube */
+        uint32_t instanceCount{ 1 };
+        uint32_t lightCount{ 0 };
+        std::vector<std::string> modelPaths{};
+        for (int i{ 1 }; i < argc; ++i)
+        {
+            std::string_view const argument{ argv[i] };
+            if (argument == "--gpu-driven")
+                app->GetRenderer()->EnableGpuDrivenRendering();
+            else if (argument == "--cpu-occlusion")
+                app->GetRenderer()->EnableOcclusionCulling(app->GetJobSystem());
+            else if (argument == "--depth-prepass")
+                app->GetRenderer()->SetDepthPrepass(true);
+            else if (argument == "--instances" && i + 1 < argc)
+                instanceCount = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+            else if (argument == "--lights" && i + 1 < argc)
+                lightCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+            else if (argument == "--pack" && i + 1 < argc)
+                ++i;
+            else if (argument == "--models" && i + 1 < argc)
+            {
+                for (auto const& entry : std::filesystem::directory_iterator(argv[++i]))
+                    if (".glb" == entry.path().extension())
+                        modelPaths.push_back(entry.path().generic_string());
+            }
+        }
+        if (modelPaths.empty())
+            modelPaths.push_back("../../models/textured_cube.glb");
+
         auto modelLoader = app->GetModelLoader();
-        std::unique_ptr<Model> model{ modelLoader->LoadModel("../../models/textured_cube.glb", "shaders/textured_surface_VS.spv", "shaders/textured_surface_PS.spv") };
-        app->GetRenderer()->UploadGeometry(std::move(model));
+        Scene& scene{ app->GetRenderer()->GetScene() };
+        uint32_t const gridSize{ static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount)))) };
+        for (size_t m{ 0 }; m < modelPaths.size(); ++m)
+        {
+            /* Loaded on the worker threads, the instances show up as their model finishes */
+            ModelId const model{ scene.AddModel(modelLoader->LoadModelAsync(modelPaths[m], "shaders/textured_surface_VS.spv", "shaders/textured_surface_PS.spv", VertexFormat::Quantized16)) };
+            /* The grids of the models are side by side along z */
+            float const z{ -3.f * static_cast<float>(gridSize * m) };
+            for (uint32_t i{ 0 }; i < instanceCount; ++i)
+            {
+                float const x{ 3.f * (static_cast<float>(i % gridSize) - 0.5f * static_cast<float>(gridSize - 1)) };
+                float const y{ 3.f * (static_cast<float>(i / gridSize) - 0.5f * static_cast<float>(gridSize - 1)) };
+                scene.AddInstance(model, DirectX::XMMatrixTranslation(x, y, z));
+            }
+        }
+        /* Over the grids and between them */
+        std::mt19937 random{ 42 };
+        float const halfGridSize{ 1.5f * static_cast<float>(gridSize) };
+        std::uniform_real_distribution<float> xy{ -halfGridSize, halfGridSize };
+        std::uniform_real_distribution<float> z{ -3.f * static_cast<float>(gridSize * modelPaths.size()), 0.f };
+        std::uniform_real_distribution<float> radius{ 2.f, 6.f };
+        std::uniform_real_distribution<float> channel{ 0.2f, 1.f };
+        for (uint32_t i{ 0 }; i < lightCount; ++i)
+            scene.AddPointLight({ { xy(random), xy(random), z(random) }, radius(random), { channel(random), channel(random), channel(random) }, 4.f });
         DebugLog(DebugLevel::Info, "Successfully initialized the Vulkan application");
     }
     catch (std::exception const& e)
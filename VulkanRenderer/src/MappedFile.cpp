@@ -0,0 +1,89 @@
+module;
+#include <cstddef>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+module MappedFile;
+
+namespace gg
+{
+	MappedFile::MappedFile(std::string const& absolutePath)
+	{
+#ifdef _WIN32
+		HANDLE const file{ CreateFileA(absolutePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+		if (INVALID_HANDLE_VALUE == file)
+			return;
+		LARGE_INTEGER size{};
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			/* The view keeps the mapping and the file open, both handles can be closed right away */
+			HANDLE const mapping{ CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) };
+			if (mapping)
+			{
+				mData = static_cast<std::byte const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				mSize = mData ? static_cast<size_t>(size.QuadPart) : 0;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int const file{ open(absolutePath.c_str(), O_RDONLY) };
+		if (file < 0)
+			return;
+		struct stat status{};
+		if (0 == fstat(file, &status) && status.st_size > 0)
+		{
+			void* const data{ mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0) };
+			if (MAP_FAILED != data)
+			{
+				mData = static_cast<std::byte const*>(data);
+				mSize = static_cast<size_t>(status.st_size);
+			}
+		}
+		close(file);
+#endif
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: mData{ std::exchange(other.mData, nullptr) }
+		, mSize{ std::exchange(other.mSize, 0) }
+	{
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			mData = std::exchange(other.mData, nullptr);
+			mSize = std::exchange(other.mSize, 0);
+		}
+		return *this;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	void MappedFile::Close()
+	{
+		if (!mData)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(mData);
+#else
+		munmap(const_cast<std::byte*>(mData), mSize);
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+
+} // namespace gg
@@ -0,0 +1,331 @@
+module;
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <process.h>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+module MeshCache;
+
+import Ktx2;
+import MappedFile;
+import Meshlet;
+import Model;
+import Vertex;
+
+using DirectX::XMFLOAT3;
+
+namespace
+{
+	using namespace gg;
+
+	constexpr uint32_t MESH_CACHE_MAGIC{ 0x434D4747 }; /* "GGMC" */
+	/* Bump on any change of the layout below or of the import post-processing (LODs, meshlets, quantization) */
+	constexpr uint32_t MESH_CACHE_VERSION{ 5 };
+	/* Every block starts aligned, so the mapped data could also be read in place */
+	constexpr size_t BLOCK_ALIGNMENT{ 16 };
+	constexpr uint32_t NO_TEXTURE{ std::numeric_limits<uint32_t>::max() };
+
+	struct CacheHeader
+	{
+		uint32_t Magic{ MESH_CACHE_MAGIC };
+		uint32_t Version{ MESH_CACHE_VERSION };
+		uint64_t SourceHash{ 0 };
+		/* Checked with the hash, a collision would also need the same size */
+		uint64_t SourceSize{ 0 };
+		uint32_t Format{ 0 };
+		uint32_t MeshCount{ 0 };
+		uint32_t TextureCount{ 0 };
+		uint32_t Padding{ 0 };
+	};
+
+	/* A KTX2 container of the texture with its mips follows, the meshes refer to the textures by their index */
+	struct CachedTexture
+	{
+		uint64_t ContentHash{ 0 };
+		uint64_t SizeBytes{ 0 };
+	};
+
+	struct CachedMesh
+	{
+		uint32_t StreamSizes[VERTEX_STREAM_COUNT]{};
+		uint32_t IndexCount{ 0 };
+		uint32_t LodCount{ 0 };
+		uint32_t MeshletCount{ 0 };
+		uint32_t MeshletVertexCount{ 0 };
+		uint32_t MeshletTriangleCount{ 0 };
+		uint32_t TextureIndex{ NO_TEXTURE };
+		XMFLOAT3 BoundsMin{};
+		XMFLOAT3 BoundsMax{};
+		VertexQuantization Quantization{};
+		float UvDensity{ 0.f };
+	};
+	static_assert(std::is_trivially_copyable_v<CachedMesh> && std::is_trivially_copyable_v<CachedTexture> && std::is_trivially_copyable_v<Meshlet> && std::is_trivially_copyable_v<MeshLod>);
+
+	size_t alignBlock(size_t offset) { return (offset + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1); }
+
+	class BlockWriter
+	{
+	public:
+		template<typename T>
+		void Write(std::span<T const> values)
+		{
+			mData.resize(alignBlock(mData.size()));
+			size_t const offset{ mData.size() };
+			mData.resize(offset + values.size_bytes());
+			if (!values.empty())
+				memcpy(mData.data() + offset, values.data(), values.size_bytes());
+		}
+
+		template<typename T>
+		void Write(T const& value) { Write(std::span<T const>{ &value, 1 }); }
+
+		std::vector<std::byte> Take() { return std::move(mData); }
+
+	private:
+		std::vector<std::byte> mData{};
+	};
+
+	/* Bounds-checked reads, a truncated or corrupted file only fails the load */
+	class BlockReader
+	{
+	public:
+		explicit BlockReader(std::span<std::byte const> data) : mData{ data } {}
+
+		template<typename T>
+		bool Read(std::vector<T>& outValues, size_t count)
+		{
+			size_t const offset{ alignBlock(mOffset) };
+			if (offset > mData.size() || count > (mData.size() - offset) / sizeof(T))
+				return false;
+			outValues.resize(count);
+			if (count > 0)
+				memcpy(outValues.data(), mData.data() + offset, count * sizeof(T));
+			mOffset = offset + count * sizeof(T);
+			return true;
+		}
+
+		template<typename T>
+		bool Read(T& outValue)
+		{
+			size_t const offset{ alignBlock(mOffset) };
+			if (offset > mData.size() || sizeof(T) > mData.size() - offset)
+				return false;
+			memcpy(&outValue, mData.data() + offset, sizeof(T));
+			mOffset = offset + sizeof(T);
+			return true;
+		}
+
+	private:
+		std::span<std::byte const> mData;
+		size_t mOffset{ 0 };
+	};
+
+	std::shared_ptr<Texture const> readTexture(BlockReader& reader)
+	{
+		CachedTexture cached{};
+		std::vector<std::byte> container{};
+		std::shared_ptr<Texture> texture{ std::make_shared<Texture>() };
+		if (!reader.Read(cached) || !reader.Read(container, cached.SizeBytes) || !ReadKtx2(container, *texture))
+			return nullptr;
+		texture->ContentHash = cached.ContentHash;
+		return texture;
+	}
+
+	/* The ranges that the renderer and the shaders index without checks, a damaged block must not reach them */
+	bool isMeshValid(Mesh const& mesh)
+	{
+		uint32_t const vertexCount{ mesh.GetVertexCount() };
+		for (uint32_t s{ 0 }; s < VERTEX_STREAM_COUNT; ++s)
+		{
+			VertexStream const stream{ static_cast<VertexStream>(s) };
+			if (mesh.StreamSizeBytes(stream) / GetStreamStride(mesh.Format, stream) != vertexCount)
+				return false;
+		}
+		if (std::ranges::any_of(mesh.Indices, [vertexCount](uint32_t index) { return index >= vertexCount; }))
+			return false;
+
+		if (mesh.Lods.empty() || mesh.Lods.size() > MAX_LOD_COUNT)
+			return false;
+		for (MeshLod const& lod : mesh.Lods)
+		{
+			if (lod.FirstIndex > mesh.Indices.size() || lod.IndexCount > mesh.Indices.size() - lod.FirstIndex)
+				return false;
+		}
+
+		for (Meshlet const& meshlet : mesh.Meshlets)
+		{
+			if (meshlet.VertexCount > MAX_MESHLET_VERTICES || meshlet.TriangleCount > MAX_MESHLET_TRIANGLES
+				|| meshlet.VertexOffset > mesh.MeshletVertices.size() || meshlet.VertexCount > mesh.MeshletVertices.size() - meshlet.VertexOffset
+				|| meshlet.TriangleOffset > mesh.MeshletTriangles.size() || meshlet.TriangleCount > mesh.MeshletTriangles.size() - meshlet.TriangleOffset)
+				return false;
+			for (uint32_t t{ meshlet.TriangleOffset }; t < meshlet.TriangleOffset + meshlet.TriangleCount; ++t)
+			{
+				uint32_t const packed{ mesh.MeshletTriangles[t] };
+				if ((packed & 0xFF) >= meshlet.VertexCount || ((packed >> 8) & 0xFF) >= meshlet.VertexCount || ((packed >> 16) & 0xFF) >= meshlet.VertexCount)
+					return false;
+			}
+		}
+		return std::ranges::none_of(mesh.MeshletVertices, [vertexCount](uint32_t vertex) { return vertex >= vertexCount; });
+	}
+
+	bool readMesh(BlockReader& reader, VertexFormat format, std::span<std::shared_ptr<Texture const> const> textures, Mesh& outMesh)
+	{
+		CachedMesh cached{};
+		if (!reader.Read(cached))
+			return false;
+		if (NO_TEXTURE != cached.TextureIndex)
+		{
+			if (cached.TextureIndex >= textures.size())
+				return false;
+			outMesh.BaseColorTexture = textures[cached.TextureIndex];
+		}
+		outMesh.Format = format;
+		outMesh.BoundsMin = cached.BoundsMin;
+		outMesh.BoundsMax = cached.BoundsMax;
+		outMesh.Quantization = cached.Quantization;
+		outMesh.UvDensity = cached.UvDensity;
+		for (uint32_t s{ 0 }; s < VERTEX_STREAM_COUNT; ++s)
+		{
+			if (cached.StreamSizes[s] % GetStreamStride(format, static_cast<VertexStream>(s)) != 0)
+				return false;
+			if (!reader.Read(outMesh.Streams[s], cached.StreamSizes[s]))
+				return false;
+		}
+		return reader.Read(outMesh.Indices, cached.IndexCount)
+			&& reader.Read(outMesh.Lods, cached.LodCount)
+			&& reader.Read(outMesh.Meshlets, cached.MeshletCount)
+			&& reader.Read(outMesh.MeshletVertices, cached.MeshletVertexCount)
+			&& reader.Read(outMesh.MeshletTriangles, cached.MeshletTriangleCount)
+			&& isMeshValid(outMesh);
+	}
+
+	std::vector<std::byte> serializeMeshCache(uint64_t sourceHash, uint64_t sourceSize, VertexFormat format, std::span<Mesh const> meshes)
+	{
+		BlockWriter writer{};
+		CacheHeader header{};
+		header.SourceHash = sourceHash;
+		header.SourceSize = sourceSize;
+		header.Format = static_cast<uint32_t>(format);
+		header.MeshCount = static_cast<uint32_t>(meshes.size());
+
+		/* Each texture once, even when several meshes use it */
+		std::vector<Texture const*> textures{};
+		for (Mesh const& mesh : meshes)
+		{
+			if (mesh.BaseColorTexture && std::ranges::find(textures, mesh.BaseColorTexture.get()) == textures.end())
+				textures.push_back(mesh.BaseColorTexture.get());
+		}
+		header.TextureCount = static_cast<uint32_t>(textures.size());
+		writer.Write(header);
+
+		for (Texture const* texture : textures)
+		{
+			std::vector<std::byte> const container{ WriteKtx2(*texture) };
+			writer.Write(CachedTexture{ texture->ContentHash, container.size() });
+			writer.Write(std::span{ container });
+		}
+
+		for (Mesh const& mesh : meshes)
+		{
+			CachedMesh cached{};
+			if (mesh.BaseColorTexture)
+				cached.TextureIndex = static_cast<uint32_t>(std::ranges::find(textures, mesh.BaseColorTexture.get()) - textures.begin());
+			for (uint32_t s{ 0 }; s < VERTEX_STREAM_COUNT; ++s)
+				cached.StreamSizes[s] = static_cast<uint32_t>(mesh.Streams[s].size());
+			cached.IndexCount = static_cast<uint32_t>(mesh.Indices.size());
+			cached.LodCount = static_cast<uint32_t>(mesh.Lods.size());
+			cached.MeshletCount = static_cast<uint32_t>(mesh.Meshlets.size());
+			cached.MeshletVertexCount = static_cast<uint32_t>(mesh.MeshletVertices.size());
+			cached.MeshletTriangleCount = static_cast<uint32_t>(mesh.MeshletTriangles.size());
+			cached.BoundsMin = mesh.BoundsMin;
+			cached.BoundsMax = mesh.BoundsMax;
+			cached.Quantization = mesh.Quantization;
+			cached.UvDensity = mesh.UvDensity;
+			writer.Write(cached);
+
+			for (auto const& stream : mesh.Streams)
+				writer.Write(std::span{ stream });
+			writer.Write(std::span{ mesh.Indices });
+			writer.Write(std::span{ mesh.Lods });
+			writer.Write(std::span{ mesh.Meshlets });
+			writer.Write(std::span{ mesh.MeshletVertices });
+			writer.Write(std::span{ mesh.MeshletTriangles });
+		}
+		return writer.Take();
+	}
+}
+
+namespace gg
+{
+	std::string GetMeshCachePath(std::string const& modelAbsolutePath)
+	{
+		return modelAbsolutePath + ".meshcache";
+	}
+
+	bool ReadMeshCache(std::string const& cacheAbsolutePath, uint64_t sourceHash, uint64_t sourceSize, VertexFormat format, std::vector<Mesh>& outMeshes)
+	{
+		MappedFile const file{ cacheAbsolutePath };
+		if (!file.IsOpen())
+			return false;
+
+		BlockReader reader{ file.GetData() };
+		CacheHeader header{};
+		if (!reader.Read(header)
+			|| MESH_CACHE_MAGIC != header.Magic
+			|| MESH_CACHE_VERSION != header.Version
+			|| sourceHash != header.SourceHash
+			|| sourceSize != header.SourceSize
+			|| static_cast<uint32_t>(format) != header.Format
+			|| header.MeshCount > file.GetData().size() / sizeof(CachedMesh)
+			|| header.TextureCount > file.GetData().size() / sizeof(CachedTexture))
+			return false;
+
+		std::vector<std::shared_ptr<Texture const>> textures(header.TextureCount);
+		for (std::shared_ptr<Texture const>& texture : textures)
+		{
+			texture = readTexture(reader);
+			if (!texture)
+				return false;
+		}
+
+		std::vector<Mesh> meshes(header.MeshCount);
+		for (Mesh& mesh : meshes)
+		{
+			if (!readMesh(reader, format, textures, mesh))
+				return false;
+		}
+		outMeshes = std::move(meshes);
+		return true;
+	}
+
+	bool WriteMeshCache(std::string const& cacheAbsolutePath, uint64_t sourceHash, uint64_t sourceSize, VertexFormat format, std::span<Mesh const> meshes)
+	{
+		std::vector<std::byte> const data{ serializeMeshCache(sourceHash, sourceSize, format, meshes) };
+		/* Write to a temporary file first, a reader must never map a half-written cache. Two loads of the same model
+		 may write at once, each has its own file and the last rename wins. */
+		static std::atomic<uint32_t> temporaryFileCount{ 0 };
+		std::string const temporaryPath{ std::format("{}.{}.{}.tmp", cacheAbsolutePath, _getpid(), temporaryFileCount++) };
+		{
+			std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+			if (!file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size())))
+				return false;
+		}
+		std::error_code error{};
+		std::filesystem::rename(temporaryPath, cacheAbsolutePath, error);
+		return !error;
+	}
+
+} // namespace gg
@@ -0,0 +1,230 @@
+module;
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+module MeshSimplifier;
+
+using namespace DirectX;
+
+namespace
+{
+	/* Symmetric 4x4 matrix of the plane equation (a, b, c, d), stored as its upper triangle,
+	 * plus the number of planes accumulated into it */
+	struct Quadric
+	{
+		double a2{}, ab{}, ac{}, ad{};
+		double b2{}, bc{}, bd{};
+		double c2{}, cd{};
+		double d2{};
+		double planeCount{};
+
+		Quadric& operator+=(Quadric const& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			planeCount += q.planeCount;
+			return *this;
+		}
+	};
+
+	Quadric planeQuadric(XMFLOAT3 const& p0, XMFLOAT3 const& p1, XMFLOAT3 const& p2)
+	{
+		XMVECTOR const v0{ XMLoadFloat3(&p0) };
+		XMVECTOR const normal{ XMVector3Normalize(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&p1), v0), XMVectorSubtract(XMLoadFloat3(&p2), v0))) };
+		XMFLOAT3 n;
+		XMStoreFloat3(&n, normal);
+		double const a{ n.x }, b{ n.y }, c{ n.z };
+		double const d{ -(a * p0.x + b * p0.y + c * p0.z) };
+
+		Quadric q{};
+		q.a2 = a * a; q.ab = a * b; q.ac = a * c; q.ad = a * d;
+		q.b2 = b * b; q.bc = b * c; q.bd = b * d;
+		q.c2 = c * c; q.cd = c * d;
+		q.d2 = d * d;
+		q.planeCount = 1.0;
+		return q;
+	}
+
+	/* Mean squared distance from p to the planes accumulated in q */
+	double evaluate(Quadric const& q, XMFLOAT3 const& p)
+	{
+		double const x{ p.x }, y{ p.y }, z{ p.z };
+		double const sum{ q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+			+ q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+			+ q.c2 * z * z + 2 * q.cd * z
+			+ q.d2 };
+		return q.planeCount > 0.0 ? sum / q.planeCount : 0.0;
+	}
+
+	uint64_t edgeKey(uint32_t a, uint32_t b)
+	{
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	}
+
+	XMVECTOR triangleNormal(XMFLOAT3 const& p0, XMFLOAT3 const& p1, XMFLOAT3 const& p2)
+	{
+		XMVECTOR const v0{ XMLoadFloat3(&p0) };
+		return XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&p1), v0), XMVectorSubtract(XMLoadFloat3(&p2), v0));
+	}
+
+	struct Collapse
+	{
+		uint32_t From;
+		uint32_t To;
+		double Cost;
+	};
+
+	/* Replacing `from` with `to` must not flip any of the remaining triangles around `from` */
+	bool flipsTriangles(std::vector<XMFLOAT3> const& positions, std::vector<uint32_t> const& indices, std::vector<uint32_t> const& triangles, uint32_t from, uint32_t to)
+	{
+		for (uint32_t t : triangles)
+		{
+			uint32_t const* tri{ &indices[t * 3] };
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+				continue; /* collapses into a degenerate triangle and gets removed */
+
+			XMFLOAT3 moved[3]{ positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+			for (uint32_t k{ 0 }; k < 3; ++k)
+				if (tri[k] == from)
+					moved[k] = positions[to];
+
+			XMVECTOR const before{ triangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]) };
+			XMVECTOR const after{ triangleNormal(moved[0], moved[1], moved[2]) };
+			if (XMVectorGetX(XMVector3Dot(before, after)) <= 0.f)
+				return true;
+		}
+		return false;
+	}
+}
+
+namespace gg
+{
+	SimplifiedMesh SimplifyMesh(std::vector<XMFLOAT3> const& positions, std::vector<uint32_t> const& indices, size_t targetIndexCount)
+	{
+		SimplifiedMesh result{ indices, 0.f };
+		size_t const vertexCount{ positions.size() };
+
+		std::vector<Quadric> quadrics(vertexCount);
+		std::unordered_map<uint64_t, uint32_t> edgeUseCount{};
+		for (size_t i{ 0 }; i + 2 < indices.size(); i += 3)
+		{
+			uint32_t const tri[3]{ indices[i], indices[i + 1], indices[i + 2] };
+			Quadric const q{ planeQuadric(positions[tri[0]], positions[tri[1]], positions[tri[2]]) };
+			for (uint32_t k{ 0 }; k < 3; ++k)
+			{
+				quadrics[tri[k]] += q;
+				++edgeUseCount[edgeKey(tri[k], tri[(k + 1) % 3])];
+			}
+		}
+
+		/* Edges used by a single triangle are on an open border or a UV seam: keep them in place to avoid cracks */
+		std::vector<bool> locked(vertexCount, false);
+		for (auto const& [key, count] : edgeUseCount)
+		{
+			if (1 == count)
+			{
+				locked[static_cast<uint32_t>(key >> 32)] = true;
+				locked[static_cast<uint32_t>(key & 0xFFFFFFFF)] = true;
+			}
+		}
+
+		double maxCost{ 0.0 };
+		std::vector<uint32_t> collapseTarget(vertexCount);
+		std::vector<bool> touched(vertexCount);
+		std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+
+		while (result.Indices.size() > targetIndexCount)
+		{
+			std::vector<uint32_t>& current{ result.Indices };
+			size_t const triangleCount{ current.size() / 3 };
+
+			for (auto& triangles : vertexTriangles)
+				triangles.clear();
+			for (uint32_t t{ 0 }; t < triangleCount; ++t)
+				for (uint32_t k{ 0 }; k < 3; ++k)
+					vertexTriangles[current[t * 3 + k]].push_back(t);
+
+			/* Gather the cheapest direction of every collapsible edge */
+			std::vector<Collapse> collapses{};
+			for (size_t i{ 0 }; i < current.size(); i += 3)
+			{
+				for (uint32_t k{ 0 }; k < 3; ++k)
+				{
+					uint32_t const a{ current[i + k] };
+					uint32_t const b{ current[i + (k + 1) % 3] };
+					if (a >= b) /* interior edges are seen from both sides, only handle them once */
+						continue;
+
+					if (locked[a] && locked[b])
+						continue;
+
+					Quadric q{ quadrics[a] };
+					q += quadrics[b];
+					double const costAB{ locked[a] ? DBL_MAX : evaluate(q, positions[b]) };
+					double const costBA{ locked[b] ? DBL_MAX : evaluate(q, positions[a]) };
+					if (costAB <= costBA)
+						collapses.push_back({ a, b, costAB });
+					else
+						collapses.push_back({ b, a, costBA });
+				}
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end(), [](Collapse const& l, Collapse const& r) { return l.Cost < r.Cost; });
+
+			/* Every collapse removes about two triangles, do not overshoot the target */
+			size_t const collapseBudget{ std::max<size_t>(1, (current.size() - targetIndexCount) / 6) };
+			size_t collapseCount{ 0 };
+
+			std::iota(collapseTarget.begin(), collapseTarget.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+			for (Collapse const& c : collapses)
+			{
+				if (touched[c.From] || touched[c.To])
+					continue;
+				if (flipsTriangles(positions, current, vertexTriangles[c.From], c.From, c.To))
+					continue;
+
+				collapseTarget[c.From] = c.To;
+				quadrics[c.To] += quadrics[c.From];
+				maxCost = std::max(maxCost, c.Cost);
+
+				/* The neighbourhood of the collapsed vertex changed, leave it for the next pass */
+				for (uint32_t t : vertexTriangles[c.From])
+					for (uint32_t k{ 0 }; k < 3; ++k)
+						touched[current[t * 3 + k]] = true;
+
+				if (++collapseCount >= collapseBudget)
+					break;
+			}
+			if (0 == collapseCount)
+				break;
+
+			/* Remap the indices and drop the triangles that became degenerate */
+			size_t writeIndex{ 0 };
+			for (size_t i{ 0 }; i < current.size(); i += 3)
+			{
+				uint32_t const a{ collapseTarget[current[i]] };
+				uint32_t const b{ collapseTarget[current[i + 1]] };
+				uint32_t const c{ collapseTarget[current[i + 2]] };
+				if (a == b || b == c || a == c)
+					continue;
+				current[writeIndex++] = a;
+				current[writeIndex++] = b;
+				current[writeIndex++] = c;
+			}
+			current.resize(writeIndex);
+		}
+
+		result.Error = static_cast<float>(std::sqrt(std::max(maxCost, 0.0)));
+		return result;
+	}
+
+} // namespace gg
@@ -0,0 +1,130 @@
+module;
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <vector>
+module Meshlet;
+
+using namespace DirectX;
+
+namespace
+{
+	using namespace gg;
+
+	/* A meshlet whose normals spread wider than this is never cone culled */
+	constexpr float MIN_CONE_DOT{ 0.1f };
+	constexpr uint32_t NOT_IN_MESHLET{ 0xFFFFFFFF };
+
+	void computeBounds(std::vector<XMFLOAT3> const& positions, std::vector<uint32_t> const& vertices, std::vector<uint32_t> const& triangles, Meshlet& meshlet)
+	{
+		XMVECTOR boundsMin{ XMVectorReplicate(FLT_MAX) };
+		XMVECTOR boundsMax{ XMVectorReplicate(-FLT_MAX) };
+		for (uint32_t i{ 0 }; i < meshlet.VertexCount; ++i)
+		{
+			XMVECTOR const p{ XMLoadFloat3(&positions[vertices[meshlet.VertexOffset + i]]) };
+			boundsMin = XMVectorMin(boundsMin, p);
+			boundsMax = XMVectorMax(boundsMax, p);
+		}
+		XMVECTOR const center{ XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f) };
+		float radius{ 0.f };
+		for (uint32_t i{ 0 }; i < meshlet.VertexCount; ++i)
+		{
+			XMVECTOR const p{ XMLoadFloat3(&positions[vertices[meshlet.VertexOffset + i]]) };
+			radius = std::max(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(p, center))));
+		}
+		XMStoreFloat3(&meshlet.Center, center);
+		meshlet.Radius = radius;
+
+		/* The cone axis is the average triangle normal, its cutoff is the sine of the largest deviation from it */
+		std::vector<XMVECTOR> normals{};
+		normals.reserve(meshlet.TriangleCount);
+		XMVECTOR axis{ XMVectorZero() };
+		for (uint32_t t{ 0 }; t < meshlet.TriangleCount; ++t)
+		{
+			uint32_t const packed{ triangles[meshlet.TriangleOffset + t] };
+			XMVECTOR const p0{ XMLoadFloat3(&positions[vertices[meshlet.VertexOffset + (packed & 0xFF)]]) };
+			XMVECTOR const p1{ XMLoadFloat3(&positions[vertices[meshlet.VertexOffset + ((packed >> 8) & 0xFF)]]) };
+			XMVECTOR const p2{ XMLoadFloat3(&positions[vertices[meshlet.VertexOffset + ((packed >> 16) & 0xFF)]]) };
+			XMVECTOR const normal{ XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)) };
+			if (XMVectorGetX(XMVector3LengthSq(normal)) <= 0.f)
+				continue; /* degenerate */
+			normals.push_back(XMVector3Normalize(normal));
+			axis = XMVectorAdd(axis, normals.back());
+		}
+
+		meshlet.ConeAxis = { 0.f, 0.f, 0.f };
+		meshlet.ConeCutoff = 1.f;
+		if (normals.empty() || XMVectorGetX(XMVector3LengthSq(axis)) <= 0.f)
+			return;
+
+		axis = XMVector3Normalize(axis);
+		float minDot{ 1.f };
+		for (XMVECTOR const& n : normals)
+			minDot = std::min(minDot, XMVectorGetX(XMVector3Dot(axis, n)));
+		if (minDot <= MIN_CONE_DOT)
+			return;
+
+		XMStoreFloat3(&meshlet.ConeAxis, axis);
+		meshlet.ConeCutoff = std::sqrt(1.f - minDot * minDot);
+	}
+}
+
+namespace gg
+{
+	void BuildMeshlets(
+		std::vector<XMFLOAT3> const& positions,
+		uint32_t const* indices,
+		size_t indexCount,
+		std::vector<Meshlet>& outMeshlets,
+		std::vector<uint32_t>& outVertices,
+		std::vector<uint32_t>& outTriangles)
+	{
+		/* Local index of every mesh vertex in the meshlet being built */
+		std::vector<uint32_t> localIndex(positions.size(), NOT_IN_MESHLET);
+		Meshlet current{};
+
+		auto finishMeshlet = [&]()
+		{
+			if (0 == current.TriangleCount)
+				return;
+			for (uint32_t i{ 0 }; i < current.VertexCount; ++i)
+				localIndex[outVertices[current.VertexOffset + i]] = NOT_IN_MESHLET;
+			computeBounds(positions, outVertices, outTriangles, current);
+			outMeshlets.push_back(current);
+
+			current = Meshlet{};
+			current.VertexOffset = static_cast<uint32_t>(outVertices.size());
+			current.TriangleOffset = static_cast<uint32_t>(outTriangles.size());
+		};
+
+		/* Greedy: triangles are appended in index buffer order until one of the limits is hit */
+		for (size_t i{ 0 }; i + 2 < indexCount; i += 3)
+		{
+			uint32_t const tri[3]{ indices[i], indices[i + 1], indices[i + 2] };
+			uint32_t newVertices{ 0 };
+			for (uint32_t k{ 0 }; k < 3; ++k)
+				if (NOT_IN_MESHLET == localIndex[tri[k]])
+					++newVertices;
+
+			if (current.VertexCount + newVertices > MAX_MESHLET_VERTICES || current.TriangleCount + 1 > MAX_MESHLET_TRIANGLES)
+				finishMeshlet();
+
+			uint32_t packed{ 0 };
+			for (uint32_t k{ 0 }; k < 3; ++k)
+			{
+				if (NOT_IN_MESHLET == localIndex[tri[k]])
+				{
+					localIndex[tri[k]] = current.VertexCount++;
+					outVertices.push_back(tri[k]);
+				}
+				packed |= localIndex[tri[k]] << (8 * k);
+			}
+			outTriangles.push_back(packed);
+			++current.TriangleCount;
+		}
+		finishMeshlet();
+	}
+
+} // namespace gg
@@ -0,0 +1,127 @@
+module;
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GG_SSE2
+#endif
+module MipChain;
+
+namespace
+{
+	/* Linear values are quantized to 12 bits for the encoding table, finer than any step of 8-bit sRGB */
+	constexpr uint32_t LINEAR_STEPS{ 4096 };
+	/* From the sum of four linear values to the encoding table index */
+	constexpr float SUM_TO_INDEX{ 0.25f * (LINEAR_STEPS - 1) };
+
+	float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+	}
+
+	/* Tables instead of pow per texel */
+	struct SrgbTables
+	{
+		std::array<float, 256> ToLinear{};
+		std::array<uint8_t, LINEAR_STEPS> ToSrgb{};
+
+		SrgbTables()
+		{
+			for (uint32_t i{ 0 }; i < ToLinear.size(); ++i)
+				ToLinear[i] = srgbToLinear(i / 255.f);
+			for (uint32_t i{ 0 }; i < ToSrgb.size(); ++i)
+				ToSrgb[i] = static_cast<uint8_t>(linearToSrgb(i / static_cast<float>(LINEAR_STEPS - 1)) * 255.f + 0.5f);
+		}
+	};
+
+#ifdef GG_SSE2
+	/* The color channels in linear space, alpha as it is */
+	__m128 loadTexel(SrgbTables const& tables, uint8_t const* texel)
+	{
+		return _mm_setr_ps(tables.ToLinear[texel[0]], tables.ToLinear[texel[1]], tables.ToLinear[texel[2]], static_cast<float>(texel[3]));
+	}
+#endif
+
+	void downsample(SrgbTables const& tables, uint8_t const* source, uint32_t sourceWidth, uint32_t sourceHeight, uint8_t* destination, uint32_t width, uint32_t height)
+	{
+#ifdef GG_SSE2
+		/* The average of the four channels at once, scaled to the encoding table index for color and to 8 bits for alpha */
+		__m128 const scale{ _mm_setr_ps(SUM_TO_INDEX, SUM_TO_INDEX, SUM_TO_INDEX, 0.25f) };
+		__m128 const half{ _mm_set1_ps(0.5f) };
+#endif
+		for (uint32_t y{ 0 }; y < height; ++y)
+		{
+			/* Clamped for the 1 texel wide or high levels of non-square images */
+			uint8_t const* row0{ source + size_t{ std::min(2 * y, sourceHeight - 1) } * sourceWidth * 4 };
+			uint8_t const* row1{ source + size_t{ std::min(2 * y + 1, sourceHeight - 1) } * sourceWidth * 4 };
+			for (uint32_t x{ 0 }; x < width; ++x)
+			{
+				size_t const x0{ size_t{ std::min(2 * x, sourceWidth - 1) } * 4 };
+				size_t const x1{ size_t{ std::min(2 * x + 1, sourceWidth - 1) } * 4 };
+				uint8_t* texel{ destination + (size_t{ y } * width + x) * 4 };
+#ifdef GG_SSE2
+				__m128 const sum{ _mm_add_ps(_mm_add_ps(loadTexel(tables, row0 + x0), loadTexel(tables, row0 + x1)), _mm_add_ps(loadTexel(tables, row1 + x0), loadTexel(tables, row1 + x1))) };
+				alignas(16) int32_t values[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(values), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), half)));
+				texel[0] = tables.ToSrgb[values[0]];
+				texel[1] = tables.ToSrgb[values[1]];
+				texel[2] = tables.ToSrgb[values[2]];
+				texel[3] = static_cast<uint8_t>(values[3]);
+#else
+				/* Summed in pairs and scaled like the SSE2 path, so that both round to the same index */
+				for (uint32_t c{ 0 }; c < 3; ++c)
+				{
+					float const sum{ (tables.ToLinear[row0[x0 + c]] + tables.ToLinear[row0[x1 + c]]) + (tables.ToLinear[row1[x0 + c]] + tables.ToLinear[row1[x1 + c]]) };
+					texel[c] = tables.ToSrgb[static_cast<uint32_t>(sum * SUM_TO_INDEX + 0.5f)];
+				}
+				/* Alpha is linear */
+				texel[3] = static_cast<uint8_t>((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) / 4);
+#endif
+			}
+		}
+	}
+}
+
+namespace gg
+{
+	uint32_t GetMipLevelCount(uint32_t width, uint32_t height)
+	{
+		return std::bit_width(std::max({ width, height, 1u }));
+	}
+
+	std::vector<uint8_t> BuildMipChain(std::span<uint8_t const> pixels, uint32_t width, uint32_t height, std::vector<MipLevel>& outLevels)
+	{
+		static SrgbTables const tables{};
+
+		outLevels.clear();
+		size_t sizeBytes{ 0 };
+		for (uint32_t level{ 0 }; level < GetMipLevelCount(width, height); ++level)
+		{
+			MipLevel const mip{ sizeBytes, std::max(width >> level, 1u), std::max(height >> level, 1u) };
+			outLevels.push_back(mip);
+			sizeBytes += size_t{ mip.Width } * mip.Height * 4;
+		}
+
+		std::vector<uint8_t> chain(sizeBytes);
+		std::copy(pixels.begin(), pixels.end(), chain.begin());
+		for (size_t level{ 1 }; level < outLevels.size(); ++level)
+		{
+			MipLevel const& source{ outLevels[level - 1] };
+			MipLevel const& mip{ outLevels[level] };
+			downsample(tables, chain.data() + source.Offset, source.Width, source.Height, chain.data() + mip.Offset, mip.Width, mip.Height);
+		}
+		return chain;
+	}
+
+} // namespace gg
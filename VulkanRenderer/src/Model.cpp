@@ -1,18 +1,54 @@
 module;
 #include <cstdint>
+#include <cstring>
+#include <DirectXMath.h>
 #include <memory>
 module Model;
 
+using DirectX::XMFLOAT3;
+
 namespace gg
 {
-	uint32_t Mesh::VerticesSizeBytes() const { return static_cast<uint32_t>(Vertices.size()) * sizeof(Vertex); }
+	bool HaveSameTexels(Texture const& a, Texture const& b)
+	{
+		return a.Width == b.Width && a.Height == b.Height && a.Format == b.Format && a.Pixels == b.Pixels;
+	}
+
+	void const* Mesh::GetStreamData(VertexStream stream) const { return Streams[static_cast<size_t>(stream)].data(); }
+	uint32_t Mesh::StreamSizeBytes(VertexStream stream) const { return static_cast<uint32_t>(Streams[static_cast<size_t>(stream)].size()); }
+	uint32_t Mesh::VerticesSizeBytes() const { return StreamSizeBytes(VertexStream::Position) + StreamSizeBytes(VertexStream::Attributes); }
 	uint32_t Mesh::IndicesSizeBytes() const { return static_cast<uint32_t>(Indices.size()) * sizeof(uint32_t); }
-	uint32_t Mesh::GetVertexCount() const { return static_cast<uint32_t>(Vertices.size()); }
+	uint32_t Mesh::GetVertexCount() const { return StreamSizeBytes(VertexStream::Position) / GetStreamStride(Format, VertexStream::Position); }
 	uint32_t Mesh::GetIndexCount() const { return static_cast<uint32_t>(Indices.size()); }
 
+	XMFLOAT3 Mesh::GetPosition(uint32_t vertexIndex) const
+	{
+		uint8_t const* const element{ Streams[static_cast<size_t>(VertexStream::Position)].data() + vertexIndex * GetStreamStride(Format, VertexStream::Position) };
+		if (VertexFormat::Quantized16 == Format)
+		{
+			QuantizedPosition position;
+			std::memcpy(&position, element, sizeof(position));
+			return DecodePosition(position, Quantization);
+		}
+		XMFLOAT3 position;
+		std::memcpy(&position, element, sizeof(position));
+		return position;
+	}
+
 	Mesh::Mesh(Mesh&& other) noexcept
-		: Vertices{ std::move(other.Vertices) }
+		: Format{ other.Format }
+		, Vertices{ std::move(other.Vertices) }
+		, Streams{ std::move(other.Streams) }
 		, Indices{ std::move(other.Indices) }
+		, Lods{ std::move(other.Lods) }
+		, Meshlets{ std::move(other.Meshlets) }
+		, MeshletVertices{ std::move(other.MeshletVertices) }
+		, MeshletTriangles{ std::move(other.MeshletTriangles) }
+		, BoundsMin{ other.BoundsMin }
+		, BoundsMax{ other.BoundsMax }
+		, Quantization{ other.Quantization }
+		, UvDensity{ other.UvDensity }
+		, BaseColorTexture{ std::move(other.BaseColorTexture) }
 	{
 	}
 
@@ -22,8 +58,23 @@ namespace gg
 		{
 			Vertices.clear();
 			Indices.clear();
+			Lods.clear();
+			Meshlets.clear();
+			MeshletVertices.clear();
+			MeshletTriangles.clear();
+			Format = other.Format;
 			Vertices = std::move(other.Vertices);
+			Streams = std::move(other.Streams);
 			Indices = std::move(other.Indices);
+			Lods = std::move(other.Lods);
+			Meshlets = std::move(other.Meshlets);
+			MeshletVertices = std::move(other.MeshletVertices);
+			MeshletTriangles = std::move(other.MeshletTriangles);
+			BoundsMin = other.BoundsMin;
+			BoundsMax = other.BoundsMax;
+			Quantization = other.Quantization;
+			UvDensity = other.UvDensity;
+			BaseColorTexture = std::move(other.BaseColorTexture);
 		}
 		return *this;
 	}
@@ -31,6 +82,7 @@ namespace gg
 	Model::Model(Model&& other) noexcept
 		: shaderProgram{ other.shaderProgram }
 		, meshes{ std::move(other.meshes) }
+		, vertexFormat{ other.vertexFormat }
 	{
 	}
 
@@ -42,6 +94,7 @@ namespace gg
 
 			shaderProgram = std::move(other.shaderProgram);
 			meshes = std::move(other.meshes);
+			vertexFormat = other.vertexFormat;
 		}
 		return *this;
 	}
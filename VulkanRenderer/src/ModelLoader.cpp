@@ -1,97 +1,539 @@
 module;
+#include <algorithm>
 #include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <DirectXMath.h>
 #include <filesystem>
 #include <format>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <stb_image.h>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 #include <vector>
 module ModelLoader;
 
+import AssetPack;
+import AsyncIo;
+import Hashing;
+import JobSystem;
+import Ktx2;
 import Logging;
+import MeshCache;
 import Model;
+import PixelConversion;
 import ShaderProgram;
+import Task;
+import TextureCompression;
 import ErrorHandling;
+import Vertex;
+import MeshSimplifier;
+import Meshlet;
 
-using DirectX::XMFLOAT2;
+using namespace DirectX;
 
 namespace
 {
 	using namespace gg;
 
+	constexpr float LOD_INDEX_RATIO{ 0.5f };   /* every LOD has about half the triangles of the previous one */
+	constexpr float LOD_MIN_REDUCTION{ 0.9f }; /* stop once the simplifier can no longer make progress */
+
 	void readVertices(aiMesh const* assimpMesh, Mesh& outMesh, unsigned int UVsetNumber)
 	{
+		outMesh.Vertices.reserve(assimpMesh->mNumVertices);
+		for (unsigned int vertexIndex{ 0 }; vertexIndex < assimpMesh->mNumVertices; ++vertexIndex)
+		{
+			auto assimpVertex = assimpMesh->mVertices[vertexIndex];
+
+			aiVector3D UV = assimpMesh->HasTextureCoords(UVsetNumber)
+				? assimpMesh->mTextureCoords[UVsetNumber][vertexIndex]
+				: aiVector3D {0, 0, 0};
+
+			outMesh.Vertices.emplace_back(
+				static_cast<float>(assimpVertex.x),
+				static_cast<float>(assimpVertex.y),
+				static_cast<float>(assimpVertex.z),
+				1.0f, // w
+				UV.x, UV.y
+			);
+		}
+	}
+
+	void readIndices(aiMesh const* assimpMesh, Mesh& outMesh)
+	{
+		outMesh.Indices.reserve(assimpMesh->mNumFaces * 3);
 		for (unsigned int faceIndex{ 0 }; faceIndex < assimpMesh->mNumFaces; ++faceIndex)
 		{
-			aiFace* face{ &assimpMesh->mFaces[faceIndex] };
-			for (unsigned int j{ 0 }; j < face->mNumIndices; ++j)
-			{
-				auto vertexIndex = face->mIndices[j];
-				auto assimpVertex = assimpMesh->mVertices[vertexIndex];
-
-				aiVector3D UV = assimpMesh->HasTextureCoords(UVsetNumber)
-					? assimpMesh->mTextureCoords[UVsetNumber][vertexIndex]
-					: aiVector3D {0, 0, 0};
-
-				outMesh.Vertices.emplace_back(
-					static_cast<float>(assimpVertex.x),
-					static_cast<float>(assimpVertex.y),
-					static_cast<float>(assimpVertex.z),
-					1.0f, // w
-					UV.x, UV.y
-				);
-			}
+			aiFace const& face{ assimpMesh->mFaces[faceIndex] };
+			if (3 != face.mNumIndices)
+				continue; /* points and lines are not rendered */
+			outMesh.Indices.insert(outMesh.Indices.end(), face.mIndices, face.mIndices + 3);
+		}
+	}
+
+	std::vector<XMFLOAT3> readPositions(Mesh const& mesh)
+	{
+		std::vector<XMFLOAT3> positions(mesh.Vertices.size());
+		for (size_t i{ 0 }; i < mesh.Vertices.size(); ++i)
+			XMStoreFloat3(&positions[i], mesh.Vertices[i].Position);
+		return positions;
+	}
+
+	/* Appends the simplified index buffers to mesh.Indices, all of them share the vertices of LOD 0 */
+	void generateLods(Mesh& mesh, std::vector<XMFLOAT3> const& positions)
+	{
+		uint32_t const sourceIndexCount{ mesh.GetIndexCount() };
+		mesh.Lods.push_back({ 0, sourceIndexCount, 0.f });
+
+		/* Simplify from the source mesh every time, so that the error is measured against LOD 0 */
+		std::vector<uint32_t> const sourceIndices{ mesh.Indices };
+		while (mesh.Lods.size() < MAX_LOD_COUNT)
+		{
+			MeshLod const& previous{ mesh.Lods.back() };
+			size_t const targetIndexCount{ static_cast<size_t>(previous.IndexCount * LOD_INDEX_RATIO) / 3 * 3 };
+			if (targetIndexCount < 3)
+				break;
+
+			SimplifiedMesh simplified{ SimplifyMesh(positions, sourceIndices, targetIndexCount) };
+			if (simplified.Indices.empty() || simplified.Indices.size() > previous.IndexCount * LOD_MIN_REDUCTION)
+				break;
+
+			MeshLod lod{};
+			lod.FirstIndex = mesh.GetIndexCount();
+			lod.IndexCount = static_cast<uint32_t>(simplified.Indices.size());
+			lod.Error = std::max(simplified.Error, previous.Error);
+			mesh.Indices.insert(mesh.Indices.end(), simplified.Indices.begin(), simplified.Indices.end());
+			mesh.Lods.push_back(lod);
+		}
+		DebugLog(DebugLevel::Info, std::format("Generated {} LODs, {} -> {} triangles", mesh.Lods.size(), sourceIndexCount / 3, mesh.Lods.back().IndexCount / 3));
+	}
+
+	void computeBounds(Mesh& mesh)
+	{
+		XMVECTOR boundsMin{ XMVectorReplicate(FLT_MAX) };
+		XMVECTOR boundsMax{ XMVectorReplicate(-FLT_MAX) };
+		for (Vertex const& v : mesh.Vertices)
+		{
+			boundsMin = XMVectorMin(boundsMin, v.Position);
+			boundsMax = XMVectorMax(boundsMax, v.Position);
+		}
+		if (mesh.Vertices.empty())
+			boundsMin = boundsMax = XMVectorZero();
+		XMStoreFloat3(&mesh.BoundsMin, boundsMin);
+		XMStoreFloat3(&mesh.BoundsMax, boundsMax);
+	}
+
+	/* Square root of the ratio of the UV area to the surface area, a texture of N texels across then has
+	   N * UvDensity texels per object-space unit on average */
+	float computeUvDensity(Mesh const& mesh, std::vector<XMFLOAT3> const& positions)
+	{
+		double uvArea{ 0. };
+		double area{ 0. };
+		for (size_t i{ 0 }; i + 2 < mesh.Lods[0].IndexCount; i += 3)
+		{
+			uint32_t const a{ mesh.Indices[i] };
+			uint32_t const b{ mesh.Indices[i + 1] };
+			uint32_t const c{ mesh.Indices[i + 2] };
+			XMVECTOR const p0{ XMLoadFloat3(&positions[a]) };
+			XMVECTOR const cross{ XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&positions[b]), p0), XMVectorSubtract(XMLoadFloat3(&positions[c]), p0)) };
+			area += XMVectorGetX(XMVector3Length(cross));
+
+			XMFLOAT2 const& uv0{ mesh.Vertices[a].TextureCoords0 };
+			XMFLOAT2 const& uv1{ mesh.Vertices[b].TextureCoords0 };
+			XMFLOAT2 const& uv2{ mesh.Vertices[c].TextureCoords0 };
+			uvArea += std::abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y));
+		}
+		return area > 0. ? static_cast<float>(std::sqrt(uvArea / area)) : 0.f;
+	}
+
+	/* Assimp reads the model, and the files it refers to, in place from the asset pack or the mapped file */
+	class AssetIOStream : public Assimp::IOStream
+	{
+	public:
+		explicit AssetIOStream(AssetFile file) : mFile{ std::move(file) }, mData{ mFile.GetData() } {}
+		explicit AssetIOStream(std::span<std::byte const> data) : mData{ data } {}
+
+		size_t Read(void* buffer, size_t size, size_t count) override
+		{
+			size_t const readCount{ 0 == size ? 0 : std::min(count, (mData.size() - mPosition) / size) };
+			memcpy(buffer, mData.data() + mPosition, readCount * size);
+			mPosition += readCount * size;
+			return readCount;
+		}
+
+		size_t Write(void const*, size_t, size_t) override { return 0; }
+
+		aiReturn Seek(size_t offset, aiOrigin origin) override
+		{
+			/* The offsets from the current or the end position may be negative, wrapped around */
+			size_t const base{ aiOrigin_SET == origin ? 0 : aiOrigin_CUR == origin ? mPosition : FileSize() };
+			size_t const position{ base + offset };
+			if (position > FileSize())
+				return aiReturn_FAILURE;
+			mPosition = position;
+			return aiReturn_SUCCESS;
 		}
+
+		size_t Tell() const override { return mPosition; }
+		size_t FileSize() const override { return mData.size(); }
+		void Flush() override {}
+
+	private:
+		AssetFile mFile;
+		std::span<std::byte const> mData;
+		size_t mPosition{ 0 };
+	};
+
+	class AssetIOSystem : public Assimp::IOSystem
+	{
+	public:
+		/* The model file has already been read, the files it refers to are opened on demand */
+		AssetIOSystem(std::string const& modelAbsolutePath, std::span<std::byte const> modelData)
+			: mModelPath{ std::filesystem::path{ modelAbsolutePath }.lexically_normal() }
+			, mModelData{ modelData }
+		{
+		}
+
+		bool Exists(char const* path) const override
+		{
+			return AssetExists(std::filesystem::absolute(path).generic_string());
+		}
+
+		char getOsSeparator() const override { return '/'; }
+
+		Assimp::IOStream* Open(char const* path, char const* mode) override
+		{
+			/* Read-only */
+			if (std::string_view{ mode }.find_first_of("wa+") != std::string_view::npos)
+				return nullptr;
+			std::filesystem::path const absolutePath{ std::filesystem::absolute(path).lexically_normal() };
+			if (absolutePath == mModelPath)
+				return new AssetIOStream{ mModelData };
+			AssetFile file{ absolutePath.generic_string() };
+			return file.IsOpen() ? new AssetIOStream{ std::move(file) } : nullptr;
+		}
+
+		void Close(Assimp::IOStream* stream) override { delete stream; }
+
+	private:
+		std::filesystem::path mModelPath;
+		std::span<std::byte const> mModelData;
+	};
+
+	/* External textures are relative to the model */
+	std::string getTextureAbsolutePath(std::string const& modelAbsolutePath, std::string const& texturePath)
+	{
+		return (std::filesystem::path{ modelAbsolutePath }.parent_path() / texturePath).generic_string();
+	}
+
+	/* Both are ordered from the highest priority */
+	IoPriority toIoPriority(TaskPriority priority)
+	{
+		return static_cast<IoPriority>(priority);
 	}
 
 	Mesh readMesh(aiMesh const* assimpMesh, aiScene const* scene)
 	{
 		Mesh mesh{};
 		readVertices(assimpMesh, mesh, 0);
+		readIndices(assimpMesh, mesh);
+		computeBounds(mesh);
+
+		std::vector<XMFLOAT3> const positions{ readPositions(mesh) };
+		generateLods(mesh, positions);
+		mesh.UvDensity = computeUvDensity(mesh, positions);
+		/* Only LOD 0 is split into meshlets, it stays at the front of the indices */
+		BuildMeshlets(positions, mesh.Indices.data(), mesh.Lods[0].IndexCount, mesh.Meshlets, mesh.MeshletVertices, mesh.MeshletTriangles);
+		DebugLog(DebugLevel::Info, std::format("Built {} meshlets", mesh.Meshlets.size()));
 		return mesh;
 	}
 }
 
 namespace gg
 {
-	ModelLoader::ModelLoader()
+	ModelLoader::ModelLoader(std::shared_ptr<JobSystem> jobs)
+		: mScheduler{ std::move(jobs) }
 	{
 	}
 
 	ModelLoader::~ModelLoader()
 	{
+		/* Cancels the reads still queued, the workers then finish the loads with what has been read */
+		mIo.Stop();
+	}
+
+	std::unique_ptr<Model> ModelLoader::LoadModel(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath, VertexFormat vertexFormat)
+	{
+		return LoadModelAsync(modelRelativePath, vertexShaderRelativePath, fragmentShaderRelativePath, vertexFormat).get();
 	}
 
-	std::unique_ptr<Model> ModelLoader::LoadModel(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath)
+	std::future<std::unique_ptr<Model>> ModelLoader::LoadModelAsync(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath,
+		VertexFormat vertexFormat, TaskPriority priority)
 	{
-		std::string modelFileAbsPath{ std::filesystem::absolute(modelRelativePath).generic_string() };
 		std::string vertexShaderAbsPath{ std::filesystem::absolute(vertexShaderRelativePath).generic_string() };
 		std::string fragmentShaderAbsPath{ std::filesystem::absolute(fragmentShaderRelativePath).generic_string() };
-		std::unique_ptr<Model> model = std::make_unique<Model>();
-		model->shaderProgram = make_shared<ShaderProgram>(vertexShaderAbsPath, fragmentShaderAbsPath);
-
-		if (!LoadMeshes(modelFileAbsPath, *model))
-			throw std::runtime_error(std::format("Failed to read the input model: {}", modelFileAbsPath));
-		return model;
+		/* The program cache is not shared with the workers */
+		std::shared_ptr<ShaderProgram> shaderProgram{ GetShaderProgram(vertexShaderAbsPath, fragmentShaderAbsPath) };
+		return StartTask(LoadModelTask(std::filesystem::absolute(modelRelativePath).generic_string(), vertexFormat, std::move(shaderProgram), priority));
 	}
 
-	bool ModelLoader::LoadMeshes(std::string const& modelAbsolutePath, Model& outModel)
+	Task<std::unique_ptr<Model>> ModelLoader::LoadModelTask(std::string modelAbsolutePath, VertexFormat vertexFormat, std::shared_ptr<ShaderProgram> shaderProgram, TaskPriority priority)
 	{
-		Assimp::Importer importer;
-		aiScene const* scene = importer.ReadFile(modelAbsolutePath,
+		std::unique_ptr<Model> model{ std::make_unique<Model>() };
+		model->shaderProgram = std::move(shaderProgram);
+		model->vertexFormat = vertexFormat;
+
+		/* Read ahead of the import, the rest of the load runs on the workers */
+		std::vector<std::byte> sourceFile{ co_await ReadFileAsync(modelAbsolutePath, priority) };
+		AssetFile source{};
+		std::span<std::byte const> sourceData{ sourceFile };
+		if (sourceData.empty())
+		{
+			source = AssetFile{ modelAbsolutePath };
+			sourceData = source.GetData();
+		}
+		if (sourceData.empty())
+			throw std::runtime_error(std::format("Failed to open the input model: {}", modelAbsolutePath));
+
+		/* The cache is keyed by the content, not the timestamp, so that a copied or reverted model is still a hit */
+		uint64_t const sourceHash{ HashBytes(sourceData) };
+		std::string const cachePath{ GetMeshCachePath(modelAbsolutePath) };
+		if (ReadMeshCache(cachePath, sourceHash, sourceData.size(), vertexFormat, model->meshes))
+		{
+			for (Mesh& mesh : model->meshes)
+			{
+				if (mesh.BaseColorTexture)
+					mesh.BaseColorTexture = ShareTexture(std::move(mesh.BaseColorTexture));
+			}
+			DebugLog(DebugLevel::Info, std::format("Loaded {} meshes from the cache {}", model->meshes.size(), cachePath));
+			co_return model;
+		}
+
+		/* The importer owns the handler, which hands it the model file already read. It keeps the aiScene alive until every mesh is converted. */
+		Assimp::Importer importer{};
+		importer.SetIOHandler(new AssetIOSystem{ modelAbsolutePath, sourceData });
+		aiScene const* scene{ importer.ReadFile(modelAbsolutePath,
 			  aiProcess_Triangulate
 			| aiProcess_JoinIdenticalVertices
 			| aiProcess_SortByPType
 			| aiProcess_FlipUVs
-		);
+		) };
+		sourceFile.clear();
+		sourceFile.shrink_to_fit();
 		if (!scene)
 			throw std::runtime_error(std::format("Failed to read the input model: {}, error: {}", modelAbsolutePath, importer.GetErrorString()));
-		for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
-			outModel.meshes.emplace_back(readMesh(scene->mMeshes[i], scene));
-		return true;
+
+		/* Simplification, meshlet building and texture decoding dominate the import, one task each spreads them over the cores.
+		 * The texture tasks come first so that their reads are all queued on the device before the meshes take the workers. */
+		std::vector<Task<>> tasks{};
+		/* Base color texture of each material, null when it has none. Only the textures of the materials that a mesh uses. */
+		std::vector<std::shared_ptr<Texture const>> materialTextures(scene->mNumMaterials);
+		for (uint32_t m{ 0 }; m < scene->mNumMaterials; ++m)
+		{
+			bool const isUsed{ std::any_of(scene->mMeshes, scene->mMeshes + scene->mNumMeshes, [m](aiMesh const* mesh) { return m == mesh->mMaterialIndex; }) };
+			aiString path{};
+			if (isUsed && (AI_SUCCESS == scene->mMaterials[m]->GetTexture(aiTextureType_BASE_COLOR, 0, &path)
+				|| AI_SUCCESS == scene->mMaterials[m]->GetTexture(aiTextureType_DIFFUSE, 0, &path)))
+				tasks.push_back(LoadMaterialTexture(*scene, modelAbsolutePath, path.C_Str(), priority, materialTextures[m]));
+		}
+		model->meshes.resize(scene->mNumMeshes);
+		for (uint32_t i{ 0 }; i < scene->mNumMeshes; ++i)
+			tasks.push_back(ConvertMesh(*scene, i, vertexFormat, priority, model->meshes[i]));
+		co_await WhenAll{ std::move(tasks) };
+
+		for (uint32_t i{ 0 }; i < model->meshes.size(); ++i)
+			model->meshes[i].BaseColorTexture = materialTextures[scene->mMeshes[i]->mMaterialIndex];
+		importer.FreeScene();
+		if (!WriteMeshCache(cachePath, sourceHash, sourceData.size(), vertexFormat, model->meshes))
+			DebugLog(DebugLevel::Error, std::format("Failed to write the mesh cache for {}", modelAbsolutePath));
+		co_return model;
+	}
+
+	Task<std::vector<std::byte>> ModelLoader::ReadFileAsync(std::string absolutePath, TaskPriority priority)
+	{
+		/* The pack is already mapped, and the callers open the missing files themselves */
+		std::vector<std::byte> file{};
+		std::error_code error{};
+		uint64_t const size{ IsInAssetPack(absolutePath) ? 0 : std::filesystem::file_size(absolutePath, error) };
+		if (error || 0 == size)
+		{
+			co_await mScheduler.Schedule(priority);
+			co_return file;
+		}
+		file.resize(size);
+		/* Named rather than a temporary of the co_await, some compilers mishandle aggregate temporaries across the suspension */
+		ReadAsync read{ mIo, mScheduler, { absolutePath, 0, file, toIoPriority(priority) }, priority };
+		IoResult const result{ co_await read };
+		file.resize(IoStatus::Success == result.Status ? result.BytesRead : 0);
+		co_return file;
+	}
+
+	std::shared_ptr<ShaderProgram> ModelLoader::GetShaderProgram(std::string const& vertexShaderAbsPath, std::string const& fragmentShaderAbsPath)
+	{
+		std::weak_ptr<ShaderProgram>& cached{ mShaderPrograms[vertexShaderAbsPath + '|' + fragmentShaderAbsPath] };
+		std::shared_ptr<ShaderProgram> shaderProgram{ cached.lock() };
+		if (!shaderProgram)
+		{
+			shaderProgram = make_shared<ShaderProgram>(vertexShaderAbsPath, fragmentShaderAbsPath);
+			cached = shaderProgram;
+		}
+		return shaderProgram;
+	}
+
+	void ModelLoader::WriteVertexStreams(Mesh& mesh, VertexFormat format)
+	{
+		mesh.Format = format;
+		if (VertexFormat::Quantized16 == format)
+			mesh.Quantization = ComputeVertexQuantization(mesh.BoundsMin, mesh.BoundsMax);
+
+		auto& positionStream{ mesh.Streams[static_cast<size_t>(VertexStream::Position)] };
+		auto& attributeStream{ mesh.Streams[static_cast<size_t>(VertexStream::Attributes)] };
+		positionStream.reserve(mesh.Vertices.size() * GetStreamStride(format, VertexStream::Position));
+		attributeStream.reserve(mesh.Vertices.size() * GetStreamStride(format, VertexStream::Attributes));
+		for (Vertex const& v : mesh.Vertices)
+			WriteVertex(v, format, mesh.Quantization, positionStream, attributeStream);
+
+		/* The full precision copy is no longer needed, only the streams get uploaded */
+		mesh.Vertices.clear();
+		mesh.Vertices.shrink_to_fit();
+	}
+
+	Task<> ModelLoader::LoadMaterialTexture(aiScene const& scene, std::string const& modelAbsolutePath, std::string texturePath, TaskPriority priority, std::shared_ptr<Texture const>& outTexture)
+	{
+		if (aiTexture const* embedded{ scene.GetEmbeddedTexture(texturePath.c_str()) })
+		{
+			/* Already in memory */
+			co_await mScheduler.Schedule(priority);
+			if (0 == embedded->mHeight)
+			{
+				/* Compressed (PNG, JPEG), mWidth is the size in bytes */
+				outTexture = GetTexture({ reinterpret_cast<std::byte const*>(embedded->pcData), embedded->mWidth });
+			}
+			else
+			{
+				std::span<std::byte const> const texels{ reinterpret_cast<std::byte const*>(embedded->pcData), size_t{ embedded->mWidth } * embedded->mHeight * sizeof(aiTexel) };
+				Texture decoded{};
+				decoded.Width = embedded->mWidth;
+				decoded.Height = embedded->mHeight;
+				decoded.ContentHash = HashBytes(texels);
+				decoded.Pixels.reserve(texels.size());
+				for (aiTexel const& texel : std::span{ embedded->pcData, size_t{ embedded->mWidth } * embedded->mHeight })
+					decoded.Pixels.insert(decoded.Pixels.end(), { texel.r, texel.g, texel.b, texel.a });
+				outTexture = ShareTexture(std::make_shared<Texture>(CompressTexture(decoded, ChooseCompressedFormat(decoded))));
+			}
+			co_return;
+		}
+
+		std::string const absolutePath{ getTextureAbsolutePath(modelAbsolutePath, texturePath) };
+		std::vector<std::byte> const textureFile{ co_await ReadFileAsync(absolutePath, priority) };
+		if (!textureFile.empty())
+		{
+			outTexture = GetTexture(textureFile);
+			co_return;
+		}
+		/* In the pack, or the read failed */
+		AssetFile const file{ absolutePath };
+		if (file.IsOpen())
+			outTexture = GetTexture(file.GetData());
+		else
+			DebugLog(DebugLevel::Error, std::format("Failed to open the texture {}", absolutePath));
+	}
+
+	Task<> ModelLoader::ConvertMesh(aiScene const& scene, uint32_t meshIndex, VertexFormat vertexFormat, TaskPriority priority, Mesh& outMesh)
+	{
+		co_await mScheduler.Schedule(priority);
+		outMesh = readMesh(scene.mMeshes[meshIndex], &scene);
+		WriteVertexStreams(outMesh, vertexFormat);
+	}
+
+	std::shared_ptr<Texture const> ModelLoader::GetTexture(std::span<std::byte const> encodedData)
+	{
+		/* Hash the encoded data, a texture shared by several models is decoded once */
+		uint64_t const contentHash{ HashBytes(encodedData) };
+		{
+			std::lock_guard lock{ mTexturesMutex };
+			auto const it{ mTextures.find(contentHash) };
+			if (it != mTextures.end() && std::ranges::equal(it->second.EncodedData, encodedData))
+			{
+				if (std::shared_ptr<Texture const> texture{ it->second.Decoded.lock() })
+					return texture;
+			}
+		}
+
+		/* Already GPU-ready */
+		if (IsKtx2(encodedData))
+		{
+			std::shared_ptr<Texture> texture{ std::make_shared<Texture>() };
+			if (!ReadKtx2(encodedData, *texture))
+			{
+				DebugLog(DebugLevel::Error, "Failed to read a KTX2 texture, only uncompressed BC1, BC3, BC5 and BC7 2D textures are supported");
+				return nullptr;
+			}
+			texture->ContentHash = contentHash;
+			return ShareTexture(std::move(texture), encodedData);
+		}
+
+		/* RGB images, most JPEGs, are decoded as they are and expanded with the SIMD kernel rather than by stb per texel */
+		stbi_uc const* encodedPixels{ reinterpret_cast<stbi_uc const*>(encodedData.data()) };
+		int const encodedSize{ static_cast<int>(encodedData.size()) };
+		int width{ 0 };
+		int height{ 0 };
+		int channels{ 0 };
+		if (!stbi_info_from_memory(encodedPixels, encodedSize, &width, &height, &channels))
+			channels = STBI_rgb_alpha;
+		int const decodedChannels{ STBI_rgb == channels ? STBI_rgb : STBI_rgb_alpha };
+		stbi_uc* pixels{ stbi_load_from_memory(encodedPixels, encodedSize, &width, &height, &channels, decodedChannels) };
+		if (!pixels)
+		{
+			DebugLog(DebugLevel::Error, std::format("Failed to decode a texture: {}", stbi_failure_reason()));
+			return nullptr;
+		}
+		Texture decoded{};
+		decoded.Width = static_cast<uint32_t>(width);
+		decoded.Height = static_cast<uint32_t>(height);
+		decoded.ContentHash = contentHash;
+		size_t const texelCount{ size_t{ decoded.Width } * decoded.Height };
+		if (STBI_rgb == decodedChannels)
+		{
+			decoded.Pixels.resize(texelCount * 4);
+			ExpandRgbToRgba({ pixels, texelCount * 3 }, decoded.Pixels);
+		}
+		else
+			decoded.Pixels.assign(pixels, pixels + texelCount * 4);
+		stbi_image_free(pixels);
+		/* Encoded once at import, the mesh cache then stores the blocks: 4 to 8 times less memory and bandwidth than RGBA8 */
+		return ShareTexture(std::make_shared<Texture>(CompressTexture(decoded, ChooseCompressedFormat(decoded))), encodedData);
+	}
+
+	std::shared_ptr<Texture const> ModelLoader::ShareTexture(std::shared_ptr<Texture const> texture, std::span<std::byte const> encodedData)
+	{
+		std::lock_guard lock{ mTexturesMutex };
+		SharedTexture& shared{ mTextures[texture->ContentHash] };
+		/* Another load may have decoded the same content in the meantime. Different texels with the same hash are not shared. */
+		if (std::shared_ptr<Texture const> existing{ shared.Decoded.lock() })
+		{
+			if (!HaveSameTexels(*existing, *texture))
+				return texture;
+			if (shared.EncodedData.empty())
+				shared.EncodedData.assign(encodedData.begin(), encodedData.end());
+			return existing;
+		}
+		shared = { texture, { encodedData.begin(), encodedData.end() } };
+		std::erase_if(mTextures, [](auto const& entry) { return entry.second.Decoded.expired(); });
+		return texture;
 	}
 
-} // namespace gg
\ No newline at end of file
+} // namespace gg
@@ -0,0 +1,409 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <memory>
+#include <span>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define GG_SSE
+#endif
+module OcclusionCulling;
+
+using namespace DirectX;
+
+namespace
+{
+	using namespace gg;
+
+	constexpr uint32_t TILE_SIZE{ OcclusionBuffer::TILE_SIZE };
+	constexpr uint64_t FULL_COVERAGE{ ~0ull };
+	/* Tile rows rasterized by one job */
+	constexpr uint32_t BAND_TILE_ROWS{ 2 };
+	/* Twice the screen area below which a triangle covers no pixel center worth the setup */
+	constexpr float MIN_TRIANGLE_AREA{ 1e-4f };
+
+	struct ClipVertex
+	{
+		float X, Y, Z, W;
+	};
+
+	/* Sutherland-Hodgman against z >= 0, the near plane of a projection with depth in [0, 1]. A triangle leaves at most 4 vertices. */
+	uint32_t clipNear(std::array<ClipVertex, 3> const& triangle, std::array<ClipVertex, 4>& outPolygon)
+	{
+		uint32_t count{ 0 };
+		for (uint32_t i{ 0 }; i < 3; ++i)
+		{
+			ClipVertex const& a{ triangle[i] };
+			ClipVertex const& b{ triangle[(i + 1) % 3] };
+			if (a.Z >= 0.f)
+				outPolygon[count++] = a;
+			if ((a.Z >= 0.f) != (b.Z >= 0.f))
+			{
+				float const t{ a.Z / (a.Z - b.Z) };
+				outPolygon[count++] = { a.X + t * (b.X - a.X), a.Y + t * (b.Y - a.Y), 0.f, a.W + t * (b.W - a.W) };
+			}
+		}
+		return count;
+	}
+
+	template <typename Triangle>
+	bool isTopLeft(Triangle const& triangle, uint32_t edge)
+	{
+		/* The inside is to the right of a left edge, or below a horizontal top edge since y points down */
+		return triangle.EdgeA[edge] > 0.f || (0.f == triangle.EdgeA[edge] && triangle.EdgeB[edge] > 0.f);
+	}
+
+	/* Bit 8 * y + x for each pixel (x, y) of the tile whose center is inside the three edges. A center exactly on an edge belongs to the
+	 * triangle when the edge is a top or left one, so that the two triangles of a shared edge cover it once and tiles fill up. */
+	template <typename Triangle>
+	uint64_t computeCoverage(Triangle const& triangle, float tileX, float tileY)
+	{
+		uint64_t coverage{ 0 };
+#if defined(GG_SSE)
+		/* Two halves of 4 pixels per row */
+		std::array<__m128, 2> const x{
+			_mm_add_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps(tileX)),
+			_mm_add_ps(_mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f), _mm_set1_ps(tileX)) };
+		std::array<std::array<__m128, 2>, 3> edges{};
+		std::array<__m128, 3> steps{};
+		std::array<__m128, 3> inclusive{};
+		__m128 const allOnes{ _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps()) };
+		for (uint32_t e{ 0 }; e < 3; ++e)
+		{
+			__m128 const a{ _mm_set1_ps(triangle.EdgeA[e]) };
+			__m128 const rowStart{ _mm_set1_ps(triangle.EdgeB[e] * (tileY + 0.5f) + triangle.EdgeC[e]) };
+			edges[e] = { _mm_add_ps(_mm_mul_ps(a, x[0]), rowStart), _mm_add_ps(_mm_mul_ps(a, x[1]), rowStart) };
+			steps[e] = _mm_set1_ps(triangle.EdgeB[e]);
+			inclusive[e] = isTopLeft(triangle, e) ? allOnes : _mm_setzero_ps();
+		}
+		for (uint32_t y{ 0 }; y < TILE_SIZE; ++y)
+		{
+			uint64_t row{ 0 };
+			for (uint32_t h{ 0 }; h < 2; ++h)
+			{
+				__m128 inside{ allOnes };
+				for (uint32_t e{ 0 }; e < 3; ++e)
+				{
+					inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(edges[e][h], _mm_setzero_ps()),
+						_mm_and_ps(inclusive[e], _mm_cmpeq_ps(edges[e][h], _mm_setzero_ps()))));
+					edges[e][h] = _mm_add_ps(edges[e][h], steps[e]);
+				}
+				row |= static_cast<uint64_t>(_mm_movemask_ps(inside)) << (4 * h);
+			}
+			coverage |= row << (TILE_SIZE * y);
+		}
+#else
+		for (uint32_t y{ 0 }; y < TILE_SIZE; ++y)
+		{
+			for (uint32_t x{ 0 }; x < TILE_SIZE; ++x)
+			{
+				float const px{ tileX + x + 0.5f };
+				float const py{ tileY + y + 0.5f };
+				bool inside{ true };
+				for (uint32_t e{ 0 }; e < 3; ++e)
+				{
+					float const edge{ triangle.EdgeA[e] * px + triangle.EdgeB[e] * py + triangle.EdgeC[e] };
+					inside &= edge > 0.f || (0.f == edge && isTopLeft(triangle, e));
+				}
+				if (inside)
+					coverage |= 1ull << (TILE_SIZE * y + x);
+			}
+		}
+#endif
+		return coverage;
+	}
+}
+
+namespace gg
+{
+	void OcclusionBuffer::Resize(uint32_t width, uint32_t height)
+	{
+		mTileCountX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		mTileCountY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		mWidth = mTileCountX * TILE_SIZE;
+		mHeight = mTileCountY * TILE_SIZE;
+		mCoverage.resize(mTileCountX * mTileCountY);
+		mReferenceDepths.resize(mCoverage.size());
+		mWorkingDepths.resize(mCoverage.size());
+		Clear();
+	}
+
+	void OcclusionBuffer::SetJobSystem(std::shared_ptr<JobSystem> jobs)
+	{
+		mJobs = std::move(jobs);
+	}
+
+	void OcclusionBuffer::Clear()
+	{
+		std::fill(mCoverage.begin(), mCoverage.end(), 0ull);
+		std::fill(mReferenceDepths.begin(), mReferenceDepths.end(), 1.f);
+		std::fill(mWorkingDepths.begin(), mWorkingDepths.end(), 0.f);
+		mOccluders.clear();
+		mTriangleCount = 0;
+	}
+
+	void OcclusionBuffer::AddOccluder(std::span<XMFLOAT3 const> positions, std::span<uint32_t const> indices, XMMATRIX const& modelViewProjection)
+	{
+		Occluder occluder{ positions, indices };
+		XMStoreFloat4x4(&occluder.ModelViewProjection, modelViewProjection);
+		mOccluders.push_back(occluder);
+	}
+
+	void OcclusionBuffer::Rasterize()
+	{
+		if (mCoverage.empty())
+			return;
+
+		if (mTriangles.size() < mOccluders.size())
+			mTriangles.resize(mOccluders.size());
+		auto const setupOccluders{ [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t o{ begin }; o < end; ++o)
+				SetupTriangles(mOccluders[o], mTriangles[o]);
+		} };
+		uint32_t const bandCount{ (mTileCountY + BAND_TILE_ROWS - 1) / BAND_TILE_ROWS };
+		auto const rasterizeBands{ [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t band{ begin }; band < end; ++band)
+				RasterizeBand(band * BAND_TILE_ROWS, std::min((band + 1) * BAND_TILE_ROWS, mTileCountY));
+		} };
+
+		uint32_t const occluderCount{ static_cast<uint32_t>(mOccluders.size()) };
+		if (mJobs)
+		{
+			mJobs->ParallelFor(occluderCount, 1, setupOccluders);
+			mJobs->ParallelFor(bandCount, 1, rasterizeBands);
+		}
+		else
+		{
+			setupOccluders(0, occluderCount);
+			rasterizeBands(0, bandCount);
+		}
+
+		mTriangleCount = 0;
+		for (uint32_t o{ 0 }; o < occluderCount; ++o)
+			mTriangleCount += static_cast<uint32_t>(mTriangles[o].size());
+		mOccluders.clear();
+	}
+
+	void OcclusionBuffer::SetupTriangles(Occluder const& occluder, std::vector<Triangle>& outTriangles) const
+	{
+		outTriangles.clear();
+		XMMATRIX const modelViewProjection{ XMLoadFloat4x4(&occluder.ModelViewProjection) };
+		std::vector<ClipVertex> vertices(occluder.Positions.size());
+		for (size_t v{ 0 }; v < vertices.size(); ++v)
+		{
+			XMFLOAT4 clip{};
+			XMStoreFloat4(&clip, XMVector3Transform(XMLoadFloat3(&occluder.Positions[v]), modelViewProjection));
+			vertices[v] = { clip.x, clip.y, clip.z, clip.w };
+		}
+
+		float const width{ static_cast<float>(mWidth) };
+		float const height{ static_cast<float>(mHeight) };
+		auto const toScreen{ [width, height](ClipVertex const& v)
+		{
+			float const inverseW{ 1.f / v.W };
+			/* Vulkan's y points down, like the rows */
+			return XMFLOAT3{ (v.X * inverseW * 0.5f + 0.5f) * width, (v.Y * inverseW * 0.5f + 0.5f) * height, v.Z * inverseW };
+		} };
+
+		for (size_t i{ 0 }; i + 2 < occluder.Indices.size(); i += 3)
+		{
+			std::array<ClipVertex, 3> const triangle{ vertices[occluder.Indices[i]], vertices[occluder.Indices[i + 1]], vertices[occluder.Indices[i + 2]] };
+			std::array<ClipVertex, 4> polygon{};
+			uint32_t const polygonSize{ clipNear(triangle, polygon) };
+
+			/* Fan of the clipped polygon */
+			for (uint32_t f{ 2 }; f < polygonSize; ++f)
+			{
+				std::array<XMFLOAT3, 3> v{ toScreen(polygon[0]), toScreen(polygon[f - 1]), toScreen(polygon[f]) };
+				float area{ (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y) };
+				if (area < 0.f)
+				{
+					std::swap(v[1], v[2]);
+					area = -area;
+				}
+				if (area < MIN_TRIANGLE_AREA)
+					continue;
+
+				float const minX{ std::min({ v[0].x, v[1].x, v[2].x }) };
+				float const minY{ std::min({ v[0].y, v[1].y, v[2].y }) };
+				float const maxX{ std::max({ v[0].x, v[1].x, v[2].x }) };
+				float const maxY{ std::max({ v[0].y, v[1].y, v[2].y }) };
+				if (maxX < 0.f || maxY < 0.f || minX >= width || minY >= height)
+					continue;
+
+				Triangle setup{};
+				for (uint32_t e{ 0 }; e < 3; ++e)
+				{
+					/* From the same end whichever triangle shares the edge, so that their edge functions are exact opposites */
+					XMFLOAT3 const& from{ v[e] };
+					XMFLOAT3 const& to{ v[(e + 1) % 3] };
+					bool const isFlipped{ to.x < from.x || (to.x == from.x && to.y < from.y) };
+					XMFLOAT3 const& a{ isFlipped ? to : from };
+					XMFLOAT3 const& b{ isFlipped ? from : to };
+					float const sign{ isFlipped ? -1.f : 1.f };
+					float const edgeA{ a.y - b.y };
+					float const edgeB{ b.x - a.x };
+					setup.EdgeA[e] = sign * edgeA;
+					setup.EdgeB[e] = sign * edgeB;
+					setup.EdgeC[e] = sign * (-edgeA * a.x - edgeB * a.y);
+				}
+				float const dz1{ v[1].z - v[0].z };
+				float const dz2{ v[2].z - v[0].z };
+				setup.DepthDx = (dz1 * (v[2].y - v[0].y) - dz2 * (v[1].y - v[0].y)) / area;
+				setup.DepthDy = (dz2 * (v[1].x - v[0].x) - dz1 * (v[2].x - v[0].x)) / area;
+				setup.DepthOrigin = v[0].z - setup.DepthDx * v[0].x - setup.DepthDy * v[0].y;
+				setup.MaxDepth = std::max({ v[0].z, v[1].z, v[2].z });
+				if (setup.MaxDepth >= 1.f)
+					continue;
+				setup.MinX = static_cast<int32_t>(std::max(minX, 0.f));
+				setup.MinY = static_cast<int32_t>(std::max(minY, 0.f));
+				setup.MaxX = static_cast<int32_t>(std::min(maxX, width - 1.f));
+				setup.MaxY = static_cast<int32_t>(std::min(maxY, height - 1.f));
+				outTriangles.push_back(setup);
+			}
+		}
+	}
+
+	void OcclusionBuffer::RasterizeBand(uint32_t firstRow, uint32_t endRow)
+	{
+		int32_t const bandMinY{ static_cast<int32_t>(firstRow * TILE_SIZE) };
+		int32_t const bandMaxY{ static_cast<int32_t>(endRow * TILE_SIZE) - 1 };
+		for (size_t o{ 0 }; o < mOccluders.size(); ++o)
+		{
+			for (Triangle const& triangle : mTriangles[o])
+			{
+				if (triangle.MaxY < bandMinY || triangle.MinY > bandMaxY)
+					continue;
+				uint32_t const tileMinY{ static_cast<uint32_t>(std::max(triangle.MinY, bandMinY)) / TILE_SIZE };
+				uint32_t const tileMaxY{ static_cast<uint32_t>(std::min(triangle.MaxY, bandMaxY)) / TILE_SIZE };
+				uint32_t const tileMinX{ static_cast<uint32_t>(triangle.MinX) / TILE_SIZE };
+				uint32_t const tileMaxX{ static_cast<uint32_t>(triangle.MaxX) / TILE_SIZE };
+				for (uint32_t ty{ tileMinY }; ty <= tileMaxY; ++ty)
+				{
+					float const tileY{ static_cast<float>(ty * TILE_SIZE) };
+					for (uint32_t tx{ tileMinX }; tx <= tileMaxX; ++tx)
+					{
+						float const tileX{ static_cast<float>(tx * TILE_SIZE) };
+						uint64_t const coverage{ computeCoverage(triangle, tileX, tileY) };
+						if (0 == coverage)
+							continue;
+						/* The plane is linear, so its farthest point over the tile is a corner, and it never gets past the farthest vertex */
+						float const depth{ std::min(triangle.MaxDepth, triangle.DepthOrigin
+							+ std::max(triangle.DepthDx * tileX, triangle.DepthDx * (tileX + TILE_SIZE))
+							+ std::max(triangle.DepthDy * tileY, triangle.DepthDy * (tileY + TILE_SIZE))) };
+						UpdateTile(ty * mTileCountX + tx, coverage, depth);
+					}
+				}
+			}
+		}
+	}
+
+	void OcclusionBuffer::UpdateTile(uint32_t tileIndex, uint64_t coverage, float depth)
+	{
+		float& referenceDepth{ mReferenceDepths[tileIndex] };
+		float& workingDepth{ mWorkingDepths[tileIndex] };
+		uint64_t& mask{ mCoverage[tileIndex] };
+		/* Already hidden by the reference layer */
+		if (depth >= referenceDepth)
+			return;
+
+		/* A triangle much farther than the working layer would loosen it more than the reference layer gains from it: start over */
+		if (0 != mask && depth - workingDepth > referenceDepth - depth)
+		{
+			mask = 0;
+			workingDepth = 0.f;
+		}
+		workingDepth = std::max(workingDepth, depth);
+		mask |= coverage;
+		if (FULL_COVERAGE == mask)
+		{
+			referenceDepth = workingDepth;
+			workingDepth = 0.f;
+			mask = 0;
+		}
+	}
+
+	bool OcclusionBuffer::IsBoxOccluded(XMFLOAT3 const& center, XMFLOAT3 const& extent, XMMATRIX const& viewProjection) const
+	{
+		if (mCoverage.empty())
+			return false;
+
+		float minX{ FLT_MAX };
+		float minY{ FLT_MAX };
+		float maxX{ -FLT_MAX };
+		float maxY{ -FLT_MAX };
+		float nearestDepth{ FLT_MAX };
+		for (uint32_t c{ 0 }; c < 8; ++c)
+		{
+			XMVECTOR const corner{ XMVectorSet(
+				center.x + ((c & 1) ? extent.x : -extent.x),
+				center.y + ((c & 2) ? extent.y : -extent.y),
+				center.z + ((c & 4) ? extent.z : -extent.z), 1.f) };
+			XMFLOAT4 clip{};
+			XMStoreFloat4(&clip, XMVector4Transform(corner, viewProjection));
+			if (clip.z < 0.f)
+				return false;
+			float const inverseW{ 1.f / clip.w };
+			minX = std::min(minX, clip.x * inverseW);
+			minY = std::min(minY, clip.y * inverseW);
+			maxX = std::max(maxX, clip.x * inverseW);
+			maxY = std::max(maxY, clip.y * inverseW);
+			nearestDepth = std::min(nearestDepth, clip.z * inverseW);
+		}
+
+		/* Every pixel the rectangle touches, clamped in float before the conversion */
+		auto const toPixel{ [](float ndc, uint32_t size)
+		{
+			return static_cast<int32_t>(std::clamp(std::floor((ndc * 0.5f + 0.5f) * size), 0.f, size - 1.f));
+		} };
+		int32_t const x0{ toPixel(minX, mWidth) };
+		int32_t const y0{ toPixel(minY, mHeight) };
+		int32_t const x1{ toPixel(maxX, mWidth) };
+		int32_t const y1{ toPixel(maxY, mHeight) };
+
+		int32_t const tileSize{ static_cast<int32_t>(TILE_SIZE) };
+		for (int32_t ty{ y0 / tileSize }; ty <= y1 / tileSize; ++ty)
+		{
+			int32_t const rowBegin{ std::max(y0 - ty * tileSize, 0) };
+			int32_t const rowEnd{ std::min(y1 - ty * tileSize, tileSize - 1) };
+			for (int32_t tx{ x0 / tileSize }; tx <= x1 / tileSize; ++tx)
+			{
+				int32_t const columnBegin{ std::max(x0 - tx * tileSize, 0) };
+				int32_t const columnEnd{ std::min(x1 - tx * tileSize, tileSize - 1) };
+				uint64_t const rowMask{ (0xFFull >> (tileSize - 1 - (columnEnd - columnBegin))) << columnBegin };
+				uint64_t rectangle{ 0 };
+				for (int32_t y{ rowBegin }; y <= rowEnd; ++y)
+					rectangle |= rowMask << (tileSize * y);
+
+				uint32_t const tileIndex{ static_cast<uint32_t>(ty) * mTileCountX + static_cast<uint32_t>(tx) };
+				/* The working layer only bounds the pixels it covers */
+				float const farthestDepth{ (rectangle & ~mCoverage[tileIndex]) ? mReferenceDepths[tileIndex] : mWorkingDepths[tileIndex] };
+				if (nearestDepth <= farthestDepth)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	void OcclusionBuffer::CullBoxes(BoundingBoxes const& boxes, XMMATRIX const& viewProjection, std::vector<uint32_t>& inOutVisibleIndices) const
+	{
+		float const* const centerX{ boxes.GetComponent(BoundingBoxes::CenterX) };
+		float const* const centerY{ boxes.GetComponent(BoundingBoxes::CenterY) };
+		float const* const centerZ{ boxes.GetComponent(BoundingBoxes::CenterZ) };
+		float const* const extentX{ boxes.GetComponent(BoundingBoxes::ExtentX) };
+		float const* const extentY{ boxes.GetComponent(BoundingBoxes::ExtentY) };
+		float const* const extentZ{ boxes.GetComponent(BoundingBoxes::ExtentZ) };
+		std::erase_if(inOutVisibleIndices, [&](uint32_t i)
+		{
+			return IsBoxOccluded({ centerX[i], centerY[i], centerZ[i] }, { extentX[i], extentY[i], extentZ[i] }, viewProjection);
+		});
+	}
+
+} // namespace gg
@@ -0,0 +1,71 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#if defined(__SSSE3__) || defined(_M_X64)
+#include <tmmintrin.h>
+#define GG_SSSE3
+#endif
+#if !defined(__SSSE3__) && defined(_M_X64)
+#include <intrin.h>
+#endif
+module PixelConversion;
+
+import ErrorHandling;
+
+namespace
+{
+#ifdef GG_SSSE3
+	/* x64 only guarantees SSE2, without -mssse3 the CPU is asked once */
+	bool isSsse3Supported()
+	{
+#if defined(__SSSE3__)
+		return true;
+#else
+		static bool const isSupported{ [] {
+			int info[4]{};
+			__cpuid(info, 1);
+			return 0 != (info[2] & (1 << 9)); /* ECX bit 9: SSSE3 */
+		}() };
+		return isSupported;
+#endif
+	}
+#endif
+}
+
+namespace gg
+{
+	void ExpandRgbToRgba(std::span<uint8_t const> rgb, std::span<uint8_t> outRgba)
+	{
+		BreakIfFalse(rgb.size() % 3 == 0 && outRgba.size() / 4 == rgb.size() / 3);
+		size_t const texelCount{ rgb.size() / 3 };
+		uint8_t const* source{ rgb.data() };
+		uint8_t* destination{ outRgba.data() };
+		size_t texel{ 0 };
+#ifdef GG_SSSE3
+		/* 4 loads of 16 bytes cover 16 texels (48 bytes), each shuffle spreads 4 of them and the alpha is or-ed in */
+		__m128i const spread{ _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1) };
+		__m128i const alpha{ _mm_set1_epi32(static_cast<int>(0xFF000000)) };
+		size_t const vectorTexelCount{ isSsse3Supported() ? texelCount : 0 };
+		for (; texel + 16 <= vectorTexelCount; texel += 16)
+		{
+			__m128i const a{ _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + texel * 3)) };
+			__m128i const b{ _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + texel * 3 + 16)) };
+			__m128i const c{ _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + texel * 3 + 32)) };
+			__m128i* output{ reinterpret_cast<__m128i*>(destination + texel * 4) };
+			_mm_storeu_si128(output, _mm_or_si128(_mm_shuffle_epi8(a, spread), alpha));
+			_mm_storeu_si128(output + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread), alpha));
+			_mm_storeu_si128(output + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), spread), alpha));
+			_mm_storeu_si128(output + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), spread), alpha));
+		}
+#endif
+		for (; texel < texelCount; ++texel)
+		{
+			destination[texel * 4] = source[texel * 3];
+			destination[texel * 4 + 1] = source[texel * 3 + 1];
+			destination[texel * 4 + 2] = source[texel * 3 + 2];
+			destination[texel * 4 + 3] = 255;
+		}
+	}
+
+} // namespace gg
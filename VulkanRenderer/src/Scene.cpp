@@ -0,0 +1,431 @@
+module;
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <DirectXMath.h>
+#include <exception>
+#include <format>
+#include <future>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+module Scene;
+
+import Bvh;
+import Culling;
+import ErrorHandling;
+import JobSystem;
+import Logging;
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t INVALID_INSTANCE_INDEX{ std::numeric_limits<uint32_t>::max() };
+	constexpr uint32_t INVALID_LIGHT_INDEX{ std::numeric_limits<uint32_t>::max() };
+	/* Rebuild once a query costs this much more than right after the last build */
+	constexpr float BVH_REBUILD_COST_RATIO{ 1.5f };
+	/* Or once this many instances, or an eighth of them, were added or removed since */
+	constexpr uint32_t BVH_REBUILD_CHANGE_COUNT{ 64 };
+
+	/* Bounding sphere of the mesh bounding boxes, and the half extent of the box around them */
+	XMFLOAT4 computeModelBounds(gg::Model const& model, XMFLOAT3& outBoxExtent)
+	{
+		outBoxExtent = {};
+		XMVECTOR boundsMin{ XMVectorReplicate(std::numeric_limits<float>::max()) };
+		XMVECTOR boundsMax{ XMVectorReplicate(-std::numeric_limits<float>::max()) };
+		for (gg::Mesh const& mesh : model.meshes)
+		{
+			boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&mesh.BoundsMin));
+			boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&mesh.BoundsMax));
+		}
+		if (model.meshes.empty())
+			return {};
+
+		XMVECTOR const center{ XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f) };
+		XMVECTOR const extent{ XMVectorSubtract(boundsMax, center) };
+		XMStoreFloat3(&outBoxExtent, extent);
+		XMFLOAT4 bounds{};
+		XMStoreFloat4(&bounds, XMVectorSetW(center, XMVectorGetX(XMVector3Length(extent))));
+		return bounds;
+	}
+}
+
+namespace gg
+{
+	ModelId Scene::AddModel(std::unique_ptr<Model> model)
+	{
+		BreakIfFalse(model != nullptr);
+		ModelId const id{ AllocateModelId() };
+		SetModelData(id, std::move(model));
+		return id;
+	}
+
+	ModelId Scene::AddModel(std::future<std::unique_ptr<Model>> model)
+	{
+		BreakIfFalse(model.valid());
+		ModelId const id{ AllocateModelId() };
+		ModelSlot& slot{ mModels[id] };
+		slot.PendingData = std::move(model);
+		slot.State = Residency::Loading;
+		mLoadingModels.push_back(id);
+		++mVersion;
+		return id;
+	}
+
+	void Scene::UpdateLoadingModels()
+	{
+		/* Collect first, a failed load removes the model from the list */
+		std::vector<ModelId> loaded{};
+		for (ModelId id : mLoadingModels)
+		{
+			if (std::future_status::ready == mModels[id].PendingData.wait_for(std::chrono::seconds{ 0 }))
+				loaded.push_back(id);
+		}
+
+		for (ModelId id : loaded)
+		{
+			std::erase(mLoadingModels, id);
+			try
+			{
+				std::unique_ptr<Model> model{ mModels[id].PendingData.get() };
+				BreakIfFalse(model != nullptr);
+				SetModelData(id, std::move(model));
+			}
+			catch (std::exception const& e)
+			{
+				DebugLog(DebugLevel::Error, std::format("Failed to load a model: {}", e.what()));
+				RemoveModel(id);
+				continue;
+			}
+
+			/* The instances were placed with empty bounds */
+			for (uint32_t i{ 0 }; i < mInstances.size(); ++i)
+			{
+				if (id == mInstanceModels[i])
+					UpdateInstanceBounds(i);
+			}
+		}
+	}
+
+	void Scene::RemoveModel(ModelId id)
+	{
+		BreakIfFalse(IsValid(id) && Residency::Releasing != mModels[id].State);
+		/* Backwards, removal only moves instances that have already been visited */
+		for (size_t i{ mInstances.size() }; i-- > 0;)
+		{
+			if (id == mInstanceModels[i])
+				RemoveInstance(mInstanceIds[i]);
+		}
+
+		if (Residency::Loading == mModels[id].State || Residency::Pending == mModels[id].State)
+		{
+			/* Never uploaded, nothing to wait for. A load still running completes into the dropped future. */
+			std::erase(mLoadingModels, id);
+			std::erase(mPendingUploads, id);
+			ReleaseModel(id);
+		}
+		else
+		{
+			mModels[id].State = Residency::Releasing;
+			mPendingReleases.push_back(id);
+		}
+		++mVersion;
+	}
+
+	Model const& Scene::GetModel(ModelId id) const
+	{
+		BreakIfFalse(IsValid(id) && Residency::Loading != mModels[id].State);
+		return *mModels[id].Data;
+	}
+
+	Residency Scene::GetResidency(ModelId id) const
+	{
+		BreakIfFalse(IsValid(id));
+		return mModels[id].State;
+	}
+
+	uint32_t Scene::GetModelIdLimit() const { return static_cast<uint32_t>(mModels.size()); }
+
+	bool Scene::IsValid(ModelId id) const { return id < mModels.size() && (mModels[id].Data != nullptr || Residency::Loading == mModels[id].State); }
+
+	InstanceId Scene::AddInstance(ModelId modelId, XMMATRIX const& objectMatrix, XMFLOAT4 const& color)
+	{
+		BreakIfFalse(IsValid(modelId) && Residency::Releasing != mModels[modelId].State);
+
+		InstanceId id{ static_cast<InstanceId>(mInstanceIndices.size()) };
+		if (mFreeInstanceIds.empty())
+		{
+			mInstanceIndices.push_back(INVALID_INSTANCE_INDEX);
+			mInstanceAabbs.emplace_back();
+			mIsInBvh.push_back(false);
+		}
+		else
+		{
+			id = mFreeInstanceIds.back();
+			mFreeInstanceIds.pop_back();
+		}
+		/* A recycled id still in the BVH is found there again once refitted */
+		if (mIsInBvh[id])
+			--mStaleBvhPrimitiveCount;
+		else
+			mUnindexedInstances.push_back(id);
+		uint32_t const index{ static_cast<uint32_t>(mInstances.size()) };
+		mInstanceIndices[id] = index;
+		mInstanceIds.push_back(id);
+		mInstanceModels.push_back(modelId);
+		mInstanceBounds.emplace_back();
+		mInstanceBoxes.Resize(index + 1);
+		InstanceData& instance{ mInstances.emplace_back() };
+		XMStoreFloat4x4(&instance.ObjectMatrix, objectMatrix);
+		instance.Color = color;
+		UpdateInstanceBounds(index);
+		++mVersion;
+		return id;
+	}
+
+	void Scene::SetInstanceTransform(InstanceId id, XMMATRIX const& objectMatrix)
+	{
+		BreakIfFalse(id < mInstanceIndices.size() && INVALID_INSTANCE_INDEX != mInstanceIndices[id]);
+		uint32_t const index{ mInstanceIndices[id] };
+		XMStoreFloat4x4(&mInstances[index].ObjectMatrix, objectMatrix);
+		UpdateInstanceBounds(index);
+	}
+
+	void Scene::SetInstanceColor(InstanceId id, XMFLOAT4 const& color)
+	{
+		BreakIfFalse(id < mInstanceIndices.size() && INVALID_INSTANCE_INDEX != mInstanceIndices[id]);
+		mInstances[mInstanceIndices[id]].Color = color;
+	}
+
+	void Scene::RemoveInstance(InstanceId id)
+	{
+		BreakIfFalse(id < mInstanceIndices.size() && INVALID_INSTANCE_INDEX != mInstanceIndices[id]);
+
+		/* Keep the instances dense: move the last one into the hole */
+		uint32_t const index{ mInstanceIndices[id] };
+		InstanceId const lastId{ mInstanceIds.back() };
+		mInstances[index] = mInstances.back();
+		mInstanceModels[index] = mInstanceModels.back();
+		mInstanceBounds[index] = mInstanceBounds.back();
+		mInstanceBoxes.Copy(mInstanceBoxes.GetSize() - 1, index);
+		mInstanceIds[index] = lastId;
+		mInstanceIndices[lastId] = index;
+		mInstances.pop_back();
+		mInstanceModels.pop_back();
+		mInstanceBounds.pop_back();
+		mInstanceBoxes.Resize(mInstanceBoxes.GetSize() - 1);
+		mInstanceIds.pop_back();
+		mInstanceIndices[id] = INVALID_INSTANCE_INDEX;
+		mFreeInstanceIds.push_back(id);
+		/* The node bounds stay conservative, the empty box is never returned */
+		mInstanceAabbs[id] = {};
+		if (mIsInBvh[id])
+			++mStaleBvhPrimitiveCount;
+		else
+			std::erase(mUnindexedInstances, id);
+		++mVersion;
+	}
+
+	LightId Scene::AddPointLight(PointLight const& light)
+	{
+		LightId id{ static_cast<LightId>(mLightIndices.size()) };
+		if (mFreeLightIds.empty())
+			mLightIndices.push_back(INVALID_LIGHT_INDEX);
+		else
+		{
+			id = mFreeLightIds.back();
+			mFreeLightIds.pop_back();
+		}
+		mLightIndices[id] = static_cast<uint32_t>(mPointLights.size());
+		mLightIds.push_back(id);
+		mPointLights.push_back(light);
+		return id;
+	}
+
+	void Scene::SetPointLight(LightId id, PointLight const& light)
+	{
+		BreakIfFalse(id < mLightIndices.size() && INVALID_LIGHT_INDEX != mLightIndices[id]);
+		mPointLights[mLightIndices[id]] = light;
+	}
+
+	void Scene::RemovePointLight(LightId id)
+	{
+		BreakIfFalse(id < mLightIndices.size() && INVALID_LIGHT_INDEX != mLightIndices[id]);
+
+		uint32_t const index{ mLightIndices[id] };
+		LightId const lastId{ mLightIds.back() };
+		mPointLights[index] = mPointLights.back();
+		mLightIds[index] = lastId;
+		mLightIndices[lastId] = index;
+		mPointLights.pop_back();
+		mLightIds.pop_back();
+		mLightIndices[id] = INVALID_LIGHT_INDEX;
+		mFreeLightIds.push_back(id);
+	}
+
+	void Scene::SetJobSystem(std::shared_ptr<JobSystem> jobs) { mJobs = std::move(jobs); }
+
+	void Scene::UpdateBvh()
+	{
+		if (mBvhRebuild && mBvhRebuildJob.IsDone())
+			FinishBvhRebuild();
+		/* Past a quarter of the tree the paths overlap, one full pass is cheaper */
+		if (mIsBvhRefitNeeded || mMovedInstances.size() > mBvh.GetPrimitives().size() / 4)
+			mBvh.Refit(mInstanceAabbs);
+		else if (!mMovedInstances.empty())
+			mBvh.Refit(mInstanceAabbs, mMovedInstances);
+		mIsBvhRefitNeeded = false;
+		mMovedInstances.clear();
+		if (mBvhRebuild)
+			return;
+
+		uint32_t const changeLimit{ std::max(BVH_REBUILD_CHANGE_COUNT, static_cast<uint32_t>(mInstances.size()) / 8) };
+		if (mUnindexedInstances.size() > changeLimit || mStaleBvhPrimitiveCount > changeLimit
+			|| mBvh.GetCost() > BVH_REBUILD_COST_RATIO * mBvh.GetBuildCost())
+			StartBvhRebuild();
+	}
+
+	void Scene::CullInstances(Frustum const& frustum, std::vector<uint32_t>& outVisibleIndices) const
+	{
+		/* Until the first build the scene is small enough for the flat pass */
+		if (mBvh.IsEmpty())
+		{
+			CullBoxes(frustum, mInstanceBoxes, outVisibleIndices);
+			return;
+		}
+
+		outVisibleIndices.clear();
+		mBvh.CullFrustum(frustum, mInstanceAabbs, outVisibleIndices);
+		for (uint32_t& index : outVisibleIndices)
+			index = mInstanceIndices[index];
+		for (InstanceId id : mUnindexedInstances)
+		{
+			if (frustum.IntersectsBox(mInstanceAabbs[id]))
+				outVisibleIndices.push_back(mInstanceIndices[id]);
+		}
+	}
+
+	std::optional<InstanceId> Scene::IntersectRay(XMFLOAT3 const& origin, XMFLOAT3 const& direction, float maxDistance) const
+	{
+		std::optional<InstanceId> nearest{};
+		if (std::optional<BvhHit> const hit{ mBvh.IntersectRay(origin, direction, maxDistance, mInstanceAabbs) })
+		{
+			nearest = hit->Primitive;
+			maxDistance = hit->Distance;
+		}
+		XMFLOAT3 const inverseDirection{ 1.f / direction.x, 1.f / direction.y, 1.f / direction.z };
+		for (InstanceId id : mUnindexedInstances)
+		{
+			float const distance{ IntersectRayBox(origin, inverseDirection, mInstanceAabbs[id]) };
+			if (distance <= maxDistance)
+			{
+				nearest = id;
+				maxDistance = distance;
+			}
+		}
+		return nearest;
+	}
+
+	std::vector<ModelId> Scene::TakePendingUploads() { return std::exchange(mPendingUploads, {}); }
+
+	std::vector<ModelId> Scene::TakePendingReleases() { return std::exchange(mPendingReleases, {}); }
+
+	void Scene::SetResident(ModelId id)
+	{
+		BreakIfFalse(IsValid(id) && Residency::Pending == mModels[id].State);
+		mModels[id].State = Residency::Resident;
+	}
+
+	void Scene::ReleaseModel(ModelId id)
+	{
+		BreakIfFalse(IsValid(id));
+		mModels[id] = {};
+		mFreeModelIds.push_back(id);
+	}
+
+	ModelId Scene::AllocateModelId()
+	{
+		if (mFreeModelIds.empty())
+		{
+			mModels.emplace_back();
+			return static_cast<ModelId>(mModels.size() - 1);
+		}
+		ModelId const id{ mFreeModelIds.back() };
+		mFreeModelIds.pop_back();
+		return id;
+	}
+
+	void Scene::SetModelData(ModelId id, std::unique_ptr<Model> model)
+	{
+		ModelSlot& slot{ mModels[id] };
+		slot.Bounds = computeModelBounds(*model, slot.BoxExtent);
+		slot.Data = std::move(model);
+		slot.State = Residency::Pending;
+		mPendingUploads.push_back(id);
+		++mVersion;
+	}
+
+	void Scene::StartBvhRebuild()
+	{
+		/* On copies, the scene keeps changing meanwhile */
+		mBvhRebuild = std::make_shared<BvhRebuild>();
+		mBvhRebuild->Boxes = mInstanceAabbs;
+		mBvhRebuild->Primitives = mInstanceIds;
+		if (!mJobs)
+		{
+			mBvhRebuild->Result.Build(mBvhRebuild->Boxes, mBvhRebuild->Primitives);
+			FinishBvhRebuild();
+			return;
+		}
+		mBvhRebuildJob = mJobs->Run([rebuild{ mBvhRebuild }] { rebuild->Result.Build(rebuild->Boxes, rebuild->Primitives); });
+	}
+
+	void Scene::FinishBvhRebuild()
+	{
+		mBvh = std::move(mBvhRebuild->Result);
+		mBvhRebuild = nullptr;
+		mBvhRebuildJob = {};
+
+		/* The instances removed, added or moved since the copies */
+		std::fill(mIsInBvh.begin(), mIsInBvh.end(), false);
+		mStaleBvhPrimitiveCount = 0;
+		for (InstanceId id : mBvh.GetPrimitives())
+		{
+			mIsInBvh[id] = true;
+			if (INVALID_INSTANCE_INDEX == mInstanceIndices[id])
+				++mStaleBvhPrimitiveCount;
+		}
+		mUnindexedInstances.clear();
+		for (InstanceId id : mInstanceIds)
+		{
+			if (!mIsInBvh[id])
+				mUnindexedInstances.push_back(id);
+		}
+		mIsBvhRefitNeeded = true;
+	}
+
+	void Scene::UpdateInstanceBounds(uint32_t index)
+	{
+		ModelSlot const& model{ mModels[mInstanceModels[index]] };
+		XMFLOAT4 const& modelBounds{ model.Bounds };
+		XMMATRIX const objectMatrix{ XMLoadFloat4x4(&mInstances[index].ObjectMatrix) };
+		float const maxScale{ GetMaxScale(objectMatrix) };
+		XMVECTOR const center{ XMVector3Transform(XMLoadFloat4(&modelBounds), objectMatrix) };
+		XMStoreFloat4(&mInstanceBounds[index], XMVectorSetW(center, modelBounds.w * maxScale));
+
+		XMFLOAT3 boxCenter{};
+		XMFLOAT3 boxExtent{};
+		TransformBox({ modelBounds.x, modelBounds.y, modelBounds.z }, model.BoxExtent, objectMatrix, boxCenter, boxExtent);
+		mInstanceBoxes.Set(index, boxCenter, boxExtent);
+
+		InstanceId const id{ mInstanceIds[index] };
+		XMStoreFloat3(&mInstanceAabbs[id].Min, XMVectorSubtract(XMLoadFloat3(&boxCenter), XMLoadFloat3(&boxExtent)));
+		XMStoreFloat3(&mInstanceAabbs[id].Max, XMVectorAdd(XMLoadFloat3(&boxCenter), XMLoadFloat3(&boxExtent)));
+		if (mIsInBvh[id])
+			mMovedInstances.push_back(id);
+	}
+
+} // namespace gg
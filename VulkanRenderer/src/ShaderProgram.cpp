@@ -1,7 +1,6 @@
 module;
 #include <cassert>
 #include <format>
-#include <fstream>
 #include <memory>
 #include <string>
 #include <utility>
@@ -9,16 +8,25 @@ module;
 module ShaderProgram;
 
 import Application;
-import ErrorHandling;
+import AssetPack;
 
 namespace
 {
-	VkShaderModule createShaderModule(VkDevice device, std::string const& shaderBlob)
+	using namespace gg;
+
+	/* SPIR-V is read in place, the pack and the mappings keep the words aligned */
+	VkShaderModule createShaderModule(VkDevice device, std::string const& shaderAbsPath)
 	{
+		AssetFile const shaderBlob{ shaderAbsPath };
+		if (!shaderBlob.IsOpen())
+		{
+			throw std::runtime_error(std::format("failed to open file: {}", shaderAbsPath));
+		}
+
 		VkShaderModuleCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = shaderBlob.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(shaderBlob.data());
+		createInfo.codeSize = shaderBlob.GetData().size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(shaderBlob.GetData().data());
 		VkShaderModule shaderModule;
 		if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
 		{
@@ -26,41 +34,20 @@ namespace
 		}
 		return shaderModule;
 	}
-
-	std::string readFile(std::string const& filename)
-	{
-		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-		if (!file.is_open())
-		{
-			throw std::runtime_error(std::format("failed to open file: {}", filename));
-		}
-
-		size_t const fileSize = static_cast<size_t>(file.tellg());
-		std::string buffer{};
-		buffer.resize(fileSize);
-		file.seekg(0);
-		file.read(buffer.data(), fileSize);
-		file.close();
-		return buffer;
-	}
 }
 
 namespace gg
 {
-	ShaderProgram::ShaderProgram(std::string const& vertexShaderAbsPath, std::string const& fragmentShaderAbsPath)
-		: vertexShaderBlob{ readFile(vertexShaderAbsPath) }
-		, fragmentShaderBlob{ readFile(fragmentShaderAbsPath) }
+	VkShaderModule LoadShaderModule(VkDevice device, std::string const& shaderAbsPath)
 	{
-		BreakIfFalse(vertexShaderBlob.size() != 0);
-		BreakIfFalse(fragmentShaderBlob.size() != 0);
+		return createShaderModule(device, shaderAbsPath);
+	}
 
+	ShaderProgram::ShaderProgram(std::string const& vertexShaderAbsPath, std::string const& fragmentShaderAbsPath)
+	{
 		device = Application::Get()->GetRenderer()->GetDevice();
-		vertexShader = createShaderModule(device, vertexShaderBlob);
-		fragmentShader = createShaderModule(device, fragmentShaderBlob);
-
-		vertexShaderBlob.clear();
-		fragmentShaderBlob.clear();
+		vertexShader = createShaderModule(device, vertexShaderAbsPath);
+		fragmentShader = createShaderModule(device, fragmentShaderAbsPath);
 	}
 
 	ShaderProgram::~ShaderProgram()
@@ -0,0 +1,61 @@
+module;
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+module Task;
+
+import JobSystem;
+
+namespace gg
+{
+	TaskScheduler::TaskScheduler(std::shared_ptr<JobSystem> jobs)
+		: mJobs{ std::move(jobs) }
+	{
+	}
+
+	TaskScheduler::~TaskScheduler()
+	{
+		while (mPendingCount.load() > 0)
+		{
+			if (!mJobs->RunPendingJob())
+				std::this_thread::yield();
+		}
+	}
+
+	void TaskScheduler::Enqueue(std::coroutine_handle<> handle, TaskPriority priority)
+	{
+		{
+			std::lock_guard lock{ mMutex };
+			mReady[static_cast<uint32_t>(priority)].push_back(handle);
+		}
+		mPendingCount.fetch_add(1);
+		/* One job per coroutine, each resumes whichever has the highest priority when it runs */
+		mJobs->Run([this] { ResumeNext(); });
+	}
+
+	void TaskScheduler::ResumeNext()
+	{
+		std::coroutine_handle<> handle{};
+		{
+			std::lock_guard lock{ mMutex };
+			for (std::deque<std::coroutine_handle<>>& ready : mReady)
+			{
+				if (!ready.empty())
+				{
+					handle = ready.front();
+					ready.pop_front();
+					break;
+				}
+			}
+		}
+		handle.resume();
+		/* Last, the scheduler may be destroyed right after */
+		mPendingCount.fetch_sub(1);
+	}
+
+} // namespace gg
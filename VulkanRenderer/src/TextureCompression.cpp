@@ -0,0 +1,275 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+module TextureCompression;
+
+import MipChain;
+import Model;
+
+namespace
+{
+	using namespace gg;
+
+	using Block = std::array<std::array<uint8_t, 4>, 16>;
+
+	/* Edge texels are repeated for the partial blocks of levels that are not a multiple of 4 */
+	Block readBlock(uint8_t const* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY)
+	{
+		Block block{};
+		for (uint32_t y{ 0 }; y < 4; ++y)
+		{
+			uint32_t const sourceY{ std::min(blockY * 4 + y, height - 1) };
+			for (uint32_t x{ 0 }; x < 4; ++x)
+			{
+				uint32_t const sourceX{ std::min(blockX * 4 + x, width - 1) };
+				memcpy(block[y * 4 + x].data(), pixels + (size_t{ sourceY } * width + sourceX) * 4, 4);
+			}
+		}
+		return block;
+	}
+
+	uint16_t packRgb565(float const* color)
+	{
+		uint32_t const r{ static_cast<uint32_t>(std::clamp(color[0], 0.f, 255.f) * 31.f / 255.f + 0.5f) };
+		uint32_t const g{ static_cast<uint32_t>(std::clamp(color[1], 0.f, 255.f) * 63.f / 255.f + 0.5f) };
+		uint32_t const b{ static_cast<uint32_t>(std::clamp(color[2], 0.f, 255.f) * 31.f / 255.f + 0.5f) };
+		return static_cast<uint16_t>(r << 11 | g << 5 | b);
+	}
+
+	std::array<int32_t, 3> unpackRgb565(uint16_t color)
+	{
+		int32_t const r{ color >> 11 & 31 };
+		int32_t const g{ color >> 5 & 63 };
+		int32_t const b{ color & 31 };
+		return { r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2 };
+	}
+
+	/* Color half of BC1 and BC3, always in the 4 color mode */
+	void encodeColorBlock(Block const& block, uint8_t* output)
+	{
+		float mean[3]{};
+		for (auto const& texel : block)
+			for (uint32_t c{ 0 }; c < 3; ++c)
+				mean[c] += texel[c] / 16.f;
+
+		/* Principal axis of the colors by power iteration on their covariance */
+		float covariance[6]{};
+		for (auto const& texel : block)
+		{
+			float const d[3]{ texel[0] - mean[0], texel[1] - mean[1], texel[2] - mean[2] };
+			covariance[0] += d[0] * d[0];
+			covariance[1] += d[0] * d[1];
+			covariance[2] += d[0] * d[2];
+			covariance[3] += d[1] * d[1];
+			covariance[4] += d[1] * d[2];
+			covariance[5] += d[2] * d[2];
+		}
+		float axis[3]{ 1.f, 1.f, 1.f };
+		for (uint32_t i{ 0 }; i < 4; ++i)
+		{
+			float const next[3]{
+				covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+				covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+				covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2] };
+			float const length{ std::max({ std::abs(next[0]), std::abs(next[1]), std::abs(next[2]) }) };
+			if (length < 1e-6f)
+				break;
+			for (uint32_t c{ 0 }; c < 3; ++c)
+				axis[c] = next[c] / length;
+		}
+
+		/* The extreme projections are the endpoints, inset slightly since the palette ends are rarely hit exactly */
+		float minProjection{ 0.f };
+		float maxProjection{ 0.f };
+		float const axisLengthSquared{ axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] };
+		for (auto const& texel : block)
+		{
+			float const projection{ ((texel[0] - mean[0]) * axis[0] + (texel[1] - mean[1]) * axis[1] + (texel[2] - mean[2]) * axis[2]) / axisLengthSquared };
+			minProjection = std::min(minProjection, projection);
+			maxProjection = std::max(maxProjection, projection);
+		}
+		float const inset{ (maxProjection - minProjection) / 32.f };
+		float endpoints[2][3]{};
+		for (uint32_t c{ 0 }; c < 3; ++c)
+		{
+			endpoints[0][c] = mean[c] + axis[c] * (maxProjection - inset);
+			endpoints[1][c] = mean[c] + axis[c] * (minProjection + inset);
+		}
+
+		uint16_t color0{ packRgb565(endpoints[0]) };
+		uint16_t color1{ packRgb565(endpoints[1]) };
+		/* color0 > color1 selects the 4 color mode */
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		uint32_t indices{ 0 };
+		if (color0 != color1)
+		{
+			std::array<int32_t, 3> const c0{ unpackRgb565(color0) };
+			std::array<int32_t, 3> const c1{ unpackRgb565(color1) };
+			std::array<std::array<int32_t, 3>, 4> palette{ c0, c1 };
+			for (uint32_t c{ 0 }; c < 3; ++c)
+			{
+				palette[2][c] = (2 * c0[c] + c1[c]) / 3;
+				palette[3][c] = (c0[c] + 2 * c1[c]) / 3;
+			}
+			for (uint32_t i{ 0 }; i < 16; ++i)
+			{
+				uint32_t bestIndex{ 0 };
+				int32_t bestDistance{ INT32_MAX };
+				for (uint32_t p{ 0 }; p < 4; ++p)
+				{
+					int32_t distance{ 0 };
+					for (uint32_t c{ 0 }; c < 3; ++c)
+						distance += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						bestIndex = p;
+					}
+				}
+				indices |= bestIndex << (2 * i);
+			}
+		}
+
+		memcpy(output, &color0, 2);
+		memcpy(output + 2, &color1, 2);
+		memcpy(output + 4, &indices, 4);
+	}
+
+	/* BC4, the alpha half of BC3 and each channel of BC5, always in the 8 value mode */
+	void encodeChannelBlock(Block const& block, uint32_t channel, uint8_t* output)
+	{
+		uint8_t minValue{ 255 };
+		uint8_t maxValue{ 0 };
+		for (auto const& texel : block)
+		{
+			minValue = std::min(minValue, texel[channel]);
+			maxValue = std::max(maxValue, texel[channel]);
+		}
+
+		uint64_t indices{ 0 };
+		if (minValue != maxValue)
+		{
+			std::array<int32_t, 8> palette{ maxValue, minValue };
+			for (int32_t p{ 1 }; p < 7; ++p)
+				palette[p + 1] = ((7 - p) * maxValue + p * minValue) / 7;
+			for (uint32_t i{ 0 }; i < 16; ++i)
+			{
+				uint64_t bestIndex{ 0 };
+				int32_t bestDistance{ INT32_MAX };
+				for (uint32_t p{ 0 }; p < 8; ++p)
+				{
+					int32_t const distance{ std::abs(block[i][channel] - palette[p]) };
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						bestIndex = p;
+					}
+				}
+				indices |= bestIndex << (3 * i);
+			}
+		}
+
+		output[0] = maxValue;
+		output[1] = minValue;
+		memcpy(output + 2, &indices, 6);
+	}
+
+	void encodeBlock(Block const& block, TextureFormat format, uint8_t* output)
+	{
+		switch (format)
+		{
+		case TextureFormat::Bc1Unorm:
+		case TextureFormat::Bc1Srgb:
+			encodeColorBlock(block, output);
+			break;
+		case TextureFormat::Bc3Unorm:
+		case TextureFormat::Bc3Srgb:
+			encodeChannelBlock(block, 3, output);
+			encodeColorBlock(block, output + 8);
+			break;
+		case TextureFormat::Bc5Unorm:
+			encodeChannelBlock(block, 0, output);
+			encodeChannelBlock(block, 1, output + 8);
+			break;
+		default:
+			throw std::runtime_error("unsupported texture compression format!");
+		}
+	}
+}
+
+namespace gg
+{
+	bool IsBlockCompressed(TextureFormat format)
+	{
+		return TextureFormat::Rgba8Srgb != format;
+	}
+
+	size_t GetTextureLevelSize(TextureFormat format, uint32_t width, uint32_t height)
+	{
+		switch (format)
+		{
+		case TextureFormat::Rgba8Srgb:
+			return size_t{ width } * height * 4;
+		case TextureFormat::Bc1Unorm:
+		case TextureFormat::Bc1Srgb:
+			return size_t{ (width + 3) / 4 } * ((height + 3) / 4) * 8;
+		default:
+			return size_t{ (width + 3) / 4 } * ((height + 3) / 4) * 16;
+		}
+	}
+
+	TextureFormat ChooseCompressedFormat(Texture const& source)
+	{
+		for (size_t i{ 3 }; i < source.Pixels.size(); i += 4)
+			if (source.Pixels[i] < 255)
+				return TextureFormat::Bc3Srgb;
+		return TextureFormat::Bc1Srgb;
+	}
+
+	Texture CompressTexture(Texture const& source, TextureFormat format)
+	{
+		if (TextureFormat::Rgba8Srgb != source.Format || !source.Levels.empty())
+			throw std::runtime_error("only uncompressed textures without mips can be compressed!");
+
+		std::vector<MipLevel> sourceLevels{};
+		std::vector<uint8_t> const chain{ BuildMipChain(source.Pixels, source.Width, source.Height, sourceLevels) };
+
+		Texture compressed{};
+		compressed.Width = source.Width;
+		compressed.Height = source.Height;
+		compressed.Format = format;
+		compressed.ContentHash = source.ContentHash;
+		size_t sizeBytes{ 0 };
+		for (MipLevel const& level : sourceLevels)
+		{
+			compressed.Levels.push_back({ sizeBytes, level.Width, level.Height });
+			sizeBytes += GetTextureLevelSize(format, level.Width, level.Height);
+		}
+		compressed.Pixels.resize(sizeBytes);
+
+		size_t const blockSize{ GetTextureLevelSize(format, 1, 1) };
+		for (size_t l{ 0 }; l < sourceLevels.size(); ++l)
+		{
+			MipLevel const& level{ sourceLevels[l] };
+			uint8_t* output{ compressed.Pixels.data() + compressed.Levels[l].Offset };
+			for (uint32_t blockY{ 0 }; blockY < (level.Height + 3) / 4; ++blockY)
+			{
+				for (uint32_t blockX{ 0 }; blockX < (level.Width + 3) / 4; ++blockX)
+				{
+					encodeBlock(readBlock(chain.data() + level.Offset, level.Width, level.Height, blockX, blockY), format, output);
+					output += blockSize;
+				}
+			}
+		}
+		return compressed;
+	}
+
+} // namespace gg
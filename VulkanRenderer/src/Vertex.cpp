@@ -1,34 +1,175 @@
 module;
-#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+#include <vector>
 #include <vulkan/vulkan.h>
 module Vertex;
 
 import Model;
 
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertFloatToHalf;
+
+namespace
+{
+	constexpr float UNORM16_MAX{ 65535.f };
+	constexpr float SNORM16_MAX{ 32767.f };
+
+	uint16_t quantizeUnorm16(float value, float bias, float scale)
+	{
+		float const normalized{ scale > 0.f ? (value - bias) / scale : 0.f };
+		return static_cast<uint16_t>(std::clamp(normalized, 0.f, 1.f) * UNORM16_MAX + 0.5f);
+	}
+
+	uint16_t quantizeSnorm16(float value)
+	{
+		return static_cast<uint16_t>(static_cast<int16_t>(std::round(std::clamp(value, -1.f, 1.f) * SNORM16_MAX)));
+	}
+
+	template<typename T>
+	void appendBytes(std::vector<uint8_t>& stream, T const& element)
+	{
+		uint8_t const* bytes{ reinterpret_cast<uint8_t const*>(&element) };
+		stream.insert(stream.end(), bytes, bytes + sizeof(T));
+	}
+
+	float signNotZero(float value)
+	{
+		return value >= 0.f ? 1.f : -1.f;
+	}
+}
+
 namespace gg
 {
-	VkVertexInputBindingDescription Vertex::GetBindingDescription()
+	std::vector<VkVertexInputBindingDescription> Vertex::GetBindingDescriptions(VertexFormat format, VertexStreams streams)
 	{
-		VkVertexInputBindingDescription bindingDescription{};
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		return bindingDescription;
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions{};
+
+		VkVertexInputBindingDescription& position{ bindingDescriptions.emplace_back() };
+		position.binding = static_cast<uint32_t>(VertexStream::Position);
+		position.stride = GetStreamStride(format, VertexStream::Position);
+		position.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		if (VertexStreams::All == streams)
+		{
+			VkVertexInputBindingDescription& attributes{ bindingDescriptions.emplace_back() };
+			attributes.binding = static_cast<uint32_t>(VertexStream::Attributes);
+			attributes.stride = GetStreamStride(format, VertexStream::Attributes);
+			attributes.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		}
+		return bindingDescriptions;
 	}
 
-	std::array<VkVertexInputAttributeDescription, 2> Vertex::GetAttributeDescriptions()
+	std::vector<VkVertexInputAttributeDescription> Vertex::GetAttributeDescriptions(VertexFormat format, VertexStreams streams)
 	{
-		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
-		attributeDescriptions[0].binding = 0;
-		attributeDescriptions[0].location = 0;
-		attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-		attributeDescriptions[0].offset = offsetof(Vertex, Position);
+		bool const isQuantized{ VertexFormat::Quantized16 == format };
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
 
-		attributeDescriptions[1].binding = 0;
-		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, TextureCoords0);
+		VkVertexInputAttributeDescription& position{ attributeDescriptions.emplace_back() };
+		position.binding = static_cast<uint32_t>(VertexStream::Position);
+		position.location = 0;
+		position.format = isQuantized ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+		position.offset = 0;
+
+		if (VertexStreams::All == streams)
+		{
+			VkVertexInputAttributeDescription& uv{ attributeDescriptions.emplace_back() };
+			uv.binding = static_cast<uint32_t>(VertexStream::Attributes);
+			uv.location = 1;
+			uv.format = isQuantized ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+			uv.offset = isQuantized ? offsetof(QuantizedAttributes, TextureCoords0) : offsetof(VertexAttributes, TextureCoords0);
+		}
 		return attributeDescriptions;
 	}
 
+	uint32_t GetStreamStride(VertexFormat format, VertexStream stream)
+	{
+		if (VertexFormat::Quantized16 == format)
+			return VertexStream::Position == stream ? sizeof(QuantizedPosition) : sizeof(QuantizedAttributes);
+		return VertexStream::Position == stream ? sizeof(XMFLOAT3) : sizeof(VertexAttributes);
+	}
+
+	uint32_t GetVertexStride(VertexFormat format)
+	{
+		return GetStreamStride(format, VertexStream::Position) + GetStreamStride(format, VertexStream::Attributes);
+	}
+
+	void WriteVertex(Vertex const& vertex, VertexFormat format, VertexQuantization const& quantization, std::vector<uint8_t>& positionStream, std::vector<uint8_t>& attributeStream)
+	{
+		if (VertexFormat::Quantized16 == format)
+		{
+			QuantizedAttributes attributes{};
+			attributes.TextureCoords0[0] = XMConvertFloatToHalf(vertex.TextureCoords0.x);
+			attributes.TextureCoords0[1] = XMConvertFloatToHalf(vertex.TextureCoords0.y);
+			appendBytes(positionStream, QuantizePosition(vertex.Position, quantization));
+			appendBytes(attributeStream, attributes);
+		}
+		else
+		{
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, vertex.Position);
+			appendBytes(positionStream, position);
+			appendBytes(attributeStream, VertexAttributes{ vertex.TextureCoords0 });
+		}
+	}
+
+	VertexQuantization ComputeVertexQuantization(XMFLOAT3 const& boundsMin, XMFLOAT3 const& boundsMax)
+	{
+		VertexQuantization quantization{};
+		quantization.Scale = { boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z, 0.f };
+		quantization.Bias = { boundsMin.x, boundsMin.y, boundsMin.z, 0.f };
+		return quantization;
+	}
+
+	QuantizedPosition QuantizePosition(XMVECTOR position, VertexQuantization const& quantization)
+	{
+		XMFLOAT3 p;
+		XMStoreFloat3(&p, position);
+
+		QuantizedPosition result{};
+		result.Position[0] = quantizeUnorm16(p.x, quantization.Bias.x, quantization.Scale.x);
+		result.Position[1] = quantizeUnorm16(p.y, quantization.Bias.y, quantization.Scale.y);
+		result.Position[2] = quantizeUnorm16(p.z, quantization.Bias.z, quantization.Scale.z);
+		return result;
+	}
+
+	XMFLOAT3 DecodePosition(QuantizedPosition const& position, VertexQuantization const& quantization)
+	{
+		return {
+			position.Position[0] / UNORM16_MAX * quantization.Scale.x + quantization.Bias.x,
+			position.Position[1] / UNORM16_MAX * quantization.Scale.y + quantization.Bias.y,
+			position.Position[2] / UNORM16_MAX * quantization.Scale.z + quantization.Bias.z };
+	}
+
+	uint32_t EncodeOctahedral(XMFLOAT3 const& v)
+	{
+		/* Project onto the octahedron and fold the lower hemisphere over the diagonals */
+		float const invL1Norm{ 1.f / (std::abs(v.x) + std::abs(v.y) + std::abs(v.z)) };
+		float x{ v.x * invL1Norm };
+		float y{ v.y * invL1Norm };
+		if (v.z < 0.f)
+		{
+			float const foldedX{ (1.f - std::abs(y)) * signNotZero(x) };
+			float const foldedY{ (1.f - std::abs(x)) * signNotZero(y) };
+			x = foldedX;
+			y = foldedY;
+		}
+		return static_cast<uint32_t>(quantizeSnorm16(x)) | (static_cast<uint32_t>(quantizeSnorm16(y)) << 16);
+	}
+
+	XMFLOAT3 DecodeOctahedral(uint32_t encoded)
+	{
+		float const x{ std::max(static_cast<int16_t>(encoded & 0xFFFF) / SNORM16_MAX, -1.f) };
+		float const y{ std::max(static_cast<int16_t>(encoded >> 16) / SNORM16_MAX, -1.f) };
+		XMFLOAT3 v{ x, y, 1.f - std::abs(x) - std::abs(y) };
+		float const t{ std::max(-v.z, 0.f) };
+		v.x += v.x >= 0.f ? -t : t;
+		v.y += v.y >= 0.f ? -t : t;
+		XMStoreFloat3(&v, XMVector3Normalize(XMLoadFloat3(&v)));
+		return v;
+	}
+
 } // namespace gg
@@ -1,7 +1,9 @@
 module;
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <DirectXMath.h>
 #include <filesystem>
 #include <format>
@@ -13,7 +15,7 @@ module;
 #include <SDL2/SDL_video.h>
 #include <SDL2/SDL_vulkan.h>
 #include <set>
-#include <stb_image.h>
+#include <span>
 #include <vector>
 #include <vulkan/vulkan.h>
 
@@ -27,8 +29,13 @@ import Camera;
 import ErrorHandling;
 import GlobalSettings;
 import Input;
+import Logging;
 import Vertex;
 import ModelLoader;
+import DrawSort;
+import JobSystem;
+import Scene;
+import ShaderProgram;
 
 using namespace DirectX;
 
@@ -69,6 +76,8 @@ namespace gg
 		CreateLogicalDevice();
 		CreateSwapChain();
 		CreateImageViews();
+		mDepthFormat = FindDepthFormat();
+		CreateDepthResources();
 		CreateRenderPass();
 
 		CreateUniformBuffers();
@@ -77,15 +86,20 @@ namespace gg
 		CreateFrameBuffers();
 		CreateCommandPool();
 
-		CreateTextureImage();
-		CreateTextureImageView();
 		CreateTextureSampler();
-
-		CreateDescriptorPool();
-		CreateDescriptorSets();
+		CreateStagingBuffer();
+		/* Its buffers are in every set 0 */
+		CreateClusteredLighting();
+		CreateDefaultMaterial();
 
 		CreateCommandBuffers();
 		CreateSyncObjects();
+		CreateStatisticsQueryPool();
+
+		/* The graphics pipelines are created once the first models become resident */
+		CreateMeshletSetLayouts();
+		CreateMeshletCullingPipeline();
+		CreateGraphicsPipelines();
 	}
 
 	void VulkanRenderer::CreateVkInstance(std::vector<char const*> const& layers, std::vector<char const*> const& extensions)
@@ -208,48 +222,109 @@ namespace gg
 			mSwapChainImageViews[i] = CreateImageView(mSwapChainImages[i], mSwapChainImageFormat);
 	}
 
-	void VulkanRenderer::CreateRenderPass()
+	void VulkanRenderer::CreateDepthResources()
+	{
+		CreateImage(mSwapChainExtent.width, mSwapChainExtent.height, 1, mDepthFormat, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mDepthImage, mDepthImageMemory);
+		mDepthImageView = CreateImageView(mDepthImage, mDepthFormat, 1, 0, VK_IMAGE_ASPECT_DEPTH_BIT);
+	}
+
+	VkFormat VulkanRenderer::FindDepthFormat() const
+	{
+		/* Most precise first, a device supports at least one of the first two, and D16 */
+		VkFormatFeatureFlags const requiredFeatures{ VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT };
+		for (VkFormat format : { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM })
+		{
+			VkFormatProperties properties{};
+			vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, format, &properties);
+			if (requiredFeatures == (properties.optimalTilingFeatures & requiredFeatures))
+				return format;
+		}
+		throw std::runtime_error("failed to find a supported depth format!");
+	}
+
+	/* A pass that is not first continues from the layouts the previous one leaves: the color still to be presented,
+	 the depth read by the depth pyramid build in between */
+	static VkRenderPass createRenderPass(VkDevice device, VkFormat colorFormat, VkFormat depthFormat, bool isFirst, bool isLast)
 	{
 		VkAttachmentDescription colorAttachment{};
-		colorAttachment.format = mSwapChainImageFormat;
+		colorAttachment.format = colorFormat;
 		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.loadOp = isFirst ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
 		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachment.initialLayout = isFirst ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.finalLayout = isLast ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentDescription depthAttachment{};
+		depthAttachment.format = depthFormat;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = isFirst ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+		depthAttachment.storeOp = isLast ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = isFirst ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthAttachment.finalLayout = isLast ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
 		VkAttachmentReference colorAttachmentRef{};
 		colorAttachmentRef.attachment = 0;
 		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
+		VkAttachmentReference depthAttachmentRef{};
+		depthAttachmentRef.attachment = 1;
+		depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		/* The depth of the previous frame or pass is overwritten, and a later pass waits for the pyramid build to read it */
+		std::array<VkSubpassDependency, 2> dependencies{};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		if (!isFirst)
+			dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+			| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		/* The depth pyramid build samples the depth */
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 		VkSubpassDescription subpass{};
 		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		subpass.colorAttachmentCount = 1;
 		subpass.pColorAttachments = &colorAttachmentRef;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+		std::array<VkAttachmentDescription, 2> const attachments{ colorAttachment, depthAttachment };
 		VkRenderPassCreateInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = 1;
-		renderPassInfo.pAttachments = &colorAttachment;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
 		renderPassInfo.subpassCount = 1;
 		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+		renderPassInfo.dependencyCount = isLast ? 1 : 2;
+		renderPassInfo.pDependencies = dependencies.data();
 
-		if (VK_SUCCESS != vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &mRenderPass))
+		VkRenderPass renderPass{};
+		if (VK_SUCCESS != vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass))
 		{
 			throw std::runtime_error("failed to create render pass!");
 		}
+		return renderPass;
+	}
 
+	void VulkanRenderer::CreateRenderPass()
+	{
+		mRenderPass = createRenderPass(mDevice, mSwapChainImageFormat, mDepthFormat, true, true);
+		mOcclusionRenderPasses[static_cast<uint32_t>(OcclusionPhase::Early)] = createRenderPass(mDevice, mSwapChainImageFormat, mDepthFormat, true, false);
+		mOcclusionRenderPasses[static_cast<uint32_t>(OcclusionPhase::Late)] = createRenderPass(mDevice, mSwapChainImageFormat, mDepthFormat, false, true);
 	}
 
 	void VulkanRenderer::CreateDescriptorSetLayout()
@@ -258,7 +333,9 @@ namespace gg
 		uboLayoutBinding.binding = 0;
 		uboLayoutBinding.descriptorCount = 1;
 		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		if (mMeshShadingSupported)
+			uboLayoutBinding.stageFlags |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
 
 		VkDescriptorSetLayoutBinding samplerLayoutBinding{};
 		samplerLayoutBinding.binding = 1;
@@ -266,7 +343,29 @@ namespace gg
 		samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-		std::array<VkDescriptorSetLayoutBinding, 2> bindings { uboLayoutBinding, samplerLayoutBinding };
+		/* Written by UploadInstances */
+		VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+		instanceLayoutBinding.binding = 2;
+		instanceLayoutBinding.descriptorCount = 1;
+		instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		if (mMeshShadingSupported)
+			instanceLayoutBinding.stageFlags |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+
+		/* The lights, the offset and count of each cluster, the light index lists and their counter, see WriteLightingDescriptors.
+		 The light culling pass writes them, the pixel shaders read the lists of their cluster. */
+		std::array<VkDescriptorSetLayoutBinding, 4> lightingLayoutBindings{};
+		for (uint32_t b{ 0 }; b < lightingLayoutBindings.size(); ++b)
+		{
+			lightingLayoutBindings[b].binding = 3 + b;
+			lightingLayoutBindings[b].descriptorCount = 1;
+			lightingLayoutBindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lightingLayoutBindings[b].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		lightingLayoutBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		std::array<VkDescriptorSetLayoutBinding, 7> bindings { uboLayoutBinding, samplerLayoutBinding, instanceLayoutBinding
+			, lightingLayoutBindings[0], lightingLayoutBindings[1], lightingLayoutBindings[2], lightingLayoutBindings[3] };
 		VkDescriptorSetLayoutCreateInfo layoutInfo{};
 		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -276,31 +375,20 @@ namespace gg
 			throw std::runtime_error("failed to create descriptor set layout!");
 	}
 
-	void VulkanRenderer::CreateGraphicsPipeline()
+	void VulkanRenderer::CreateGraphicsPipelines()
 	{
 		VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 		vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageInfo.module = mModel->shaderProgram->GetVertexShader();
 		vertShaderStageInfo.pName = VS_ENTRY_POINT;
 
 		VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
 		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageInfo.module = mModel->shaderProgram->GetFragmentShader();
 		fragShaderStageInfo.pName = FS_ENTRY_POINT;
 
-		VkPipelineShaderStageCreateInfo const shaderStages[]{ vertShaderStageInfo, fragShaderStageInfo };
-
-		auto bindingDescription = Vertex::GetBindingDescription();
-		auto attributeDescriptions = Vertex::GetAttributeDescriptions();
-
 		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 		VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
 		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -341,6 +429,15 @@ namespace gg
 		multisampling.sampleShadingEnable = VK_FALSE;
 		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+		VkPipelineDepthStencilStateCreateInfo depthStencil{};
+		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencil.depthTestEnable = VK_TRUE;
+		depthStencil.depthWriteEnable = VK_TRUE;
+		/* Equal passes where the depth prepass already wrote, the draws it skips still write their own depth */
+		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+		depthStencil.depthBoundsTestEnable = VK_FALSE;
+		depthStencil.stencilTestEnable = VK_FALSE;
+
 		VkPipelineColorBlendAttachmentState colorBlendAttachment{};
 		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 		colorBlendAttachment.blendEnable = VK_FALSE;
@@ -363,31 +460,185 @@ namespace gg
 		pipelineLayoutInfo.setLayoutCount = 1;
 		pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
 
-		if (VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout))
+		/* Per-mesh dequantization scale and bias */
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(VertexQuantization);
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		/* The layouts outlive the swap chain, only the pipelines bake its extent */
+		if (!mPipelineLayout && VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout))
 		{
 			throw std::runtime_error("failed to create pipeline layout!");
 		}
 
 		VkGraphicsPipelineCreateInfo pipelineInfo{};
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineInfo.stageCount = 2;
-		pipelineInfo.pStages = shaderStages;
 		pipelineInfo.pVertexInputState = &vertexInputInfo;
 		pipelineInfo.pInputAssemblyState = &inputAssembly;
 		pipelineInfo.pViewportState = &viewportState;
 		pipelineInfo.pRasterizationState = &rasterizer;
 		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = &depthStencil;
 		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.layout = mPipelineLayout;
 		pipelineInfo.renderPass = mRenderPass;
 		pipelineInfo.subpass = 0;
 
-		if (VK_SUCCESS != vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGraphicsPipeline))
+		/* The depth prepass writes no color, and has no pixel shader */
+		VkPipelineColorBlendAttachmentState depthOnlyBlendAttachment{ colorBlendAttachment };
+		depthOnlyBlendAttachment.colorWriteMask = 0;
+		VkPipelineColorBlendStateCreateInfo depthOnlyBlending{ colorBlending };
+		depthOnlyBlending.pAttachments = &depthOnlyBlendAttachment;
+		VkPipelineShaderStageCreateInfo prepassVertShaderStageInfo{ vertShaderStageInfo };
+		prepassVertShaderStageInfo.module = std::ranges::all_of(mGraphicsPipelines, [](GraphicsPipeline const& p) { return p.Pipeline != VK_NULL_HANDLE; })
+			? VK_NULL_HANDLE
+			: LoadShaderModule(mDevice, std::filesystem::absolute("shaders/depth_prepass_VS.spv").generic_string());
+
+		for (GraphicsPipeline& graphicsPipeline : mGraphicsPipelines)
+		{
+			if (graphicsPipeline.Pipeline)
+				continue;
+
+			/* Binds only the position stream, the vertex shaders of the models transform like it, see surface.hlsli */
+			auto prepassBindingDescriptions = Vertex::GetBindingDescriptions(graphicsPipeline.Format, VertexStreams::PositionOnly);
+			auto prepassAttributeDescriptions = Vertex::GetAttributeDescriptions(graphicsPipeline.Format, VertexStreams::PositionOnly);
+			vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(prepassBindingDescriptions.size());
+			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(prepassAttributeDescriptions.size());
+			vertexInputInfo.pVertexBindingDescriptions = prepassBindingDescriptions.data();
+			vertexInputInfo.pVertexAttributeDescriptions = prepassAttributeDescriptions.data();
+			pipelineInfo.stageCount = 1;
+			pipelineInfo.pStages = &prepassVertShaderStageInfo;
+			pipelineInfo.pColorBlendState = &depthOnlyBlending;
+			pipelineInfo.layout = mPipelineLayout;
+			if (VK_SUCCESS != vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline.DepthPrepassPipeline))
+			{
+				throw std::runtime_error("failed to create the depth prepass pipeline!");
+			}
+			pipelineInfo.pColorBlendState = &colorBlending;
+
+			vertShaderStageInfo.module = graphicsPipeline.Program->GetVertexShader();
+			fragShaderStageInfo.module = graphicsPipeline.Program->GetFragmentShader();
+			VkPipelineShaderStageCreateInfo const shaderStages[]{ vertShaderStageInfo, fragShaderStageInfo };
+
+			auto bindingDescriptions = Vertex::GetBindingDescriptions(graphicsPipeline.Format, VertexStreams::All);
+			auto attributeDescriptions = Vertex::GetAttributeDescriptions(graphicsPipeline.Format, VertexStreams::All);
+			vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+			vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+			vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+			pipelineInfo.stageCount = 2;
+			pipelineInfo.pStages = shaderStages;
+			pipelineInfo.layout = mPipelineLayout;
+			if (VK_SUCCESS != vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline.Pipeline))
+			{
+				throw std::runtime_error("failed to create graphics pipeline!");
+			}
+		}
+		vkDestroyShaderModule(mDevice, prepassVertShaderStageInfo.module, nullptr);
+
+		if (mGpuDriven)
+		{
+			/* Same fixed function state, the object transforms and the dequantization come from storage buffers */
+			std::array<VkDescriptorSetLayout, 2> const gpuDrivenSetLayouts{ mDescriptorSetLayout, mGpuDrivenSetLayout };
+			VkPushConstantRange gpuDrivenPushConstantRange{};
+			gpuDrivenPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+			gpuDrivenPushConstantRange.offset = 0;
+			gpuDrivenPushConstantRange.size = sizeof(GpuDrivenConstants);
+			pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(gpuDrivenSetLayouts.size());
+			pipelineLayoutInfo.pSetLayouts = gpuDrivenSetLayouts.data();
+			pipelineLayoutInfo.pPushConstantRanges = &gpuDrivenPushConstantRange;
+			if (!mGpuDrivenPipelineLayout && VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mGpuDrivenPipelineLayout))
+			{
+				throw std::runtime_error("failed to create the GPU-driven pipeline layout!");
+			}
+			if (mGpuDrivenPipeline || mGraphicsPipelines.empty())
+				return;
+
+			/* All objects are drawn at once, with the fragment shader and vertex format of the first model */
+			GraphicsPipeline const& firstPipeline{ mGraphicsPipelines.front() };
+			auto bindingDescriptions = Vertex::GetBindingDescriptions(firstPipeline.Format, VertexStreams::All);
+			auto attributeDescriptions = Vertex::GetAttributeDescriptions(firstPipeline.Format, VertexStreams::All);
+			vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+			vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+			vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+			VkPipelineShaderStageCreateInfo gpuDrivenVertShaderStageInfo{ vertShaderStageInfo };
+			gpuDrivenVertShaderStageInfo.module = LoadShaderModule(mDevice, std::filesystem::absolute("shaders/gpu_driven_VS.spv").generic_string());
+			fragShaderStageInfo.module = firstPipeline.Program->GetFragmentShader();
+			VkPipelineShaderStageCreateInfo const gpuDrivenStages[]{ gpuDrivenVertShaderStageInfo, fragShaderStageInfo };
+			pipelineInfo.stageCount = 2;
+			pipelineInfo.pStages = gpuDrivenStages;
+			pipelineInfo.layout = mGpuDrivenPipelineLayout;
+			VkResult const result{ vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGpuDrivenPipeline) };
+
+			/* cleanup */
+			vkDestroyShaderModule(mDevice, gpuDrivenVertShaderStageInfo.module, nullptr);
+			if (VK_SUCCESS != result)
+			{
+				throw std::runtime_error("failed to create the GPU-driven pipeline!");
+			}
+			return;
+		}
+
+		if (!mMeshShadingSupported)
+			return;
+
+		/* Same fixed function state for the meshlets, the task and mesh shaders replace the vertex input */
+		std::array<VkDescriptorSetLayout, 2> const meshShadingSetLayouts{ mDescriptorSetLayout, mMeshShadingSetLayout };
+		VkPushConstantRange meshShadingPushConstantRange{};
+		meshShadingPushConstantRange.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+		meshShadingPushConstantRange.offset = 0;
+		meshShadingPushConstantRange.size = sizeof(MeshletConstants);
+		pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(meshShadingSetLayouts.size());
+		pipelineLayoutInfo.pSetLayouts = meshShadingSetLayouts.data();
+		pipelineLayoutInfo.pPushConstantRanges = &meshShadingPushConstantRange;
+		if (!mMeshShadingPipelineLayout && VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mMeshShadingPipelineLayout))
+		{
+			throw std::runtime_error("failed to create the mesh shading pipeline layout!");
+		}
+		if (std::ranges::all_of(mGraphicsPipelines, [](GraphicsPipeline const& p) { return p.MeshShadingPipeline != VK_NULL_HANDLE; }))
+			return;
+
+		VkPipelineShaderStageCreateInfo taskShaderStageInfo{};
+		taskShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		taskShaderStageInfo.stage = VK_SHADER_STAGE_TASK_BIT_EXT;
+		taskShaderStageInfo.module = LoadShaderModule(mDevice, std::filesystem::absolute("shaders/meshlet_mesh_AS.spv").generic_string());
+		taskShaderStageInfo.pName = TS_ENTRY_POINT;
+
+		VkPipelineShaderStageCreateInfo meshShaderStageInfo{};
+		meshShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		meshShaderStageInfo.stage = VK_SHADER_STAGE_MESH_BIT_EXT;
+		meshShaderStageInfo.module = LoadShaderModule(mDevice, std::filesystem::absolute("shaders/meshlet_mesh_MS.spv").generic_string());
+		meshShaderStageInfo.pName = MS_ENTRY_POINT;
+
+		pipelineInfo.stageCount = 3;
+		pipelineInfo.pVertexInputState = nullptr;
+		pipelineInfo.pInputAssemblyState = nullptr;
+		pipelineInfo.layout = mMeshShadingPipelineLayout;
+		VkResult result{ VK_SUCCESS };
+		for (GraphicsPipeline& graphicsPipeline : mGraphicsPipelines)
 		{
-			throw std::runtime_error("failed to create graphics pipeline!");
+			if (graphicsPipeline.MeshShadingPipeline)
+				continue;
+			fragShaderStageInfo.module = graphicsPipeline.Program->GetFragmentShader();
+			VkPipelineShaderStageCreateInfo const meshShadingStages[]{ taskShaderStageInfo, meshShaderStageInfo, fragShaderStageInfo };
+			pipelineInfo.pStages = meshShadingStages;
+			result = vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline.MeshShadingPipeline);
+			if (VK_SUCCESS != result)
+				break;
 		}
 
 		/* cleanup */
+		vkDestroyShaderModule(mDevice, taskShaderStageInfo.module, nullptr);
+		vkDestroyShaderModule(mDevice, meshShaderStageInfo.module, nullptr);
+		if (VK_SUCCESS != result)
+		{
+			throw std::runtime_error("failed to create the mesh shading pipeline!");
+		}
 	}
 
 	void VulkanRenderer::CreateFrameBuffers()
@@ -395,11 +646,12 @@ namespace gg
 		mFrameBuffers.resize(mSwapChainImageViews.size());
 		for (size_t i{ 0 }; i < mSwapChainImageViews.size(); ++i)
 		{
-			VkImageView attachments[]{ mSwapChainImageViews[i] };
+			/* The depth image is shared, the frames in flight use it one after the other */
+			VkImageView attachments[]{ mSwapChainImageViews[i], mDepthImageView };
 			VkFramebufferCreateInfo framebufferInfo{};
 			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 			framebufferInfo.renderPass = mRenderPass;
-			framebufferInfo.attachmentCount = 1;
+			framebufferInfo.attachmentCount = 2;
 			framebufferInfo.pAttachments = attachments;
 			framebufferInfo.width = mSwapChainExtent.width;
 			framebufferInfo.height = mSwapChainExtent.height;
@@ -424,53 +676,10 @@ namespace gg
 		}
 	}
 
-	void VulkanRenderer::CreateTextureImage()
-	{
-		// TODO: move this outside of the renderer
-		int texWidth, texHeight, texChannels;
-		std::string textureFileAbsPath{ std::filesystem::absolute("../../textures/CubeColor.tga").generic_string() };
-		stbi_uc* pixels = stbi_load(textureFileAbsPath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		VkDeviceSize imageSizeBytes = texWidth * texHeight * 4;
-
-		if (!pixels)
-			throw std::runtime_error("failed to load texture image!");
-
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		CreateBuffer(stagingBuffer
-			, stagingBufferMemory
-			, imageSizeBytes
-			, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
-			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		);
-
-		void* mappedData;
-		vkMapMemory(mDevice, stagingBufferMemory, 0, imageSizeBytes, 0, &mappedData);
-		memcpy(mappedData, pixels, static_cast<size_t>(imageSizeBytes));
-		vkUnmapMemory(mDevice, stagingBufferMemory);
-
-		stbi_image_free(pixels);
-
-		CreateImage(texWidth
-			, texHeight
-			, VK_FORMAT_R8G8B8A8_SRGB
-			, VK_IMAGE_TILING_OPTIMAL
-			, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-			, mTextureImage
-			, mTextureImageMemory);
-
-		TransitionImageLayout(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		CopyBufferToImage(stagingBuffer, mTextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-		TransitionImageLayout(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-		vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
-		vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
-	}
-
 	void VulkanRenderer::CreateImage(
 		  uint32_t width
 		, uint32_t height
+		, uint32_t mipLevels
 		, VkFormat format
 		, VkImageTiling tiling
 		, VkImageUsageFlags usage
@@ -484,12 +693,12 @@ namespace gg
 		imageInfo.extent.width = static_cast<uint32_t>(width);
 		imageInfo.extent.height = static_cast<uint32_t>(height);
 		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = 1;
+		imageInfo.mipLevels = mipLevels;
 		imageInfo.arrayLayers = 1;
 		imageInfo.format = format;
-		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.tiling = tiling;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		imageInfo.usage = usage;
 		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
@@ -502,7 +711,7 @@ namespace gg
 		VkMemoryAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
 
 		if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
 			throw std::runtime_error("failed to allocate image memory!");
@@ -596,7 +805,7 @@ namespace gg
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
 
-	static bool checkDeviceExtensionSupport(VkPhysicalDevice const device)
+	static std::set<std::string> getDeviceExtensions(VkPhysicalDevice const device)
 	{
 		uint32_t extensionCount;
 		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
@@ -607,7 +816,12 @@ namespace gg
 		std::set<std::string> availableExtensionNames{};
 		for (auto& ext : availableExtensions)
 			availableExtensionNames.insert(ext.extensionName);
+		return availableExtensionNames;
+	}
 
+	static bool checkDeviceExtensionSupport(VkPhysicalDevice const device)
+	{
+		std::set<std::string> const availableExtensionNames{ getDeviceExtensions(device) };
 		for (auto& ext : deviceExtensions)
 			if (!availableExtensionNames.contains(ext))
 				return false;
@@ -702,70 +916,177 @@ namespace gg
 			queueCreateInfo.pQueuePriorities = &queuePriority;
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
+		/* Optional features: indirect count draws for the GPU-driven mode, task and mesh shaders for the meshlets */
+		bool const meshShaderExtensionSupported{ getDeviceExtensions(mPhysicalDevice).contains(VK_EXT_MESH_SHADER_EXTENSION_NAME) };
+		VkPhysicalDeviceMeshShaderFeaturesEXT supportedMeshShaderFeatures{};
+		supportedMeshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+		VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+		supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		supportedVulkan12Features.pNext = meshShaderExtensionSupported ? &supportedMeshShaderFeatures : nullptr;
+		VkPhysicalDeviceFeatures2 supportedFeatures{};
+		supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures.pNext = &supportedVulkan12Features;
+		vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &supportedFeatures);
+
+		mMeshShadingSupported = meshShaderExtensionSupported && supportedMeshShaderFeatures.taskShader && supportedMeshShaderFeatures.meshShader;
+		mIndirectFirstInstanceSupported = supportedFeatures.features.drawIndirectFirstInstance;
+		mGpuDrivenSupported = supportedVulkan12Features.drawIndirectCount
+			&& supportedFeatures.features.multiDrawIndirect
+			&& mIndirectFirstInstanceSupported;
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		deviceFeatures.multiDrawIndirect = mGpuDrivenSupported;
+		/* Also used by the indirect draws of the meshlet compute culling */
+		deviceFeatures.drawIndirectFirstInstance = mIndirectFirstInstanceSupported;
+		/* The imported textures are BC1 or BC3, see AcquireMaterial for devices without them */
+		deviceFeatures.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+		mPipelineStatisticsSupported = supportedFeatures.features.pipelineStatisticsQuery;
+		deviceFeatures.pipelineStatisticsQuery = mPipelineStatisticsSupported;
+
+		VkPhysicalDeviceVulkan12Features vulkan12Features{};
+		vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		vulkan12Features.drawIndirectCount = mGpuDrivenSupported;
+
+		VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{};
+		meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+		meshShaderFeatures.taskShader = mMeshShadingSupported;
+		meshShaderFeatures.meshShader = mMeshShadingSupported;
+
+		std::vector<char const*> enabledExtensions{ deviceExtensions };
+		if (mMeshShadingSupported)
+		{
+			enabledExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+			vulkan12Features.pNext = &meshShaderFeatures;
+		}
+
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &vulkan12Features;
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 		createInfo.pEnabledFeatures = &deviceFeatures;
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+		createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 		if (VK_SUCCESS != vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mDevice))
 		{
 			throw std::runtime_error("failed to create logical device!");
 		}
 		vkGetDeviceQueue(mDevice, indices.graphicsFamily.value(), 0, &mGraphicsQueue);
+
+		if (mMeshShadingSupported)
+			mCmdDrawMeshTasks = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdDrawMeshTasksEXT"));
+		DebugLog(DebugLevel::Info, mMeshShadingSupported ? "Meshlets are culled in task shaders"
+			: mIndirectFirstInstanceSupported ? "Meshlets are culled in a compute pass" : "Meshlets are not culled, drawIndirectFirstInstance is unsupported");
 	}
 
-	void VulkanRenderer::UploadGeometry(std::unique_ptr<Model> model)
+	bool VulkanRenderer::EnableGpuDrivenRendering()
 	{
-		mModel = std::move(model);
-		for (auto& m : mModel->meshes)
-			CreateVertexBuffer(m);
-		CreateGraphicsPipeline();
+		BreakIfFalse(mResidentModels.empty());
+		mGpuDriven = mGpuDrivenSupported;
+		if (!mGpuDriven)
+		{
+			DebugLog(DebugLevel::Info, "GPU-driven rendering needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance");
+			return false;
+		}
+
+		CreateGpuDrivenDescriptorSets();
+		CreateGpuCullingPipeline();
+		CreateDepthPyramidPipeline();
+		CreateDepthPyramid();
+		CreateGraphicsPipelines();
+		return true;
 	}
 
-	void VulkanRenderer::CreateVertexBuffer(Mesh const& mesh)
+	void VulkanRenderer::EnableOcclusionCulling(std::shared_ptr<JobSystem> jobs)
 	{
-		uint32_t const VB_sizeBytes{ mesh.VerticesSizeBytes() };
+		mOcclusionCulling = true;
+		mOcclusionBuffer.SetJobSystem(std::move(jobs));
+		ResizeOcclusionBuffer();
+		if (mGpuDriven)
+			DebugLog(DebugLevel::Info, "CPU occlusion culling is skipped by the GPU-driven path, it culls against its depth pyramid");
+	}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		CreateBuffer(stagingBuffer, stagingBufferMemory, VB_sizeBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	void VulkanRenderer::SetDepthPrepass(bool enabled)
+	{
+		mDepthPrepass = enabled;
+		DebugLog(DebugLevel::Info, std::format("Depth prepass {}", enabled ? "on" : "off"));
+	}
 
-		void* mappedData;
-		vkMapMemory(mDevice, stagingBufferMemory, 0, VB_sizeBytes, 0, &mappedData);
-		memcpy(mappedData, mesh.Vertices.data(), static_cast<size_t>(VB_sizeBytes));
-		vkUnmapMemory(mDevice, stagingBufferMemory);
+	bool VulkanRenderer::IsDepthPrepassEnabled() const { return mDepthPrepass; }
 
-		VkBufferUsageFlagBits const usage = static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-		CreateBuffer(mVB, mVertexBufferMemory, VB_sizeBytes, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		CopyBuffer(stagingBuffer, mVB, VB_sizeBytes);
+	Scene& VulkanRenderer::GetScene() { return mScene; }
 
-		vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
-		vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
+	uint32_t VulkanRenderer::GetGraphicsPipelineIndex(Model const& model)
+	{
+		/* Models loaded with the same shaders share the program, see ModelLoader */
+		for (uint32_t i{ 0 }; i < mGraphicsPipelines.size(); ++i)
+			if (mGraphicsPipelines[i].Program == model.shaderProgram && mGraphicsPipelines[i].Format == model.vertexFormat)
+				return i;
+
+		mGraphicsPipelines.push_back({ model.shaderProgram, model.vertexFormat });
+		return static_cast<uint32_t>(mGraphicsPipelines.size() - 1);
 	}
 
-	void VulkanRenderer::CreateIndexBuffer(Mesh const& mesh)
+	void VulkanRenderer::CreateVertexBuffer(Mesh const& mesh, MeshBuffers& buffers)
 	{
-		VkBuffer IB{};
-		VkDeviceMemory IndexBufferMemory{};
+		/* Each stream gets its own buffer, so that depth-only passes only fetch positions */
+		for (uint32_t i{ 0 }; i < VERTEX_STREAM_COUNT; ++i)
+		{
+			VertexStream const stream{ static_cast<VertexStream>(i) };
+			CreateDeviceLocalBuffer(buffers.VertexBuffers[i]
+				, buffers.VertexBuffersMemory[i]
+				, mesh.GetStreamData(stream)
+				, mesh.StreamSizeBytes(stream)
+				, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT); /* storage: fetched by the mesh shader */
+		}
+	}
 
-		uint32_t const IB_sizeBytes{ mesh.IndicesSizeBytes() };
+	void VulkanRenderer::CreateIndexBuffer(Mesh const& mesh, MeshBuffers& buffers)
+	{
+		CreateDeviceLocalBuffer(buffers.IndexBuffer, buffers.IndexBufferMemory, mesh.Indices.data(), mesh.IndicesSizeBytes(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	}
+
+	void VulkanRenderer::DestroyMeshBuffers(MeshBuffers& buffers)
+	{
+		/* Destroying null handles is a no-op, meshes without meshlets leave those empty */
+		for (uint32_t i{ 0 }; i < VERTEX_STREAM_COUNT; ++i)
+		{
+			vkDestroyBuffer(mDevice, buffers.VertexBuffers[i], nullptr);
+			vkFreeMemory(mDevice, buffers.VertexBuffersMemory[i], nullptr);
+		}
+		vkDestroyBuffer(mDevice, buffers.IndexBuffer, nullptr);
+		vkFreeMemory(mDevice, buffers.IndexBufferMemory, nullptr);
+
+		vkDestroyBuffer(mDevice, buffers.MeshletBuffer, nullptr);
+		vkFreeMemory(mDevice, buffers.MeshletBufferMemory, nullptr);
+		vkDestroyBuffer(mDevice, buffers.MeshletVertexBuffer, nullptr);
+		vkFreeMemory(mDevice, buffers.MeshletVertexBufferMemory, nullptr);
+		vkDestroyBuffer(mDevice, buffers.MeshletTriangleBuffer, nullptr);
+		vkFreeMemory(mDevice, buffers.MeshletTriangleBufferMemory, nullptr);
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			vkDestroyBuffer(mDevice, buffers.CulledIndexBuffers[i], nullptr);
+			vkFreeMemory(mDevice, buffers.CulledIndexBuffersMemory[i], nullptr);
+			vkDestroyBuffer(mDevice, buffers.DrawCommandBuffers[i], nullptr);
+			vkFreeMemory(mDevice, buffers.DrawCommandBuffersMemory[i], nullptr);
+		}
+	}
 
+	void VulkanRenderer::CreateDeviceLocalBuffer(VkBuffer& outBuffer, VkDeviceMemory& outMemory, void const* data, uint64_t sizeBytes, VkBufferUsageFlags usage)
+	{
 		VkBuffer stagingBuffer;
 		VkDeviceMemory stagingBufferMemory;
-		CreateBuffer(stagingBuffer, stagingBufferMemory, IB_sizeBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		CreateBuffer(stagingBuffer, stagingBufferMemory, sizeBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
 		void* mappedData;
-		vkMapMemory(mDevice, stagingBufferMemory, 0, IB_sizeBytes, 0, &mappedData);
-		memcpy(mappedData, mesh.Indices.data(), static_cast<size_t>(IB_sizeBytes));
+		vkMapMemory(mDevice, stagingBufferMemory, 0, sizeBytes, 0, &mappedData);
+		memcpy(mappedData, data, static_cast<size_t>(sizeBytes));
 		vkUnmapMemory(mDevice, stagingBufferMemory);
 
-		VkBufferUsageFlagBits const usage = static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-		CreateBuffer(IB, IndexBufferMemory, IB_sizeBytes, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		CopyBuffer(stagingBuffer, IB, IB_sizeBytes);
+		VkBufferUsageFlagBits const deviceUsage = static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage);
+		CreateBuffer(outBuffer, outMemory, sizeBytes, deviceUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CopyBuffer(stagingBuffer, outBuffer, sizeBytes);
 
 		vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
 		vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
@@ -773,7 +1094,7 @@ namespace gg
 
 	void VulkanRenderer::CreateUniformBuffers()
 	{
-		VkDeviceSize const bufferSize = sizeof(XMMATRIX);
+		VkDeviceSize const bufferSize = sizeof(FrameConstants);
 		mUniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 		mUniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
@@ -781,70 +1102,40 @@ namespace gg
 			CreateBuffer(mUniformBuffers[i], mUniformBuffersMemory[i], bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 	}
 
-	void VulkanRenderer::CreateDescriptorPool()
+	void VulkanRenderer::CreateStagingBuffer()
 	{
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-		VkDescriptorPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-		if (VK_SUCCESS != vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool))
-			throw std::runtime_error("failed to create descriptor pool!");
+		CreateBuffer(mStagingBuffer, mStagingBufferMemory, STAGING_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		/* Mapped for the lifetime of the renderer */
+		void* mappedData;
+		if (VK_SUCCESS != vkMapMemory(mDevice, mStagingBufferMemory, 0, STAGING_BUFFER_SIZE, 0, &mappedData))
+			throw std::runtime_error("failed to map the staging buffer!");
+		mMappedStagingBuffer = static_cast<uint8_t*>(mappedData);
 	}
 
-	void VulkanRenderer::CreateDescriptorSets()
+	VulkanRenderer::StagingAllocation VulkanRenderer::WriteStaging(std::span<uint8_t const> data)
 	{
-		std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, mDescriptorSetLayout);
-		VkDescriptorSetAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = mDescriptorPool;
-		allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-		allocInfo.pSetLayouts = layouts.data();
+		/* An allocation never wraps around the end of the ring */
+		uint64_t head{ (mStagingHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1) };
+		if (head % STAGING_BUFFER_SIZE + data.size() > STAGING_BUFFER_SIZE)
+			head += STAGING_BUFFER_SIZE - head % STAGING_BUFFER_SIZE;
 
-		mDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-		if (VK_SUCCESS != vkAllocateDescriptorSets(mDevice, &allocInfo, mDescriptorSets.data()))
+		StagingAllocation allocation{};
+		if (head + data.size() - mStagingTail <= STAGING_BUFFER_SIZE)
 		{
-			throw std::runtime_error("failed to allocate descriptor sets!");
+			allocation.Buffer = mStagingBuffer;
+			allocation.Offset = head % STAGING_BUFFER_SIZE;
+			mStagingHead = head + data.size();
+			memcpy(mMappedStagingBuffer + allocation.Offset, data.data(), data.size());
+			return allocation;
 		}
 
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-		{
-			VkDescriptorBufferInfo bufferInfo{};
-			bufferInfo.buffer = mUniformBuffers[i];
-			bufferInfo.offset = 0;
-			bufferInfo.range = sizeof(XMMATRIX);
-
-			VkDescriptorImageInfo imageInfo{};
-			imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageInfo.imageView = mTextureImageView;
-			imageInfo.sampler = mTextureSampler;
-
-			std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[0].dstSet = mDescriptorSets[i];
-			descriptorWrites[0].dstBinding = 0;
-			descriptorWrites[0].dstArrayElement = 0;
-			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			descriptorWrites[0].descriptorCount = 1;
-			descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descriptorWrites[1].dstSet = mDescriptorSets[i];
-			descriptorWrites[1].dstBinding = 1;
-			descriptorWrites[1].dstArrayElement = 0;
-			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			descriptorWrites[1].descriptorCount = 1;
-			descriptorWrites[1].pImageInfo = &imageInfo;
-
-			vkUpdateDescriptorSets(mDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-		}
+		/* Larger than what the frames in flight left free */
+		CreateBuffer(allocation.Buffer, allocation.DedicatedMemory, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		void* mappedData;
+		vkMapMemory(mDevice, allocation.DedicatedMemory, 0, data.size(), 0, &mappedData);
+		memcpy(mappedData, data.data(), data.size());
+		vkUnmapMemory(mDevice, allocation.DedicatedMemory);
+		return allocation;
 	}
 
 	void VulkanRenderer::ResizeWindow()
@@ -861,10 +1152,26 @@ namespace gg
 			vkDestroyFramebuffer(mDevice, framebuffer, nullptr);
 		for (auto imageView : mSwapChainImageViews)
 			vkDestroyImageView(mDevice, imageView, nullptr);
+		DestroyDepthPyramid();
+		vkDestroyImageView(mDevice, mDepthImageView, nullptr);
+		vkDestroyImage(mDevice, mDepthImage, nullptr);
+		vkFreeMemory(mDevice, mDepthImageMemory, nullptr);
 
-		vkDestroyPipeline(mDevice, mGraphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
+		/* The pipelines depend on the render pass and the extent, the layouts are kept */
+		for (GraphicsPipeline& graphicsPipeline : mGraphicsPipelines)
+		{
+			vkDestroyPipeline(mDevice, graphicsPipeline.Pipeline, nullptr);
+			vkDestroyPipeline(mDevice, graphicsPipeline.MeshShadingPipeline, nullptr);
+			vkDestroyPipeline(mDevice, graphicsPipeline.DepthPrepassPipeline, nullptr);
+			graphicsPipeline.Pipeline = VK_NULL_HANDLE;
+			graphicsPipeline.MeshShadingPipeline = VK_NULL_HANDLE;
+			graphicsPipeline.DepthPrepassPipeline = VK_NULL_HANDLE;
+		}
+		vkDestroyPipeline(mDevice, mGpuDrivenPipeline, nullptr);
+		mGpuDrivenPipeline = VK_NULL_HANDLE;
 		vkDestroyRenderPass(mDevice, mRenderPass, nullptr);
+		for (VkRenderPass renderPass : mOcclusionRenderPasses)
+			vkDestroyRenderPass(mDevice, renderPass, nullptr);
 		vkDestroySwapchainKHR(mDevice, mSwapChain, nullptr);
 	}
 
@@ -875,8 +1182,13 @@ namespace gg
 
 		CreateSwapChain();
 		CreateImageViews();
+		CreateDepthResources();
+		if (mGpuDriven)
+			CreateDepthPyramid();
+		if (mOcclusionCulling)
+			ResizeOcclusionBuffer();
 		CreateRenderPass();
-		CreateGraphicsPipeline();
+		CreateGraphicsPipelines();
 		CreateFrameBuffers();
 	}
 
@@ -932,10 +1244,6 @@ namespace gg
 
 		CleanupSwapChain();
 		
-		vkDestroySampler(mDevice, mTextureSampler, nullptr);
-		vkDestroyImageView(mDevice, mTextureImageView, nullptr);
-		vkDestroyImage(mDevice, mTextureImage, nullptr);
-		vkFreeMemory(mDevice, mTextureImageMemory, nullptr);
 
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
 		{
@@ -944,6 +1252,7 @@ namespace gg
 			vkDestroyFence(mDevice, mInFlightFences[i], nullptr);
 		}
 		vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
+		vkDestroyQueryPool(mDevice, mStatisticsQueryPool, nullptr);
 
 		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
 		{
@@ -951,13 +1260,33 @@ namespace gg
 			vkFreeMemory(mDevice, mUniformBuffersMemory[i], nullptr);
 		}
 
-		vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+		DestroyInstanceBuffers();
 		vkDestroyDescriptorSetLayout(mDevice, mDescriptorSetLayout, nullptr);
-		vkDestroyBuffer(mDevice, mVB, nullptr);
-		vkFreeMemory(mDevice, mVertexBufferMemory, nullptr);
+		for (ResidentModel& resident : mResidentModels)
+		{
+			for (MeshBuffers& buffers : resident.Meshes)
+				DestroyMeshBuffers(buffers);
+			vkDestroyDescriptorPool(mDevice, resident.MeshletDescriptorPool, nullptr);
+		}
+		DestroyRetiredModels(true);
+		DestroyRetiredTextures(true);
+		DestroyMaterials();
+		vkDestroyBuffer(mDevice, mStagingBuffer, nullptr);
+		vkFreeMemory(mDevice, mStagingBufferMemory, nullptr);
+		vkDestroySampler(mDevice, mTextureSampler, nullptr);
+
+		vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
+		vkDestroyPipelineLayout(mDevice, mMeshShadingPipelineLayout, nullptr);
+		vkDestroyPipeline(mDevice, mMeshletCullingPipeline, nullptr);
+		vkDestroyPipelineLayout(mDevice, mMeshletCullingPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(mDevice, mMeshletCullingSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(mDevice, mMeshShadingSetLayout, nullptr);
+		DestroyGpuDrivenScene();
+		DestroyClusteredLighting();
 
 		/* destroys the associated shaders */
-		mModel.reset();
+		mGraphicsPipelines.clear();
+		mScene = {};
 
 		vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
 		vkDestroyDevice(mDevice, nullptr);
@@ -979,6 +1308,25 @@ namespace gg
 	void VulkanRenderer::Render(uint64_t deltaTimeMs)
 	{
 		vkWaitForFences(mDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, UINT64_MAX);
+		++mFrameNumber;
+		ReportPipelineStatistics();
+		mFrameArena.Reset();
+		DestroyRetiredModels(false);
+		DestroyRetiredTextures(false);
+		mStagingTail = mStagingFrameEnds[mCurrentFrame];
+
+		size_t const pipelineCount{ mGraphicsPipelines.size() };
+		UpdateResidency();
+		if (pipelineCount != mGraphicsPipelines.size())
+			CreateGraphicsPipelines();
+		if (mGpuDriven)
+		{
+			bool const geometryRebuilt{ mGpuGeometryDirty };
+			if (geometryRebuilt)
+				RebuildGpuDrivenGeometry();
+			if (geometryRebuilt || mGpuObjectsVersion != mScene.GetVersion())
+				UploadGpuObjects();
+		}
 
 		uint32_t imageIndex;
 		VkResult result = vkAcquireNextImageKHR(mDevice, mSwapChain, UINT64_MAX, mImageAvailableSemaphores[mCurrentFrame], VK_NULL_HANDLE, &imageIndex);
@@ -1000,13 +1348,28 @@ namespace gg
 		XMMATRIX const& viewMatrix = mCamera->GetViewMatrix();
 		XMMATRIX const& mProjectionMatrix = mCamera->GetProjectionMatrix();
 
-		XMMATRIX mvpMatrix = XMMatrixMultiply(modelMatrix, viewMatrix);
-		mvpMatrix = XMMatrixMultiply(mvpMatrix, mProjectionMatrix);
+		XMMATRIX const modelViewMatrix = XMMatrixMultiply(modelMatrix, viewMatrix);
+		XMMATRIX const mvpMatrix = XMMatrixMultiply(modelViewMatrix, mProjectionMatrix);
+		XMStoreFloat4x4(&mModelViewMatrix, modelViewMatrix);
+
+		/* The GPU-driven mode culls and selects the LODs in its culling pass */
+		if (mGpuDriven)
+			UploadInstances(mScene.GetInstances());
+		else
+		{
+			BuildDrawList(modelViewMatrix, mvpMatrix);
+			UploadInstances(mVisibleInstances);
+		}
+
+		FrameConstants frameConstants{};
+		XMStoreFloat4x4(&frameConstants.ModelViewProjection, mvpMatrix);
+		XMStoreFloat4x4(&frameConstants.ModelView, modelViewMatrix);
+		UploadLights(modelViewMatrix, frameConstants);
 
 		/* submit the UBO data */
 		void* data;
-		vkMapMemory(mDevice, mUniformBuffersMemory[mCurrentFrame], 0, sizeof(XMMATRIX), 0, &data);
-		memcpy(data, &mvpMatrix, sizeof(XMMATRIX));
+		vkMapMemory(mDevice, mUniformBuffersMemory[mCurrentFrame], 0, sizeof(FrameConstants), 0, &data);
+		memcpy(data, &frameConstants, sizeof(FrameConstants));
 		vkUnmapMemory(mDevice, mUniformBuffersMemory[mCurrentFrame]);
 		/***********************/
 
@@ -1016,6 +1379,7 @@ namespace gg
 		RecordCommandBuffer(mCommandBuffers[mCurrentFrame], imageIndex, mvpMatrix);
 		/* Execute the commands */
 		SubmitCommands();
+		mStagingFrameEnds[mCurrentFrame] = mStagingHead;
 		/* Present the frame and inefficiently wait for the frame to render. */
 		result = Present(imageIndex);
 
@@ -1071,6 +1435,15 @@ namespace gg
 			throw std::runtime_error("failed to begin recording command buffer!");
 		}
 
+		/* Around all the render passes of the frame, read back once its fence signals */
+		if (mStatisticsQueryPool)
+		{
+			vkCmdResetQueryPool(commandBuffer, mStatisticsQueryPool, mCurrentFrame, 1);
+			vkCmdBeginQuery(commandBuffer, mStatisticsQueryPool, mCurrentFrame, 0);
+			mStatisticsRecorded[mCurrentFrame] = true;
+			mStatisticsDepthPrepass[mCurrentFrame] = mDepthPrepass && !mGpuDriven;
+		}
+
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = mRenderPass;
@@ -1078,29 +1451,211 @@ namespace gg
 		renderPassInfo.renderArea.offset = { 0, 0 };
 		renderPassInfo.renderArea.extent = mSwapChainExtent;
 
-		VkClearValue clearColor = { {{0.0f, 0.2f, 0.4f, 1.0f}} };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = { {0.0f, 0.2f, 0.4f, 1.0f} };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		/* Dispatches are not allowed inside a render pass. In the GPU-driven mode the
+		 rotating model matrix acts as the root transform of all objects. */
+		if (mGpuDriven)
+		{
+			RecordLightCulling(commandBuffer);
+			/* The late phase tests against the depth of the early one, what it finds visible is drawn on top */
+			for (OcclusionPhase phase : { OcclusionPhase::Early, OcclusionPhase::Late })
+			{
+				if (OcclusionPhase::Late == phase)
+					RecordDepthPyramid(commandBuffer);
+				RecordGpuCulling(commandBuffer, mvpMatrix, phase);
+				renderPassInfo.renderPass = mOcclusionRenderPasses[static_cast<uint32_t>(phase)];
+				vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+				DrawGpuDriven(commandBuffer, mvpMatrix, phase);
+				vkCmdEndRenderPass(commandBuffer);
+			}
+			if (mStatisticsQueryPool)
+				vkCmdEndQuery(commandBuffer, mStatisticsQueryPool, mCurrentFrame);
+			if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer))
+			{
+				throw std::runtime_error("failed to record command buffer!");
+			}
+			return;
+		}
+
+		/* Neither are copies, and the descriptor sets must be final before they are bound */
+		StreamTextures(commandBuffer);
+		RecordMeshletCulling(commandBuffer);
+		RecordLightCulling(commandBuffer);
 
 		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
 
-		VkBuffer vertexBuffers[]{ mVB };
-		VkDeviceSize offsets[]{ 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		/* The packets are sorted by pass, pipeline, material and mesh, the cache drops the binds that repeat */
+		DrawStateCache state{};
+		state.CommandBuffer = commandBuffer;
+		for (DrawPacket const& packet : mDrawPackets)
+		{
+			DrawItem const& draw{ mDrawItems[packet.DrawIndex] };
+			GraphicsPipeline const& graphicsPipeline{ mGraphicsPipelines[draw.PipelineIndex] };
+			VkDescriptorSet const materialSet{ mMaterials[draw.MaterialIndex].DescriptorSets[mCurrentFrame] };
+			++state.Requested.Draws;
+			++state.Issued.Draws;
+			/* The meshlet draws are not part of the depth prepass */
+			if (UsesMeshlets(draw))
+			{
+				if (mMeshShadingSupported)
+					state.BindPipeline(graphicsPipeline.MeshShadingPipeline, mMeshShadingPipelineLayout);
+				else
+					state.BindPipeline(graphicsPipeline.Pipeline, mPipelineLayout);
+				state.BindDescriptorSet(materialSet);
+				DrawMeshlets(draw, state);
+				continue;
+			}
 
-		/* bind a desciptor for the UBO */
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSets[mCurrentFrame], 0, nullptr);
-		for (auto& m : mModel->meshes)
-			vkCmdDraw(commandBuffer, m.GetVertexCount(), 1, 0, 0);
+			bool const isDepthPrepass{ DrawPass::DepthPrepass == GetDrawPass(packet.Key) };
+			state.BindPipeline(isDepthPrepass ? graphicsPipeline.DepthPrepassPipeline : graphicsPipeline.Pipeline, mPipelineLayout);
+			state.BindDescriptorSet(materialSet);
+			Mesh const& mesh{ mScene.GetModel(draw.Model).meshes[draw.MeshIndex] };
+			MeshBuffers const& buffers{ mResidentModels[draw.Model].Meshes[draw.MeshIndex] };
+			MeshLod const& lod{ mesh.Lods[draw.Lod] };
+			state.BindVertexStreams(buffers);
+			state.BindIndexBuffer(buffers.IndexBuffer);
+			state.PushQuantization(mesh.Quantization);
+			/* SV_InstanceID includes firstInstance, it indexes this frame's visible instances */
+			vkCmdDrawIndexed(commandBuffer, lod.IndexCount, draw.InstanceCount, lod.FirstIndex, 0, draw.FirstInstance);
+		}
+		ReportDrawStatistics(state);
 
 		vkCmdEndRenderPass(commandBuffer);
+		if (mStatisticsQueryPool)
+			vkCmdEndQuery(commandBuffer, mStatisticsQueryPool, mCurrentFrame);
 		if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer))
 		{
 			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
 
+	float VulkanRenderer::GetPixelsPerUnit() const
+	{
+		/* Projected size of one unit at a distance of one unit, in pixels */
+		float const projectionScale{ XMVectorGetY(mCamera->GetProjectionMatrix().r[1]) };
+		return projectionScale * 0.5f * static_cast<float>(mSwapChainExtent.height);
+	}
+
+	void VulkanRenderer::DrawStateCache::BindPipeline(VkPipeline pipeline, VkPipelineLayout layout)
+	{
+		++Requested.PipelineBinds;
+		if (pipeline != Pipeline)
+		{
+			vkCmdBindPipeline(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			Pipeline = pipeline;
+			++Issued.PipelineBinds;
+		}
+		if (layout != Layout)
+		{
+			/* The layouts differ in their push constants, set 0 and the pushed values do not carry over */
+			Layout = layout;
+			DescriptorSet = VK_NULL_HANDLE;
+			HasQuantization = false;
+		}
+	}
+
+	void VulkanRenderer::DrawStateCache::BindDescriptorSet(VkDescriptorSet descriptorSet)
+	{
+		++Requested.DescriptorSetBinds;
+		if (descriptorSet == DescriptorSet)
+			return;
+		vkCmdBindDescriptorSets(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Layout, 0, 1, &descriptorSet, 0, nullptr);
+		DescriptorSet = descriptorSet;
+		++Issued.DescriptorSetBinds;
+	}
+
+	void VulkanRenderer::DrawStateCache::BindVertexStreams(MeshBuffers const& buffers)
+	{
+		++Requested.VertexBufferBinds;
+		if (buffers.VertexBuffers[0] == VertexBuffer)
+			return;
+		VulkanRenderer::BindVertexStreams(CommandBuffer, buffers, VertexStreams::All);
+		VertexBuffer = buffers.VertexBuffers[0];
+		++Issued.VertexBufferBinds;
+	}
+
+	void VulkanRenderer::DrawStateCache::BindIndexBuffer(VkBuffer indexBuffer)
+	{
+		++Requested.IndexBufferBinds;
+		if (indexBuffer == IndexBuffer)
+			return;
+		vkCmdBindIndexBuffer(CommandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		IndexBuffer = indexBuffer;
+		++Issued.IndexBufferBinds;
+	}
+
+	void VulkanRenderer::DrawStateCache::PushQuantization(VertexQuantization const& quantization)
+	{
+		++Requested.PushConstants;
+		if (HasQuantization && 0 == memcmp(&quantization, &Quantization, sizeof(VertexQuantization)))
+			return;
+		vkCmdPushConstants(CommandBuffer, Layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexQuantization), &quantization);
+		Quantization = quantization;
+		HasQuantization = true;
+		++Issued.PushConstants;
+	}
+
+	void VulkanRenderer::ReportDrawStatistics(DrawStateCache const& state)
+	{
+		/* Only when the numbers change, a static scene logs once */
+		if (state.Issued == mLastDrawStatistics)
+			return;
+		mLastDrawStatistics = state.Issued;
+		DebugLog(DebugLevel::Info, std::format("{} draws, binds issued/requested: pipelines {}/{}, descriptor sets {}/{}, vertex buffers {}/{}, index buffers {}/{}, push constants {}/{}"
+			, state.Issued.Draws
+			, state.Issued.PipelineBinds, state.Requested.PipelineBinds
+			, state.Issued.DescriptorSetBinds, state.Requested.DescriptorSetBinds
+			, state.Issued.VertexBufferBinds, state.Requested.VertexBufferBinds
+			, state.Issued.IndexBufferBinds, state.Requested.IndexBufferBinds
+			, state.Issued.PushConstants, state.Requested.PushConstants));
+	}
+
+	void VulkanRenderer::CreateStatisticsQueryPool()
+	{
+		if (!mPipelineStatisticsSupported)
+		{
+			DebugLog(DebugLevel::Info, "The fragment shader invocations are not reported, the device lacks pipelineStatisticsQuery");
+			return;
+		}
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT;
+		queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+		if (VK_SUCCESS != vkCreateQueryPool(mDevice, &queryPoolInfo, nullptr, &mStatisticsQueryPool))
+		{
+			throw std::runtime_error("failed to create the pipeline statistics query pool!");
+		}
+	}
+
+	void VulkanRenderer::ReportPipelineStatistics()
+	{
+		if (!mStatisticsQueryPool || !mStatisticsRecorded[mCurrentFrame] || 0 != mFrameNumber % STATISTICS_REPORT_INTERVAL)
+			return;
+		/* The fence of the frame has signaled, the result is available */
+		uint64_t fragmentShaderInvocations{ 0 };
+		if (VK_SUCCESS != vkGetQueryPoolResults(mDevice, mStatisticsQueryPool, mCurrentFrame, 1, sizeof(fragmentShaderInvocations)
+			, &fragmentShaderInvocations, sizeof(fragmentShaderInvocations), VK_QUERY_RESULT_64_BIT))
+			return;
+		DebugLog(DebugLevel::Info, std::format("{} fragment shader invocations, {:.2f} per pixel, depth prepass {}"
+			, fragmentShaderInvocations
+			, static_cast<double>(fragmentShaderInvocations) / (static_cast<double>(mSwapChainExtent.width) * mSwapChainExtent.height)
+			, mStatisticsDepthPrepass[mCurrentFrame] ? "on" : "off"));
+	}
+
+	void VulkanRenderer::BindVertexStreams(VkCommandBuffer commandBuffer, MeshBuffers const& buffers, VertexStreams streams)
+	{
+		/* Streams are laid out so that the position-only set is a prefix of all streams */
+		uint32_t const streamCount{ VertexStreams::PositionOnly == streams ? 1 : VERTEX_STREAM_COUNT };
+		std::array<VkDeviceSize, VERTEX_STREAM_COUNT> offsets{};
+		vkCmdBindVertexBuffers(commandBuffer, 0, streamCount, buffers.VertexBuffers.data(), offsets.data());
+	}
+
 	VkCommandBuffer VulkanRenderer::BeginSingleTimeCommands()
 	{
 		VkCommandBufferAllocateInfo allocInfo{};
@@ -1219,16 +1774,16 @@ namespace gg
 		EndSingleTimeCommands(commandBuffer);
 	}
 
-	VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format)
+	VkImageView VulkanRenderer::CreateImageView(VkImage image, VkFormat format, uint32_t mipLevels, uint32_t baseMipLevel, VkImageAspectFlags aspectMask)
 	{
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
 		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 		viewInfo.format = format;
-		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.aspectMask = aspectMask;
+		viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+		viewInfo.subresourceRange.levelCount = mipLevels;
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.subresourceRange.layerCount = 1;
 
@@ -1238,11 +1793,6 @@ namespace gg
 		return imageView;
 	}
 
-	void VulkanRenderer::CreateTextureImageView()
-	{
-		mTextureImageView = CreateImageView(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB);
-	}
-
 	void VulkanRenderer::CreateTextureSampler()
 	{
 		VkSamplerCreateInfo samplerInfo{};
@@ -1265,7 +1815,7 @@ namespace gg
 		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 		samplerInfo.mipLodBias = 0.0f;
 		samplerInfo.minLod = 0.0f;
-		samplerInfo.maxLod = 0.0f;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE; /* every mip level of the view */
 
 		if (vkCreateSampler(mDevice, &samplerInfo, nullptr, &mTextureSampler) != VK_SUCCESS)
 			throw std::runtime_error("failed to create texture sampler!");
@@ -0,0 +1,206 @@
+module;
+#include <array>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import ShaderProgram;
+
+namespace
+{
+	/* Must match the workgroup size of cs_main in depth_pyramid.hlsl */
+	constexpr uint32_t DEPTH_PYRAMID_GROUP_SIZE{ 8 };
+	constexpr VkFormat DEPTH_PYRAMID_FORMAT{ VK_FORMAT_R32_SFLOAT };
+
+	/* Rounded up, so that the texel i of a level covers the texels 2i and 2i + 1 of the level below */
+	VkExtent2D getNextLevelExtent(VkExtent2D extent)
+	{
+		return { (extent.width + 1) / 2, (extent.height + 1) / 2 };
+	}
+}
+
+namespace gg
+{
+	void VulkanRenderer::CreateDepthPyramidPipeline()
+	{
+		/* The level below, the depth buffer for level 0, and the level written */
+		std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+		bindings[0].binding = 0;
+		bindings[0].descriptorCount = 1;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[1].binding = 1;
+		bindings[1].descriptorCount = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		if (VK_SUCCESS != vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mDepthPyramidSetLayout))
+			throw std::runtime_error("failed to create the depth pyramid descriptor set layout!");
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &mDepthPyramidSetLayout;
+		if (VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mDepthPyramidPipelineLayout))
+			throw std::runtime_error("failed to create the depth pyramid pipeline layout!");
+
+		VkShaderModule const shader{ LoadShaderModule(mDevice, std::filesystem::absolute("shaders/depth_pyramid_CS.spv").generic_string()) };
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader;
+		pipelineInfo.stage.pName = CS_ENTRY_POINT;
+		pipelineInfo.layout = mDepthPyramidPipelineLayout;
+		VkResult const result{ vkCreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mDepthPyramidPipeline) };
+		vkDestroyShaderModule(mDevice, shader, nullptr);
+		if (VK_SUCCESS != result)
+			throw std::runtime_error("failed to create the depth pyramid pipeline!");
+	}
+
+	void VulkanRenderer::CreateDepthPyramid()
+	{
+		/* Level 0 has half the size of the depth buffer, the last level is a single texel */
+		VkExtent2D const baseExtent{ getNextLevelExtent(mSwapChainExtent) };
+		mDepthPyramidLevelCount = 1;
+		for (VkExtent2D extent{ baseExtent }; extent.width > 1 || extent.height > 1; extent = getNextLevelExtent(extent))
+			++mDepthPyramidLevelCount;
+
+		CreateImage(baseExtent.width, baseExtent.height, mDepthPyramidLevelCount, DEPTH_PYRAMID_FORMAT, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mDepthPyramidImage, mDepthPyramidImageMemory);
+		mDepthPyramidView = CreateImageView(mDepthPyramidImage, DEPTH_PYRAMID_FORMAT, mDepthPyramidLevelCount);
+		mDepthPyramidLevelViews.resize(mDepthPyramidLevelCount);
+		for (uint32_t level{ 0 }; level < mDepthPyramidLevelCount; ++level)
+			mDepthPyramidLevelViews[level] = CreateImageView(mDepthPyramidImage, DEPTH_PYRAMID_FORMAT, 1, level);
+
+		/* Written and read in the general layout, it never changes */
+		VkCommandBuffer const commandBuffer{ BeginSingleTimeCommands() };
+		RecordImageBarrier(commandBuffer, mDepthPyramidImage, 0, mDepthPyramidLevelCount
+			, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL
+			, 0, VK_ACCESS_SHADER_WRITE_BIT
+			, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		EndSingleTimeCommands(commandBuffer);
+
+		std::array<VkDescriptorPoolSize, 2> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		poolSizes[0].descriptorCount = mDepthPyramidLevelCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[1].descriptorCount = mDepthPyramidLevelCount;
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = mDepthPyramidLevelCount;
+		if (VK_SUCCESS != vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDepthPyramidDescriptorPool))
+			throw std::runtime_error("failed to create the depth pyramid descriptor pool!");
+
+		std::vector<VkDescriptorSetLayout> const layouts(mDepthPyramidLevelCount, mDepthPyramidSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = mDepthPyramidDescriptorPool;
+		allocInfo.descriptorSetCount = mDepthPyramidLevelCount;
+		allocInfo.pSetLayouts = layouts.data();
+		mDepthPyramidDescriptorSets.resize(mDepthPyramidLevelCount);
+		if (VK_SUCCESS != vkAllocateDescriptorSets(mDevice, &allocInfo, mDepthPyramidDescriptorSets.data()))
+			throw std::runtime_error("failed to allocate the depth pyramid descriptor sets!");
+
+		WriteDepthPyramidDescriptors();
+	}
+
+	void VulkanRenderer::DestroyDepthPyramid()
+	{
+		/* Destroying null handles is a no-op when the GPU-driven mode is off */
+		vkDestroyDescriptorPool(mDevice, mDepthPyramidDescriptorPool, nullptr);
+		for (VkImageView levelView : mDepthPyramidLevelViews)
+			vkDestroyImageView(mDevice, levelView, nullptr);
+		vkDestroyImageView(mDevice, mDepthPyramidView, nullptr);
+		vkDestroyImage(mDevice, mDepthPyramidImage, nullptr);
+		vkFreeMemory(mDevice, mDepthPyramidImageMemory, nullptr);
+		mDepthPyramidDescriptorPool = VK_NULL_HANDLE;
+		mDepthPyramidDescriptorSets.clear();
+		mDepthPyramidLevelViews.clear();
+		mDepthPyramidView = VK_NULL_HANDLE;
+		mDepthPyramidImage = VK_NULL_HANDLE;
+		mDepthPyramidImageMemory = VK_NULL_HANDLE;
+		mDepthPyramidLevelCount = 0;
+	}
+
+	void VulkanRenderer::WriteDepthPyramidDescriptors()
+	{
+		/* The reductions, level by level */
+		for (uint32_t level{ 0 }; level < mDepthPyramidLevelCount; ++level)
+		{
+			VkDescriptorImageInfo const sourceInfo{ 0 == level
+				? VkDescriptorImageInfo{ VK_NULL_HANDLE, mDepthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+				: VkDescriptorImageInfo{ VK_NULL_HANDLE, mDepthPyramidLevelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL } };
+			VkDescriptorImageInfo const destinationInfo{ VK_NULL_HANDLE, mDepthPyramidLevelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+			std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+			for (uint32_t b{ 0 }; b < descriptorWrites.size(); ++b)
+			{
+				descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[b].dstSet = mDepthPyramidDescriptorSets[level];
+				descriptorWrites[b].dstBinding = b;
+				descriptorWrites[b].descriptorCount = 1;
+			}
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			descriptorWrites[0].pImageInfo = &sourceInfo;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			descriptorWrites[1].pImageInfo = &destinationInfo;
+			vkUpdateDescriptorSets(mDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+
+		/* The whole pyramid for the late culling phase of every frame */
+		VkDescriptorImageInfo const pyramidInfo{ VK_NULL_HANDLE, mDepthPyramidView, VK_IMAGE_LAYOUT_GENERAL };
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = mGpuDrivenDescriptorSets[i];
+			descriptorWrite.dstBinding = 5; /* after the buffers, see CreateGpuDrivenDescriptorSets */
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pImageInfo = &pyramidInfo;
+			vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+		}
+	}
+
+	void VulkanRenderer::RecordDepthPyramid(VkCommandBuffer commandBuffer)
+	{
+		/* Only the late culling phase reads it */
+		if (mGpuObjects.empty())
+			return;
+
+		/* The early render pass made the depth readable, see createRenderPass */
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mDepthPyramidPipeline);
+		VkExtent2D extent{ mSwapChainExtent };
+		for (uint32_t level{ 0 }; level < mDepthPyramidLevelCount; ++level)
+		{
+			extent = getNextLevelExtent(extent);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mDepthPyramidPipelineLayout, 0, 1, &mDepthPyramidDescriptorSets[level], 0, nullptr);
+			vkCmdDispatch(commandBuffer
+				, (extent.width + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE
+				, (extent.height + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE
+				, 1);
+
+			/* Read by the next level, and by the culling after the last one */
+			RecordImageBarrier(commandBuffer, mDepthPyramidImage, level, 1
+				, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL
+				, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT
+				, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
+	}
+
+} // namespace gg
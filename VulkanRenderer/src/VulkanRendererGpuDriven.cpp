@@ -0,0 +1,350 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import Logging;
+import Model;
+import Scene;
+import ShaderProgram;
+import Vertex;
+
+using namespace DirectX;
+
+namespace
+{
+	/* Must match the workgroup size of cs_main in gpu_cull.hlsl */
+	constexpr uint32_t CULLING_GROUP_SIZE{ 64 };
+	/* objects, meshes, draw commands, draw counts, visibility, then the depth pyramid */
+	constexpr uint32_t GPU_DRIVEN_BUFFER_BINDING_COUNT{ 5 };
+	constexpr uint32_t GPU_DRIVEN_BINDING_COUNT{ GPU_DRIVEN_BUFFER_BINDING_COUNT + 1 };
+	/* GpuMeshOffset of the models left out of the merged geometry */
+	constexpr uint32_t EXCLUDED_FROM_GPU_GEOMETRY{ std::numeric_limits<uint32_t>::max() };
+}
+
+namespace gg
+{
+	void VulkanRenderer::RebuildGpuDrivenGeometry()
+	{
+		/* Only when models become resident or are released, the buffers may still be read by the frames in flight */
+		vkDeviceWaitIdle(mDevice);
+		mGpuGeometryDirty = false;
+		DestroyMeshBuffers(mGpuGeometry);
+		mGpuGeometry = {};
+		vkDestroyBuffer(mDevice, mGpuMeshBuffer, nullptr);
+		vkFreeMemory(mDevice, mGpuMeshBufferMemory, nullptr);
+		mGpuMeshBuffer = VK_NULL_HANDLE;
+		mGpuMeshBufferMemory = VK_NULL_HANDLE;
+
+		/* Concatenate the geometry of all meshes, the draws address it with firstIndex and vertexOffset */
+		std::array<std::vector<uint8_t>, VERTEX_STREAM_COUNT> streams{};
+		std::vector<uint32_t> indices{};
+		std::vector<GpuMesh> gpuMeshes{};
+		int32_t vertexOffset{ 0 };
+		for (ModelId id{ 0 }; id < mResidentModels.size(); ++id)
+		{
+			ResidentModel& resident{ mResidentModels[id] };
+			resident.GpuMeshOffset = EXCLUDED_FROM_GPU_GEOMETRY;
+			if (!resident.IsResident)
+				continue;
+
+			/* One draw renders everything, so all models share the vertex format of the pipeline */
+			Model const& model{ mScene.GetModel(id) };
+			if (model.vertexFormat != mGraphicsPipelines[resident.PipelineIndex].Format || model.vertexFormat != mGraphicsPipelines.front().Format)
+			{
+				DebugLog(DebugLevel::Error, std::format("Model {} is not drawn, its vertex format differs from the first model", id));
+				continue;
+			}
+
+			resident.GpuMeshOffset = static_cast<uint32_t>(gpuMeshes.size());
+			for (Mesh const& mesh : model.meshes)
+			{
+				XMVECTOR const boundsMin{ XMLoadFloat3(&mesh.BoundsMin) };
+				XMVECTOR const boundsMax{ XMLoadFloat3(&mesh.BoundsMax) };
+				XMVECTOR const center{ XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f) };
+
+				GpuMesh& gpuMesh{ gpuMeshes.emplace_back() };
+				gpuMesh.Quantization = mesh.Quantization;
+				XMStoreFloat3(&gpuMesh.BoundsCenter, center);
+				gpuMesh.BoundsRadius = XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, center)));
+				gpuMesh.VertexOffset = vertexOffset;
+				gpuMesh.LodCount = static_cast<uint32_t>(std::min<size_t>(mesh.Lods.size(), MAX_LOD_COUNT));
+				for (uint32_t l{ 0 }; l < gpuMesh.LodCount; ++l)
+				{
+					MeshLod const& lod{ mesh.Lods[l] };
+					gpuMesh.Lods[l] = { static_cast<uint32_t>(indices.size()) + lod.FirstIndex, lod.IndexCount, lod.Error, 0 };
+				}
+
+				for (uint32_t i{ 0 }; i < VERTEX_STREAM_COUNT; ++i)
+					streams[i].insert(streams[i].end(), mesh.Streams[i].begin(), mesh.Streams[i].end());
+				indices.insert(indices.end(), mesh.Indices.begin(), mesh.Indices.end());
+				vertexOffset += static_cast<int32_t>(mesh.GetVertexCount());
+			}
+		}
+		if (gpuMeshes.empty())
+			return;
+
+		for (uint32_t i{ 0 }; i < VERTEX_STREAM_COUNT; ++i)
+			CreateDeviceLocalBuffer(mGpuGeometry.VertexBuffers[i], mGpuGeometry.VertexBuffersMemory[i], streams[i].data(), streams[i].size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+		CreateDeviceLocalBuffer(mGpuGeometry.IndexBuffer, mGpuGeometry.IndexBufferMemory, indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+		CreateDeviceLocalBuffer(mGpuMeshBuffer, mGpuMeshBufferMemory, gpuMeshes.data(), gpuMeshes.size() * sizeof(GpuMesh), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	}
+
+	void VulkanRenderer::CreateGpuDrivenDescriptorSets()
+	{
+		std::array<VkDescriptorSetLayoutBinding, GPU_DRIVEN_BINDING_COUNT> bindings{};
+		for (uint32_t i{ 0 }; i < GPU_DRIVEN_BINDING_COUNT; ++i)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorCount = 1;
+			bindings[i].descriptorType = i < GPU_DRIVEN_BUFFER_BINDING_COUNT ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			/* The vertex shader reads the objects and meshes, only the culling writes the draws */
+			bindings[i].stageFlags = i < 2 ? VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		if (VK_SUCCESS != vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mGpuDrivenSetLayout))
+			throw std::runtime_error("failed to create the GPU-driven descriptor set layout!");
+
+		std::array<VkDescriptorPoolSize, 2> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[0].descriptorCount = GPU_DRIVEN_BUFFER_BINDING_COUNT * MAX_FRAMES_IN_FLIGHT;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		poolSizes[1].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+		if (VK_SUCCESS != vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mGpuDrivenDescriptorPool))
+			throw std::runtime_error("failed to create the GPU-driven descriptor pool!");
+
+		std::array<VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> layouts{};
+		layouts.fill(mGpuDrivenSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = mGpuDrivenDescriptorPool;
+		allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+		allocInfo.pSetLayouts = layouts.data();
+		if (VK_SUCCESS != vkAllocateDescriptorSets(mDevice, &allocInfo, mGpuDrivenDescriptorSets.data()))
+			throw std::runtime_error("failed to allocate the GPU-driven descriptor sets!");
+	}
+
+	void VulkanRenderer::CreateGpuCullingPipeline()
+	{
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(GpuDrivenConstants);
+
+		/* Same sets as the GPU-driven graphics pipeline, set 0 holds the instances */
+		std::array<VkDescriptorSetLayout, 2> const setLayouts{ mDescriptorSetLayout, mGpuDrivenSetLayout };
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+		pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mGpuCullingPipelineLayout))
+			throw std::runtime_error("failed to create the GPU culling pipeline layout!");
+
+		VkShaderModule const shader{ LoadShaderModule(mDevice, std::filesystem::absolute("shaders/gpu_cull_CS.spv").generic_string()) };
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader;
+		pipelineInfo.stage.pName = CS_ENTRY_POINT;
+		pipelineInfo.layout = mGpuCullingPipelineLayout;
+		VkResult const result{ vkCreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGpuCullingPipeline) };
+		vkDestroyShaderModule(mDevice, shader, nullptr);
+		if (VK_SUCCESS != result)
+			throw std::runtime_error("failed to create the GPU culling pipeline!");
+	}
+
+	void VulkanRenderer::UploadGpuObjects()
+	{
+		/* Only when instances or models are added or removed: the transforms are read from the instance buffer,
+		 so the per-frame CPU cost does not depend on the object count */
+		vkDeviceWaitIdle(mDevice);
+		mGpuObjectsVersion = mScene.GetVersion();
+		DestroyGpuObjectBuffers();
+
+		mGpuObjects.clear();
+		std::span<ModelId const> const instanceModels{ mScene.GetInstanceModels() };
+		for (uint32_t instanceIndex{ 0 }; instanceIndex < instanceModels.size(); ++instanceIndex)
+		{
+			ModelId const model{ instanceModels[instanceIndex] };
+			ResidentModel const& resident{ mResidentModels[model] };
+			if (!resident.IsResident || EXCLUDED_FROM_GPU_GEOMETRY == resident.GpuMeshOffset)
+				continue;
+			uint32_t const meshCount{ static_cast<uint32_t>(mScene.GetModel(model).meshes.size()) };
+			for (uint32_t meshIndex{ 0 }; meshIndex < meshCount; ++meshIndex)
+				mGpuObjects.push_back({ instanceIndex, resident.GpuMeshOffset + meshIndex });
+		}
+		if (mGpuObjects.empty())
+			return;
+
+		uint64_t const objectCount{ mGpuObjects.size() };
+		CreateDeviceLocalBuffer(mGpuObjectBuffer, mGpuObjectBufferMemory, mGpuObjects.data(), objectCount * sizeof(GpuObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		/* Nothing is visible yet: the first frame draws everything in the late phase */
+		std::vector<uint32_t> const visibility(objectCount, 0);
+		CreateDeviceLocalBuffer(mGpuVisibilityBuffer, mGpuVisibilityBufferMemory, visibility.data(), objectCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			/* The draws of each phase, worst case: every object is visible */
+			CreateBuffer(mGpuDrawCommandBuffers[i]
+				, mGpuDrawCommandBuffersMemory[i]
+				, OCCLUSION_PHASE_COUNT * objectCount * sizeof(VkDrawIndexedIndirectCommand)
+				, static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+				, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			CreateBuffer(mGpuDrawCountBuffers[i]
+				, mGpuDrawCountBuffersMemory[i]
+				, OCCLUSION_PHASE_COUNT * sizeof(uint32_t)
+				, static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+				, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+			std::array<VkDescriptorBufferInfo, GPU_DRIVEN_BUFFER_BINDING_COUNT> const bufferInfos
+			{ {
+				{ mGpuObjectBuffer, 0, VK_WHOLE_SIZE },
+				{ mGpuMeshBuffer, 0, VK_WHOLE_SIZE },
+				{ mGpuDrawCommandBuffers[i], 0, VK_WHOLE_SIZE },
+				{ mGpuDrawCountBuffers[i], 0, VK_WHOLE_SIZE },
+				{ mGpuVisibilityBuffer, 0, VK_WHOLE_SIZE }
+			} };
+			std::array<VkWriteDescriptorSet, GPU_DRIVEN_BUFFER_BINDING_COUNT> descriptorWrites{};
+			for (uint32_t b{ 0 }; b < GPU_DRIVEN_BUFFER_BINDING_COUNT; ++b)
+			{
+				descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[b].dstSet = mGpuDrivenDescriptorSets[i];
+				descriptorWrites[b].dstBinding = b;
+				descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[b].descriptorCount = 1;
+				descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+			}
+			vkUpdateDescriptorSets(mDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+	}
+
+	void VulkanRenderer::DestroyGpuObjectBuffers()
+	{
+		vkDestroyBuffer(mDevice, mGpuObjectBuffer, nullptr);
+		vkFreeMemory(mDevice, mGpuObjectBufferMemory, nullptr);
+		vkDestroyBuffer(mDevice, mGpuVisibilityBuffer, nullptr);
+		vkFreeMemory(mDevice, mGpuVisibilityBufferMemory, nullptr);
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			vkDestroyBuffer(mDevice, mGpuDrawCommandBuffers[i], nullptr);
+			vkFreeMemory(mDevice, mGpuDrawCommandBuffersMemory[i], nullptr);
+			vkDestroyBuffer(mDevice, mGpuDrawCountBuffers[i], nullptr);
+			vkFreeMemory(mDevice, mGpuDrawCountBuffersMemory[i], nullptr);
+		}
+		mGpuObjectBuffer = VK_NULL_HANDLE;
+		mGpuObjectBufferMemory = VK_NULL_HANDLE;
+		mGpuVisibilityBuffer = VK_NULL_HANDLE;
+		mGpuVisibilityBufferMemory = VK_NULL_HANDLE;
+		mGpuDrawCommandBuffers = {};
+		mGpuDrawCommandBuffersMemory = {};
+		mGpuDrawCountBuffers = {};
+		mGpuDrawCountBuffersMemory = {};
+	}
+
+	void VulkanRenderer::DestroyGpuDrivenScene()
+	{
+		/* Destroying null handles is a no-op when the GPU-driven mode is off */
+		DestroyGpuObjectBuffers();
+		DestroyMeshBuffers(mGpuGeometry);
+		vkDestroyPipelineLayout(mDevice, mGpuDrivenPipelineLayout, nullptr);
+		vkDestroyBuffer(mDevice, mGpuMeshBuffer, nullptr);
+		vkFreeMemory(mDevice, mGpuMeshBufferMemory, nullptr);
+		vkDestroyPipeline(mDevice, mGpuCullingPipeline, nullptr);
+		vkDestroyPipelineLayout(mDevice, mGpuCullingPipelineLayout, nullptr);
+		vkDestroyPipeline(mDevice, mDepthPyramidPipeline, nullptr);
+		vkDestroyPipelineLayout(mDevice, mDepthPyramidPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(mDevice, mDepthPyramidSetLayout, nullptr);
+		vkDestroyDescriptorPool(mDevice, mGpuDrivenDescriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(mDevice, mGpuDrivenSetLayout, nullptr);
+	}
+
+	void VulkanRenderer::RecordGpuCulling(VkCommandBuffer commandBuffer, XMMATRIX const& viewProjection, OcclusionPhase phase)
+	{
+		if (mGpuObjects.empty())
+			return;
+
+		if (OcclusionPhase::Early == phase)
+		{
+			vkCmdFillBuffer(commandBuffer, mGpuDrawCountBuffers[mCurrentFrame], 0, OCCLUSION_PHASE_COUNT * sizeof(uint32_t), 0);
+
+			/* Also orders the visibility written by the late phase of the previous frame, and the reads of the
+			 depth pyramid before this frame rebuilds it */
+			VkMemoryBarrier clearBarrier{};
+			clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+				, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		GpuDrivenConstants constants{};
+		XMStoreFloat4x4(&constants.ViewProjection, viewProjection);
+		constants.PixelsPerUnit = GetPixelsPerUnit();
+		constants.MaxLodErrorPixels = MAX_LOD_ERROR_PIXELS;
+		constants.ObjectCount = static_cast<uint32_t>(mGpuObjects.size());
+		constants.Phase = phase;
+		constants.DepthWidth = mSwapChainExtent.width;
+		constants.DepthHeight = mSwapChainExtent.height;
+		constants.DepthPyramidLevelCount = mDepthPyramidLevelCount;
+
+		std::array<VkDescriptorSet, 2> const descriptorSets{ mMaterials[DEFAULT_MATERIAL].DescriptorSets[mCurrentFrame], mGpuDrivenDescriptorSets[mCurrentFrame] };
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mGpuCullingPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mGpuCullingPipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+		vkCmdPushConstants(commandBuffer, mGpuCullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (constants.ObjectCount + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+
+		VkMemoryBarrier cullingBarrier{};
+		cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		cullingBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullingBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	void VulkanRenderer::DrawGpuDriven(VkCommandBuffer commandBuffer, XMMATRIX const& viewProjection, OcclusionPhase phase)
+	{
+		if (mGpuObjects.empty())
+			return;
+
+		GpuDrivenConstants constants{};
+		XMStoreFloat4x4(&constants.ViewProjection, viewProjection);
+
+		/* Each phase has its own range of draws and its own count */
+		uint32_t const objectCount{ static_cast<uint32_t>(mGpuObjects.size()) };
+		uint32_t const phaseIndex{ static_cast<uint32_t>(phase) };
+		std::array<VkDescriptorSet, 2> const descriptorSets{ mMaterials[DEFAULT_MATERIAL].DescriptorSets[mCurrentFrame], mGpuDrivenDescriptorSets[mCurrentFrame] };
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGpuDrivenPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mGpuDrivenPipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+		vkCmdPushConstants(commandBuffer, mGpuDrivenPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+		BindVertexStreams(commandBuffer, mGpuGeometry, VertexStreams::All);
+		vkCmdBindIndexBuffer(commandBuffer, mGpuGeometry.IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexedIndirectCount(commandBuffer
+			, mGpuDrawCommandBuffers[mCurrentFrame], phaseIndex * objectCount * sizeof(VkDrawIndexedIndirectCommand)
+			, mGpuDrawCountBuffers[mCurrentFrame], phaseIndex * sizeof(uint32_t)
+			, objectCount
+			, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+} // namespace gg
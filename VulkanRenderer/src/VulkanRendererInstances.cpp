@@ -0,0 +1,64 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <DirectXMath.h>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t INITIAL_INSTANCE_CAPACITY{ 64 };
+}
+
+namespace gg
+{
+	void VulkanRenderer::CreateInstanceBuffer(uint32_t frameIndex, uint32_t capacity)
+	{
+		CreateBuffer(mInstanceBuffers[frameIndex]
+			, mInstanceBuffersMemory[frameIndex]
+			, capacity * sizeof(InstanceData)
+			, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		/* Stays mapped, the instances are copied every frame */
+		vkMapMemory(mDevice, mInstanceBuffersMemory[frameIndex], 0, VK_WHOLE_SIZE, 0, &mMappedInstanceBuffers[frameIndex]);
+		mInstanceBufferCapacities[frameIndex] = capacity;
+	}
+
+	void VulkanRenderer::UploadInstances(std::span<InstanceData const> instances)
+	{
+		/* The fence of the current frame has been waited on, its buffer and descriptor set are no longer in use.
+		 The buffers are created by the first upload, so that the descriptor set is complete even for an empty scene. */
+		if (instances.size() > mInstanceBufferCapacities[mCurrentFrame] || !mInstanceBuffers[mCurrentFrame])
+		{
+			vkDestroyBuffer(mDevice, mInstanceBuffers[mCurrentFrame], nullptr);
+			vkFreeMemory(mDevice, mInstanceBuffersMemory[mCurrentFrame], nullptr);
+			uint32_t const capacity{ std::max({ static_cast<uint32_t>(instances.size()), 2 * mInstanceBufferCapacities[mCurrentFrame], INITIAL_INSTANCE_CAPACITY }) };
+			CreateInstanceBuffer(mCurrentFrame, capacity);
+			/* Every material has its own copy of set 0 */
+			for (Material const& material : mMaterials)
+			{
+				if (material.DescriptorPool)
+					WriteInstanceDescriptor(material, mCurrentFrame);
+			}
+		}
+		if (!instances.empty())
+			memcpy(mMappedInstanceBuffers[mCurrentFrame], instances.data(), instances.size_bytes());
+	}
+
+	void VulkanRenderer::DestroyInstanceBuffers()
+	{
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			/* Freeing the memory unmaps it */
+			vkDestroyBuffer(mDevice, mInstanceBuffers[i], nullptr);
+			vkFreeMemory(mDevice, mInstanceBuffersMemory[i], nullptr);
+		}
+	}
+
+} // namespace gg
@@ -0,0 +1,166 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import Camera;
+import Scene;
+import ShaderProgram;
+
+using namespace DirectX;
+
+namespace
+{
+	/* Must match LIGHT_CULL_GROUP_SIZE in light_cull.hlsl */
+	constexpr uint32_t LIGHT_CULL_GROUP_SIZE{ 64 };
+}
+
+namespace gg
+{
+	void VulkanRenderer::CreateClusteredLighting()
+	{
+		for (ClusterLightingBuffers& buffers : mClusterLighting)
+		{
+			CreateBuffer(buffers.Lights, buffers.LightsMemory, MAX_LIGHT_COUNT * sizeof(GpuPointLight)
+				, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			/* Stays mapped, the lights are copied every frame */
+			if (VK_SUCCESS != vkMapMemory(mDevice, buffers.LightsMemory, 0, VK_WHOLE_SIZE, 0, &buffers.MappedLights))
+				throw std::runtime_error("failed to map the light buffer!");
+			CreateBuffer(buffers.ClusterLights, buffers.ClusterLightsMemory, CLUSTER_COUNT * 2 * sizeof(uint32_t)
+				, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			CreateBuffer(buffers.LightIndices, buffers.LightIndicesMemory, MAX_CLUSTER_LIGHT_INDICES * sizeof(uint32_t)
+				, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			CreateBuffer(buffers.LightIndexCount, buffers.LightIndexCountMemory, sizeof(uint32_t)
+				, static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+
+		/* Set 0 only, with the sets of the default material like the other compute passes */
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
+		if (VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mLightCullingPipelineLayout))
+			throw std::runtime_error("failed to create the light culling pipeline layout!");
+
+		VkShaderModule const shader{ LoadShaderModule(mDevice, std::filesystem::absolute("shaders/light_cull_CS.spv").generic_string()) };
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader;
+		pipelineInfo.stage.pName = CS_ENTRY_POINT;
+		pipelineInfo.layout = mLightCullingPipelineLayout;
+		VkResult const result{ vkCreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mLightCullingPipeline) };
+		vkDestroyShaderModule(mDevice, shader, nullptr);
+		if (VK_SUCCESS != result)
+			throw std::runtime_error("failed to create the light culling pipeline!");
+	}
+
+	void VulkanRenderer::DestroyClusteredLighting()
+	{
+		vkDestroyPipeline(mDevice, mLightCullingPipeline, nullptr);
+		vkDestroyPipelineLayout(mDevice, mLightCullingPipelineLayout, nullptr);
+		for (ClusterLightingBuffers& buffers : mClusterLighting)
+		{
+			/* Freeing the memory unmaps it */
+			vkDestroyBuffer(mDevice, buffers.Lights, nullptr);
+			vkFreeMemory(mDevice, buffers.LightsMemory, nullptr);
+			vkDestroyBuffer(mDevice, buffers.ClusterLights, nullptr);
+			vkFreeMemory(mDevice, buffers.ClusterLightsMemory, nullptr);
+			vkDestroyBuffer(mDevice, buffers.LightIndices, nullptr);
+			vkFreeMemory(mDevice, buffers.LightIndicesMemory, nullptr);
+			vkDestroyBuffer(mDevice, buffers.LightIndexCount, nullptr);
+			vkFreeMemory(mDevice, buffers.LightIndexCountMemory, nullptr);
+		}
+	}
+
+	void VulkanRenderer::WriteLightingDescriptors(Material const& material, uint32_t frameIndex)
+	{
+		/* Bindings 3 to 6 of set 0, see CreateDescriptorSetLayout */
+		ClusterLightingBuffers const& buffers{ mClusterLighting[frameIndex] };
+		std::array<VkDescriptorBufferInfo, 4> const bufferInfos{ {
+			{ buffers.Lights, 0, VK_WHOLE_SIZE },
+			{ buffers.ClusterLights, 0, VK_WHOLE_SIZE },
+			{ buffers.LightIndices, 0, VK_WHOLE_SIZE },
+			{ buffers.LightIndexCount, 0, VK_WHOLE_SIZE } } };
+
+		std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+		for (uint32_t b{ 0 }; b < descriptorWrites.size(); ++b)
+		{
+			descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[b].dstSet = material.DescriptorSets[frameIndex];
+			descriptorWrites[b].dstBinding = 3 + b;
+			descriptorWrites[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[b].descriptorCount = 1;
+			descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+		}
+		vkUpdateDescriptorSets(mDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
+	void VulkanRenderer::UploadLights(XMMATRIX const& modelViewMatrix, FrameConstants& outConstants)
+	{
+		float const nearPlane{ mCamera->GetNearPlane() };
+		float const farPlane{ mCamera->GetFarPlane() };
+
+		/* The fence of the current frame has been waited on, its light buffer is no longer read.
+		 The root transform of the scene does not scale, the radii carry over to view space. */
+		GpuPointLight* const gpuLights{ static_cast<GpuPointLight*>(mClusterLighting[mCurrentFrame].MappedLights) };
+		uint32_t lightCount{ 0 };
+		for (PointLight const& light : mScene.GetPointLights())
+		{
+			if (MAX_LIGHT_COUNT == lightCount)
+				break;
+			XMFLOAT3 position{};
+			XMStoreFloat3(&position, XMVector3TransformCoord(XMLoadFloat3(&light.Position), modelViewMatrix));
+			/* No cluster is behind the camera or past the far plane */
+			if (position.z + light.Radius < nearPlane || position.z - light.Radius > farPlane)
+				continue;
+			GpuPointLight& gpuLight{ gpuLights[lightCount++] };
+			gpuLight.Position = position;
+			gpuLight.Radius = light.Radius;
+			gpuLight.Color = { light.Color.x * light.Intensity, light.Color.y * light.Intensity, light.Color.z * light.Intensity };
+		}
+
+		/* Slice 0 starts on the near plane and slice CLUSTER_GRID_Z on the far plane */
+		XMMATRIX const& projection{ mCamera->GetProjectionMatrix() };
+		float const sliceScale{ static_cast<float>(CLUSTER_GRID_Z) / std::log(farPlane / nearPlane) };
+		outConstants.ProjectionScale = { XMVectorGetX(projection.r[0]), XMVectorGetY(projection.r[1]) };
+		outConstants.ScreenSize = { static_cast<float>(mSwapChainExtent.width), static_cast<float>(mSwapChainExtent.height) };
+		outConstants.SliceScale = sliceScale;
+		outConstants.SliceBias = -std::log(nearPlane) * sliceScale;
+		outConstants.LightCount = lightCount;
+		outConstants.AmbientIntensity = mScene.GetPointLights().empty() ? 1.f : AMBIENT_INTENSITY;
+	}
+
+	void VulkanRenderer::RecordLightCulling(VkCommandBuffer commandBuffer)
+	{
+		/* Every cluster is written, even without lights, the pixel shaders always read their list */
+		ClusterLightingBuffers const& buffers{ mClusterLighting[mCurrentFrame] };
+		vkCmdFillBuffer(commandBuffer, buffers.LightIndexCount, 0, sizeof(uint32_t), 0);
+
+		VkMemoryBarrier clearBarrier{};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mLightCullingPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mLightCullingPipelineLayout, 0, 1, &mMaterials[DEFAULT_MATERIAL].DescriptorSets[mCurrentFrame], 0, nullptr);
+		vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + LIGHT_CULL_GROUP_SIZE - 1) / LIGHT_CULL_GROUP_SIZE, 1, 1);
+
+		VkMemoryBarrier cullingBarrier{};
+		cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		cullingBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &cullingBarrier, 0, nullptr, 0, nullptr);
+	}
+
+} // namespace gg
@@ -0,0 +1,326 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <DirectXMath.h>
+#include <format>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import ErrorHandling;
+import Ktx2;
+import Logging;
+import MipChain;
+import Model;
+
+using namespace DirectX;
+
+namespace gg
+{
+	void VulkanRenderer::CreateDefaultMaterial()
+	{
+		std::shared_ptr<Texture> white{ std::make_shared<Texture>() };
+		white->Pixels = { 255, 255, 255, 255 };
+		white->Width = 1;
+		white->Height = 1;
+		uint32_t const index{ CreateMaterial(white) };
+		BreakIfFalse(DEFAULT_MATERIAL == index);
+		/* Never released */
+		mMaterials[DEFAULT_MATERIAL].ReferenceCount = 1;
+	}
+
+	uint32_t VulkanRenderer::AcquireMaterial(std::shared_ptr<Texture const> const& texture)
+	{
+		if (!texture)
+			return DEFAULT_MATERIAL;
+		/* Optional in Vulkan, although every desktop GPU samples BC formats */
+		VkFormatProperties formatProperties{};
+		vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, GetVulkanFormat(texture->Format), &formatProperties);
+		if (0 == (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+		{
+			DebugLog(DebugLevel::Error, std::format("The device cannot sample the texture format {}, using the default material", static_cast<uint32_t>(texture->Format)));
+			return DEFAULT_MATERIAL;
+		}
+
+		/* By content, so that the same image in different models is uploaded once */
+		auto const sameContent{ [&texture](Material const& material)
+		{
+			std::shared_ptr<Texture const> const content{ material.Content.lock() };
+			return content && (content == texture || HaveSameTexels(*content, *texture));
+		} };
+		auto const it{ mMaterialIndices.find(texture->ContentHash) };
+		uint32_t const index{ it != mMaterialIndices.end() && sameContent(mMaterials[it->second]) ? it->second : CreateMaterial(texture) };
+		++mMaterials[index].ReferenceCount;
+		return index;
+	}
+
+	void VulkanRenderer::ReleaseMaterial(uint32_t materialIndex)
+	{
+		Material& material{ mMaterials[materialIndex] };
+		BreakIfFalse(material.ReferenceCount > 0);
+		if (DEFAULT_MATERIAL == materialIndex || --material.ReferenceCount > 0)
+			return;
+		/* Another material may own the hash when their contents collided */
+		auto const it{ mMaterialIndices.find(material.ContentHash) };
+		if (it != mMaterialIndices.end() && materialIndex == it->second)
+			mMaterialIndices.erase(it);
+		std::erase(mPendingTextureUploads, materialIndex);
+		DestroyMaterial(material);
+		mFreeMaterialIndices.push_back(materialIndex);
+	}
+
+	uint32_t VulkanRenderer::CreateMaterial(std::shared_ptr<Texture const> const& source)
+	{
+		Texture const& texture{ *source };
+		uint32_t index{ static_cast<uint32_t>(mMaterials.size()) };
+		if (mFreeMaterialIndices.empty())
+			mMaterials.emplace_back();
+		else
+		{
+			index = mFreeMaterialIndices.back();
+			mFreeMaterialIndices.pop_back();
+		}
+		Material& material{ mMaterials[index] };
+		material = {};
+		material.ContentHash = texture.ContentHash;
+		material.Content = source;
+
+		/* Without mips, minified textures alias and every sample misses the texture cache.
+		   Block-compressed textures come with theirs, the others get them built on upload. */
+		VkFormat const format{ GetVulkanFormat(texture.Format) };
+		uint32_t mipLevels{ GetMipLevelCount(texture.Width, texture.Height) };
+		MipLevel firstLevel{ 0, texture.Width, texture.Height };
+		/* Textures that come with their levels are streamed, only the coarse ones are loaded up front */
+		if (texture.Levels.size() > 1)
+		{
+			material.Source = source;
+			material.ResidentLevel = GetInitialResidentLevel(texture);
+			material.ResidentBytes = texture.Pixels.size() - texture.Levels[material.ResidentLevel].Offset;
+			material.RequestedLevel = material.ResidentLevel;
+			material.LastUsedFrame = mFrameNumber;
+			mStreamedTextureBytes += material.ResidentBytes;
+			firstLevel = texture.Levels[material.ResidentLevel];
+		}
+		if (!texture.Levels.empty())
+			mipLevels = static_cast<uint32_t>(texture.Levels.size()) - material.ResidentLevel;
+		CreateImage(firstLevel.Width
+			, firstLevel.Height
+			, mipLevels
+			, format
+			, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			, material.Image
+			, material.ImageMemory);
+		/* Streamed textures are uploaded with the next frame rather than waiting on the queue here */
+		if (material.Source)
+			mPendingTextureUploads.push_back(index);
+		else
+			UploadTexture(texture, material.Image, mipLevels);
+		material.ImageView = CreateImageView(material.Image, format, mipLevels);
+
+		/* A copy of set 0 per frame: its uniform, instance and lighting buffers, and this texture */
+		std::array<VkDescriptorPoolSize, 3> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[2].descriptorCount = static_cast<uint32_t>(5 * MAX_FRAMES_IN_FLIGHT);
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+		if (VK_SUCCESS != vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &material.DescriptorPool))
+			throw std::runtime_error("failed to create material descriptor pool!");
+
+		std::array<VkDescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> layouts{};
+		layouts.fill(mDescriptorSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = material.DescriptorPool;
+		allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+		allocInfo.pSetLayouts = layouts.data();
+		if (VK_SUCCESS != vkAllocateDescriptorSets(mDevice, &allocInfo, material.DescriptorSets.data()))
+			throw std::runtime_error("failed to allocate material descriptor sets!");
+
+		for (uint32_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			VkDescriptorBufferInfo bufferInfo{};
+			bufferInfo.buffer = mUniformBuffers[i];
+			bufferInfo.offset = 0;
+			bufferInfo.range = sizeof(FrameConstants);
+
+			VkWriteDescriptorSet descriptorWrite{};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = material.DescriptorSets[i];
+			descriptorWrite.dstBinding = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+
+			WriteImageDescriptor(material, i);
+			WriteLightingDescriptors(material, i);
+
+			/* Otherwise written by the first UploadInstances of the frame */
+			if (mInstanceBuffers[i])
+				WriteInstanceDescriptor(material, i);
+		}
+
+		if (DEFAULT_MATERIAL != index)
+			mMaterialIndices.emplace(texture.ContentHash, index);
+		return index;
+	}
+
+	void VulkanRenderer::UploadTexture(Texture const& texture, VkImage image, uint32_t mipLevels)
+	{
+		/* The GPU builds the mips when it can filter the format in blits, otherwise they are built here and uploaded with the base level.
+		   Textures that come with their levels, all the block-compressed ones, are copied as they are. */
+		VkFormatProperties formatProperties{};
+		vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+		VkFormatFeatureFlags const blitFeatures{ VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT };
+		bool const blitMips{ texture.Levels.empty() && mipLevels > 1 && blitFeatures == (formatProperties.optimalTilingFeatures & blitFeatures) };
+
+		std::vector<MipLevel> levels{ { 0, texture.Width, texture.Height } };
+		std::vector<uint8_t> mipChain{};
+		std::span<uint8_t const> data{ texture.Pixels };
+		if (!texture.Levels.empty())
+			levels = texture.Levels;
+		else if (mipLevels > 1 && !blitMips)
+		{
+			mipChain = BuildMipChain(texture.Pixels, texture.Width, texture.Height, levels);
+			data = mipChain;
+		}
+
+		StagingAllocation const staging{ WriteStaging(data) };
+
+		/* One submission for all the levels */
+		VkCommandBuffer commandBuffer{ BeginSingleTimeCommands() };
+		RecordImageBarrier(commandBuffer, image, 0, mipLevels
+			, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, 0, VK_ACCESS_TRANSFER_WRITE_BIT
+			, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		std::vector<VkBufferImageCopy> regions(levels.size());
+		for (uint32_t level{ 0 }; level < levels.size(); ++level)
+		{
+			regions[level].bufferOffset = staging.Offset + levels[level].Offset;
+			regions[level].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+			regions[level].imageExtent = { levels[level].Width, levels[level].Height, 1 };
+		}
+		vkCmdCopyBufferToImage(commandBuffer, staging.Buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+		uint32_t firstUnreadLevel{ 0 };
+		if (blitMips)
+		{
+			/* Each level is filtered from the previous one, which then becomes readable by the shaders */
+			for (uint32_t level{ 1 }; level < mipLevels; ++level)
+			{
+				RecordImageBarrier(commandBuffer, image, level - 1, 1
+					, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+					, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT
+					, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+				VkImageBlit blit{};
+				blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+				blit.srcOffsets[1] = { static_cast<int32_t>(std::max(texture.Width >> (level - 1), 1u)), static_cast<int32_t>(std::max(texture.Height >> (level - 1), 1u)), 1 };
+				blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				blit.dstOffsets[1] = { static_cast<int32_t>(std::max(texture.Width >> level, 1u)), static_cast<int32_t>(std::max(texture.Height >> level, 1u)), 1 };
+				vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+				RecordImageBarrier(commandBuffer, image, level - 1, 1
+					, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+					, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT
+					, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+			}
+			firstUnreadLevel = mipLevels - 1;
+		}
+		RecordImageBarrier(commandBuffer, image, firstUnreadLevel, mipLevels - firstUnreadLevel
+			, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+			, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		EndSingleTimeCommands(commandBuffer);
+
+		if (VK_NULL_HANDLE != staging.DedicatedMemory)
+		{
+			vkDestroyBuffer(mDevice, staging.Buffer, nullptr);
+			vkFreeMemory(mDevice, staging.DedicatedMemory, nullptr);
+		}
+	}
+
+	void VulkanRenderer::WriteImageDescriptor(Material const& material, uint32_t frameIndex)
+	{
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = material.ImageView;
+		imageInfo.sampler = mTextureSampler;
+
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = material.DescriptorSets[frameIndex];
+		descriptorWrite.dstBinding = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+	}
+
+	void VulkanRenderer::RecordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMipLevel, uint32_t levelCount
+		, VkImageLayout oldLayout, VkImageLayout newLayout
+		, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask
+		, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseMipLevel, levelCount, 0, 1 };
+		barrier.srcAccessMask = srcAccessMask;
+		barrier.dstAccessMask = dstAccessMask;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void VulkanRenderer::WriteInstanceDescriptor(Material const& material, uint32_t frameIndex)
+	{
+		VkDescriptorBufferInfo bufferInfo{ mInstanceBuffers[frameIndex], 0, VK_WHOLE_SIZE };
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = material.DescriptorSets[frameIndex];
+		descriptorWrite.dstBinding = 2;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+		vkUpdateDescriptorSets(mDevice, 1, &descriptorWrite, 0, nullptr);
+	}
+
+	void VulkanRenderer::DestroyMaterial(Material& material)
+	{
+		mStreamedTextureBytes -= material.ResidentBytes;
+		vkDestroyDescriptorPool(mDevice, material.DescriptorPool, nullptr);
+		vkDestroyImageView(mDevice, material.ImageView, nullptr);
+		vkDestroyImage(mDevice, material.Image, nullptr);
+		vkFreeMemory(mDevice, material.ImageMemory, nullptr);
+		material = {};
+	}
+
+	void VulkanRenderer::DestroyMaterials()
+	{
+		for (Material& material : mMaterials)
+			DestroyMaterial(material);
+		mMaterials.clear();
+		mFreeMaterialIndices.clear();
+		mMaterialIndices.clear();
+	}
+
+} // namespace gg
@@ -0,0 +1,334 @@
+module;
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import Meshlet;
+import Model;
+import Scene;
+import ShaderProgram;
+import Vertex;
+
+using namespace DirectX;
+
+namespace
+{
+	/* Must match the workgroup size of as_main in meshlet_mesh.hlsl */
+	constexpr uint32_t TASK_GROUP_SIZE{ 32 };
+	/* Storage buffers of the culling compute shader: meshlets, vertices, triangles, culled indices, draw command */
+	constexpr uint32_t CULLING_STORAGE_BUFFER_COUNT{ 5 };
+	/* Storage buffers of the mesh shader: meshlets, vertices, triangles and the vertex streams */
+	constexpr uint32_t MESH_SHADING_STORAGE_BUFFER_COUNT{ 3 + gg::VERTEX_STREAM_COUNT };
+
+	VkDescriptorSetLayoutBinding layoutBinding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages)
+	{
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = binding;
+		layoutBinding.descriptorCount = 1;
+		layoutBinding.descriptorType = type;
+		layoutBinding.stageFlags = stages;
+		return layoutBinding;
+	}
+
+	VkDescriptorBufferInfo wholeBuffer(VkBuffer buffer)
+	{
+		return { buffer, 0, VK_WHOLE_SIZE };
+	}
+}
+
+namespace gg
+{
+	bool VulkanRenderer::UsesMeshlets(DrawItem const& draw) const
+	{
+		/* Coarser LODs are small on screen, they are drawn directly. The meshlets are culled
+		 in the space of one instance, many instances are cheaper as one instanced draw.
+		 Without mesh shaders the indirect draw of the compute culling needs a nonzero firstInstance. */
+		return (mMeshShadingSupported || mIndirectFirstInstanceSupported)
+			&& 1 == draw.InstanceCount && 0 == draw.Lod
+			&& !mScene.GetModel(draw.Model).meshes[draw.MeshIndex].Meshlets.empty();
+	}
+
+	XMFLOAT3 VulkanRenderer::GetObjectSpaceCameraPosition(InstanceData const& instance) const
+	{
+		XMMATRIX const objectToView{ XMLoadFloat4x4(&instance.ObjectMatrix) * XMLoadFloat4x4(&mModelViewMatrix) };
+		XMFLOAT3 cameraPosition;
+		XMStoreFloat3(&cameraPosition, XMMatrixInverse(nullptr, objectToView).r[3]);
+		return cameraPosition;
+	}
+
+	void VulkanRenderer::CreateMeshletBuffers(Mesh const& mesh, MeshBuffers& buffers)
+	{
+		if (mesh.Meshlets.empty())
+			return;
+
+		CreateDeviceLocalBuffer(buffers.MeshletBuffer, buffers.MeshletBufferMemory
+			, mesh.Meshlets.data(), mesh.Meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		CreateDeviceLocalBuffer(buffers.MeshletVertexBuffer, buffers.MeshletVertexBufferMemory
+			, mesh.MeshletVertices.data(), mesh.MeshletVertices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		CreateDeviceLocalBuffer(buffers.MeshletTriangleBuffer, buffers.MeshletTriangleBufferMemory
+			, mesh.MeshletTriangles.data(), mesh.MeshletTriangles.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+		if (mMeshShadingSupported)
+			return;
+
+		/* The compute path writes the surviving triangles of LOD 0 into an index buffer every frame */
+		uint64_t const culledIndicesSizeBytes{ mesh.Lods[0].IndexCount * sizeof(uint32_t) };
+		VkDrawIndexedIndirectCommand const emptyDraw{ 0, 1, 0, 0, 0 };
+		for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		{
+			CreateBuffer(buffers.CulledIndexBuffers[i]
+				, buffers.CulledIndexBuffersMemory[i]
+				, culledIndicesSizeBytes
+				, static_cast<VkBufferUsageFlagBits>(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+				, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			CreateDeviceLocalBuffer(buffers.DrawCommandBuffers[i], buffers.DrawCommandBuffersMemory[i]
+				, &emptyDraw, sizeof(emptyDraw), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		}
+	}
+
+	void VulkanRenderer::CreateMeshletSetLayouts()
+	{
+		if (mMeshShadingSupported)
+		{
+			VkShaderStageFlags const stages{ VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT };
+			std::array<VkDescriptorSetLayoutBinding, MESH_SHADING_STORAGE_BUFFER_COUNT> bindings{};
+			for (uint32_t i{ 0 }; i < MESH_SHADING_STORAGE_BUFFER_COUNT; ++i)
+				bindings[i] = layoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stages);
+
+			VkDescriptorSetLayoutCreateInfo layoutInfo{};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+			layoutInfo.pBindings = bindings.data();
+			if (VK_SUCCESS != vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mMeshShadingSetLayout))
+				throw std::runtime_error("failed to create the mesh shading descriptor set layout!");
+		}
+		else
+		{
+			/* Set 1 of the culling pass, the camera and the instances come from set 0 */
+			std::array<VkDescriptorSetLayoutBinding, CULLING_STORAGE_BUFFER_COUNT> bindings{};
+			for (uint32_t i{ 0 }; i < bindings.size(); ++i)
+				bindings[i] = layoutBinding(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+
+			VkDescriptorSetLayoutCreateInfo layoutInfo{};
+			layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+			layoutInfo.pBindings = bindings.data();
+			if (VK_SUCCESS != vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mMeshletCullingSetLayout))
+				throw std::runtime_error("failed to create the meshlet culling descriptor set layout!");
+		}
+	}
+
+	void VulkanRenderer::CreateMeshletDescriptorSets(Model const& model, ResidentModel& resident)
+	{
+		uint32_t meshletMeshCount{ 0 };
+		for (Mesh const& mesh : model.meshes)
+			if (!mesh.Meshlets.empty())
+				++meshletMeshCount;
+		if (0 == meshletMeshCount)
+			return;
+
+		/* One set per mesh for the mesh shaders, one per mesh and frame for the culling pass */
+		uint32_t const setCount{ mMeshShadingSupported ? meshletMeshCount : meshletMeshCount * MAX_FRAMES_IN_FLIGHT };
+		VkDescriptorPoolSize poolSize{};
+		poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSize.descriptorCount = setCount * (mMeshShadingSupported ? MESH_SHADING_STORAGE_BUFFER_COUNT : CULLING_STORAGE_BUFFER_COUNT);
+
+		/* One pool per model, released together with its buffers */
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		poolInfo.maxSets = setCount;
+		if (VK_SUCCESS != vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &resident.MeshletDescriptorPool))
+			throw std::runtime_error("failed to create the meshlet descriptor pool!");
+
+		auto allocateSet = [this, &resident](VkDescriptorSetLayout layout)
+		{
+			VkDescriptorSetAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			allocInfo.descriptorPool = resident.MeshletDescriptorPool;
+			allocInfo.descriptorSetCount = 1;
+			allocInfo.pSetLayouts = &layout;
+			VkDescriptorSet set;
+			if (VK_SUCCESS != vkAllocateDescriptorSets(mDevice, &allocInfo, &set))
+				throw std::runtime_error("failed to allocate the meshlet descriptor sets!");
+			return set;
+		};
+
+		auto writeSet = [this](VkDescriptorSet set, uint32_t firstBinding, VkDescriptorType type, std::vector<VkDescriptorBufferInfo> const& bufferInfos)
+		{
+			std::vector<VkWriteDescriptorSet> writes(bufferInfos.size());
+			for (size_t i{ 0 }; i < bufferInfos.size(); ++i)
+			{
+				writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i].dstSet = set;
+				writes[i].dstBinding = firstBinding + static_cast<uint32_t>(i);
+				writes[i].descriptorType = type;
+				writes[i].descriptorCount = 1;
+				writes[i].pBufferInfo = &bufferInfos[i];
+			}
+			vkUpdateDescriptorSets(mDevice, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+		};
+
+		for (size_t m{ 0 }; m < model.meshes.size(); ++m)
+		{
+			if (model.meshes[m].Meshlets.empty())
+				continue;
+
+			MeshBuffers& buffers{ resident.Meshes[m] };
+			if (mMeshShadingSupported)
+			{
+				buffers.MeshShadingDescriptorSet = allocateSet(mMeshShadingSetLayout);
+				writeSet(buffers.MeshShadingDescriptorSet, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {
+					wholeBuffer(buffers.MeshletBuffer),
+					wholeBuffer(buffers.MeshletVertexBuffer),
+					wholeBuffer(buffers.MeshletTriangleBuffer),
+					wholeBuffer(buffers.VertexBuffers[static_cast<size_t>(VertexStream::Position)]),
+					wholeBuffer(buffers.VertexBuffers[static_cast<size_t>(VertexStream::Attributes)]) });
+				continue;
+			}
+
+			for (size_t i{ 0 }; i < MAX_FRAMES_IN_FLIGHT; ++i)
+			{
+				VkDescriptorSet const set{ allocateSet(mMeshletCullingSetLayout) };
+				writeSet(set, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {
+					wholeBuffer(buffers.MeshletBuffer),
+					wholeBuffer(buffers.MeshletVertexBuffer),
+					wholeBuffer(buffers.MeshletTriangleBuffer),
+					wholeBuffer(buffers.CulledIndexBuffers[i]),
+					wholeBuffer(buffers.DrawCommandBuffers[i]) });
+				buffers.CullingDescriptorSets[i] = set;
+			}
+		}
+	}
+
+	void VulkanRenderer::CreateMeshletCullingPipeline()
+	{
+		if (mMeshShadingSupported)
+			return;
+
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(MeshletConstants);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		std::array<VkDescriptorSetLayout, 2> const setLayouts{ mDescriptorSetLayout, mMeshletCullingSetLayout };
+		pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+		pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (VK_SUCCESS != vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mMeshletCullingPipelineLayout))
+			throw std::runtime_error("failed to create the meshlet culling pipeline layout!");
+
+		VkShaderModule const shader{ LoadShaderModule(mDevice, std::filesystem::absolute("shaders/meshlet_cull_CS.spv").generic_string()) };
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = shader;
+		pipelineInfo.stage.pName = CS_ENTRY_POINT;
+		pipelineInfo.layout = mMeshletCullingPipelineLayout;
+		VkResult const result{ vkCreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mMeshletCullingPipeline) };
+		vkDestroyShaderModule(mDevice, shader, nullptr);
+		if (VK_SUCCESS != result)
+			throw std::runtime_error("failed to create the meshlet culling pipeline!");
+	}
+
+	void VulkanRenderer::RecordMeshletCulling(VkCommandBuffer commandBuffer)
+	{
+		if (mMeshShadingSupported)
+			return; /* culled by the task shader */
+
+		size_t culledCount{ 0 };
+		for (DrawItem const& draw : mDrawItems)
+			culledCount += UsesMeshlets(draw);
+		if (0 == culledCount)
+			return;
+
+		std::span<DrawItem const*> const culledDraws{ mFrameArena.Allocate<DrawItem const*>(culledCount) };
+		culledCount = 0;
+		for (DrawItem const& draw : mDrawItems)
+			if (UsesMeshlets(draw))
+				culledDraws[culledCount++] = &draw;
+
+		/* The vertex shader finds the instance through the firstInstance of the draw command */
+		for (DrawItem const* draw : culledDraws)
+		{
+			VkBuffer const drawCommandBuffer{ mResidentModels[draw->Model].Meshes[draw->MeshIndex].DrawCommandBuffers[mCurrentFrame] };
+			vkCmdFillBuffer(commandBuffer, drawCommandBuffer, offsetof(VkDrawIndexedIndirectCommand, indexCount), sizeof(uint32_t), 0);
+			vkCmdFillBuffer(commandBuffer, drawCommandBuffer, offsetof(VkDrawIndexedIndirectCommand, firstInstance), sizeof(uint32_t), draw->FirstInstance);
+		}
+
+		VkMemoryBarrier clearBarrier{};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mMeshletCullingPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mMeshletCullingPipelineLayout, 0, 1, &mMaterials[DEFAULT_MATERIAL].DescriptorSets[mCurrentFrame], 0, nullptr);
+		for (DrawItem const* draw : culledDraws)
+		{
+			Mesh const& mesh{ mScene.GetModel(draw->Model).meshes[draw->MeshIndex] };
+			MeshletConstants constants{};
+			constants.CameraPosition = GetObjectSpaceCameraPosition(mVisibleInstances[draw->FirstInstance]);
+			constants.MeshletCount = static_cast<uint32_t>(mesh.Meshlets.size());
+			constants.InstanceIndex = draw->FirstInstance;
+
+			MeshBuffers const& buffers{ mResidentModels[draw->Model].Meshes[draw->MeshIndex] };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mMeshletCullingPipelineLayout, 1, 1, &buffers.CullingDescriptorSets[mCurrentFrame], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, mMeshletCullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+			vkCmdDispatch(commandBuffer, constants.MeshletCount, 1, 1);
+		}
+
+		VkMemoryBarrier cullingBarrier{};
+		cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		cullingBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &cullingBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	void VulkanRenderer::DrawMeshlets(DrawItem const& draw, DrawStateCache& state)
+	{
+		Mesh const& mesh{ mScene.GetModel(draw.Model).meshes[draw.MeshIndex] };
+		MeshBuffers const& buffers{ mResidentModels[draw.Model].Meshes[draw.MeshIndex] };
+
+		if (mMeshShadingSupported)
+		{
+			MeshletConstants constants{};
+			constants.Quantization = mesh.Quantization;
+			constants.CameraPosition = GetObjectSpaceCameraPosition(mVisibleInstances[draw.FirstInstance]);
+			constants.MeshletCount = static_cast<uint32_t>(mesh.Meshlets.size());
+			constants.IsQuantized = VertexFormat::Quantized16 == mesh.Format;
+			constants.InstanceIndex = draw.FirstInstance;
+
+			/* Per mesh and instance, never redundant */
+			vkCmdBindDescriptorSets(state.CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mMeshShadingPipelineLayout, 1, 1, &buffers.MeshShadingDescriptorSet, 0, nullptr);
+			vkCmdPushConstants(state.CommandBuffer, mMeshShadingPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(constants), &constants);
+			++state.Requested.DescriptorSetBinds;
+			++state.Issued.DescriptorSetBinds;
+			++state.Requested.PushConstants;
+			++state.Issued.PushConstants;
+			state.HasQuantization = false;
+			mCmdDrawMeshTasks(state.CommandBuffer, (constants.MeshletCount + TASK_GROUP_SIZE - 1) / TASK_GROUP_SIZE, 1, 1);
+			return;
+		}
+
+		state.BindVertexStreams(buffers);
+		state.BindIndexBuffer(buffers.CulledIndexBuffers[mCurrentFrame]);
+		state.PushQuantization(mesh.Quantization);
+		vkCmdDrawIndexedIndirect(state.CommandBuffer, buffers.DrawCommandBuffers[mCurrentFrame], 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+} // namespace gg
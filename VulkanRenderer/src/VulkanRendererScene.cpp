@@ -0,0 +1,290 @@
+module;
+#include <algorithm>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <limits>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import Culling;
+import DrawSort;
+import Model;
+import OcclusionCulling;
+import Scene;
+
+using namespace DirectX;
+
+namespace gg
+{
+	void VulkanRenderer::UpdateResidency()
+	{
+		mScene.UpdateLoadingModels();
+		mScene.UpdateBvh();
+
+		/* Releases first, their ids may be reused by the pending uploads */
+		for (ModelId id : mScene.TakePendingReleases())
+			ReleaseModel(id);
+
+		mResidentModels.resize(mScene.GetModelIdLimit());
+		for (ModelId id : mScene.TakePendingUploads())
+			UploadModel(id);
+	}
+
+	void VulkanRenderer::UploadModel(ModelId id)
+	{
+		Model const& model{ mScene.GetModel(id) };
+		ResidentModel& resident{ mResidentModels[id] };
+		resident = {};
+		resident.PipelineIndex = GetGraphicsPipelineIndex(model);
+
+		/* The GPU-driven mode merges the geometry of all models instead, and draws them with the default material */
+		if (!mGpuDriven)
+		{
+			for (Mesh const& mesh : model.meshes)
+			{
+				MeshBuffers& buffers{ resident.Meshes.emplace_back() };
+				CreateVertexBuffer(mesh, buffers);
+				CreateIndexBuffer(mesh, buffers);
+				CreateMeshletBuffers(mesh, buffers);
+				resident.MeshMaterials.push_back(AcquireMaterial(mesh.BaseColorTexture));
+			}
+			CreateMeshletDescriptorSets(model, resident);
+		}
+
+		resident.IsResident = true;
+		mScene.SetResident(id);
+		mGpuGeometryDirty |= mGpuDriven;
+	}
+
+	void VulkanRenderer::ReleaseModel(ModelId id)
+	{
+		/* The frames in flight may still draw the model */
+		ResidentModel& resident{ mResidentModels[id] };
+		mRetiredModels.push_back({ std::move(resident.Meshes), resident.MeshletDescriptorPool, std::move(resident.MeshMaterials), mFrameNumber + MAX_FRAMES_IN_FLIGHT });
+		resident = {};
+		mScene.ReleaseModel(id);
+		mGpuGeometryDirty |= mGpuDriven;
+	}
+
+	void VulkanRenderer::DestroyRetiredModels(bool waitForAll)
+	{
+		std::erase_if(mRetiredModels, [this, waitForAll](RetiredModel& retired)
+		{
+			if (!waitForAll && retired.ReleaseFrame > mFrameNumber)
+				return false;
+			for (MeshBuffers& buffers : retired.Meshes)
+				DestroyMeshBuffers(buffers);
+			vkDestroyDescriptorPool(mDevice, retired.MeshletDescriptorPool, nullptr);
+			for (uint32_t material : retired.MeshMaterials)
+				ReleaseMaterial(material);
+			return true;
+		});
+	}
+
+	std::optional<InstanceId> VulkanRenderer::PickInstance(uint32_t x, uint32_t y) const
+	{
+		/* The viewport is not flipped, the top row is at -1 */
+		float const ndcX{ 2.f * (static_cast<float>(x) + 0.5f) / static_cast<float>(mSwapChainExtent.width) - 1.f };
+		float const ndcY{ 2.f * (static_cast<float>(y) + 0.5f) / static_cast<float>(mSwapChainExtent.height) - 1.f };
+		XMFLOAT3 origin{};
+		XMFLOAT3 direction{};
+		mCamera->GetRay(ndcX, ndcY, XMLoadFloat4x4(&mModelViewMatrix), origin, direction);
+		/* Up to the far plane */
+		return mScene.IntersectRay(origin, direction, 1.f);
+	}
+
+	void VulkanRenderer::BuildDrawList(XMMATRIX const& modelViewMatrix, XMMATRIX const& mvpMatrix)
+	{
+		/* The instance bounds are in the space below the root transform, which the MVP starts from */
+		Frustum const frustum{ Frustum::FromMatrix(mvpMatrix) };
+		std::span<XMFLOAT4 const> const bounds{ mScene.GetInstanceBounds() };
+		std::span<ModelId const> const instanceModels{ mScene.GetInstanceModels() };
+		std::span<InstanceData const> const instances{ mScene.GetInstances() };
+
+		for (ResidentModel& resident : mResidentModels)
+		{
+			resident.VisibleInstanceCount = 0;
+			resident.NearestVisibleDepth = std::numeric_limits<float>::max();
+		}
+
+		/* Through the BVH the cost grows with the visible instances, not with the scene */
+		mScene.CullInstances(frustum, mVisibleInstanceIndices);
+		std::erase_if(mVisibleInstanceIndices, [this, instanceModels](uint32_t i) { return !mResidentModels[instanceModels[i]].IsResident; });
+		if (mOcclusionCulling && !mGpuDriven)
+			CullOccludedInstances(modelViewMatrix, mvpMatrix);
+		for (uint32_t i : mVisibleInstanceIndices)
+		{
+			ResidentModel& resident{ mResidentModels[instanceModels[i]] };
+			++resident.VisibleInstanceCount;
+
+			XMVECTOR const viewCenter{ XMVector3Transform(XMLoadFloat4(&bounds[i]), modelViewMatrix) };
+			float const depth{ XMVectorGetX(XMVector3Length(viewCenter)) - bounds[i].w };
+			resident.NearestVisibleDepth = std::min(resident.NearestVisibleDepth, depth);
+		}
+
+		/* Counting sort by model, so that each mesh draws all the visible instances of its model at once */
+		uint32_t firstInstance{ 0 };
+		for (ResidentModel& resident : mResidentModels)
+		{
+			resident.FirstVisibleInstance = firstInstance;
+			firstInstance += std::exchange(resident.VisibleInstanceCount, 0);
+		}
+		mVisibleInstances.resize(mVisibleInstanceIndices.size());
+		for (uint32_t i : mVisibleInstanceIndices)
+		{
+			ResidentModel& resident{ mResidentModels[instanceModels[i]] };
+			mVisibleInstances[resident.FirstVisibleInstance + resident.VisibleInstanceCount++] = instances[i];
+		}
+
+		mDrawItems.clear();
+		for (ModelId id{ 0 }; id < mResidentModels.size(); ++id)
+		{
+			ResidentModel const& resident{ mResidentModels[id] };
+			if (0 == resident.VisibleInstanceCount)
+				continue;
+
+			Model const& model{ mScene.GetModel(id) };
+			std::span<InstanceData const> const visible{ mVisibleInstances.data() + resident.FirstVisibleInstance, resident.VisibleInstanceCount };
+			for (uint32_t m{ 0 }; m < model.meshes.size(); ++m)
+			{
+				float const maxScaleOverDistance{ GetMaxScaleOverDistance(model.meshes[m], visible, modelViewMatrix) };
+				RequestTextureLevel(resident.MeshMaterials[m], model.meshes[m], maxScaleOverDistance);
+				mDrawItems.push_back({ resident.PipelineIndex, resident.MeshMaterials[m], id, m
+					, SelectLod(model.meshes[m], maxScaleOverDistance)
+					, resident.FirstVisibleInstance, resident.VisibleInstanceCount, resident.NearestVisibleDepth });
+			}
+		}
+
+		/* Fewest state changes: pass, pipeline, material, geometry, then front to back. The depth prepass draws the same items
+		 * without their materials, except the meshlet ones. */
+		size_t const prepassCount{ mDepthPrepass ? static_cast<size_t>(std::ranges::count_if(mDrawItems, [this](DrawItem const& draw) { return !UsesMeshlets(draw); })) : 0 };
+		mDrawPackets = mFrameArena.Allocate<DrawPacket>(mDrawItems.size() + prepassCount);
+		uint32_t packetCount{ 0 };
+		for (uint32_t i{ 0 }; i < mDrawItems.size(); ++i)
+		{
+			DrawItem const& draw{ mDrawItems[i] };
+			/* The mesh shading variant is a different pipeline */
+			uint32_t const pipeline{ draw.PipelineIndex << 1 | static_cast<uint32_t>(mMeshShadingSupported && UsesMeshlets(draw)) };
+			uint64_t const key{ MakeDrawKey({ DrawPass::Opaque, pipeline, draw.MaterialIndex, draw.Model, draw.MeshIndex, draw.Depth }) };
+			mDrawPackets[packetCount++] = { key, i };
+			if (mDepthPrepass && !UsesMeshlets(draw))
+				mDrawPackets[packetCount++] = { MakeDrawKey({ DrawPass::DepthPrepass, draw.PipelineIndex, 0, draw.Model, draw.MeshIndex, draw.Depth }), i };
+		}
+		RadixSort(mDrawPackets, mFrameArena.Allocate<DrawPacket>(mDrawPackets.size()));
+	}
+
+	void VulkanRenderer::CullOccludedInstances(XMMATRIX const& modelViewMatrix, XMMATRIX const& mvpMatrix)
+	{
+		std::span<XMFLOAT4 const> const bounds{ mScene.GetInstanceBounds() };
+		std::span<ModelId const> const instanceModels{ mScene.GetInstanceModels() };
+		std::span<InstanceData const> const instances{ mScene.GetInstances() };
+
+		/* The instances that appear the largest, near ones first since they hide the most */
+		mOccluderCandidates.clear();
+		for (uint32_t i : mVisibleInstanceIndices)
+		{
+			XMVECTOR const viewCenter{ XMVector3Transform(XMLoadFloat4(&bounds[i]), modelViewMatrix) };
+			float const distance{ std::max(XMVectorGetX(XMVector3Length(viewCenter)) - bounds[i].w, 0.01f) };
+			float const size{ bounds[i].w / distance };
+			if (size >= MIN_OCCLUDER_SIZE)
+				mOccluderCandidates.push_back({ size, i });
+		}
+		size_t const occluderCount{ std::min<size_t>(mOccluderCandidates.size(), MAX_OCCLUDER_COUNT) };
+		std::partial_sort(mOccluderCandidates.begin(), mOccluderCandidates.begin() + occluderCount, mOccluderCandidates.end(),
+			[](auto const& a, auto const& b) { return a.first > b.first; });
+
+		mOcclusionBuffer.Clear();
+		for (size_t o{ 0 }; o < occluderCount; ++o)
+		{
+			uint32_t const i{ mOccluderCandidates[o].second };
+			XMMATRIX const modelViewProjection{ XMMatrixMultiply(XMLoadFloat4x4(&instances[i].ObjectMatrix), mvpMatrix) };
+			for (OccluderMesh const& occluder : GetOccluderMeshes(instanceModels[i]))
+				mOcclusionBuffer.AddOccluder(occluder.Positions, occluder.Indices, modelViewProjection);
+		}
+		mOcclusionBuffer.Rasterize();
+		mOcclusionBuffer.CullBoxes(mScene.GetInstanceBoxes(), mvpMatrix, mVisibleInstanceIndices);
+	}
+
+	std::vector<VulkanRenderer::OccluderMesh> const& VulkanRenderer::GetOccluderMeshes(ModelId id)
+	{
+		ResidentModel& resident{ mResidentModels[id] };
+		Model const& model{ mScene.GetModel(id) };
+		if (resident.Occluders.size() == model.meshes.size())
+			return resident.Occluders;
+
+		resident.Occluders.resize(model.meshes.size());
+		for (size_t m{ 0 }; m < model.meshes.size(); ++m)
+		{
+			Mesh const& mesh{ model.meshes[m] };
+			OccluderMesh& occluder{ resident.Occluders[m] };
+			if (mesh.Lods.empty())
+				continue;
+
+			/* The coarsest LOD that stays within the silhouette tolerance, a simplified occluder rasterizes faster */
+			XMVECTOR const extent{ XMVectorSubtract(XMLoadFloat3(&mesh.BoundsMax), XMLoadFloat3(&mesh.BoundsMin)) };
+			float const radius{ 0.5f * XMVectorGetX(XMVector3Length(extent)) };
+			uint32_t lod{ 0 };
+			for (uint32_t l{ 1 }; l < mesh.Lods.size(); ++l)
+				if (mesh.Lods[l].Error <= MAX_OCCLUDER_ERROR * radius)
+					lod = l;
+
+			/* Only the vertices of the LOD, decoded once */
+			std::vector<uint32_t> remap(mesh.GetVertexCount(), std::numeric_limits<uint32_t>::max());
+			std::span<uint32_t const> const indices{ mesh.Indices.data() + mesh.Lods[lod].FirstIndex, mesh.Lods[lod].IndexCount };
+			occluder.Indices.reserve(indices.size());
+			for (uint32_t index : indices)
+			{
+				if (std::numeric_limits<uint32_t>::max() == remap[index])
+				{
+					remap[index] = static_cast<uint32_t>(occluder.Positions.size());
+					occluder.Positions.push_back(mesh.GetPosition(index));
+				}
+				occluder.Indices.push_back(remap[index]);
+			}
+		}
+		return resident.Occluders;
+	}
+
+	void VulkanRenderer::ResizeOcclusionBuffer()
+	{
+		/* The aspect ratio of the swap chain */
+		uint32_t const height{ OCCLUSION_BUFFER_WIDTH * mSwapChainExtent.height / std::max(mSwapChainExtent.width, 1u) };
+		mOcclusionBuffer.Resize(OCCLUSION_BUFFER_WIDTH, std::max(height, 1u));
+	}
+
+	float VulkanRenderer::GetMaxScaleOverDistance(Mesh const& mesh, std::span<InstanceData const> instances, XMMATRIX const& modelViewMatrix) const
+	{
+		XMVECTOR const boundsMin{ XMLoadFloat3(&mesh.BoundsMin) };
+		XMVECTOR const boundsMax{ XMLoadFloat3(&mesh.BoundsMax) };
+		XMVECTOR const center{ XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f) };
+		float const radius{ XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, center))) };
+
+		/* All instances share the draw, the one that appears the largest picks the LOD and the texture level */
+		float maxScaleOverDistance{ 0.f };
+		for (InstanceData const& instance : instances)
+		{
+			XMMATRIX const objectMatrix{ XMLoadFloat4x4(&instance.ObjectMatrix) };
+			float const scale{ GetMaxScale(objectMatrix) };
+			/* Distance to the closest point of the bounding sphere */
+			XMVECTOR const viewCenter{ XMVector3Transform(center, XMMatrixMultiply(objectMatrix, modelViewMatrix)) };
+			float const distance{ std::max(XMVectorGetX(XMVector3Length(viewCenter)) - radius * scale, 0.01f) };
+			maxScaleOverDistance = std::max(maxScaleOverDistance, scale / distance);
+		}
+		return maxScaleOverDistance;
+	}
+
+	uint32_t VulkanRenderer::SelectLod(Mesh const& mesh, float maxScaleOverDistance) const
+	{
+		float const pixelsPerUnit{ GetPixelsPerUnit() };
+		uint32_t lod{ 0 };
+		for (uint32_t l{ 1 }; l < mesh.Lods.size(); ++l)
+			if (mesh.Lods[l].Error * pixelsPerUnit * maxScaleOverDistance <= MAX_LOD_ERROR_PIXELS)
+				lod = l;
+		return lod;
+	}
+
+} // namespace gg
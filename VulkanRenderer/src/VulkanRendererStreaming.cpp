@@ -0,0 +1,266 @@
+module;
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+module VulkanRenderer;
+
+import Ktx2;
+import MipChain;
+import Model;
+
+namespace
+{
+	using namespace gg;
+
+	/* The levels are stored finest first, so the ones from a level on end the texture data */
+	uint64_t getLevelsSize(Texture const& texture, uint32_t firstLevel)
+	{
+		return texture.Pixels.size() - texture.Levels[firstLevel].Offset;
+	}
+
+	uint64_t getLevelSize(Texture const& texture, uint32_t level)
+	{
+		return getLevelsSize(texture, level) - (level + 1 < texture.Levels.size() ? getLevelsSize(texture, level + 1) : 0);
+	}
+}
+
+namespace gg
+{
+	uint32_t VulkanRenderer::GetInitialResidentLevel(Texture const& texture)
+	{
+		uint32_t level{ 0 };
+		while (level + 1 < texture.Levels.size() && std::max(texture.Levels[level].Width, texture.Levels[level].Height) > STREAMING_INITIAL_SIZE)
+			++level;
+		return level;
+	}
+
+	void VulkanRenderer::RequestTextureLevel(uint32_t materialIndex, Mesh const& mesh, float maxScaleOverDistance)
+	{
+		Material& material{ mMaterials[materialIndex] };
+		if (!material.Source)
+			return;
+
+		/* The level whose texels are about a pixel wide on the instance that appears the largest */
+		Texture const& texture{ *material.Source };
+		uint32_t const coarsestLevel{ static_cast<uint32_t>(texture.Levels.size()) - 1 };
+		float const texelsPerUnit{ mesh.UvDensity * std::sqrt(static_cast<float>(texture.Width) * static_cast<float>(texture.Height)) };
+		float const pixelsPerUnit{ GetPixelsPerUnit() * maxScaleOverDistance };
+		uint32_t level{ coarsestLevel };
+		if (texelsPerUnit > 0.f && pixelsPerUnit > 0.f)
+			level = static_cast<uint32_t>(std::clamp(std::floor(std::log2(texelsPerUnit / pixelsPerUnit)), 0.f, static_cast<float>(coarsestLevel)));
+
+		if (material.LastUsedFrame != mFrameNumber)
+		{
+			material.LastUsedFrame = mFrameNumber;
+			material.RequestedLevel = level;
+		}
+		else
+			material.RequestedLevel = std::min(material.RequestedLevel, level);
+	}
+
+	void VulkanRenderer::StreamTextures(VkCommandBuffer commandBuffer)
+	{
+		/* The initial levels of the textures created since the last frame */
+		for (uint32_t index : mPendingTextureUploads)
+		{
+			Material const& material{ mMaterials[index] };
+			Texture const& texture{ *material.Source };
+			uint32_t const levelCount{ static_cast<uint32_t>(texture.Levels.size()) };
+			RecordImageBarrier(commandBuffer, material.Image, 0, levelCount - material.ResidentLevel
+				, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+				, 0, VK_ACCESS_TRANSFER_WRITE_BIT
+				, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+			RecordTextureUpload(commandBuffer, texture, material.Image, material.ResidentLevel, material.ResidentLevel, levelCount);
+			RecordImageBarrier(commandBuffer, material.Image, 0, levelCount - material.ResidentLevel
+				, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+				, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT
+				, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		}
+		mPendingTextureUploads.clear();
+
+		/* The textures drawn this frame that need finer levels, the largest shortfall first */
+		std::span<uint32_t> upgrades{ mFrameArena.Allocate<uint32_t>(mMaterials.size()) };
+		size_t upgradeCount{ 0 };
+		for (uint32_t i{ 0 }; i < mMaterials.size(); ++i)
+		{
+			Material const& material{ mMaterials[i] };
+			if (material.Source && mFrameNumber == material.LastUsedFrame && material.RequestedLevel < material.ResidentLevel)
+				upgrades[upgradeCount++] = i;
+		}
+		upgrades = upgrades.first(upgradeCount);
+		std::ranges::sort(upgrades, std::greater{}, [this](uint32_t i) { return mMaterials[i].ResidentLevel - mMaterials[i].RequestedLevel; });
+
+		/* A level at a time while the frame's upload limit allows, so that a large texture does not stall the frame */
+		uint64_t uploadedBytes{ 0 };
+		for (uint32_t index : upgrades)
+		{
+			Material& material{ mMaterials[index] };
+			Texture const& texture{ *material.Source };
+			uint32_t level{ material.ResidentLevel - 1 };
+			if (uploadedBytes > 0 && uploadedBytes + getLevelSize(texture, level) > MAX_STREAMED_BYTES_PER_FRAME)
+				break;
+			uint64_t levelBytes{ getLevelSize(texture, level) };
+			while (level > material.RequestedLevel && uploadedBytes + levelBytes + getLevelSize(texture, level - 1) <= MAX_STREAMED_BYTES_PER_FRAME)
+				levelBytes += getLevelSize(texture, --level);
+
+			uint64_t const requiredBytes{ mStreamedTextureBytes + levelBytes };
+			if (requiredBytes > TEXTURE_STREAMING_BUDGET_BYTES && !EvictTextureLevels(commandBuffer, requiredBytes - TEXTURE_STREAMING_BUDGET_BYTES))
+				continue;
+			SetResidentLevel(commandBuffer, material, level);
+			uploadedBytes += levelBytes;
+		}
+
+		/* This frame's sets were last used by the frame that has just completed, the other ones are still in flight */
+		uint32_t const frameBit{ 1u << mCurrentFrame };
+		for (Material& material : mMaterials)
+		{
+			if (0 != (material.StaleDescriptorSets & frameBit))
+			{
+				WriteImageDescriptor(material, mCurrentFrame);
+				material.StaleDescriptorSets &= ~frameBit;
+			}
+		}
+	}
+
+	bool VulkanRenderer::EvictTextureLevels(VkCommandBuffer commandBuffer, uint64_t requiredBytes)
+	{
+		/* Each texture keeps what this frame's draws need, the unused ones drop back to their initial levels */
+		auto const getKeptLevel{ [this](Material const& material)
+		{
+			return mFrameNumber == material.LastUsedFrame ? material.RequestedLevel : GetInitialResidentLevel(*material.Source);
+		} };
+
+		std::span<uint32_t> candidates{ mFrameArena.Allocate<uint32_t>(mMaterials.size()) };
+		size_t candidateCount{ 0 };
+		uint64_t evictableBytes{ 0 };
+		for (uint32_t i{ 0 }; i < mMaterials.size(); ++i)
+		{
+			Material const& material{ mMaterials[i] };
+			if (!material.Source || material.ResidentLevel >= getKeptLevel(material))
+				continue;
+			candidates[candidateCount++] = i;
+			evictableBytes += material.ResidentBytes - getLevelsSize(*material.Source, getKeptLevel(material));
+		}
+		/* Rather than evicting for nothing */
+		if (evictableBytes < requiredBytes)
+			return false;
+
+		/* Least recently used first */
+		candidates = candidates.first(candidateCount);
+		std::ranges::sort(candidates, std::less{}, [this](uint32_t i) { return mMaterials[i].LastUsedFrame; });
+		uint64_t evictedBytes{ 0 };
+		for (uint32_t index : candidates)
+		{
+			if (evictedBytes >= requiredBytes)
+				break;
+			Material& material{ mMaterials[index] };
+			uint64_t const residentBytes{ material.ResidentBytes };
+			SetResidentLevel(commandBuffer, material, getKeptLevel(material));
+			evictedBytes += residentBytes - material.ResidentBytes;
+		}
+		return true;
+	}
+
+	void VulkanRenderer::SetResidentLevel(VkCommandBuffer commandBuffer, Material& material, uint32_t residentLevel)
+	{
+		Texture const& texture{ *material.Source };
+		uint32_t const levelCount{ static_cast<uint32_t>(texture.Levels.size()) };
+		uint32_t const previousLevel{ material.ResidentLevel };
+		VkFormat const format{ GetVulkanFormat(texture.Format) };
+
+		/* The frames in flight may still sample the current image */
+		RetiredTexture retired{ material.Image, material.ImageMemory, material.ImageView };
+		retired.ReleaseFrame = mFrameNumber + MAX_FRAMES_IN_FLIGHT;
+
+		MipLevel const& firstLevel{ texture.Levels[residentLevel] };
+		CreateImage(firstLevel.Width
+			, firstLevel.Height
+			, levelCount - residentLevel
+			, format
+			, VK_IMAGE_TILING_OPTIMAL
+			, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+			, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			, material.Image
+			, material.ImageMemory);
+		RecordImageBarrier(commandBuffer, material.Image, 0, levelCount - residentLevel
+			, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+			, 0, VK_ACCESS_TRANSFER_WRITE_BIT
+			, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		/* The levels that both images hold are copied on the GPU */
+		uint32_t const firstCopiedLevel{ std::max(residentLevel, previousLevel) };
+		RecordImageBarrier(commandBuffer, retired.Image, firstCopiedLevel - previousLevel, levelCount - firstCopiedLevel
+			, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+			, 0, VK_ACCESS_TRANSFER_READ_BIT
+			, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		std::vector<VkImageCopy> copies{};
+		for (uint32_t level{ firstCopiedLevel }; level < levelCount; ++level)
+		{
+			VkImageCopy& copy{ copies.emplace_back() };
+			copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - previousLevel, 0, 1 };
+			copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - residentLevel, 0, 1 };
+			copy.extent = { texture.Levels[level].Width, texture.Levels[level].Height, 1 };
+		}
+		vkCmdCopyImage(commandBuffer, retired.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, material.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+
+		/* The finer levels come from the texture data */
+		if (residentLevel < previousLevel)
+			RecordTextureUpload(commandBuffer, texture, material.Image, residentLevel, residentLevel, previousLevel);
+
+		RecordImageBarrier(commandBuffer, material.Image, 0, levelCount - residentLevel
+			, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+			, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT
+			, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		/* Covers exactly the resident levels, the sampler cannot reach the missing ones */
+		material.ImageView = CreateImageView(material.Image, format, levelCount - residentLevel);
+		mRetiredTextures.push_back(retired);
+
+		uint64_t const residentBytes{ getLevelsSize(texture, residentLevel) };
+		mStreamedTextureBytes = mStreamedTextureBytes - material.ResidentBytes + residentBytes;
+		material.ResidentBytes = residentBytes;
+		material.ResidentLevel = residentLevel;
+		material.StaleDescriptorSets = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+	}
+
+	void VulkanRenderer::RecordTextureUpload(VkCommandBuffer commandBuffer, Texture const& texture, VkImage image, uint32_t imageFirstLevel, uint32_t firstLevel, uint32_t endLevel)
+	{
+		/* The levels are contiguous, one staging write covers them all */
+		size_t const firstOffset{ texture.Levels[firstLevel].Offset };
+		size_t const endOffset{ endLevel < texture.Levels.size() ? texture.Levels[endLevel].Offset : texture.Pixels.size() };
+		StagingAllocation const staging{ WriteStaging(std::span{ texture.Pixels }.subspan(firstOffset, endOffset - firstOffset)) };
+
+		std::vector<VkBufferImageCopy> regions(endLevel - firstLevel);
+		for (uint32_t level{ firstLevel }; level < endLevel; ++level)
+		{
+			VkBufferImageCopy& region{ regions[level - firstLevel] };
+			region.bufferOffset = staging.Offset + texture.Levels[level].Offset - firstOffset;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - imageFirstLevel, 0, 1 };
+			region.imageExtent = { texture.Levels[level].Width, texture.Levels[level].Height, 1 };
+		}
+		vkCmdCopyBufferToImage(commandBuffer, staging.Buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+		/* The ring is reclaimed with the frame, a dedicated buffer is retired like an image */
+		if (VK_NULL_HANDLE != staging.DedicatedMemory)
+			mRetiredTextures.push_back({ VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, staging.Buffer, staging.DedicatedMemory, mFrameNumber + MAX_FRAMES_IN_FLIGHT });
+	}
+
+	void VulkanRenderer::DestroyRetiredTextures(bool waitForAll)
+	{
+		std::erase_if(mRetiredTextures, [this, waitForAll](RetiredTexture const& retired)
+		{
+			if (!waitForAll && retired.ReleaseFrame > mFrameNumber)
+				return false;
+			vkDestroyImageView(mDevice, retired.ImageView, nullptr);
+			vkDestroyImage(mDevice, retired.Image, nullptr);
+			vkFreeMemory(mDevice, retired.ImageMemory, nullptr);
+			vkDestroyBuffer(mDevice, retired.StagingBuffer, nullptr);
+			vkFreeMemory(mDevice, retired.StagingBufferMemory, nullptr);
+			return true;
+		});
+	}
+
+} // namespace gg
@@ -8,6 +8,7 @@ export module Application;
 
 import VulkanRenderer;
 import Input;
+import JobSystem;
 import TimeManager;
 import ModelLoader;
 
@@ -28,8 +29,11 @@ namespace gg
 		void OnWindowMinimized();
 		void OnWindowRestored();
 		void OnKeyPressed(SDL_Keycode, bool isDown);
+		/* Logs the instance under the cursor */
+		void OnMouseButtonPressed(uint32_t x, uint32_t y);
 
 		std::shared_ptr<InputManager> GetInputManager();
+		std::shared_ptr<JobSystem> GetJobSystem();
 		std::shared_ptr<ModelLoader> GetModelLoader();
 		std::shared_ptr<TimeManager> GetTimeManager();
 		std::shared_ptr<VulkanRenderer> GetRenderer();
@@ -39,6 +43,8 @@ namespace gg
 
 		bool mPaused{ false };
 
+		/* First, the loaders run on it until they are destroyed */
+		std::shared_ptr<JobSystem> mJobSystem;
 		std::shared_ptr<InputManager> mInputManager;
 		std::shared_ptr<ModelLoader> mModelLoader;
 		std::shared_ptr<TimeManager> mTimeManager;
@@ -0,0 +1,83 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+export module AssetPack;
+
+import MappedFile;
+
+namespace gg
+{
+	/* Read-only archive of asset files, mapped whole so that the page cache serves repeated launches.
+	 * The files are found through a table of contents sorted by path hash, and keyed by their path relative to the pack. */
+	export class AssetPack
+	{
+	public:
+		/* Not open when the file is missing or is not a valid pack */
+		explicit AssetPack(std::string const& absolutePath);
+
+		AssetPack(AssetPack const&) = delete;
+		AssetPack& operator=(AssetPack const&) = delete;
+
+		bool IsOpen() const { return !mEntries.empty(); }
+		bool Contains(std::string const& absolutePath) const;
+		/* Empty when the pack does not have the file. Stored files are read in place,
+		 * compressed ones are expanded into storage which the returned span then points to. */
+		std::span<std::byte const> Read(std::string const& absolutePath, std::vector<std::byte>& storage) const;
+
+		struct Entry
+		{
+			uint64_t PathHash{ 0 };
+			uint64_t Offset{ 0 };
+			uint64_t Size{ 0 };
+			uint64_t StoredSize{ 0 };
+			uint32_t PathOffset{ 0 };
+			uint32_t PathSize{ 0 };
+			uint32_t Compression{ 0 };
+			uint32_t Padding{ 0 };
+		};
+
+	private:
+		Entry const* FindEntry(std::string const& absolutePath) const;
+
+		MappedFile mFile;
+		std::string mRootDirectory;
+		std::span<Entry const> mEntries;
+		std::span<std::byte const> mPaths;
+	};
+
+	/* Packs the files under the pack's directory, the ones that shrink enough are compressed. False when a file cannot be read or the pack written. */
+	export bool WriteAssetPack(std::string const& packAbsolutePath, std::span<std::string const> fileAbsolutePaths);
+
+	/* The asset files are read from the mounted pack when it has them, otherwise from disk.
+	 * Mount before loading anything, the loading threads do not synchronize with it. */
+	export bool MountAssetPack(std::string const& packAbsolutePath);
+	export bool AssetExists(std::string const& absolutePath);
+	export bool IsInAssetPack(std::string const& absolutePath);
+
+	/* The whole content of an asset file, in place in the pack or mapped from disk */
+	export class AssetFile
+	{
+	public:
+		AssetFile() = default;
+		/* Not open when neither the mounted pack nor the disk have the file, or when it is empty */
+		explicit AssetFile(std::string const& absolutePath);
+
+		AssetFile(AssetFile&&) noexcept = default;
+		AssetFile& operator=(AssetFile&&) noexcept = default;
+
+		bool IsOpen() const { return !mData.empty(); }
+		std::span<std::byte const> GetData() const { return mData; }
+
+	private:
+		/* Keeps the pack mapped while the data points into it */
+		std::shared_ptr<AssetPack const> mPack;
+		MappedFile mFile;
+		std::vector<std::byte> mStorage;
+		std::span<std::byte const> mData;
+	};
+
+} // namespace gg
@@ -0,0 +1,91 @@
+module;
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+export module AsyncIo;
+
+namespace gg
+{
+	export enum class IoPriority : uint32_t
+	{
+		High,   /* blocks a load from making progress */
+		Normal,
+		Low,    /* prefetching */
+	};
+	constexpr uint32_t IO_PRIORITY_COUNT{ 3 };
+
+	export enum class IoStatus : uint32_t
+	{
+		Success,
+		Failed,
+		Cancelled,
+	};
+
+	export struct IoRead
+	{
+		std::string AbsolutePath;
+		uint64_t Offset{ 0 };
+		/* Owned by the caller until the completion runs, may be staging memory. Fewer bytes are read when the file ends first. */
+		std::span<std::byte> Destination;
+		IoPriority Priority{ IoPriority::Normal };
+		/* Runs on an I/O thread, hand the work over to another thread. The byte count is only set on success. */
+		std::function<void(IoStatus, size_t bytesRead)> OnComplete;
+	};
+
+	export using IoRequestId = uint64_t;
+
+	/* Asynchronous file reads, many kept in flight so that the storage device sees a deep queue instead of one read at a time.
+	 * io_uring on Linux when the kernel allows it, otherwise blocking reads on a few threads. */
+	export class AsyncIo
+	{
+	public:
+		explicit AsyncIo(uint32_t queueDepth = 64);
+		~AsyncIo();
+
+		AsyncIo(AsyncIo const&) = delete;
+		AsyncIo& operator=(AsyncIo const&) = delete;
+
+		/* Safe to call from any thread, including from a completion. The reads are moved from, the ids come in the same order. */
+		std::vector<IoRequestId> Submit(std::span<IoRead> reads);
+		IoRequestId Submit(IoRead read);
+		/* Only a read that is still queued can be cancelled, its completion then runs with Cancelled on the calling thread */
+		bool Cancel(IoRequestId);
+		/* Cancels the queued reads and waits for the ones in flight. The reads submitted afterwards are cancelled right away. */
+		void Stop();
+
+	private:
+		struct Request
+		{
+			IoRequestId Id{ 0 };
+			IoRead Read;
+		};
+		struct Ring;
+
+		/* Highest priority first, in submission order within a priority */
+		bool PopRequest(Request&);
+		void RunRing();
+		void RunWorker();
+		void WakeRing();
+
+		std::mutex mMutex;
+		std::condition_variable mRequestAvailable;
+		std::array<std::deque<Request>, IO_PRIORITY_COUNT> mQueues;
+		IoRequestId mNextId{ 1 };
+		bool mStopping{ false };
+
+		uint32_t mQueueDepth{ 0 };
+		/* Null when the blocking threads are used */
+		std::unique_ptr<Ring> mRing;
+		std::vector<std::thread> mThreads;
+	};
+
+} // namespace gg
@@ -0,0 +1,73 @@
+module;
+#include <cstdint>
+#include <DirectXMath.h>
+#include <optional>
+#include <span>
+#include <vector>
+export module Bvh;
+
+import Culling;
+
+using DirectX::XMFLOAT3;
+
+namespace gg
+{
+	/* 32 bytes, two to a cache line. The children of a node are next to each other, after their parent. */
+	export struct BvhNode
+	{
+		XMFLOAT3 Min{};
+		uint32_t Offset{ 0 }; /* leaf: first primitive, interior: first child */
+		XMFLOAT3 Max{};
+		uint32_t Count{ 0 };  /* primitives of a leaf, 0 for an interior node */
+	};
+
+	export struct BvhHit
+	{
+		uint32_t Primitive{ 0 };
+		float Distance{ 0.f };
+	};
+
+	/* Bounding volume hierarchy over boxes, built with a binned surface area heuristic into one array of nodes.
+	 * The primitives are indices into a span of boxes that the caller owns and passes to every call. */
+	export class Bvh
+	{
+	public:
+		/* Over the given primitives only, the other boxes are ignored */
+		void Build(std::span<Aabb const> boxes, std::span<uint32_t const> primitives);
+		/* Recomputes the node bounds bottom-up once the boxes have moved. The tree keeps its shape, so its quality degrades. */
+		void Refit(std::span<Aabb const> boxes);
+		/* Only the paths from the leaves of the moved primitives up, until a node keeps its bounds. Primitives not in the tree are skipped. */
+		void Refit(std::span<Aabb const> boxes, std::span<uint32_t const> movedPrimitives);
+
+		/* Expected cost of a query, in box tests. Compare it with the build cost to decide when to rebuild. */
+		float GetCost() const { return mCost; }
+		float GetBuildCost() const { return mBuildCost; }
+		bool IsEmpty() const { return mNodes.empty(); }
+		std::span<uint32_t const> GetPrimitives() const { return mPrimitives; }
+
+		/* Appends the primitives whose box intersects the frustum. A subtree fully inside it is appended without testing its boxes. */
+		void CullFrustum(Frustum const&, std::span<Aabb const> boxes, std::vector<uint32_t>& outPrimitives) const;
+		/* Nearest primitive box that the ray enters within maxDistance, or starts in. The direction does not need to be normalized,
+		 * the distance is then in multiples of it. Front to back, so that the subtrees behind the nearest hit are skipped. */
+		std::optional<BvhHit> IntersectRay(XMFLOAT3 const& origin, XMFLOAT3 const& direction, float maxDistance, std::span<Aabb const> boxes) const;
+
+	private:
+		/* Sets the bounds of the node from its primitives or children */
+		void ComputeNodeBounds(uint32_t nodeIndex, std::span<Aabb const> boxes);
+		void UpdateCost();
+
+		std::vector<BvhNode> mNodes;
+		std::vector<uint32_t> mParents;    /* by node */
+		std::vector<uint32_t> mPrimitives; /* the ones of a subtree are contiguous */
+		std::vector<uint32_t> mLeaves;     /* by primitive */
+		/* Sum of the node areas weighted by their cost, updated by the refits */
+		double mCostSum{ 0.0 };
+		float mCost{ 0.f };
+		float mBuildCost{ 0.f };
+	};
+
+	/* Distance along the ray to where it enters the box, 0 when it starts inside, infinity when it misses.
+	 * Takes 1 / direction, to compute it once per ray. */
+	export float IntersectRayBox(XMFLOAT3 const& origin, XMFLOAT3 const& inverseDirection, Aabb const&);
+
+} // namespace gg
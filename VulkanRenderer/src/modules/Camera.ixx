@@ -3,6 +3,7 @@ module;
 #include <DirectXMath.h>
 export module Camera;
 
+using DirectX::XMFLOAT3;
 using DirectX::XMMATRIX;
 using DirectX::XMVECTOR;
 
@@ -15,6 +16,12 @@ export namespace gg {
 		void UpdateProjectionMatrix(float windowAspectRatio);
 		XMMATRIX const & GetViewMatrix() const;
 		XMMATRIX const & GetProjectionMatrix() const;
+		/* View distances of the planes of the projection */
+		float GetNearPlane() const;
+		float GetFarPlane() const;
+		/* Ray through a point of the viewport, in the space that the model-view matrix transforms from.
+		 * Starts on the near plane and reaches the far plane at a distance of 1 direction. */
+		void GetRay(float ndcX, float ndcY, XMMATRIX const& modelViewMatrix, XMFLOAT3& outOrigin, XMFLOAT3& outDirection) const;
 	private:
 		XMMATRIX mProjectionMatrix{};
 		XMMATRIX mViewMatrix{};
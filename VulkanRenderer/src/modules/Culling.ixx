@@ -0,0 +1,69 @@
+module;
+#include <array>
+#include <cfloat>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <vector>
+export module Culling;
+
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4;
+using DirectX::XMMATRIX;
+
+namespace gg
+{
+	/* Empty by default: contains nothing, and is outside every frustum */
+	export struct Aabb
+	{
+		XMFLOAT3 Min{ FLT_MAX, FLT_MAX, FLT_MAX };
+		XMFLOAT3 Max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	};
+
+	/* Six inward facing planes, in the space that the matrix they were extracted from transforms from */
+	export struct Frustum
+	{
+		std::array<XMFLOAT4, 6> Planes{};
+
+		/* Gribb & Hartmann, for a row-vector (model-)view-projection matrix with depth in [0, 1] */
+		static Frustum FromMatrix(XMMATRIX const&);
+		/* Sphere as center (xyz) and radius (w) */
+		bool IntersectsSphere(XMFLOAT4 const& sphere) const;
+		/* Only false when the box is fully outside one of the planes */
+		bool IntersectsBox(Aabb const&) const;
+	};
+
+	/* Axis-aligned boxes as center and half extent, stored structure-of-arrays so that the culling tests 4 boxes per instruction.
+	 * The arrays are padded to a multiple of 4 with boxes that are never visible. */
+	export class BoundingBoxes
+	{
+	public:
+		uint32_t GetSize() const { return mSize; }
+		void Resize(uint32_t size);
+		void Set(uint32_t index, XMFLOAT3 const& center, XMFLOAT3 const& extent);
+		/* For dense arrays that fill a hole with their last element */
+		void Copy(uint32_t from, uint32_t to);
+
+		enum Component : uint32_t
+		{
+			CenterX, CenterY, CenterZ,
+			ExtentX, ExtentY, ExtentZ,
+			COMPONENT_COUNT
+		};
+		float const* GetComponent(Component component) const { return mComponents[component].data(); }
+
+	private:
+		uint32_t mSize{ 0 };
+		std::array<std::vector<float>, COMPONENT_COUNT> mComponents;
+	};
+
+	/* Replaces the indices with the ones of the boxes that intersect the frustum. A box is only rejected when it is fully outside
+	 * one of the planes, so that a few boxes near the corners are kept. SSE tests 4 boxes at a time. */
+	export void CullBoxes(Frustum const&, BoundingBoxes const&, std::vector<uint32_t>& outVisibleIndices);
+
+	/* World-space box of an object-space box, through the absolute value of the matrix so that it bounds the rotated box */
+	export void TransformBox(XMFLOAT3 const& center, XMFLOAT3 const& extent, XMMATRIX const& objectMatrix, XMFLOAT3& outCenter, XMFLOAT3& outExtent);
+
+	/* Largest scale of the basis vectors, scales bounding spheres and LOD errors */
+	export float GetMaxScale(XMMATRIX const& objectMatrix);
+
+} // namespace gg
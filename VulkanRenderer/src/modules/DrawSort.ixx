@@ -0,0 +1,41 @@
+module;
+#include <cstdint>
+#include <span>
+export module DrawSort;
+
+namespace gg
+{
+	export enum class DrawPass : uint8_t
+	{
+		DepthPrepass, /* positions only, before the opaque pass shades */
+		Opaque
+	};
+
+	/* What a draw binds, from the most to the least expensive state change */
+	export struct DrawKeyFields
+	{
+		DrawPass Pass{ DrawPass::Opaque };
+		uint32_t Pipeline{ 0 };
+		uint32_t Material{ 0 };
+		uint32_t Model{ 0 };
+		uint32_t Mesh{ 0 };
+		float Depth{ 0.f }; /* view distance, nearer draws first */
+	};
+
+	/* Bits from the most significant: pass 4, pipeline 8, material 12, model 14, mesh 10, depth 16.
+	 * Larger fields wrap, which only costs binds: the draw itself is found through DrawIndex. */
+	export uint64_t MakeDrawKey(DrawKeyFields const&);
+	export DrawPass GetDrawPass(uint64_t key);
+
+	export struct DrawPacket
+	{
+		uint64_t Key{ 0 };
+		uint32_t DrawIndex{ 0 };
+		uint32_t Padding{ 0 };
+	};
+
+	/* Stable LSD radix sort by Key, one pass per byte, skipping the bytes that all keys share.
+	 * Scratch must be as large as packets, nothing is allocated. */
+	export void RadixSort(std::span<DrawPacket> packets, std::span<DrawPacket> scratch);
+
+} // namespace gg
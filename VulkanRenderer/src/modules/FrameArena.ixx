@@ -0,0 +1,41 @@
+module;
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+export module FrameArena;
+
+namespace gg
+{
+	/* Linear allocator for data that lives for one frame. Allocating bumps an offset, Reset frees
+	 * everything at once. A frame that outgrows the block spills into separate allocations, the next
+	 * Reset grows the block to the peak so that the following frames allocate nothing. */
+	export class FrameArena
+	{
+	public:
+		explicit FrameArena(size_t capacityBytes = 64 * 1024);
+
+		/* Uninitialized storage for count objects, valid until the next Reset */
+		template <typename T>
+		std::span<T> Allocate(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+			return { static_cast<T*>(AllocateBytes(count * sizeof(T), alignof(T))), count };
+		}
+
+		void Reset();
+		size_t GetCapacity() const { return mCapacity; }
+
+	private:
+		void* AllocateBytes(size_t sizeBytes, size_t alignment);
+
+		std::unique_ptr<std::byte[]> mBlock;
+		size_t mCapacity{ 0 };
+		size_t mOffset{ 0 };
+		/* Bytes requested since the last Reset, including the spilled ones */
+		size_t mPeak{ 0 };
+		std::vector<std::unique_ptr<std::byte[]>> mOverflow;
+	};
+
+} // namespace gg
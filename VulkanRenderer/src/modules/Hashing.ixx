@@ -0,0 +1,12 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <span>
+export module Hashing;
+
+namespace gg
+{
+	/* 64-bit, with the word mixing and final avalanche of xxHash64 on a single lane, for detecting changed content. Not cryptographic. */
+	export uint64_t HashBytes(std::span<std::byte const>);
+
+} // namespace gg
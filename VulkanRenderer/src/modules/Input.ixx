@@ -16,6 +16,7 @@ export namespace gg
 		TurnCameraRight,
 		LookCameraUp,
 		LookCameraDown,
+		ToggleDepthPrepass,
 		Count
 	};
 
@@ -0,0 +1,96 @@
+module;
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+export module JobSystem;
+
+namespace gg
+{
+	export class JobSystem;
+
+	struct Job
+	{
+		std::function<void()> Function;
+		/* The dependencies not done yet, plus one until the job is submitted */
+		std::atomic<uint32_t> DependencyCount{ 1 };
+		std::atomic<bool> IsDone{ false };
+		/* The jobs to release once this one is done */
+		std::mutex DependentsMutex;
+		std::vector<std::shared_ptr<Job>> Dependents;
+	};
+
+	/* Refers to a submitted job, to wait for it or to run other jobs after it. Cheap to copy. */
+	export class JobHandle
+	{
+	public:
+		JobHandle() = default;
+
+		/* An empty handle is done */
+		bool IsDone() const { return !mJob || mJob->IsDone.load(std::memory_order_acquire); }
+
+	private:
+		friend class JobSystem;
+		explicit JobHandle(std::shared_ptr<Job> job) : mJob{ std::move(job) } {}
+
+		std::shared_ptr<Job> mJob;
+	};
+
+	/* Work-stealing job system, one for the whole engine. Each worker runs the newest job of its own deque first,
+	 * and steals the oldest job of another deque when its own is empty. A thread waiting on a job runs the queued ones meanwhile. */
+	export class JobSystem
+	{
+	public:
+		/* 0 leaves one core to the render thread */
+		explicit JobSystem(uint32_t threadCount = 0);
+		/* Runs the queued jobs, including the ones they submit, before joining */
+		~JobSystem();
+
+		JobSystem(JobSystem const&) = delete;
+		JobSystem& operator=(JobSystem const&) = delete;
+
+		/* Safe to call from any thread, including from a job. The job is queued once all its dependencies are done, it must not throw. */
+		JobHandle Run(std::function<void()> function, std::span<JobHandle const> dependencies = {});
+		/* Runs the queued jobs on the calling thread until the job is done */
+		void Wait(JobHandle const&);
+		/* Calls function(begin, end) over [0, count) in batches of at most batchSize and returns once all are done, the calling thread takes part.
+		 * The range is split in halves, so that the idle threads steal the large ranges first. */
+		void ParallelFor(uint32_t count, uint32_t batchSize, std::function<void(uint32_t begin, uint32_t end)> const& function);
+		/* Runs one queued job on the calling thread, false when there is none. For the threads waiting on something else than a job. */
+		bool RunPendingJob();
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(mThreads.size()); }
+
+	private:
+		struct Queue
+		{
+			std::mutex Mutex;
+			std::deque<std::shared_ptr<Job>> Jobs;
+		};
+
+		void Push(std::shared_ptr<Job>);
+		std::shared_ptr<Job> Pop();
+		void Execute(std::shared_ptr<Job>);
+		void RunWorker(uint32_t queueIndex);
+		uint32_t GetQueueIndex() const;
+
+		/* One per worker, and a last one shared by the other threads */
+		std::vector<Queue> mQueues;
+		std::atomic<uint32_t> mQueuedCount{ 0 };
+		/* Queued and running, the destructor waits for them */
+		std::atomic<uint32_t> mPendingCount{ 0 };
+
+		/* The idle workers sleep until a job is queued */
+		std::mutex mSleepMutex;
+		std::condition_variable mJobAvailable;
+		std::atomic<uint32_t> mSleepingCount{ 0 };
+		bool mStopping{ false };
+		std::vector<std::thread> mThreads;
+	};
+
+} // namespace gg
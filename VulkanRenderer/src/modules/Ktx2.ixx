@@ -0,0 +1,25 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+export module Ktx2;
+
+import Model;
+
+namespace gg
+{
+	/* KTX2 containers (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) of 2D textures in one of the
+	 * TextureFormat formats with their mips. Supercompressed data, such as Basis Universal, is not supported. */
+	/* Also the vkFormat of the container */
+	export VkFormat GetVulkanFormat(TextureFormat);
+
+	export bool IsKtx2(std::span<std::byte const> data);
+
+	/* False when the container is invalid or holds an unsupported format or layout. The content hash is left to the caller. */
+	export bool ReadKtx2(std::span<std::byte const> data, Texture& outTexture);
+
+	export std::vector<std::byte> WriteKtx2(Texture const&);
+
+} // namespace gg
@@ -0,0 +1,36 @@
+module;
+#include <cstddef>
+#include <span>
+#include <string>
+export module MappedFile;
+
+namespace gg
+{
+	/* Read-only memory mapping of a whole file. The pages are loaded on first access. */
+	export class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		/* Not open when the file does not exist, is empty or cannot be mapped */
+		explicit MappedFile(std::string const& absolutePath);
+
+		MappedFile(MappedFile&&) noexcept;
+		MappedFile& operator=(MappedFile&&) noexcept;
+
+		/* Prohibit copying to make sure the view is unmapped exactly once */
+		MappedFile(MappedFile const&) = delete;
+		MappedFile& operator=(MappedFile const&) = delete;
+
+		~MappedFile();
+
+		bool IsOpen() const { return nullptr != mData; }
+		std::span<std::byte const> GetData() const { return { mData, mSize }; }
+
+	private:
+		void Close();
+
+		std::byte const* mData{ nullptr };
+		size_t mSize{ 0 };
+	};
+
+} // namespace gg
@@ -0,0 +1,24 @@
+module;
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+export module MeshCache;
+
+import Model;
+import Vertex;
+
+namespace gg
+{
+	/* Binary cache of imported meshes, stored next to the source model.
+	 * The meshes are kept exactly as they are uploaded (vertex streams, indices with all the LODs, meshlets,
+	 * block-compressed textures as KTX2), so loading is a straight copy of each block out of the mapped file. */
+	export std::string GetMeshCachePath(std::string const& modelAbsolutePath);
+
+	/* False when the cache is missing, from another version, or was built from a source of different content or size or for another format */
+	export bool ReadMeshCache(std::string const& cacheAbsolutePath, uint64_t sourceHash, uint64_t sourceSize, VertexFormat, std::vector<Mesh>& outMeshes);
+
+	/* False when the file cannot be written, a missing cache is only slower */
+	export bool WriteMeshCache(std::string const& cacheAbsolutePath, uint64_t sourceHash, uint64_t sourceSize, VertexFormat, std::span<Mesh const>);
+
+} // namespace gg
@@ -0,0 +1,21 @@
+module;
+#include <cstdint>
+#include <DirectXMath.h>
+#include <vector>
+export module MeshSimplifier;
+
+using DirectX::XMFLOAT3;
+
+export namespace gg
+{
+	struct SimplifiedMesh
+	{
+		std::vector<uint32_t> Indices;
+		float Error{ 0.f }; /* object-space distance from the simplified surface to the source */
+	};
+
+	/* Quadric error metric edge collapse. Vertices are only ever collapsed onto other existing vertices,
+	 * so the result indexes into the same vertex buffer as the source. Open borders (incl. UV seams) are locked. */
+	SimplifiedMesh SimplifyMesh(std::vector<XMFLOAT3> const& positions, std::vector<uint32_t> const& indices, size_t targetIndexCount);
+
+} // namespace gg
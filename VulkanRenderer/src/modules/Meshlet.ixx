@@ -0,0 +1,44 @@
+module;
+#include <cstdint>
+#include <DirectXMath.h>
+#include <vector>
+export module Meshlet;
+
+using DirectX::XMFLOAT3;
+
+export namespace gg
+{
+	constexpr uint32_t MAX_MESHLET_VERTICES{ 64 };
+	constexpr uint32_t MAX_MESHLET_TRIANGLES{ 124 };
+
+	/* Matches struct Meshlet in shaders/meshlet_culling.hlsli */
+	struct Meshlet
+	{
+		/* Bounding sphere */
+		XMFLOAT3 Center{};
+		float Radius{ 0.f };
+		/* Normal cone: the meshlet is back-facing when
+		 * dot(Center - camera, ConeAxis) >= ConeCutoff * length(Center - camera) + Radius */
+		XMFLOAT3 ConeAxis{};
+		float ConeCutoff{ 1.f };
+
+		uint32_t VertexOffset{ 0 };   /* into the meshlet vertices */
+		uint32_t TriangleOffset{ 0 }; /* into the meshlet triangles */
+		uint32_t VertexCount{ 0 };
+		uint32_t TriangleCount{ 0 };
+	};
+	static_assert(sizeof(Meshlet) == 48);
+
+	/* Splits the triangle list into meshlets of up to MAX_MESHLET_VERTICES vertices and MAX_MESHLET_TRIANGLES triangles.
+	 * outVertices maps the meshlet-local vertex indices to the mesh vertices, outTriangles holds
+	 * three 8-bit local indices per triangle packed into a uint32_t. */
+	void BuildMeshlets(
+		std::vector<XMFLOAT3> const& positions,
+		uint32_t const* indices,
+		size_t indexCount,
+		std::vector<Meshlet>& outMeshlets,
+		std::vector<uint32_t>& outVertices,
+		std::vector<uint32_t>& outTriangles
+	);
+
+} // namespace gg
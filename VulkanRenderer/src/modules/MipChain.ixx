@@ -0,0 +1,25 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+export module MipChain;
+
+namespace gg
+{
+	/* A level of a mip chain stored one level after the other */
+	export struct MipLevel
+	{
+		size_t Offset{ 0 }; /* in bytes */
+		uint32_t Width{ 0 };
+		uint32_t Height{ 0 };
+	};
+
+	/* Down to 1x1 */
+	export uint32_t GetMipLevelCount(uint32_t width, uint32_t height);
+
+	/* Every level of an RGBA8 sRGB image, level 0 first. Each level is a 2x2 box filter of the previous one,
+	 * averaged in linear space so that the mips do not darken. CPU fallback for formats without linear blits. */
+	export std::vector<uint8_t> BuildMipChain(std::span<uint8_t const> pixels, uint32_t width, uint32_t height, std::vector<MipLevel>& outLevels);
+
+} // namespace gg
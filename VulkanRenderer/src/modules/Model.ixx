@@ -1,31 +1,97 @@
 module;
+#include <array>
+#include <cstdint>
+#include <DirectXMath.h>
 #include <memory>
 #include <vector>
 export module Model;
 
+import Meshlet;
+import MipChain;
 import Vertex;
 import ShaderProgram;
 
+using DirectX::XMFLOAT3;
+
 namespace gg
 {
+	export constexpr uint32_t MAX_LOD_COUNT{ 6 };
+
+	/* A range of Mesh::Indices that draws the mesh at a reduced level of detail */
+	export struct MeshLod
+	{
+		uint32_t FirstIndex{ 0 };
+		uint32_t IndexCount{ 0 };
+		float Error{ 0.f }; /* object-space geometric deviation from LOD 0 */
+	};
+
+	/* Block-compressed formats store 4x4 texel blocks of 8 (BC1) or 16 bytes */
+	export enum class TextureFormat : uint32_t
+	{
+		Rgba8Srgb,
+		Bc1Unorm,
+		Bc1Srgb,
+		Bc3Unorm,
+		Bc3Srgb,
+		Bc5Unorm,
+		Bc7Unorm,
+		Bc7Srgb,
+	};
+
+	/* GPU-ready image. Shared by every mesh and model that uses the same source image. */
+	export struct Texture
+	{
+		/* Every level in Levels, one after the other */
+		std::vector<uint8_t> Pixels{};
+		/* Empty when Pixels only holds level 0 and the renderer builds the mips, only for Rgba8Srgb */
+		std::vector<MipLevel> Levels{};
+		uint32_t Width{ 0 };
+		uint32_t Height{ 0 };
+		TextureFormat Format{ TextureFormat::Rgba8Srgb };
+		/* Of the encoded source data, identifies the image across models and loads */
+		uint64_t ContentHash{ 0 };
+	};
+
+	/* Same size, format and bytes. Textures with the same ContentHash are only shared when this holds. */
+	export bool HaveSameTexels(Texture const&, Texture const&);
+
 	export struct Mesh
 	{
 		Mesh() = default;
 		Mesh(Mesh&&) noexcept;
 		Mesh& operator=(Mesh&&) noexcept;
 
+		VertexFormat Format{ VertexFormat::Float32 };
+		/* Full precision vertices, only kept while importing */
 		std::vector<Vertex> Vertices{};
+		/* GPU-ready vertex data in Format, one buffer per VertexStream */
+		std::array<std::vector<uint8_t>, VERTEX_STREAM_COUNT> Streams{};
+		/* Index buffer of all the LODs, they share the vertex streams */
 		std::vector<uint32_t> Indices{};
+		std::vector<MeshLod> Lods{};
+		/* Meshlets of LOD 0, see BuildMeshlets */
+		std::vector<Meshlet> Meshlets{};
+		std::vector<uint32_t> MeshletVertices{};
+		std::vector<uint32_t> MeshletTriangles{};
+
+		/* Object-space bounds, also used to quantize the positions */
+		XMFLOAT3 BoundsMin{};
+		XMFLOAT3 BoundsMax{};
+		VertexQuantization Quantization{};
+		/* Texture coordinate units per object-space unit over the surface of LOD 0, drives the texture streaming */
+		float UvDensity{ 0.f };
 
-		unsigned char* Texture{ nullptr };
-		unsigned int TextureColorFormat{ 0 }; /* GL_RGB or GL_RGBA */
-		int TextureWidth{ 0 };
-		int TextureHeight{ 0 };
+		/* Null when the material has none, the renderer then uses its default white texture */
+		std::shared_ptr<Texture const> BaseColorTexture{};
 
+		void const* GetStreamData(VertexStream) const;
+		uint32_t StreamSizeBytes(VertexStream) const;
 		uint32_t VerticesSizeBytes() const;
 		uint32_t IndicesSizeBytes() const;
 		uint32_t GetVertexCount() const;
 		uint32_t GetIndexCount() const;
+		/* Object-space position of a vertex, decoded from the position stream */
+		XMFLOAT3 GetPosition(uint32_t vertexIndex) const;
 	};
 
 	export struct Model
@@ -37,6 +103,7 @@ namespace gg
 
 		std::shared_ptr<ShaderProgram> shaderProgram;
 		std::vector<Mesh> meshes;
+		VertexFormat vertexFormat{ VertexFormat::Float32 };
 	};
 
 } // namespace gg
@@ -1,22 +1,71 @@
 module;
+#include <cstddef>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct aiScene;
 export module ModelLoader;
 
+import AsyncIo;
+import JobSystem;
 import Model;
+import ShaderProgram;
+import Task;
+import Vertex;
 
 namespace gg
 {
 	export class ModelLoader
 	{
 	public:
-		ModelLoader();
+		/* The loads run on the engine's jobs */
+		explicit ModelLoader(std::shared_ptr<JobSystem>);
 		~ModelLoader();
 
-		std::unique_ptr<Model> LoadModel(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath);
+		/* Blocks until the model is loaded, its meshes are still converted in parallel */
+		std::unique_ptr<Model> LoadModel(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath, VertexFormat = VertexFormat::Float32);
+		/* Each load is a coroutine: it holds no thread while its files are read, and its steps run on the workers at the given priority.
+		 * Call it from the thread that owns the loader, the future rethrows the import errors. See Scene::AddModel to keep rendering while loading. */
+		std::future<std::unique_ptr<Model>> LoadModelAsync(std::string const& modelRelativePath, std::string const& vertexShaderRelativePath, std::string const& fragmentShaderRelativePath,
+			VertexFormat = VertexFormat::Float32, TaskPriority = TaskPriority::Normal);
 
 	private:
-		bool LoadMeshes(std::string const& modelAbsolutePath, Model & outModel);
+		/* Reads the meshes from the mesh cache, or imports them and rebuilds the cache when the source has changed */
+		Task<std::unique_ptr<Model>> LoadModelTask(std::string modelAbsolutePath, VertexFormat, std::shared_ptr<ShaderProgram>, TaskPriority);
+		/* Continues on a worker with the whole file, empty when it is in the asset pack, missing or the read failed */
+		Task<std::vector<std::byte>> ReadFileAsync(std::string absolutePath, TaskPriority);
+		/* The scene and the outputs belong to the load, which awaits these tasks */
+		Task<> LoadMaterialTexture(aiScene const&, std::string const& modelAbsolutePath, std::string texturePath, TaskPriority, std::shared_ptr<Texture const>& outTexture);
+		Task<> ConvertMesh(aiScene const&, uint32_t meshIndex, VertexFormat, TaskPriority, Mesh& outMesh);
+		/* Returns the texture already loaded with the same content, or decodes it */
+		std::shared_ptr<Texture const> GetTexture(std::span<std::byte const> encodedData);
+		/* The encoded data, when there is one, lets GetTexture skip decoding the same file again */
+		std::shared_ptr<Texture const> ShareTexture(std::shared_ptr<Texture const>, std::span<std::byte const> encodedData = {});
+		static void WriteVertexStreams(Mesh&, VertexFormat);
+		std::shared_ptr<ShaderProgram> GetShaderProgram(std::string const& vertexShaderAbsPath, std::string const& fragmentShaderAbsPath);
+
+		/* Models loaded with the same shaders share the program, and with it the renderer's pipeline */
+		std::unordered_map<std::string, std::weak_ptr<ShaderProgram>> mShaderPrograms;
+		/* Decoded textures by content hash, used from the worker threads. The encoded data is kept while the texture is alive,
+		 * so that a hash hit is only taken after comparing the bytes. */
+		struct SharedTexture
+		{
+			std::weak_ptr<Texture const> Decoded{};
+			std::vector<std::byte> EncodedData{};
+		};
+		std::mutex mTexturesMutex;
+		std::unordered_map<uint64_t, SharedTexture> mTextures;
+		/* The reads are stopped first, their completions resume the loads on the workers */
+		AsyncIo mIo;
+		/* Last, so that the pending loads finish before the rest of the loader is destroyed */
+		TaskScheduler mScheduler;
 	};
 
-} // namespace gg
\ No newline at end of file
+} // namespace gg
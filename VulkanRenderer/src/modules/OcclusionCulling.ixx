@@ -0,0 +1,98 @@
+module;
+#include <cstdint>
+#include <DirectXMath.h>
+#include <memory>
+#include <span>
+#include <vector>
+export module OcclusionCulling;
+
+import Culling;
+import JobSystem;
+
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4X4;
+using DirectX::XMMATRIX;
+
+namespace gg
+{
+	/* Low resolution depth for occlusion culling on the CPU, in the style of masked software occlusion culling (Andersson et al. 2015).
+	 * Instead of a depth per pixel, a tile of 8x8 pixels keeps a reference depth that bounds all its pixels, and a working depth that
+	 * bounds the pixels of a coverage mask. The occluders are rasterized by bands of tiles on the job system, then boxes are tested
+	 * against the tiles they cover. Depth in [0, 1], larger is farther, nothing is written behind the far plane. */
+	export class OcclusionBuffer
+	{
+	public:
+		/* The 64 pixels of a tile fit the coverage mask in one uint64_t, and a tile row in two SSE registers */
+		static constexpr uint32_t TILE_SIZE{ 8 };
+
+		/* Rounded up to whole tiles, clears the buffer */
+		void Resize(uint32_t width, uint32_t height);
+		uint32_t GetWidth() const { return mWidth; }
+		uint32_t GetHeight() const { return mHeight; }
+		/* Without it the occluders are rasterized on the calling thread */
+		void SetJobSystem(std::shared_ptr<JobSystem>);
+
+		/* Everything at the far plane, and no occluders queued */
+		void Clear();
+		/* Queues the triangles of an occluder, the spans must stay valid until Rasterize. The matrix takes the positions to clip space,
+		 * the triangles are clipped against the near plane. Both windings are rasterized. */
+		void AddOccluder(std::span<XMFLOAT3 const> positions, std::span<uint32_t const> indices, XMMATRIX const& modelViewProjection);
+		/* Rasterizes the queued occluders, in the order they were added: front to back occludes best */
+		void Rasterize();
+		/* Triangles written by the last Rasterize, after clipping */
+		uint32_t GetTriangleCount() const { return mTriangleCount; }
+
+		/* True when all the pixels the box covers are behind the occluders. A box that crosses the near plane is visible. */
+		bool IsBoxOccluded(XMFLOAT3 const& center, XMFLOAT3 const& extent, XMMATRIX const& viewProjection) const;
+		/* Removes the indices of the occluded boxes, keeps the order of the others */
+		void CullBoxes(BoundingBoxes const&, XMMATRIX const& viewProjection, std::vector<uint32_t>& inOutVisibleIndices) const;
+
+	private:
+		struct Occluder
+		{
+			std::span<XMFLOAT3 const> Positions;
+			std::span<uint32_t const> Indices;
+			XMFLOAT4X4 ModelViewProjection{};
+		};
+
+		/* Screen-space triangle, its edge functions are positive inside */
+		struct Triangle
+		{
+			float EdgeA[3]{};
+			float EdgeB[3]{};
+			float EdgeC[3]{};
+			/* Depth plane: DepthOrigin + DepthDx * x + DepthDy * y */
+			float DepthOrigin{ 0.f };
+			float DepthDx{ 0.f };
+			float DepthDy{ 0.f };
+			float MaxDepth{ 0.f };
+			/* Pixel bounds, inclusive and inside the buffer */
+			int32_t MinX{ 0 };
+			int32_t MinY{ 0 };
+			int32_t MaxX{ 0 };
+			int32_t MaxY{ 0 };
+		};
+
+		void SetupTriangles(Occluder const&, std::vector<Triangle>& outTriangles) const;
+		/* The tile rows [firstRow, endRow), no other band writes them */
+		void RasterizeBand(uint32_t firstRow, uint32_t endRow);
+		/* Merges the coverage of a triangle into the two layers of the tile */
+		void UpdateTile(uint32_t tileIndex, uint64_t coverage, float depth);
+
+		uint32_t mWidth{ 0 };
+		uint32_t mHeight{ 0 };
+		uint32_t mTileCountX{ 0 };
+		uint32_t mTileCountY{ 0 };
+		/* By tile, row by row */
+		std::vector<uint64_t> mCoverage;       /* bit 8 * y + x for the pixel (x, y) of the tile */
+		std::vector<float> mReferenceDepths;   /* of all the pixels */
+		std::vector<float> mWorkingDepths;     /* of the covered pixels */
+
+		std::vector<Occluder> mOccluders;
+		/* By occluder, kept to reuse their memory */
+		std::vector<std::vector<Triangle>> mTriangles;
+		uint32_t mTriangleCount{ 0 };
+		std::shared_ptr<JobSystem> mJobs;
+	};
+
+} // namespace gg
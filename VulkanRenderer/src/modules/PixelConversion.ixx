@@ -0,0 +1,11 @@
+module;
+#include <cstdint>
+#include <span>
+export module PixelConversion;
+
+namespace gg
+{
+	/* Opaque RGBA8 from RGB8, outRgba holds 4 bytes for every 3 of rgb. SSSE3 shuffles 16 texels at a time where available. */
+	export void ExpandRgbToRgba(std::span<uint8_t const> rgb, std::span<uint8_t> outRgba);
+
+} // namespace gg
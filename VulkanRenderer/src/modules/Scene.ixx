@@ -0,0 +1,172 @@
+module;
+#include <cfloat>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <future>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+export module Scene;
+
+import Bvh;
+import Culling;
+import JobSystem;
+import Model;
+
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4;
+using DirectX::XMFLOAT4X4;
+using DirectX::XMMATRIX;
+
+namespace gg
+{
+	/* Handles stay valid until the model or the instance is removed */
+	export using ModelId = uint32_t;
+	export using InstanceId = uint32_t;
+	export using LightId = uint32_t;
+
+	export enum class Residency : uint8_t
+	{
+		Loading,   /* the loader is still importing it, its instances are placed but not drawn */
+		Pending,   /* added, waiting for the renderer to upload it */
+		Resident,  /* the GPU buffers are ready, its instances are drawn */
+		Releasing  /* removed, the GPU buffers are freed once no frame in flight uses them */
+	};
+
+	/* Per-instance data, see shaders/instance.hlsli */
+	export struct InstanceData
+	{
+		XMFLOAT4X4 ObjectMatrix{}; /* object to world */
+		XMFLOAT4 Color{ 1.f, 1.f, 1.f, 1.f };
+	};
+
+	/* In the space of the instances, lights nothing beyond its radius */
+	export struct PointLight
+	{
+		XMFLOAT3 Position{};
+		float Radius{ 1.f };
+		XMFLOAT3 Color{ 1.f, 1.f, 1.f };
+		float Intensity{ 1.f };
+	};
+
+	/* The models to render and their instances. Only CPU data, the renderer
+	 * uploads and releases the models by following their residency. */
+	export class Scene
+	{
+	public:
+		ModelId AddModel(std::unique_ptr<Model>);
+		/* The model becomes Pending once the load completes, see UpdateLoadingModels. A failed load removes the model. */
+		ModelId AddModel(std::future<std::unique_ptr<Model>>);
+		/* Also removes the instances of the model */
+		void RemoveModel(ModelId);
+		Model const& GetModel(ModelId) const;
+		Residency GetResidency(ModelId) const;
+		/* Every valid ModelId is smaller */
+		uint32_t GetModelIdLimit() const;
+		bool IsValid(ModelId) const;
+
+		InstanceId AddInstance(ModelId, XMMATRIX const& objectMatrix, XMFLOAT4 const& color = { 1.f, 1.f, 1.f, 1.f });
+		void SetInstanceTransform(InstanceId, XMMATRIX const& objectMatrix);
+		void SetInstanceColor(InstanceId, XMFLOAT4 const& color);
+		void RemoveInstance(InstanceId);
+
+		/* Dense per-instance arrays in the same order, which changes when instances are removed */
+		std::span<InstanceData const> GetInstances() const { return mInstances; }
+		std::span<ModelId const> GetInstanceModels() const { return mInstanceModels; }
+		/* World-space bounding spheres, center (xyz) and radius (w) */
+		std::span<XMFLOAT4 const> GetInstanceBounds() const { return mInstanceBounds; }
+		/* World-space bounding boxes, tighter than the spheres for the culling */
+		BoundingBoxes const& GetInstanceBoxes() const { return mInstanceBoxes; }
+		LightId AddPointLight(PointLight const&);
+		void SetPointLight(LightId, PointLight const&);
+		void RemovePointLight(LightId);
+		/* Dense, the order changes when lights are removed */
+		std::span<PointLight const> GetPointLights() const { return mPointLights; }
+
+		/* Changes whenever a model or an instance is added or removed */
+		uint64_t GetVersion() const { return mVersion; }
+
+		/* Runs the BVH rebuilds in the background, without it they block UpdateBvh */
+		void SetJobSystem(std::shared_ptr<JobSystem>);
+		/* Once per frame before the queries: refits the BVH to the moved instances, and rebuilds it once the refits or
+		 * the added and removed instances have degraded it too much. A rebuild replaces the BVH on a later call. */
+		void UpdateBvh();
+		/* Replaces the indices with the dense ones of the instances whose box intersects the frustum, through the BVH */
+		void CullInstances(Frustum const&, std::vector<uint32_t>& outVisibleIndices) const;
+		/* Nearest instance whose box the ray enters, see Bvh::IntersectRay */
+		std::optional<InstanceId> IntersectRay(XMFLOAT3 const& origin, XMFLOAT3 const& direction, float maxDistance = FLT_MAX) const;
+
+		/* Residency transitions, driven by the renderer */
+		void UpdateLoadingModels();
+		std::vector<ModelId> TakePendingUploads();
+		std::vector<ModelId> TakePendingReleases();
+		void SetResident(ModelId);
+		/* Destroys the model and recycles its id */
+		void ReleaseModel(ModelId);
+
+	private:
+		struct ModelSlot
+		{
+			std::unique_ptr<Model> Data;
+			std::future<std::unique_ptr<Model>> PendingData;
+			XMFLOAT4 Bounds{}; /* object-space bounding sphere of all meshes */
+			XMFLOAT3 BoxExtent{}; /* half extent of the object-space box of all meshes, centered on the sphere */
+			Residency State{ Residency::Pending };
+		};
+
+		ModelId AllocateModelId();
+		void SetModelData(ModelId, std::unique_ptr<Model>);
+		void UpdateInstanceBounds(uint32_t instanceIndex);
+
+		std::vector<ModelSlot> mModels;
+		std::vector<ModelId> mFreeModelIds;
+		std::vector<ModelId> mLoadingModels;
+		std::vector<ModelId> mPendingUploads;
+		std::vector<ModelId> mPendingReleases;
+
+		/* Instances in dense arrays, removal moves the last instance into the hole */
+		std::vector<InstanceData> mInstances;
+		std::vector<ModelId> mInstanceModels;
+		std::vector<XMFLOAT4> mInstanceBounds;
+		BoundingBoxes mInstanceBoxes;
+		std::vector<InstanceId> mInstanceIds;      /* dense index to id */
+		std::vector<uint32_t> mInstanceIndices;    /* id to dense index */
+		std::vector<InstanceId> mFreeInstanceIds;
+
+		/* Dense as well, with the same id scheme */
+		std::vector<PointLight> mPointLights;
+		std::vector<LightId> mLightIds;            /* dense index to id */
+		std::vector<uint32_t> mLightIndices;       /* id to dense index */
+		std::vector<LightId> mFreeLightIds;
+
+		/* The BVH is over the ids, whose boxes do not move when instances are removed. A removed id keeps an empty box until the next rebuild. */
+		struct BvhRebuild
+		{
+			std::vector<Aabb> Boxes;
+			std::vector<InstanceId> Primitives;
+			Bvh Result;
+		};
+
+		void StartBvhRebuild();
+		void FinishBvhRebuild();
+
+		std::shared_ptr<JobSystem> mJobs;
+		std::vector<Aabb> mInstanceAabbs;          /* by id */
+		Bvh mBvh;
+		std::vector<bool> mIsInBvh;                /* by id */
+		/* Added since the last build, tested one by one */
+		std::vector<InstanceId> mUnindexedInstances;
+		/* In the BVH and moved since the last refit */
+		std::vector<InstanceId> mMovedInstances;
+		/* Removed ids still in the BVH */
+		uint32_t mStaleBvhPrimitiveCount{ 0 };
+		bool mIsBvhRefitNeeded{ false };
+		/* Shared with the job, which may outlive the scene */
+		std::shared_ptr<BvhRebuild> mBvhRebuild;
+		JobHandle mBvhRebuildJob;
+
+		uint64_t mVersion{ 0 };
+	};
+
+} // namespace gg
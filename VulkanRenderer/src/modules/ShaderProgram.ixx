@@ -7,6 +7,12 @@ export namespace gg
 {
 	char const* VS_ENTRY_POINT{ "vs_main" };
 	char const* FS_ENTRY_POINT{ "ps_main" };
+	char const* CS_ENTRY_POINT{ "cs_main" };
+	char const* TS_ENTRY_POINT{ "as_main" };
+	char const* MS_ENTRY_POINT{ "ms_main" };
+
+	/* For the stages that are not part of a ShaderProgram. The caller owns the returned module. */
+	VkShaderModule LoadShaderModule(VkDevice, std::string const& shaderAbsPath);
 
 	class ShaderProgram
 	{
@@ -27,9 +33,6 @@ export namespace gg
 		VkShaderModule GetFragmentShader();
 
 	private:
-		std::string vertexShaderBlob;
-		std::string fragmentShaderBlob;
-
 		VkShaderModule vertexShader{ nullptr };
 		VkShaderModule fragmentShader{ nullptr };
 		VkDevice device;
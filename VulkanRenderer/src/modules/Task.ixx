@@ -0,0 +1,305 @@
+module;
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+export module Task;
+
+import AsyncIo;
+import JobSystem;
+
+namespace gg
+{
+	export enum class TaskPriority : uint32_t
+	{
+		High,
+		Normal,
+		Low,
+	};
+	constexpr uint32_t TASK_PRIORITY_COUNT{ 3 };
+
+	template <typename T>
+	class Task;
+
+	template <typename T>
+	struct TaskPromiseBase
+	{
+		/* Resumes the awaiting coroutine directly, without growing the stack */
+		struct FinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			template <typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+			{
+				std::coroutine_handle<> const continuation{ handle.promise().Continuation };
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() noexcept { Exception = std::current_exception(); }
+
+		std::coroutine_handle<> Continuation;
+		std::exception_ptr Exception;
+	};
+
+	template <typename T>
+	struct TaskPromise : TaskPromiseBase<T>
+	{
+		Task<T> get_return_object() noexcept;
+		void return_value(T value) { Value.emplace(std::move(value)); }
+		T TakeResult()
+		{
+			if (this->Exception)
+				std::rethrow_exception(this->Exception);
+			return std::move(*Value);
+		}
+
+		std::optional<T> Value;
+	};
+
+	template <>
+	struct TaskPromise<void> : TaskPromiseBase<void>
+	{
+		Task<void> get_return_object() noexcept;
+		void return_void() const noexcept {}
+		void TakeResult()
+		{
+			if (Exception)
+				std::rethrow_exception(Exception);
+		}
+	};
+
+	/* A coroutine that starts when it is awaited, and resumes its awaiter once it returns. Owns its frame.
+	 * Each step of a load is a co_await: a read, a move to the workers, the loads it waits for. */
+	export template <typename T = void>
+	class Task
+	{
+	public:
+		using promise_type = TaskPromise<T>;
+
+		Task() = default;
+		explicit Task(std::coroutine_handle<promise_type> handle) : mHandle{ handle } {}
+
+		Task(Task&& other) noexcept : mHandle{ std::exchange(other.mHandle, nullptr) } {}
+		Task& operator=(Task&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (mHandle)
+					mHandle.destroy();
+				mHandle = std::exchange(other.mHandle, nullptr);
+			}
+			return *this;
+		}
+
+		/* Prohibit copying to make sure the frame is destroyed exactly once */
+		Task(Task const&) = delete;
+		Task& operator=(Task const&) = delete;
+
+		~Task()
+		{
+			if (mHandle)
+				mHandle.destroy();
+		}
+
+		auto operator co_await() && noexcept
+		{
+			struct Awaiter
+			{
+				bool await_ready() const noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+				{
+					Handle.promise().Continuation = awaiting;
+					return Handle;
+				}
+				T await_resume() { return Handle.promise().TakeResult(); }
+
+				std::coroutine_handle<promise_type> Handle;
+			};
+			return Awaiter{ mHandle };
+		}
+
+	private:
+		std::coroutine_handle<promise_type> mHandle;
+	};
+
+	template <typename T>
+	Task<T> TaskPromise<T>::get_return_object() noexcept
+	{
+		return Task<T>{ std::coroutine_handle<TaskPromise<T>>::from_promise(*this) };
+	}
+
+	inline Task<void> TaskPromise<void>::get_return_object() noexcept
+	{
+		return Task<void>{ std::coroutine_handle<TaskPromise<void>>::from_promise(*this) };
+	}
+
+	/* Starts right away and destroys itself when done, for the roots of the task graphs */
+	struct DetachedTask
+	{
+		struct promise_type
+		{
+			DetachedTask get_return_object() const noexcept { return {}; }
+			std::suspend_never initial_suspend() const noexcept { return {}; }
+			std::suspend_never final_suspend() const noexcept { return {}; }
+			void return_void() const noexcept {}
+			/* The detached coroutines catch everything themselves */
+			void unhandled_exception() const noexcept { std::terminate(); }
+		};
+	};
+
+	template <typename T>
+	DetachedTask fulfillPromise(Task<T> task, std::promise<T> promise)
+	{
+		try
+		{
+			if constexpr (std::is_void_v<T>)
+			{
+				co_await std::move(task);
+				promise.set_value();
+			}
+			else
+				promise.set_value(co_await std::move(task));
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+		}
+	}
+
+	/* Runs the task on the calling thread until its first suspension, the future gets its result or exception */
+	export template <typename T>
+	std::future<T> StartTask(Task<T> task)
+	{
+		std::promise<T> promise{};
+		std::future<T> future{ promise.get_future() };
+		fulfillPromise(std::move(task), std::move(promise));
+		return future;
+	}
+
+	/* Resumes the ready coroutines as jobs, highest priority first. A suspended coroutine holds no thread. */
+	export class TaskScheduler
+	{
+	public:
+		explicit TaskScheduler(std::shared_ptr<JobSystem>);
+		/* Runs the ready coroutines, including the ones they make ready, before returning */
+		~TaskScheduler();
+
+		TaskScheduler(TaskScheduler const&) = delete;
+		TaskScheduler& operator=(TaskScheduler const&) = delete;
+
+		struct ScheduleAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle) const { Scheduler.Enqueue(handle, Priority); }
+			void await_resume() const noexcept {}
+
+			TaskScheduler& Scheduler;
+			TaskPriority Priority;
+		};
+		/* co_await Schedule(): continues on a worker */
+		ScheduleAwaiter Schedule(TaskPriority priority = TaskPriority::Normal) { return { *this, priority }; }
+
+		/* Safe to call from any thread */
+		void Enqueue(std::coroutine_handle<>, TaskPriority);
+
+	private:
+		void ResumeNext();
+
+		std::shared_ptr<JobSystem> mJobs;
+		std::mutex mMutex;
+		std::array<std::deque<std::coroutine_handle<>>, TASK_PRIORITY_COUNT> mReady;
+		/* Enqueued and not resumed yet, or still running */
+		std::atomic<uint32_t> mPendingCount{ 0 };
+	};
+
+	export struct IoResult
+	{
+		IoStatus Status{ IoStatus::Failed };
+		size_t BytesRead{ 0 };
+	};
+
+	/* co_await ReadAsync(...): submits the read, and continues on a worker once it completes */
+	export struct ReadAsync
+	{
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			Read.OnComplete = [this, handle](IoStatus status, size_t bytesRead)
+			{
+				Result = { status, bytesRead };
+				Scheduler.Enqueue(handle, Priority);
+			};
+			Io.Submit(std::move(Read));
+		}
+		IoResult await_resume() const noexcept { return Result; }
+
+		AsyncIo& Io;
+		TaskScheduler& Scheduler;
+		IoRead Read;
+		TaskPriority Priority{ TaskPriority::Normal };
+		IoResult Result{};
+	};
+
+	/* co_await WhenAll(tasks): runs the tasks concurrently and continues once they are all done.
+	 * Each task runs on the awaiting thread until its first suspension, have it co_await a Schedule() to spread over the workers.
+	 * Rethrows the exception of the first failed task. */
+	export class WhenAll
+	{
+	public:
+		explicit WhenAll(std::vector<Task<>> tasks) : mTasks{ std::move(tasks) }, mExceptions(mTasks.size()) {}
+
+		bool await_ready() const noexcept { return mTasks.empty(); }
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			mContinuation = handle;
+			/* One count for the starting loop, so that a task finishing early does not resume the awaiter during it */
+			mRemainingCount = mTasks.size() + 1;
+			for (size_t i{ 0 }; i < mTasks.size(); ++i)
+				RunTask(*this, i);
+			return 1 != mRemainingCount.fetch_sub(1);
+		}
+		void await_resume() const
+		{
+			for (std::exception_ptr const& exception : mExceptions)
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+			}
+		}
+
+	private:
+		static DetachedTask RunTask(WhenAll& whenAll, size_t index)
+		{
+			try
+			{
+				co_await std::move(whenAll.mTasks[index]);
+			}
+			catch (...)
+			{
+				whenAll.mExceptions[index] = std::current_exception();
+			}
+			if (1 == whenAll.mRemainingCount.fetch_sub(1))
+				whenAll.mContinuation.resume();
+		}
+
+		std::vector<Task<>> mTasks;
+		std::vector<std::exception_ptr> mExceptions;
+		std::atomic<size_t> mRemainingCount{ 0 };
+		std::coroutine_handle<> mContinuation;
+	};
+
+} // namespace gg
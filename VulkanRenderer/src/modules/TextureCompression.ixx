@@ -0,0 +1,23 @@
+module;
+#include <cstddef>
+#include <cstdint>
+export module TextureCompression;
+
+import Model;
+
+namespace gg
+{
+	export bool IsBlockCompressed(TextureFormat);
+
+	/* In bytes, block-compressed levels are rounded up to whole 4x4 blocks */
+	export size_t GetTextureLevelSize(TextureFormat, uint32_t width, uint32_t height);
+
+	/* BC1 for opaque images, BC3 when any texel is transparent */
+	export TextureFormat ChooseCompressedFormat(Texture const& source);
+
+	/* Import-time encoder: builds the mip chain of an Rgba8Srgb texture and encodes every level to BC1, BC3 or BC5.
+	 * The endpoints are fit along the principal axis of each block's colors, good enough for base colors at a
+	 * fraction of the cost of an exhaustive search. BC7 can be loaded but not encoded. */
+	export Texture CompressTexture(Texture const& source, TextureFormat);
+
+} // namespace gg
@@ -1,14 +1,42 @@
 module;
 #include <DirectXMath.h>
-#include <array>
+#include <DirectXPackedVector.h>
+#include <cstdint>
+#include <vector>
 #include <vulkan/vulkan.h>
 export module Vertex;
 
 using DirectX::XMVECTOR;
 using DirectX::XMFLOAT2;
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4;
+using DirectX::PackedVector::HALF;
 
-namespace gg 
+namespace gg
 {
+	/* Layout of the vertex data as it is stored on the GPU */
+	export enum class VertexFormat : uint8_t
+	{
+		Float32,    /* float3 position + float2 UV - 20 bytes per vertex */
+		Quantized16 /* UNORM16 position relative to the mesh bounds + half UV - 12 bytes per vertex */
+	};
+
+	/* Vertex data is split into separate buffers (bindings) so passes can fetch only what they need */
+	export enum class VertexStream : uint8_t
+	{
+		Position = 0,
+		Attributes = 1 /* everything except the position */
+	};
+	export constexpr uint32_t VERTEX_STREAM_COUNT{ 2 };
+
+	/* Set of streams read by a pass */
+	export enum class VertexStreams : uint8_t
+	{
+		PositionOnly, /* depth prepass, shadows, occlusion */
+		All
+	};
+
+	/* Full precision vertex, only used on the CPU while importing a mesh */
 	export struct Vertex
 	{
 		XMVECTOR Position;
@@ -23,8 +51,52 @@ namespace gg
 			, TextureCoords0{ u, v }
 		{}
 
-		static VkVertexInputBindingDescription GetBindingDescription();
-		static std::array<VkVertexInputAttributeDescription, 2> GetAttributeDescriptions();
+		static std::vector<VkVertexInputBindingDescription> GetBindingDescriptions(VertexFormat, VertexStreams = VertexStreams::All);
+		static std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions(VertexFormat, VertexStreams = VertexStreams::All);
+	};
+
+	/* Attribute stream element of VertexFormat::Float32 */
+	export struct VertexAttributes
+	{
+		XMFLOAT2 TextureCoords0{};
+	};
+
+	/* Position stream element of VertexFormat::Quantized16: xyz are UNORM16 relative to the mesh bounding box,
+	 * w is padding as R16G16B16 is not a mandatory vertex format */
+	export struct QuantizedPosition
+	{
+		uint16_t Position[4]{};
 	};
+	static_assert(sizeof(QuantizedPosition) == 8);
+
+	/* Attribute stream element of VertexFormat::Quantized16.
+	 * Normals and tangents are to be added as octahedral-encoded uint32_t (see EncodeOctahedral). */
+	export struct QuantizedAttributes
+	{
+		HALF TextureCoords0[2]{};
+	};
+	static_assert(sizeof(QuantizedAttributes) == 4);
+
+	/* Per-mesh dequantization parameters: position = quantized * Scale + Bias.
+	 * Matches the push constant block of the vertex shader. */
+	export struct VertexQuantization
+	{
+		XMFLOAT4 Scale{ 1.f, 1.f, 1.f, 0.f };
+		XMFLOAT4 Bias{ 0.f, 0.f, 0.f, 0.f };
+	};
+
+	export uint32_t GetStreamStride(VertexFormat, VertexStream);
+	export uint32_t GetVertexStride(VertexFormat);
+
+	/* Appends the vertex to the position and attribute streams in the given format */
+	export void WriteVertex(Vertex const&, VertexFormat, VertexQuantization const&, std::vector<uint8_t>& positionStream, std::vector<uint8_t>& attributeStream);
+
+	export VertexQuantization ComputeVertexQuantization(XMFLOAT3 const& boundsMin, XMFLOAT3 const& boundsMax);
+	export QuantizedPosition QuantizePosition(XMVECTOR position, VertexQuantization const&);
+	export XMFLOAT3 DecodePosition(QuantizedPosition const&, VertexQuantization const&);
+
+	/* Octahedral encoding of a unit vector into two SNORM16 values */
+	export uint32_t EncodeOctahedral(XMFLOAT3 const& unitVector);
+	export XMFLOAT3 DecodeOctahedral(uint32_t encoded);
 
 } // namespace gg
@@ -1,20 +1,34 @@
 module;
+#include <array>
 #include <cstdint>
 #include <DirectXMath.h>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <SDL2/SDL_video.h>
 #include <vulkan/vulkan.h>
 export module VulkanRenderer;
 
 import Camera;
+import DrawSort;
+import FrameArena;
 import Input;
+import JobSystem;
+import OcclusionCulling;
 import Vertex;
 import TimeManager;
 import Model;
+import Scene;
+import ShaderProgram;
 
+using DirectX::XMFLOAT2;
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4;
+using DirectX::XMFLOAT4X4;
 using DirectX::XMMATRIX;
 
 namespace gg 
@@ -23,37 +37,440 @@ namespace gg
 	public:
 		VulkanRenderer(uint32_t width, uint32_t height, SDL_Window*);
 		~VulkanRenderer();
-		void UploadGeometry(std::unique_ptr<Model>);
+		/* Call before adding models. Returns false when the device lacks the required features. */
+		bool EnableGpuDrivenRendering();
+		/* Hides the instances behind the largest visible ones, rasterized on the CPU before the draws are recorded.
+		 * Only for the CPU-driven path, the GPU-driven one tests its depth pyramid instead. */
+		void EnableOcclusionCulling(std::shared_ptr<JobSystem>);
+		/* Draws the depth of the opaque meshes first, positions only, so that their pixel shaders run once per pixel.
+		 * Not for the meshlet draws nor the GPU-driven path. */
+		void SetDepthPrepass(bool enabled);
+		bool IsDepthPrepassEnabled() const;
+		/* Models added to the scene are uploaded by the next Render, removed ones are released
+		 * once no frame in flight uses them */
+		Scene& GetScene();
+		/* Instance under a pixel of the last rendered frame, by its bounding box */
+		std::optional<InstanceId> PickInstance(uint32_t x, uint32_t y) const;
 		void OnWindowResized(uint32_t width, uint32_t height);
 		void Render(uint64_t deltaTimeMs);
 		VkDevice GetDevice();
 	private:
+		static constexpr int8_t MAX_FRAMES_IN_FLIGHT{ 2 };
+		/* Coarsest LOD whose geometric error projects to at most this many pixels */
+		static constexpr float MAX_LOD_ERROR_PIXELS{ 1.f };
+		/* Texture streaming: the levels of the streamed textures that stay in device memory, the texel data uploaded per frame
+		 * at most (a single level larger than that still goes through, alone), and the largest level loaded up front */
+		static constexpr uint64_t TEXTURE_STREAMING_BUDGET_BYTES{ 256ull << 20 };
+		static constexpr uint64_t MAX_STREAMED_BYTES_PER_FRAME{ 4ull << 20 };
+		static constexpr uint32_t STREAMING_INITIAL_SIZE{ 64 };
+		/* Persistently mapped upload memory, enough for the streaming of the frames in flight. Offsets suit any texel block. */
+		static constexpr uint64_t STAGING_BUFFER_SIZE{ 32ull << 20 };
+		static constexpr uint64_t STAGING_ALIGNMENT{ 16 };
+		/* Frames between two logs of the fragment shader invocations */
+		static constexpr uint64_t STATISTICS_REPORT_INTERVAL{ 300 };
+		/* CPU occlusion culling: the width of its depth buffer, the height follows the swap chain, the most instances rasterized
+		 * as occluders, the size they must appear with (bounding radius over distance), and the geometric error of their LOD
+		 * relative to their bounding radius */
+		static constexpr uint32_t OCCLUSION_BUFFER_WIDTH{ 320 };
+		static constexpr uint32_t MAX_OCCLUDER_COUNT{ 16 };
+		static constexpr float MIN_OCCLUDER_SIZE{ 0.1f };
+		static constexpr float MAX_OCCLUDER_ERROR{ 0.01f };
+		/* Clustered lighting: the tiles of the screen and the depth slices of the cluster grid, the most lights in a frame
+		 * and light indices in all the cluster lists, see shaders/clustered_lighting.hlsli. The ambient light of a scene
+		 * with lights, one without them is drawn as it comes. */
+		static constexpr uint32_t CLUSTER_GRID_X{ 16 };
+		static constexpr uint32_t CLUSTER_GRID_Y{ 9 };
+		static constexpr uint32_t CLUSTER_GRID_Z{ 24 };
+		static constexpr uint32_t CLUSTER_COUNT{ CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z };
+		static constexpr uint32_t MAX_LIGHT_COUNT{ 4096 };
+		static constexpr uint32_t MAX_CLUSTER_LIGHT_INDICES{ 64 * CLUSTER_COUNT };
+		static constexpr float AMBIENT_INTENSITY{ 0.1f };
+
+		/* Positions of one LOD of a mesh, only the vertices it uses */
+		struct OccluderMesh
+		{
+			std::vector<XMFLOAT3> Positions;
+			std::vector<uint32_t> Indices;
+		};
+
+		struct MeshBuffers
+		{
+			std::array<VkBuffer, VERTEX_STREAM_COUNT> VertexBuffers{};
+			std::array<VkDeviceMemory, VERTEX_STREAM_COUNT> VertexBuffersMemory{};
+			VkBuffer IndexBuffer{};
+			VkDeviceMemory IndexBufferMemory{};
+
+			/* Meshlets of LOD 0, null when the mesh has none */
+			VkBuffer MeshletBuffer{};
+			VkDeviceMemory MeshletBufferMemory{};
+			VkBuffer MeshletVertexBuffer{};
+			VkDeviceMemory MeshletVertexBufferMemory{};
+			VkBuffer MeshletTriangleBuffer{};
+			VkDeviceMemory MeshletTriangleBufferMemory{};
+			VkDescriptorSet MeshShadingDescriptorSet{};
+			/* Output of the compute meshlet culling, written every frame */
+			std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> CulledIndexBuffers{};
+			std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> CulledIndexBuffersMemory{};
+			std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> DrawCommandBuffers{};
+			std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> DrawCommandBuffersMemory{};
+			std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> CullingDescriptorSets{};
+		};
+
+		/* GPU buffers of a model in the scene, indexed by ModelId */
+		struct ResidentModel
+		{
+			bool IsResident{ false };
+			std::vector<MeshBuffers> Meshes;
+			VkDescriptorPool MeshletDescriptorPool{};
+			uint32_t PipelineIndex{ 0 };
+			/* Material of each mesh, see AcquireMaterial */
+			std::vector<uint32_t> MeshMaterials;
+			/* Index of its first mesh in the GPU-driven mesh buffer */
+			uint32_t GpuMeshOffset{ 0 };
+			/* Its range of the visible instances in the current frame */
+			uint32_t FirstVisibleInstance{ 0 };
+			uint32_t VisibleInstanceCount{ 0 };
+			/* View distance of its nearest visible instance */
+			float NearestVisibleDepth{ 0.f };
+			/* By mesh, built the first time an instance occludes, see GetOccluderMeshes */
+			std::vector<OccluderMesh> Occluders;
+		};
+
+		/* Buffers of a removed model, destroyed once the frames in flight are done with them */
+		struct RetiredModel
+		{
+			std::vector<MeshBuffers> Meshes;
+			VkDescriptorPool MeshletDescriptorPool{};
+			std::vector<uint32_t> MeshMaterials;
+			uint64_t ReleaseFrame{ 0 };
+		};
+
+		/* A texture and the set 0 of each frame that samples it. Meshes with the same texture content share it. */
+		struct Material
+		{
+			uint64_t ContentHash{ 0 };
+			/* Compared on a hash hit before the material is shared */
+			std::weak_ptr<Texture const> Content{};
+			VkImage Image{};
+			VkDeviceMemory ImageMemory{};
+			VkImageView ImageView{};
+			VkDescriptorPool DescriptorPool{};
+			std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> DescriptorSets{};
+			uint32_t ReferenceCount{ 0 };
+
+			/* Streaming, see VulkanRendererStreaming.cpp. The image only holds the levels of Source from ResidentLevel on,
+			 * Source is null for the textures that are always fully resident. */
+			std::shared_ptr<Texture const> Source{};
+			uint32_t ResidentLevel{ 0 };
+			uint64_t ResidentBytes{ 0 };
+			/* Finest level that a draw of LastUsedFrame needs */
+			uint32_t RequestedLevel{ 0 };
+			uint64_t LastUsedFrame{ 0 };
+			/* A bit per frame in flight whose descriptor set still samples the previous image */
+			uint32_t StaleDescriptorSets{ 0 };
+		};
+		/* White, for the meshes without a texture. Its sets also serve the passes that do not sample textures. */
+		static constexpr uint32_t DEFAULT_MATERIAL{ 0 };
+
+		/* Where the data of this frame's copies was written, see WriteStaging */
+		struct StagingAllocation
+		{
+			VkBuffer Buffer{};
+			VkDeviceSize Offset{ 0 };
+			/* Of a dedicated buffer for data that did not fit in the staging buffer, null otherwise */
+			VkDeviceMemory DedicatedMemory{};
+		};
+
+		/* Image of a streamed texture replaced by one with other levels, or a dedicated staging buffer */
+		struct RetiredTexture
+		{
+			VkImage Image{};
+			VkDeviceMemory ImageMemory{};
+			VkImageView ImageView{};
+			VkBuffer StagingBuffer{};
+			VkDeviceMemory StagingBufferMemory{};
+			uint64_t ReleaseFrame{ 0 };
+		};
+
+		/* One per shader program and vertex format, shared by the models that use them */
+		struct GraphicsPipeline
+		{
+			std::shared_ptr<ShaderProgram> Program;
+			VertexFormat Format{ VertexFormat::Float32 };
+			VkPipeline Pipeline{};
+			VkPipeline MeshShadingPipeline{};
+			VkPipeline DepthPrepassPipeline{};
+		};
+
+		/* One mesh of a model for all its visible instances */
+		struct DrawItem
+		{
+			uint32_t PipelineIndex{ 0 };
+			uint32_t MaterialIndex{ 0 };
+			ModelId Model{ 0 };
+			uint32_t MeshIndex{ 0 };
+			uint32_t Lod{ 0 };
+			uint32_t FirstInstance{ 0 };
+			uint32_t InstanceCount{ 0 };
+			float Depth{ 0.f };
+		};
+
+		/* Binds of one frame, the requested ones are what recording every draw on its own would bind */
+		struct DrawStatistics
+		{
+			uint32_t Draws{ 0 };
+			uint32_t PipelineBinds{ 0 };
+			uint32_t DescriptorSetBinds{ 0 };
+			uint32_t VertexBufferBinds{ 0 };
+			uint32_t IndexBufferBinds{ 0 };
+			uint32_t PushConstants{ 0 };
+
+			bool operator==(DrawStatistics const&) const = default;
+		};
+
+		/* State of the command buffer being recorded, skips the binds that would not change it */
+		struct DrawStateCache
+		{
+			VkCommandBuffer CommandBuffer{};
+			VkDescriptorSet DescriptorSet{};
+			VkPipeline Pipeline{};
+			VkPipelineLayout Layout{};
+			VkBuffer VertexBuffer{};
+			VkBuffer IndexBuffer{};
+			VertexQuantization Quantization{};
+			bool HasQuantization{ false };
+			DrawStatistics Requested{};
+			DrawStatistics Issued{};
+
+			/* A layout change also invalidates set 0 and the push constants */
+			void BindPipeline(VkPipeline, VkPipelineLayout);
+			/* Set 0 of the material, after BindPipeline */
+			void BindDescriptorSet(VkDescriptorSet);
+			void BindVertexStreams(MeshBuffers const&);
+			void BindIndexBuffer(VkBuffer);
+			void PushQuantization(VertexQuantization const&);
+		};
+
+		/* Push constants of the meshlet culling and mesh shaders, see shaders/meshlet_culling.hlsli */
+		struct MeshletConstants
+		{
+			VertexQuantization Quantization{};
+			XMFLOAT3 CameraPosition{};
+			uint32_t MeshletCount{ 0 };
+			uint32_t IsQuantized{ 0 };
+			uint32_t InstanceIndex{ 0 };
+		};
+
+		/* Storage buffer layouts of the GPU-driven mode, see shaders/gpu_driven.hlsli */
+		struct GpuLod
+		{
+			uint32_t FirstIndex{ 0 };
+			uint32_t IndexCount{ 0 };
+			float Error{ 0.f };
+			uint32_t Padding{ 0 };
+		};
+
+		struct GpuMesh
+		{
+			VertexQuantization Quantization{};
+			XMFLOAT3 BoundsCenter{};
+			float BoundsRadius{ 0.f };
+			int32_t VertexOffset{ 0 };
+			uint32_t LodCount{ 0 };
+			uint32_t Padding[2]{};
+			std::array<GpuLod, MAX_LOD_COUNT> Lods{};
+		};
+
+		/* One mesh of one instance */
+		struct GpuObject
+		{
+			uint32_t InstanceIndex{ 0 };
+			uint32_t MeshIndex{ 0 };
+		};
+
+		/* The GPU-driven culling runs twice a frame. The early phase draws the objects that were visible in the previous frame,
+		 * the late phase tests all of them against the depth pyramid of those draws and draws the ones that became visible. */
+		enum class OcclusionPhase : uint32_t { Early, Late };
+		static constexpr uint32_t OCCLUSION_PHASE_COUNT{ 2 };
+
+		struct GpuDrivenConstants
+		{
+			XMFLOAT4X4 ViewProjection{};
+			float PixelsPerUnit{ 0.f };
+			float MaxLodErrorPixels{ 0.f };
+			uint32_t ObjectCount{ 0 };
+			OcclusionPhase Phase{ OcclusionPhase::Early };
+			/* Of the depth buffer, level 0 of the pyramid has half its size */
+			uint32_t DepthWidth{ 0 };
+			uint32_t DepthHeight{ 0 };
+			uint32_t DepthPyramidLevelCount{ 0 };
+			uint32_t Padding{ 0 };
+		};
+
+		/* Uniform buffer of set 0, see shaders/frame.hlsli */
+		struct FrameConstants
+		{
+			XMFLOAT4X4 ModelViewProjection{};
+			XMFLOAT4X4 ModelView{};
+			/* P00 and P11 of the projection */
+			XMFLOAT2 ProjectionScale{};
+			XMFLOAT2 ScreenSize{};
+			/* Depth slice of the clusters: log(z) * SliceScale + SliceBias */
+			float SliceScale{ 0.f };
+			float SliceBias{ 0.f };
+			uint32_t LightCount{ 0 };
+			float AmbientIntensity{ 1.f };
+		};
+
+		/* Storage buffer layout of the clustered lighting, in view space, see shaders/clustered_lighting.hlsli */
+		struct GpuPointLight
+		{
+			XMFLOAT3 Position{};
+			float Radius{ 0.f };
+			XMFLOAT3 Color{};
+			float Padding{ 0.f };
+		};
+
+		/* Per frame in flight, the lights are written by the CPU and the cluster lists by the light culling pass */
+		struct ClusterLightingBuffers
+		{
+			VkBuffer Lights{};
+			VkDeviceMemory LightsMemory{};
+			void* MappedLights{ nullptr };
+			/* Offset and count in LightIndices of each cluster */
+			VkBuffer ClusterLights{};
+			VkDeviceMemory ClusterLightsMemory{};
+			VkBuffer LightIndices{};
+			VkDeviceMemory LightIndicesMemory{};
+			/* Atomic counter of the reserved light indices */
+			VkBuffer LightIndexCount{};
+			VkDeviceMemory LightIndexCountMemory{};
+		};
+
 		void CreateVkInstance(std::vector<char const*> const & layers, std::vector<char const*> const & extensions);
 		void SelectPhysicalDevice();
 		void CreateLogicalDevice();
 		void CreateSwapChain();
 		void CreateRenderPass();
 		void CreateDescriptorSetLayout();
-		void CreateGraphicsPipeline();
+		/* Creates the missing pipelines of mGraphicsPipelines */
+		void CreateGraphicsPipelines();
+		uint32_t GetGraphicsPipelineIndex(Model const&);
 		void CreateFrameBuffers();
 		void CreateCommandPool();
 
 		void CreateImageViews();
-		void CreateTextureImage();
-		void CreateImage(uint32_t width, uint32_t height, VkFormat, VkImageTiling, VkImageUsageFlags, VkMemoryPropertyFlags, VkImage&, VkDeviceMemory&);
-		VkImageView CreateImageView(VkImage, VkFormat);
-		void CreateTextureImageView();
+		void CreateDepthResources();
+		void CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat, VkImageTiling, VkImageUsageFlags, VkMemoryPropertyFlags, VkImage&, VkDeviceMemory&);
+		VkImageView CreateImageView(VkImage, VkFormat, uint32_t mipLevels = 1, uint32_t baseMipLevel = 0, VkImageAspectFlags = VK_IMAGE_ASPECT_COLOR_BIT);
 		void CreateTextureSampler();
 
 		void CreateCommandBuffers();
 		void CreateSyncObjects();
-		void CreateVertexBuffer(Mesh const&);
-		void CreateIndexBuffer(Mesh const&);
+		void CreateVertexBuffer(Mesh const&, MeshBuffers&);
+		void CreateIndexBuffer(Mesh const&, MeshBuffers&);
+		void DestroyMeshBuffers(MeshBuffers&);
 		void CreateUniformBuffers();
-		void CreateDescriptorPool();
-		void CreateDescriptorSets();
+		void CreateStagingBuffer();
+		/* For copies recorded in the current frame, the space is reused once the frame completes */
+		StagingAllocation WriteStaging(std::span<uint8_t const>);
 		
 		void RecordCommandBuffer(VkCommandBuffer, uint32_t imageIndex, XMMATRIX const & mvpMatrix);
+		static void BindVertexStreams(VkCommandBuffer, MeshBuffers const&, VertexStreams);
+		void ReportDrawStatistics(DrawStateCache const&);
+		/* Logs the fragment shader invocations of the frame that last used the current frame's query, see STATISTICS_REPORT_INTERVAL */
+		void ReportPipelineStatistics();
+		void CreateStatisticsQueryPool();
+		/* Supports depth attachments and sampling, without stencil */
+		VkFormat FindDepthFormat() const;
+		float GetPixelsPerUnit() const;
+
+		/* Scene residency and draw list, see VulkanRendererScene.cpp */
+		void UpdateResidency();
+		void UploadModel(ModelId);
+		void ReleaseModel(ModelId);
+		void DestroyRetiredModels(bool waitForAll);
+		void BuildDrawList(XMMATRIX const& modelViewMatrix, XMMATRIX const& mvpMatrix);
+		/* Removes the occluded instances from mVisibleInstanceIndices */
+		void CullOccludedInstances(XMMATRIX const& modelViewMatrix, XMMATRIX const& mvpMatrix);
+		std::vector<OccluderMesh> const& GetOccluderMeshes(ModelId);
+		void ResizeOcclusionBuffer();
+		/* Of the instance that appears the largest, the scale of its object matrix over its view distance */
+		float GetMaxScaleOverDistance(Mesh const&, std::span<InstanceData const> instances, XMMATRIX const& modelViewMatrix) const;
+		uint32_t SelectLod(Mesh const&, float maxScaleOverDistance) const;
+
+		/* Textures and their descriptor sets, see VulkanRendererMaterials.cpp */
+		void CreateDefaultMaterial();
+		/* Uploads the texture unless a material with the same content exists, null or a format the device cannot sample returns DEFAULT_MATERIAL */
+		uint32_t AcquireMaterial(std::shared_ptr<Texture const> const&);
+		/* Destroys the material with its last reference, the frames in flight must be done with it */
+		void ReleaseMaterial(uint32_t materialIndex);
+		uint32_t CreateMaterial(std::shared_ptr<Texture const> const&);
+		/* Copies the texture into all the mip levels of the image, which ends up ready for sampling. Waits for the copies. */
+		void UploadTexture(Texture const&, VkImage, uint32_t mipLevels);
+		void WriteImageDescriptor(Material const&, uint32_t frameIndex);
+		static void RecordImageBarrier(VkCommandBuffer, VkImage, uint32_t baseMipLevel, uint32_t levelCount
+			, VkImageLayout oldLayout, VkImageLayout newLayout
+			, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask
+			, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+		void WriteInstanceDescriptor(Material const&, uint32_t frameIndex);
+		void DestroyMaterial(Material&);
+		void DestroyMaterials();
+
+		/* Texture streaming, see VulkanRendererStreaming.cpp */
+		void RequestTextureLevel(uint32_t materialIndex, Mesh const&, float maxScaleOverDistance);
+		void StreamTextures(VkCommandBuffer);
+		/* Copies of the texture levels [firstLevel, endLevel) into the image whose level 0 is imageFirstLevel, in TRANSFER_DST layout */
+		void RecordTextureUpload(VkCommandBuffer, Texture const&, VkImage, uint32_t imageFirstLevel, uint32_t firstLevel, uint32_t endLevel);
+		/* Records the copies into a new image that holds the levels from residentLevel on, and retires the current one */
+		void SetResidentLevel(VkCommandBuffer, Material&, uint32_t residentLevel);
+		/* Drops the fine levels of the least recently used textures, false when that cannot free requiredBytes */
+		bool EvictTextureLevels(VkCommandBuffer, uint64_t requiredBytes);
+		/* Finest level not larger than STREAMING_INITIAL_SIZE */
+		static uint32_t GetInitialResidentLevel(Texture const&);
+		void DestroyRetiredTextures(bool waitForAll);
+
+		/* Meshlet culling, see VulkanRendererMeshlets.cpp */
+		void CreateMeshletSetLayouts();
+		void CreateMeshletBuffers(Mesh const&, MeshBuffers&);
+		void CreateMeshletDescriptorSets(Model const&, ResidentModel&);
+		void CreateMeshletCullingPipeline();
+		bool UsesMeshlets(DrawItem const&) const;
+		XMFLOAT3 GetObjectSpaceCameraPosition(InstanceData const&) const;
+		void RecordMeshletCulling(VkCommandBuffer);
+		void DrawMeshlets(DrawItem const&, DrawStateCache&);
+
+		/* Per-frame instance buffers, see VulkanRendererInstances.cpp */
+		void CreateInstanceBuffer(uint32_t frameIndex, uint32_t capacity);
+		void UploadInstances(std::span<InstanceData const>);
+		void DestroyInstanceBuffers();
+
+		/* GPU-driven rendering, see VulkanRendererGpuDriven.cpp */
+		void CreateGpuDrivenDescriptorSets();
+		void CreateGpuCullingPipeline();
+		void RebuildGpuDrivenGeometry();
+		void UploadGpuObjects();
+		void DestroyGpuObjectBuffers();
+		void DestroyGpuDrivenScene();
+		void RecordGpuCulling(VkCommandBuffer, XMMATRIX const& viewProjection, OcclusionPhase);
+		void DrawGpuDriven(VkCommandBuffer, XMMATRIX const& viewProjection, OcclusionPhase);
+
+		/* Clustered lighting, see VulkanRendererLighting.cpp */
+		void CreateClusteredLighting();
+		void DestroyClusteredLighting();
+		/* The lights and cluster buffers of every frame in flight */
+		void WriteLightingDescriptors(Material const&, uint32_t frameIndex);
+		/* Writes the lights that may be in front of the far plane in view space, and fills the lighting part of the constants */
+		void UploadLights(XMMATRIX const& modelViewMatrix, FrameConstants& outConstants);
+		void RecordLightCulling(VkCommandBuffer);
+
+		/* Hierarchical depth for the occlusion culling, see VulkanRendererDepthPyramid.cpp */
+		void CreateDepthPyramidPipeline();
+		/* Sized after the swap chain */
+		void CreateDepthPyramid();
+		void DestroyDepthPyramid();
+		void WriteDepthPyramidDescriptors();
+		void RecordDepthPyramid(VkCommandBuffer);
 		VkCommandBuffer BeginSingleTimeCommands();
 		void EndSingleTimeCommands(VkCommandBuffer);
 		void SubmitCommands();
@@ -100,8 +517,8 @@ namespace gg
 		);
 
 		void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+		void CreateDeviceLocalBuffer(VkBuffer& outBuffer, VkDeviceMemory& outMemory, void const* data, uint64_t sizeBytes, VkBufferUsageFlags usage);
 
-		static constexpr int8_t MAX_FRAMES_IN_FLIGHT{ 2 };
 		uint32_t mWidth{};
 		uint32_t mHeight{};
 		SDL_Window* mWindowHandle{};
@@ -109,10 +526,12 @@ namespace gg
 
 		VkCommandPool mCommandPool{};
 		std::vector<VkCommandBuffer> mCommandBuffers;
+		/* The whole frame, and the passes of the occlusion phases of the GPU-driven mode. All are compatible. */
 		VkRenderPass mRenderPass{};
+		std::array<VkRenderPass, OCCLUSION_PHASE_COUNT> mOcclusionRenderPasses{};
 		VkDescriptorSetLayout mDescriptorSetLayout{};
 		VkPipelineLayout mPipelineLayout{};
-		VkPipeline mGraphicsPipeline{};
+		std::vector<GraphicsPipeline> mGraphicsPipelines;
 
 		/* Render Targets */
 		std::vector<VkImage> mSwapChainImages;
@@ -120,25 +539,127 @@ namespace gg
 		std::vector<VkFramebuffer> mFrameBuffers;
 		VkFormat mSwapChainImageFormat{};
 		VkExtent2D mSwapChainExtent{};
+		/* Sampled by the depth pyramid build */
+		VkFormat mDepthFormat{ VK_FORMAT_UNDEFINED };
+		VkImage mDepthImage{};
+		VkDeviceMemory mDepthImageMemory{};
+		VkImageView mDepthImageView{};
 
 		uint32_t mCurrentFrame{ 0 };
+		/* Number of frames rendered so far */
+		uint64_t mFrameNumber{ 0 };
+
+		Scene mScene;
+		std::vector<ResidentModel> mResidentModels;
+		std::vector<RetiredModel> mRetiredModels;
+		std::vector<DrawItem> mDrawItems;
+		/* mDrawItems in bind order, see DrawSort */
+		std::span<DrawPacket> mDrawPackets;
+		/* Reset at the start of every frame */
+		FrameArena mFrameArena;
+		DrawStatistics mLastDrawStatistics{};
+		bool mDepthPrepass{ false };
+		/* One fragment shader invocation query per frame in flight, null without pipelineStatisticsQuery */
+		bool mPipelineStatisticsSupported{ false };
+		VkQueryPool mStatisticsQueryPool{};
+		std::array<bool, MAX_FRAMES_IN_FLIGHT> mStatisticsRecorded{};
+		std::array<bool, MAX_FRAMES_IN_FLIGHT> mStatisticsDepthPrepass{};
+		/* Visible instances grouped by model, the contents of this frame's instance buffer */
+		std::vector<InstanceData> mVisibleInstances;
+		std::vector<uint32_t> mVisibleInstanceIndices;
+		bool mOcclusionCulling{ false };
+		OcclusionBuffer mOcclusionBuffer;
+		/* Size over distance and index of the instances that may occlude */
+		std::vector<std::pair<float, uint32_t>> mOccluderCandidates;
+		/* Root transform of the scene times the view, for the meshlet cone culling */
+		XMFLOAT4X4 mModelViewMatrix{};
+
+		/* Copy of the drawn instances for each frame in flight, read by the vertex shaders through SV_InstanceID */
+		std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> mInstanceBuffers{};
+		std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> mInstanceBuffersMemory{};
+		std::array<void*, MAX_FRAMES_IN_FLIGHT> mMappedInstanceBuffers{};
+		std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> mInstanceBufferCapacities{};
 
-		/* Vertex Buffer for the cube. TODO: There is a better place for it. */
-		VkBuffer mVB{};
-		VkDeviceMemory mVertexBufferMemory{};
+		/* Meshlets are culled in a task shader when VK_EXT_mesh_shader is available,
+		 * otherwise by a compute pass that writes an index buffer for an indirect draw.
+		 * That draw passes the instance as its firstInstance, without drawIndirectFirstInstance the meshes are drawn whole. */
+		bool mMeshShadingSupported{ false };
+		bool mIndirectFirstInstanceSupported{ false };
+		PFN_vkCmdDrawMeshTasksEXT mCmdDrawMeshTasks{};
+		VkDescriptorSetLayout mMeshletCullingSetLayout{};
+		VkPipelineLayout mMeshletCullingPipelineLayout{};
+		VkPipeline mMeshletCullingPipeline{};
+		VkDescriptorSetLayout mMeshShadingSetLayout{};
+		VkPipelineLayout mMeshShadingPipelineLayout{};
 
-		/* Textures. TODO: move to a better place */
-		VkImage mTextureImage;
-		VkDeviceMemory mTextureImageMemory;
-		VkImageView mTextureImageView;
-		VkSampler mTextureSampler;
+		/* GPU-driven mode: all meshes share one set of vertex and index buffers, a compute pass
+		 * culls the objects and selects their LODs, an indirect count draw per occlusion phase
+		 * renders them with the pipeline state of the first model */
+		bool mGpuDrivenSupported{ false };
+		bool mGpuDriven{ false };
+		MeshBuffers mGpuGeometry{};
+		bool mGpuGeometryDirty{ false };
+		std::vector<GpuObject> mGpuObjects;
+		/* Scene version that mGpuObjects was built from */
+		uint64_t mGpuObjectsVersion{ 0 };
+		VkBuffer mGpuObjectBuffer{};
+		VkDeviceMemory mGpuObjectBufferMemory{};
+		VkBuffer mGpuMeshBuffer{};
+		VkDeviceMemory mGpuMeshBufferMemory{};
+		std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> mGpuDrawCommandBuffers{};
+		std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> mGpuDrawCommandBuffersMemory{};
+		std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> mGpuDrawCountBuffers{};
+		std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> mGpuDrawCountBuffersMemory{};
+		/* A flag per object, whether the late phase of the previous frame found it visible */
+		VkBuffer mGpuVisibilityBuffer{};
+		VkDeviceMemory mGpuVisibilityBufferMemory{};
+		VkDescriptorSetLayout mGpuDrivenSetLayout{};
+		VkDescriptorPool mGpuDrivenDescriptorPool{};
+		std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> mGpuDrivenDescriptorSets{};
+		VkPipelineLayout mGpuCullingPipelineLayout{};
+		VkPipeline mGpuCullingPipeline{};
+		VkPipelineLayout mGpuDrivenPipelineLayout{};
+		VkPipeline mGpuDrivenPipeline{};
+
+		/* Farthest depth of 2x2 texels of the level below, from the depth of the early phase. One set per level. */
+		VkImage mDepthPyramidImage{};
+		VkDeviceMemory mDepthPyramidImageMemory{};
+		VkImageView mDepthPyramidView{};
+		std::vector<VkImageView> mDepthPyramidLevelViews;
+		uint32_t mDepthPyramidLevelCount{ 0 };
+		VkDescriptorSetLayout mDepthPyramidSetLayout{};
+		VkDescriptorPool mDepthPyramidDescriptorPool{};
+		std::vector<VkDescriptorSet> mDepthPyramidDescriptorSets;
+		VkPipelineLayout mDepthPyramidPipelineLayout{};
+		VkPipeline mDepthPyramidPipeline{};
+
+		std::array<ClusterLightingBuffers, MAX_FRAMES_IN_FLIGHT> mClusterLighting{};
+		VkPipelineLayout mLightCullingPipelineLayout{};
+		VkPipeline mLightCullingPipeline{};
+
+		/* Indexed by DrawItem::MaterialIndex, released slots are reused */
+		std::vector<Material> mMaterials;
+		std::vector<uint32_t> mFreeMaterialIndices;
+		std::unordered_map<uint64_t, uint32_t> mMaterialIndices; /* by texture content hash */
+		VkSampler mTextureSampler{};
+		/* Materials created this frame whose levels StreamTextures uploads */
+		std::vector<uint32_t> mPendingTextureUploads;
+		/* Sum of Material::ResidentBytes of the streamed textures */
+		uint64_t mStreamedTextureBytes{ 0 };
+		std::vector<RetiredTexture> mRetiredTextures;
 
 		std::vector<VkBuffer> mUniformBuffers;
 		std::vector<VkDeviceMemory> mUniformBuffersMemory;
-		VkDescriptorPool mDescriptorPool;
-		std::vector<VkDescriptorSet> mDescriptorSets;
 
-		std::unique_ptr<Model> mModel;
+		/* Ring of upload memory: mStagingHead and mStagingTail count the bytes ever allocated and freed,
+		 * a frame frees what was allocated before the end of the previous frame in its slot */
+		VkBuffer mStagingBuffer{};
+		VkDeviceMemory mStagingBufferMemory{};
+		uint8_t* mMappedStagingBuffer{ nullptr };
+		uint64_t mStagingHead{ 0 };
+		uint64_t mStagingTail{ 0 };
+		std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> mStagingFrameEnds{};
+
 		std::unique_ptr<Camera> mCamera;
 
 		VkDevice mDevice{};